@@ -0,0 +1,233 @@
+#include <carousel.h>
+#include <timely.h>
+#include <tscclock.h>
+
+#include <chrono>
+#include <cmath>
+#include <queue>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Closed loop pacing of 'kFlows' flows with 'kInFlight' packets each. Virtual TSC time advances one slot per step;
+// every packet released is immediately replaced by the next packet of its flow. This keeps every flow active and
+// the wheel at a constant 'kFlows*kInFlight' packets. Rates are log-uniform between eRPC's minimum Timely rate and
+// 1.25GB/s, or come from each flow's 'Timely' fed a synthetic RTT per packet released
+
+typedef Experiment::Timely<Experiment::TimelyErpcParams> TimelyErpc;
+
+const unsigned kFlows = 100000;                     // active flows
+const unsigned kInFlight = 4;                       // packets queued per flow
+const uint32_t kPacketBytes = 4096;                 // packet size
+const double kMinRateBps = 15e6;                    // slowest flow
+const double kMaxRateBps = 1.25e9;                  // fastest flow
+
+struct Stats {
+  uint64_t                      d_operations;       // enqueues plus dequeues
+  double                        d_seconds;          // wall time
+  uint64_t                      d_early;            // packets released a slot or more before their release time
+  uint64_t                      d_late;             // packets released a slot or more after their release time
+};
+
+std::vector<double> makeRates(unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> exponent(std::log(kMinRateBps), std::log(kMaxRateBps));
+  std::vector<double> rates(kFlows);
+  for (double& rate: rates) {
+    rate = std::exp(exponent(rng));
+  }
+  return rates;
+}
+
+// Run 'steps' slots of the closed loop through a 'Carousel'. If 'timely' is not empty each release updates the
+// flow's Timely with a synthetic RTT and re-paces the flow at its new rate. Per-flow departures are counted in
+// 'departures' and their first and last departure in 'first' and 'last'
+Stats runCarousel(const std::vector<double>& rates, double ghz, uint64_t steps, std::vector<TimelyErpc> *timely,
+  std::vector<uint64_t>& departures, std::vector<uint64_t>& first, std::vector<uint64_t>& last) {
+  Experiment::Carousel wheel(kFlows, kFlows*kInFlight, ghz);
+  const uint64_t slot = wheel.slotTicks();
+  uint64_t now = 1ull<<40;
+
+  for (unsigned f=0; f<kFlows; ++f) {
+    wheel.setRate(f, rates[f]);
+    for (unsigned i=0; i<kInFlight; ++i) {
+      wheel.enqueue(f, kPacketBytes, now);
+    }
+  }
+
+  std::mt19937 rng(7);
+  std::normal_distribution<double> rttDist(60.0, 20.0);
+  Stats stats = Stats();
+  auto visitor = [&](const Experiment::CarouselPacket& packet) {
+    const int64_t error = static_cast<int64_t>(now-packet.d_releaseTicks);
+    if (error<=-static_cast<int64_t>(slot)) {
+      ++stats.d_early;
+    } else if (error>=static_cast<int64_t>(slot)) {
+      ++stats.d_late;
+    }
+    const unsigned f = packet.d_flow;
+    if (departures[f]++==0) {
+      first[f] = now;
+    }
+    last[f] = now;
+    if (timely) {
+      const double nowUs = static_cast<double>(now)/ghz/1000.0;
+      wheel.setRate(f, (*timely)[f].update(std::max(1.0, rttDist(rng)), nowUs));
+    }
+    wheel.enqueue(f, kPacketBytes, now);
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  for (uint64_t s=0; s<steps; ++s, now+=slot) {
+    stats.d_operations += 2*wheel.dequeue(now, visitor);
+  }
+  stats.d_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  return stats;
+}
+
+// The same closed loop through a binary heap of (release time, flow) with per-flow next release times
+Stats runHeap(const std::vector<double>& rates, double ghz, uint64_t steps, uint64_t slot) {
+  typedef std::pair<uint64_t, uint32_t> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+  std::vector<uint64_t> next(kFlows, 0), ticksPerPacket(kFlows);
+  uint64_t now = 1ull<<40;
+  auto enqueue = [&](uint32_t f) {
+    const uint64_t release = std::max(now, next[f]);
+    next[f] = release+ticksPerPacket[f];
+    heap.push(Entry(release, f));
+  };
+  for (unsigned f=0; f<kFlows; ++f) {
+    ticksPerPacket[f] = static_cast<uint64_t>(kPacketBytes/rates[f]*1e9*ghz);
+    for (unsigned i=0; i<kInFlight; ++i) {
+      enqueue(f);
+    }
+  }
+
+  Stats stats = Stats();
+  const auto start = std::chrono::steady_clock::now();
+  for (uint64_t s=0; s<steps; ++s, now+=slot) {
+    while (!heap.empty() && heap.top().first<=now) {
+      const uint32_t f = heap.top().second;
+      heap.pop();
+      enqueue(f);
+      stats.d_operations += 2;
+    }
+  }
+  stats.d_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  return stats;
+}
+
+int main(int argc, char **argv) {
+  const double virtualMs = argc>1 ? atof(argv[1]) : 5.0;
+  const double ghz = Experiment::TscClock::calibrateFast().d_ghz;
+  const std::vector<double> rates = makeRates(1);
+  int failures = 0;
+
+  {
+    Experiment::Carousel wheel(1, 1, ghz);
+    std::cout << "Carousel with default slots at TSC " << ghz << " GHz" << std::endl << wheel;
+  }
+  const uint64_t slotTicks = Experiment::Carousel(1, 1, ghz).slotTicks();
+  const uint64_t steps = static_cast<uint64_t>(virtualMs*1e6*ghz/static_cast<double>(slotTicks));
+
+  // Fixed rates: every release within a slot of its release time, and each flow's departures at its rate
+  std::vector<uint64_t> departures(kFlows, 0), first(kFlows, 0), last(kFlows, 0);
+  const Stats fixed = runCarousel(rates, ghz, steps, 0, departures, first, last);
+  double worstRateError = 0;
+  unsigned measured = 0;
+  for (unsigned f=0; f<kFlows; ++f) {
+    // Departures are stamped to a slot, so flows with few departures measure the slot rather than the pacing
+    if (departures[f]>2*kInFlight) {
+      const double seconds = static_cast<double>(last[f]-first[f])/ghz/1e9;
+      const double achieved = (departures[f]-1)*static_cast<double>(kPacketBytes)/seconds;
+      worstRateError = std::max(worstRateError, std::fabs(achieved/rates[f]-1.0));
+      ++measured;
+    }
+  }
+  printf("\n%u flows x %u packets in flight, %.1f ms virtual time, %lu slots of %lu ticks\n", kFlows, kInFlight,
+    virtualMs, steps, slotTicks);
+  printf("carousel fixed rates : %6.1f M ops/s (%lu ops in %.2f s), early %lu, late %lu\n",
+    fixed.d_operations/fixed.d_seconds/1e6, fixed.d_operations, fixed.d_seconds, fixed.d_early, fixed.d_late);
+  printf("  worst per-flow rate error over %u flows: %.3f%%\n", measured, 100*worstRateError);
+  if (fixed.d_early || fixed.d_late) {
+    printf("FAIL: packets released more than a slot from their release time\n");
+    ++failures;
+  }
+  if (worstRateError>0.01) {
+    printf("FAIL: a flow was paced more than 1%% off its rate\n");
+    ++failures;
+  }
+
+  // Rates from Timely, re-paced on every release
+  std::vector<TimelyErpc> timely(kFlows);
+  std::fill(departures.begin(), departures.end(), 0);
+  const Stats driven = runCarousel(rates, ghz, steps, &timely, departures, first, last);
+  printf("carousel Timely rates: %6.1f M ops/s (%lu ops in %.2f s), early %lu, late %lu\n",
+    driven.d_operations/driven.d_seconds/1e6, driven.d_operations, driven.d_seconds, driven.d_early, driven.d_late);
+  if (driven.d_early || driven.d_late) {
+    printf("FAIL: packets released more than a slot from their release time\n");
+    ++failures;
+  }
+
+  const Stats heap = runHeap(rates, ghz, steps, slotTicks);
+  printf("binary heap          : %6.1f M ops/s (%lu ops in %.2f s)\n", heap.d_operations/heap.d_seconds/1e6,
+    heap.d_operations, heap.d_seconds);
+
+  // A flow whose next release is beyond the horizon is clamped to the horizon and never released early
+  {
+    Experiment::Carousel wheel(1, 4, ghz);
+    const uint64_t start = 1ull<<40;
+    wheel.setRate(0, 100*1000);
+    wheel.enqueue(0, kPacketBytes, start);
+    wheel.enqueue(0, kPacketBytes, start);
+    const uint64_t second = wheel.nextReleaseTicks(0)-static_cast<uint64_t>(kPacketBytes/1e5*1e9*ghz);
+    uint64_t released = 0, releasedAt = 0;
+    uint64_t now = start;
+    auto visitor = [&](const Experiment::CarouselPacket& packet) {
+      if (++released==2) {
+        releasedAt = now;
+      }
+      if (now+wheel.slotTicks()<=packet.d_releaseTicks) {
+        ++failures;
+        printf("FAIL: clamped packet released early\n");
+      }
+    };
+    while (released<2) {
+      now += wheel.slotTicks();
+      wheel.dequeue(now, visitor);
+    }
+    printf("beyond horizon: release at +%.1f ms, left at +%.1f ms, clamped %lu times\n",
+      static_cast<double>(second-start)/ghz/1e6, static_cast<double>(releasedAt-start)/ghz/1e6, wheel.clamped());
+    if (wheel.clamped()==0) {
+      printf("FAIL: expected a clamped packet\n");
+      ++failures;
+    }
+  }
+
+  // A late 'dequeue' empties the wheel and its visitor enqueues the flow's next packet, which moves the cursor up to
+  // 'now'. That packet must leave in the same call, not a horizon later
+  {
+    Experiment::Carousel wheel(1, 4, ghz);
+    wheel.setRate(0, kMaxRateBps);
+    wheel.setBudget(0, 1);
+    const uint64_t start = 1ull<<40;
+    wheel.enqueue(0, kPacketBytes, start);
+    const uint64_t now = start+5*wheel.slotTicks();
+    unsigned released = 0;
+    auto visitor = [&](const Experiment::CarouselPacket&) {
+      if (++released==1 && !wheel.enqueue(0, kPacketBytes, now)) {
+        printf("FAIL: visitor could not enqueue the next packet\n");
+        ++failures;
+      }
+    };
+    wheel.dequeue(now, visitor);
+    printf("late dequeue onto an empty wheel: %u of 2 packets released, %u queued\n", released, wheel.size());
+    if (released!=2 || wheel.size()!=0) {
+      printf("FAIL: the packet enqueued by the visitor was not released\n");
+      ++failures;
+    }
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+#include <carousel.h>
+#include <tscclock.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 'kFlows' senders each offer a packet every 'kProducePeriod' slots, a little under their paced rate. After
+// 'kSlowMs' a fraction of them is slowed to eRPC's minimum Timely rate, so they now offer 6 times what they may send.
+// Budgeted, the wheel holds at most 'kBudget' packets per flow and a refused sender blocks until a completion.
+// Unbudgeted, the pool is large and every packet offered is queued. Time is virtual, one slot per step
+
+const unsigned kFlows = 2000;                       // senders
+const uint32_t kBudget = 8;                         // in-flight packets per flow when budgeted
+const uint32_t kUnboundedCapacity = 4u<<20;         // pool when unbudgeted
+const uint32_t kPacketBytes = 4096;                 // packet size
+const unsigned kProducePeriod = 44;                 // slots between packets offered by one sender
+const double kFastRateBps = 100e6;                  // rate of a flow not slowed
+const double kSlowRateBps = 15e6;                   // rate of a slowed flow
+const double kSlowMs = 2;                           // virtual time flows are slowed at
+const double kWindowMs = 5;                         // virtual time measurement starts at
+const double kRunMs = 30;                           // virtual time run ends at
+
+struct Sender {
+  bool                          d_blocked;          // refused by the pacer; produces again on its next completion
+  uint64_t                      d_completed;        // completions in the measurement window
+  uint64_t                      d_first;            // TSC of first completion in the window
+  uint64_t                      d_last;             // TSC of last completion in the window
+};
+
+struct Result {
+  uint32_t                      d_peakPackets;      // most packets in the wheel at once
+  uint32_t                      d_endPackets;       // packets in the wheel at the end
+  double                        d_fastMinBps;       // slowest achieved rate of a flow not slowed
+  double                        d_slowMinBps;       // slowest achieved rate of a slowed flow
+  double                        d_slowMaxBps;       // fastest achieved rate of a slowed flow
+  double                        d_maxSojournUs;     // longest a packet waited in the wheel in the window
+  uint64_t                      d_refused;          // enqueues refused
+  uint64_t                      d_clamped;          // packets placed at the horizon
+};
+
+Result run(bool budgeted, double slowedFraction, double ghz) {
+  const uint32_t capacity = budgeted ? kFlows*kBudget : kUnboundedCapacity;
+  Experiment::Carousel wheel(kFlows, capacity, ghz);
+  const uint64_t slot = wheel.slotTicks();
+  const unsigned slowed = static_cast<unsigned>(slowedFraction*kFlows);
+  for (unsigned f=0; f<kFlows; ++f) {
+    wheel.setRate(f, kFastRateBps);
+    wheel.setBudget(f, budgeted ? kBudget : capacity);
+  }
+
+  const uint64_t start = 1ull<<40;
+  const uint64_t slowAt = start+static_cast<uint64_t>(kSlowMs*1e6*ghz);
+  const uint64_t windowAt = start+static_cast<uint64_t>(kWindowMs*1e6*ghz);
+  const uint64_t endAt = start+static_cast<uint64_t>(kRunMs*1e6*ghz);
+  std::vector<Sender> senders(kFlows, Sender{false, 0, 0, 0});
+  Result result = Result();
+  uint64_t now = start;
+
+  auto send = [&](unsigned f) {
+    if (!wheel.enqueue(f, kPacketBytes, now, now)) {
+      senders[f].d_blocked = true;
+      ++result.d_refused;
+    }
+  };
+
+  // The completion: account the packet, then unblock the sender, which produces its next packet at once
+  auto complete = [&](const Experiment::CarouselPacket& packet) {
+    Sender& sender = senders[packet.d_flow];
+    if (now>=windowAt) {
+      if (sender.d_completed++==0) {
+        sender.d_first = now;
+      }
+      sender.d_last = now;
+      if (packet.d_flow<slowed) {
+        result.d_maxSojournUs = std::max(result.d_maxSojournUs, static_cast<double>(now-packet.d_cookie)/ghz/1000.0);
+      }
+    }
+    if (sender.d_blocked) {
+      sender.d_blocked = false;
+      send(packet.d_flow);
+    }
+  };
+
+  bool slowDone = false;
+  for (uint64_t step=0; now<endAt; ++step, now+=slot) {
+    if (!slowDone && now>=slowAt) {
+      for (unsigned f=0; f<slowed; ++f) {
+        wheel.setRate(f, kSlowRateBps);
+      }
+      slowDone = true;
+    }
+    // Senders are staggered so 'kFlows/kProducePeriod' of them offer a packet each slot
+    for (unsigned f=static_cast<unsigned>(step%kProducePeriod); f<kFlows; f+=kProducePeriod) {
+      if (!senders[f].d_blocked) {
+        send(f);
+      }
+    }
+    result.d_peakPackets = std::max(result.d_peakPackets, wheel.size());
+    wheel.dequeue(now, complete);
+  }
+
+  result.d_endPackets = wheel.size();
+  result.d_clamped = wheel.clamped();
+  result.d_fastMinBps = result.d_slowMinBps = 1e300;
+  for (unsigned f=0; f<kFlows; ++f) {
+    const Sender& sender = senders[f];
+    const double seconds = static_cast<double>(sender.d_last-sender.d_first)/ghz/1e9;
+    const double bps = sender.d_completed>1 ? (sender.d_completed-1)*static_cast<double>(kPacketBytes)/seconds : 0.0;
+    if (f<slowed) {
+      result.d_slowMinBps = std::min(result.d_slowMinBps, bps);
+      result.d_slowMaxBps = std::max(result.d_slowMaxBps, bps);
+    } else {
+      result.d_fastMinBps = std::min(result.d_fastMinBps, bps);
+    }
+  }
+  if (slowed==0) {
+    result.d_slowMinBps = 0;
+  }
+  if (slowed==kFlows) {
+    result.d_fastMinBps = 0;
+  }
+  return result;
+}
+
+int main() {
+  const double ghz = Experiment::TscClock::calibrateFast().d_ghz;
+  const uint64_t slotTicks = Experiment::Carousel(1, 1, ghz).slotTicks();
+  const double offeredBps = kPacketBytes/(kProducePeriod*static_cast<double>(slotTicks)/ghz/1e9);
+  const double slowPacketUs = kPacketBytes/kSlowRateBps*1e6;
+  const double slotUs = static_cast<double>(slotTicks)/ghz/1000.0;
+  int failures = 0;
+
+  printf("%u flows offering %.1f MB/s each, paced at %.0f MB/s, slowed to %.0f MB/s at %.0f ms, "
+    "measured %.0f-%.0f ms\n", kFlows, offeredBps/1e6, kFastRateBps/1e6, kSlowRateBps/1e6, kSlowMs, kWindowMs, kRunMs);
+  printf("%-10s %7s %12s %10s %11s %12s %19s %14s %10s %10s\n", "mode", "slowed", "peak packets", "peak MB",
+    "end packets", "fast min MB/s", "slow min/max MB/s", "max sojourn us", "refused", "clamped");
+
+  const double fractions[] = {0.0, 0.1, 0.5, 1.0};
+  for (const bool budgeted: {true, false}) {
+    for (const double fraction: fractions) {
+      const Result r = run(budgeted, fraction, ghz);
+      printf("%-10s %6.0f%% %12u %10.1f %11u %12.2f %9.2f/%-9.2f %14.0f %10lu %10lu\n",
+        budgeted ? "budgeted" : "unbounded", 100*fraction, r.d_peakPackets,
+        r.d_peakPackets*sizeof(Experiment::CarouselPacket)/1e6, r.d_endPackets, r.d_fastMinBps/1e6,
+        r.d_slowMinBps/1e6, r.d_slowMaxBps/1e6, r.d_maxSojournUs, r.d_refused, r.d_clamped);
+      if (!budgeted) {
+        continue;
+      }
+
+      // Budgeted: the wheel never holds more than the budgets, flows not slowed get what they offer, slowed flows
+      // get their rate, and no packet waits longer than its budget takes to drain
+      if (r.d_peakPackets>kFlows*kBudget) {
+        printf("FAIL: wheel exceeded the sum of budgets\n");
+        ++failures;
+      }
+      if (fraction<1.0 && r.d_fastMinBps<0.99*offeredBps) {
+        printf("FAIL: a flow not slowed got less than 99%% of its offered load\n");
+        ++failures;
+      }
+      if (fraction>0.0 && (r.d_slowMinBps<0.99*kSlowRateBps || r.d_slowMaxBps>1.01*kSlowRateBps)) {
+        printf("FAIL: a slowed flow was not paced within 1%% of its rate\n");
+        ++failures;
+      }
+      if (r.d_maxSojournUs>kBudget*slowPacketUs+slotUs) {
+        printf("FAIL: a packet waited longer than its flow's budget takes to drain\n");
+        ++failures;
+      }
+      if (r.d_clamped) {
+        printf("FAIL: a budgeted flow reached past the horizon\n");
+        ++failures;
+      }
+    }
+  }
+
+  return failures ? 1 : 0;
+}
@@ -11,6 +11,8 @@
 #include <cmath>
 #include <cstring>
 
+#include <streamstats.h>
+
 namespace CommFunc
 {
     static double FloatErr=std::numeric_limits<double>::epsilon();
@@ -41,4 +43,6 @@ namespace CommFunc
     double NormalCDF(double x, double mu, double sigma);
     double NormalPDF(double x, double mu, double sigma);
     void summarize(const std::vector<double>& data);
+    void summarize(const Experiment::StreamStats& stats); // print from a one pass accumulator; no samples kept
+    void summarize(const Experiment::StreamStats& stats, const std::vector<long int>& hist); // print with given bins
 }
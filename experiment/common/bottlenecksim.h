@@ -0,0 +1,881 @@
+#pragma once
+
+// Purpose: Deterministic discrete-event simulation of paced flows sharing one bottleneck switch queue
+//
+// Classes:
+//   Experiment::SimEvent: One scheduled event: virtual time, tie-break order, kind, flow, packet and hop
+//   Experiment::SimEventQueue: 4-ary min-heap of 'SimEvent' ordered by time then order
+//   Experiment::SimDelayLine: FIFO of 'SimEvent' scheduled in time order
+//   Experiment::SimLinkConfig: Bottleneck link rate, switch buffer, packet size and ECN marking thresholds
+//   Experiment::SimFlowConfig: One flow's start, stop, size and one-way propagation delays
+//   Experiment::SimFlow: One flow's configuration and counters
+//   Experiment::SimEcnAware<CONTROLLER>: True if 'CONTROLLER' takes the ECN mark of each ACK
+//   Experiment::BottleneckSim<CONTROLLER>: Flows paced by their own rate controller through one FIFO switch queue
+//
+// Functions:
+//   Experiment::queueAreaSince: Integral of a draining FIFO's queued bytes over an interval with no arrivals
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// 'timely_erpc' feeds Timely RTTs drawn from a fixed distribution, so the rate Timely picks never changes the RTT it
+// sees next. Here the RTT is the consequence of the rate. Every flow owns a 'CONTROLLER' (e.g. 'Timely<PARAMS>') and
+// sends one packet each 'bytes/rate()'. Packets reach the bottleneck after the flow's forward delay and join one FIFO
+// queue drained at the link rate. A packet is dropped if the bytes queued ahead of it plus its own would exceed the
+// buffer. Otherwise it leaves the switch at
+//
+//   departure = max(arrival, departure of the packet ahead) + bytes/linkRate
+//
+// and its ACK reaches the sender after the flow's return delay. The ACK calls 'update(rttUs, nowUs)' with
+//
+//   rtt = ack time - send time - bytes/linkRate
+//
+// which is propagation plus queueing. The packet's own serialization is left out as 'Timely::update' asks. A
+// dropped packet is reported back after the return delay, as a switch that trims or NACKs would, and its bytes are
+// sent again. Time is an integer count of nanoseconds and nothing is random, so a run is exactly repeatable and
+// 'digest' of two runs of the same flows compares equal.
+//
+// Each packet costs three events: send, switch arrival and ACK or drop report. Only sends need a priority queue. An
+// arrival is scheduled at 'now+forwardNs' and 'now' never decreases, so the arrivals of all flows with the same
+// forward delay are scheduled in time order. So are drop reports at 'now+returnNs', and ACKs at
+// 'departure+returnNs' since departures never decrease either. Such events go into a 'SimDelayLine' per kind and
+// distinct delay, a FIFO whose push and pop are O(1). The next event is the earliest of the heap's top and each
+// line's front, so a run with a few RTT classes pays one heap operation per packet, not three. The heap, a 4-ary one
+// holding each flow's next send, has half the levels of a binary heap, and its 4 children share a cache line pair.
+// A send handler reschedules itself with 'replaceTop', one sift-down rather than a pop and a push. Ties are broken
+// by 'd_order', the count of events scheduled before, so equal times run in the order they were scheduled.
+//
+// A 'CONTROLLER' must provide 'double rate() const' in bytes/sec and 'double update(double rttUs, double nowUs)'
+// defined for increasing 'nowUs'.
+//
+// The switch can mark ECN like RED does on enqueue. A packet accepted with fewer than 'd_ecnMinBytes' queued ahead is
+// not marked. One with 'd_ecnMaxBytes' or more queued ahead is. In between, it is marked with a probability rising
+// linearly from 0 to 'd_ecnMaxProbability'. The draws come from a fixed 'nextUniform' sequence (see 'xorshift.h'), so
+// runs stay repeatable.
+// The ACK carries the mark back. A controller that provides 'double update(double rttUs, double nowUs, bool
+// ecnMarked)' gets it through that overload (see 'SimEcnAware'). Others never see marks.
+
+#include <hdrhistogram.h>
+#include <xorshift.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Experiment {
+
+struct SimEvent {
+  // DATA
+  uint64_t                      d_timeNs;           // virtual time the event fires
+  uint64_t                      d_order;            // insertion count breaking ties between equal times
+  uint64_t                      d_sendNs;           // send time of the packet the event is about
+  uint32_t                      d_flow;             // flow the event belongs to
+  uint32_t                      d_bytes;            // size of the packet the event is about
+  uint32_t                      d_kind;             // meaning is up to the simulator
+  uint32_t                      d_hop;              // position along the flow's path of links; 0 with one link
+
+  // CLASS METHODS
+  static bool before(const SimEvent& lhs, const SimEvent& rhs);
+    // Return true if 'lhs' fires before 'rhs': earlier time, or the same time and lower order
+};
+
+class SimEventQueue {
+  // DATA
+  std::vector<SimEvent>         d_heap;             // 4-ary min-heap by 'SimEvent::before'
+
+  // PRIVATE MANIPULATORS
+  void siftDown(std::size_t index, const SimEvent& event);
+    // Place 'event' at 'index' or below it moving earlier children up
+
+public:
+  // CREATORS
+  explicit SimEventQueue(std::size_t capacity = 1024);
+    // Create an empty queue with room for 'capacity' events before it grows
+
+  SimEventQueue(const SimEventQueue& other) = delete;
+    // Copy constructor not provided
+
+  ~SimEventQueue() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  bool empty() const;
+    // Return true if no event is queued
+
+  std::size_t size() const;
+    // Return events queued
+
+  const SimEvent& top() const;
+    // Return the earliest event. Behavior is defined provided '!empty()'
+
+  // MANIPULATORS
+  void push(const SimEvent& event);
+    // Queue 'event'
+
+  void pop();
+    // Remove the earliest event. Behavior is defined provided '!empty()'
+
+  void replaceTop(const SimEvent& event);
+    // Same as 'pop' then 'push(event)' with one sift. Behavior is defined provided '!empty()'
+
+  void clear();
+    // Remove every event
+
+  SimEventQueue& operator=(const SimEventQueue& rhs) = delete;
+    // Assignment operator not provided
+};
+
+class SimDelayLine {
+  // DATA
+  std::vector<SimEvent>         d_ring;             // power of 2 slots
+  std::size_t                   d_head;             // slot of the front event
+  std::size_t                   d_count;            // events queued
+
+public:
+  // CREATORS
+  explicit SimDelayLine(std::size_t capacity = 256);
+    // Create an empty line with room for 'capacity', rounded up to a power of 2, events before it grows
+
+  // ACCESSORS
+  bool empty() const;
+    // Return true if no event is queued
+
+  std::size_t size() const;
+    // Return events queued
+
+  const SimEvent& front() const;
+    // Return the earliest event. Behavior is defined provided '!empty()'
+
+  // MANIPULATORS
+  void push(const SimEvent& event);
+    // Append 'event'. Behavior is defined provided no queued event fires after 'event'
+
+  void pop();
+    // Remove the earliest event. Behavior is defined provided '!empty()'
+};
+
+struct SimLinkConfig {
+  // DATA
+  double                        d_rateBps = 1.25e9;         // bottleneck bytes/sec (10Gbps)
+  uint64_t                      d_bufferBytes = 1u<<20;     // switch buffer; a packet that would overflow it drops
+  uint32_t                      d_packetBytes = 4096;       // bytes per packet; a flow's last packet may be shorter
+  uint64_t                      d_ecnMinBytes = 0;          // queued ahead at which ECN marking starts
+  uint64_t                      d_ecnMaxBytes = 0;          // queued ahead from which every packet is marked; 0 never
+  double                        d_ecnMaxProbability = 0.01; // marking probability just below 'd_ecnMaxBytes'
+};
+
+struct SimFlowConfig {
+  // DATA
+  uint64_t                      d_startNs = 0;              // first send
+  uint64_t                      d_stopNs = ~0ull;           // no send at or after this time
+  uint64_t                      d_bytes = 0;                // bytes to deliver; 0 sends until 'd_stopNs'
+  uint64_t                      d_forwardNs = 5000;         // sender to switch
+  uint64_t                      d_returnNs = 5000;          // switch to receiver and the ACK back to the sender
+};
+
+struct SimFlow {
+  // DATA
+  SimFlowConfig                 d_config;           // as given to 'addFlow'
+  uint64_t                      d_sentBytes;        // bytes sent and not reported dropped
+  uint64_t                      d_ackedBytes;       // bytes acknowledged
+  uint64_t                      d_packets;          // packets sent including resends
+  uint64_t                      d_drops;            // packets dropped at the switch
+  uint64_t                      d_marks;            // packets ECN marked at the switch
+  uint64_t                      d_finishNs;         // time the last of 'd_config.d_bytes' was acknowledged; 0 until
+  uint64_t                      d_lastRttNs;        // last RTT given to the controller
+  unsigned                      d_arriveLine;       // delay line of this flow's switch arrivals
+  unsigned                      d_ackLine;          // delay line of this flow's ACKs
+  unsigned                      d_dropLine;         // delay line of this flow's drop reports
+  bool                          d_sendQueued;       // a send event is queued
+};
+
+template <class CONTROLLER, class = void>
+struct SimEcnAware : std::false_type {
+  // 'CONTROLLER' has no 'update(rttUs, nowUs, ecnMarked)'
+};
+
+template <class CONTROLLER>
+struct SimEcnAware<CONTROLLER, std::void_t<decltype(std::declval<CONTROLLER&>().update(1.0, 1.0, true))>>
+: std::true_type {
+  // 'CONTROLLER' has 'update(rttUs, nowUs, ecnMarked)'
+};
+
+double queueAreaSince(uint64_t busyUntilNs, uint64_t fromNs, uint64_t nowNs, double bytesPerNs);
+  // Return the integral of queued bytes over '[fromNs, nowNs]' in bytes*ns for a queue that drains at 'bytesPerNs'
+  // until 'busyUntilNs' and takes no arrivals in between. 'BottleneckSim' and 'FabricSim' both account their queues
+  // with it
+
+template <class CONTROLLER>
+class BottleneckSim {
+public:
+  // TYPES
+  enum EventKind {
+    e_SEND = 0,                                     // flow may send its next packet
+    e_ARRIVE = 1,                                   // packet reaches the switch
+    e_ACK = 2,                                      // packet's ACK reaches the sender
+    e_DROP = 3,                                     // sender learns the packet was dropped
+    e_MARKED_ACK = 4,                               // ACK of a packet the switch ECN marked
+  };
+
+private:
+  // DATA
+  SimLinkConfig                 d_link;             // bottleneck configuration
+  double                        d_nsPerByte;        // '1e9/d_link.d_rateBps'
+  SimEventQueue                 d_events;           // pending sends
+  std::vector<SimDelayLine>     d_lines;            // other pending events, one line per kind and delay
+  std::vector<uint64_t>         d_lineDelayNs;      // delay of each line
+  std::vector<unsigned>         d_lineKind;         // kind of event in each line
+  uint64_t                      d_order;            // events scheduled
+  std::vector<SimFlow>          d_flows;            // per flow state
+  std::deque<CONTROLLER>        d_controllers;      // per flow rate controller; a deque needs no copy or move
+  uint64_t                      d_nowNs;            // virtual time
+  uint64_t                      d_busyUntilNs;      // time the last accepted packet finishes leaving the switch
+  uint64_t                      d_areaNs;           // time up to which 'd_queueArea' is computed
+  double                        d_queueArea;        // integral of queued bytes over time, bytes*ns
+  double                        d_peakQueueBytes;   // most bytes queued at an arrival since 'resetPeakQueue'
+  uint64_t                      d_departedBytes;    // bytes accepted by the switch
+  uint64_t                      d_drops;            // packets dropped by the switch
+  uint64_t                      d_marks;            // packets ECN marked by the switch
+  uint64_t                      d_markState;        // 'nextUniform' state for marking draws
+  uint64_t                      d_processed;        // events handled
+  HdrHistogram                  d_rttNs;            // RTTs given to the controllers, ns
+
+  // PRIVATE ACCESSORS
+  uint64_t serializationNs(uint32_t bytes) const;
+    // Return the time 'bytes' take to leave the switch
+
+  // PRIVATE MANIPULATORS
+  bool mark(double queued);
+    // Return true if a packet accepted with 'queued' bytes ahead of it is ECN marked
+
+  unsigned lineOf(unsigned kind, uint64_t delayNs);
+    // Return the delay line of events of 'kind' scheduled 'delayNs' after a time that never decreases, adding it if
+    // needed
+
+  void accountQueue(uint64_t nowNs);
+    // Add the queue occupancy from 'd_areaNs' to 'nowNs' to 'd_queueArea'
+
+  void onSend(const SimEvent& event);
+  void onArrive(const SimEvent& event);
+  void onAck(const SimEvent& event);
+  void onDrop(const SimEvent& event);
+    // Handle 'event'. A send is still the top of 'd_events' and its handler replaces or pops it. Every other event
+    // has been removed from its queue
+
+public:
+  // CREATORS
+  explicit BottleneckSim(const SimLinkConfig& link = SimLinkConfig());
+    // Create a simulator of 'link' with no flows at time 0. Behavior is defined provided 'link.d_rateBps>0' and
+    // 'link.d_packetBytes>0'
+
+  BottleneckSim(const BottleneckSim& other) = delete;
+    // Copy constructor not provided
+
+  ~BottleneckSim() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint64_t nowNs() const;
+    // Return virtual time
+
+  const SimLinkConfig& link() const;
+    // Return the bottleneck configuration
+
+  unsigned flowCount() const;
+    // Return flows added
+
+  const SimFlow& flow(unsigned index) const;
+    // Return the state of flow 'index'
+
+  const CONTROLLER& controller(unsigned index) const;
+    // Return the controller of flow 'index'
+
+  double queueBytes() const;
+    // Return bytes in the switch queue, including the packet being sent, at 'nowNs'
+
+  double queueArea() const;
+    // Return the integral of queued bytes over '[0, nowNs]' in bytes*ns. Divide a difference by the elapsed ns for
+    // the mean occupancy over an interval
+
+  double peakQueueBytes() const;
+    // Return the most bytes a packet found queued ahead of it since 'resetPeakQueue' or creation
+
+  uint64_t departedBytes() const;
+    // Return bytes accepted by the switch. All have left or will leave at line rate
+
+  uint64_t drops() const;
+    // Return packets dropped at the switch
+
+  uint64_t marks() const;
+    // Return packets ECN marked at the switch
+
+  uint64_t processed() const;
+    // Return events handled
+
+  std::size_t pending() const;
+    // Return events queued
+
+  const HdrHistogram& rttNs() const;
+    // Return every RTT given to a controller, ns
+
+  uint64_t digest() const;
+    // Return a hash of the counters of every flow and the link, and every controller's rate bit pattern. Two runs of
+    // the same flows to the same time have the same digest
+
+  // MANIPULATORS
+  template <class... ARGS>
+  unsigned addFlow(const SimFlowConfig& config, ARGS&&... args);
+    // Add a flow whose controller is 'CONTROLLER(args...)' returning its index. Behavior is defined provided
+    // 'config.d_startNs>=nowNs()' and 'config.d_forwardNs+config.d_returnNs>0'
+
+  void run(uint64_t untilNs);
+    // Handle every event at or before 'untilNs' in time order then set 'nowNs()' to 'untilNs'. Behavior is defined
+    // provided 'untilNs>=nowNs()'
+
+  void resetPeakQueue();
+    // Restart 'peakQueueBytes' from the current occupancy
+
+  BottleneckSim& operator=(const BottleneckSim& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// FREE FUNCTIONS
+inline
+double queueAreaSince(uint64_t busyUntilNs, uint64_t fromNs, uint64_t nowNs, double bytesPerNs) {
+  // Between arrivals the backlog, in ns of work, falls with slope 1 until it is 0. Return the trapezoid under it
+  if (busyUntilNs<=fromNs || nowNs<=fromNs) {
+    return 0;
+  }
+  const uint64_t end = std::min(nowNs, busyUntilNs);
+  const double startBacklog = static_cast<double>(busyUntilNs-fromNs);
+  const double endBacklog = static_cast<double>(busyUntilNs-end);
+  return 0.5*(startBacklog+endBacklog)*static_cast<double>(end-fromNs)*bytesPerNs;
+}
+
+// SimEvent
+// CLASS METHODS
+inline
+bool SimEvent::before(const SimEvent& lhs, const SimEvent& rhs) {
+  return lhs.d_timeNs<rhs.d_timeNs || (lhs.d_timeNs==rhs.d_timeNs && lhs.d_order<rhs.d_order);
+}
+
+// SimEventQueue
+
+// PRIVATE MANIPULATORS
+inline
+void SimEventQueue::siftDown(std::size_t index, const SimEvent& event) {
+  const std::size_t size = d_heap.size();
+  SimEvent *heap = d_heap.data();
+  for (;;) {
+    const std::size_t first = 4*index+1;
+    if (first>=size) {
+      break;
+    }
+    const std::size_t last = std::min(first+4, size);
+    std::size_t best = first;
+    for (std::size_t child=first+1; child<last; ++child) {
+      if (SimEvent::before(heap[child], heap[best])) {
+        best = child;
+      }
+    }
+    if (!SimEvent::before(heap[best], event)) {
+      break;
+    }
+    heap[index] = heap[best];
+    index = best;
+  }
+  heap[index] = event;
+}
+
+// CREATORS
+inline
+SimEventQueue::SimEventQueue(std::size_t capacity)
+{
+  d_heap.reserve(capacity);
+}
+
+// ACCESSORS
+inline
+bool SimEventQueue::empty() const {
+  return d_heap.empty();
+}
+
+inline
+std::size_t SimEventQueue::size() const {
+  return d_heap.size();
+}
+
+inline
+const SimEvent& SimEventQueue::top() const {
+  assert(!d_heap.empty());
+  return d_heap.front();
+}
+
+// MANIPULATORS
+inline
+void SimEventQueue::push(const SimEvent& event) {
+  std::size_t index = d_heap.size();
+  d_heap.push_back(event);
+  SimEvent *heap = d_heap.data();
+  while (index) {
+    const std::size_t parent = (index-1)/4;
+    if (!SimEvent::before(event, heap[parent])) {
+      break;
+    }
+    heap[index] = heap[parent];
+    index = parent;
+  }
+  heap[index] = event;
+}
+
+inline
+void SimEventQueue::pop() {
+  assert(!d_heap.empty());
+  const SimEvent last = d_heap.back();
+  d_heap.pop_back();
+  if (!d_heap.empty()) {
+    siftDown(0, last);
+  }
+}
+
+inline
+void SimEventQueue::replaceTop(const SimEvent& event) {
+  assert(!d_heap.empty());
+  siftDown(0, event);
+}
+
+inline
+void SimEventQueue::clear() {
+  d_heap.clear();
+}
+
+// SimDelayLine
+// CREATORS
+inline
+SimDelayLine::SimDelayLine(std::size_t capacity)
+: d_ring(std::size_t(1)<<(capacity>1 ? 64-__builtin_clzll(capacity-1) : 0))
+, d_head(0)
+, d_count(0)
+{
+}
+
+// ACCESSORS
+inline
+bool SimDelayLine::empty() const {
+  return d_count==0;
+}
+
+inline
+std::size_t SimDelayLine::size() const {
+  return d_count;
+}
+
+inline
+const SimEvent& SimDelayLine::front() const {
+  assert(d_count);
+  return d_ring[d_head];
+}
+
+// MANIPULATORS
+inline
+void SimDelayLine::push(const SimEvent& event) {
+  const std::size_t mask = d_ring.size()-1;
+  assert(d_count==0 || !SimEvent::before(event, d_ring[(d_head+d_count-1)&mask]));
+  if (d_count==d_ring.size()) {
+    // Unroll into a ring twice the size
+    std::vector<SimEvent> ring(2*d_ring.size());
+    for (std::size_t i=0; i<d_count; ++i) {
+      ring[i] = d_ring[(d_head+i)&mask];
+    }
+    d_ring.swap(ring);
+    d_head = 0;
+  }
+  d_ring[(d_head+d_count)&(d_ring.size()-1)] = event;
+  ++d_count;
+}
+
+inline
+void SimDelayLine::pop() {
+  assert(d_count);
+  d_head = (d_head+1)&(d_ring.size()-1);
+  --d_count;
+}
+
+// BottleneckSim
+// PRIVATE ACCESSORS
+template <class CONTROLLER>
+inline
+uint64_t BottleneckSim<CONTROLLER>::serializationNs(uint32_t bytes) const {
+  return std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(bytes*d_nsPerByte)));
+}
+
+// PRIVATE MANIPULATORS
+template <class CONTROLLER>
+inline
+bool BottleneckSim<CONTROLLER>::mark(double queued) {
+  if (queued<static_cast<double>(d_link.d_ecnMinBytes)) {
+    return false;
+  }
+  if (queued>=static_cast<double>(d_link.d_ecnMaxBytes)) {
+    return true;
+  }
+  const double uniform = nextUniform(&d_markState);
+  const double span = static_cast<double>(d_link.d_ecnMaxBytes-d_link.d_ecnMinBytes);
+  return uniform<d_link.d_ecnMaxProbability*(queued-static_cast<double>(d_link.d_ecnMinBytes))/span;
+}
+
+template <class CONTROLLER>
+inline
+unsigned BottleneckSim<CONTROLLER>::lineOf(unsigned kind, uint64_t delayNs) {
+  for (unsigned i=0; i<d_lines.size(); ++i) {
+    if (d_lineKind[i]==kind && d_lineDelayNs[i]==delayNs) {
+      return i;
+    }
+  }
+  d_lines.emplace_back();
+  d_lineKind.push_back(kind);
+  d_lineDelayNs.push_back(delayNs);
+  return static_cast<unsigned>(d_lines.size()-1);
+}
+
+template <class CONTROLLER>
+inline
+void BottleneckSim<CONTROLLER>::accountQueue(uint64_t nowNs) {
+  d_queueArea += queueAreaSince(d_busyUntilNs, d_areaNs, nowNs, d_link.d_rateBps*1e-9);
+  d_areaNs = nowNs;
+}
+
+template <class CONTROLLER>
+inline
+void BottleneckSim<CONTROLLER>::onSend(const SimEvent& event) {
+  SimFlow& flow = d_flows[event.d_flow];
+  const SimFlowConfig& config = flow.d_config;
+  const uint64_t remaining = config.d_bytes ? config.d_bytes-flow.d_sentBytes : d_link.d_packetBytes;
+  if (d_nowNs>=config.d_stopNs || remaining==0) {
+    // Nothing to send until a drop hands bytes back
+    flow.d_sendQueued = false;
+    d_events.pop();
+    return;
+  }
+
+  const uint32_t bytes = static_cast<uint32_t>(std::min<uint64_t>(remaining, d_link.d_packetBytes));
+  flow.d_sentBytes += bytes;
+  ++flow.d_packets;
+
+  const double rate = d_controllers[event.d_flow].rate();
+  const uint64_t gapNs = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(bytes*1e9/rate)));
+
+  SimEvent next = event;
+  next.d_timeNs = d_nowNs+gapNs;
+  next.d_order = d_order++;
+  d_events.replaceTop(next);
+
+  SimEvent arrive = event;
+  arrive.d_kind = e_ARRIVE;
+  arrive.d_timeNs = d_nowNs+config.d_forwardNs;
+  arrive.d_order = d_order++;
+  arrive.d_sendNs = d_nowNs;
+  arrive.d_bytes = bytes;
+  d_lines[flow.d_arriveLine].push(arrive);
+}
+
+template <class CONTROLLER>
+inline
+void BottleneckSim<CONTROLLER>::onArrive(const SimEvent& event) {
+  accountQueue(d_nowNs);
+  const double queued = queueBytes();
+  d_peakQueueBytes = std::max(d_peakQueueBytes, queued);
+
+  SimFlow& flow = d_flows[event.d_flow];
+  SimEvent reply = event;
+  reply.d_order = d_order++;
+  if (queued+event.d_bytes>static_cast<double>(d_link.d_bufferBytes)) {
+    // A drop report leaves now, ahead of ACKs of packets still queued, so it has a line of its own
+    ++d_drops;
+    ++flow.d_drops;
+    reply.d_kind = e_DROP;
+    reply.d_timeNs = d_nowNs+flow.d_config.d_returnNs;
+    d_lines[flow.d_dropLine].push(reply);
+  } else {
+    d_busyUntilNs = std::max(d_nowNs, d_busyUntilNs)+serializationNs(event.d_bytes);
+    d_departedBytes += event.d_bytes;
+    reply.d_kind = e_ACK;
+    if (d_link.d_ecnMaxBytes && mark(queued)) {
+      ++d_marks;
+      ++flow.d_marks;
+      reply.d_kind = e_MARKED_ACK;
+    }
+    reply.d_timeNs = d_busyUntilNs+flow.d_config.d_returnNs;
+    d_lines[flow.d_ackLine].push(reply);
+  }
+}
+
+template <class CONTROLLER>
+inline
+void BottleneckSim<CONTROLLER>::onAck(const SimEvent& event) {
+  SimFlow& flow = d_flows[event.d_flow];
+  flow.d_ackedBytes += event.d_bytes;
+  if (flow.d_config.d_bytes && flow.d_ackedBytes==flow.d_config.d_bytes) {
+    flow.d_finishNs = d_nowNs;
+  }
+  const uint64_t rttNs = d_nowNs-event.d_sendNs-serializationNs(event.d_bytes);
+  flow.d_lastRttNs = rttNs;
+  d_rttNs.recordUnits(rttNs);
+  if constexpr (SimEcnAware<CONTROLLER>::value) {
+    d_controllers[event.d_flow].update(static_cast<double>(rttNs)*1e-3, static_cast<double>(d_nowNs)*1e-3,
+      event.d_kind==e_MARKED_ACK);
+  } else {
+    d_controllers[event.d_flow].update(static_cast<double>(rttNs)*1e-3, static_cast<double>(d_nowNs)*1e-3);
+  }
+}
+
+template <class CONTROLLER>
+inline
+void BottleneckSim<CONTROLLER>::onDrop(const SimEvent& event) {
+  SimFlow& flow = d_flows[event.d_flow];
+  flow.d_sentBytes -= event.d_bytes;
+  if (!flow.d_sendQueued && flow.d_config.d_bytes) {
+    // The flow had sent everything; wake it to resend these bytes
+    SimEvent send = event;
+    send.d_kind = e_SEND;
+    send.d_timeNs = d_nowNs;
+    send.d_order = d_order++;
+    send.d_bytes = 0;
+    flow.d_sendQueued = true;
+    d_events.push(send);
+  }
+}
+
+// CREATORS
+template <class CONTROLLER>
+inline
+BottleneckSim<CONTROLLER>::BottleneckSim(const SimLinkConfig& link)
+: d_link(link)
+, d_nsPerByte(1e9/link.d_rateBps)
+, d_order(0)
+, d_nowNs(0)
+, d_busyUntilNs(0)
+, d_areaNs(0)
+, d_queueArea(0)
+, d_peakQueueBytes(0)
+, d_departedBytes(0)
+, d_drops(0)
+, d_marks(0)
+, d_markState(0x9e3779b97f4a7c15ull)
+, d_processed(0)
+, d_rttNs(1e9)
+{
+  assert(link.d_rateBps>0);
+  assert(link.d_packetBytes>0);
+  assert(link.d_ecnMaxBytes==0 || link.d_ecnMinBytes<link.d_ecnMaxBytes);
+}
+
+// ACCESSORS
+template <class CONTROLLER>
+inline
+uint64_t BottleneckSim<CONTROLLER>::nowNs() const {
+  return d_nowNs;
+}
+
+template <class CONTROLLER>
+inline
+const SimLinkConfig& BottleneckSim<CONTROLLER>::link() const {
+  return d_link;
+}
+
+template <class CONTROLLER>
+inline
+unsigned BottleneckSim<CONTROLLER>::flowCount() const {
+  return static_cast<unsigned>(d_flows.size());
+}
+
+template <class CONTROLLER>
+inline
+const SimFlow& BottleneckSim<CONTROLLER>::flow(unsigned index) const {
+  assert(index<d_flows.size());
+  return d_flows[index];
+}
+
+template <class CONTROLLER>
+inline
+const CONTROLLER& BottleneckSim<CONTROLLER>::controller(unsigned index) const {
+  assert(index<d_controllers.size());
+  return d_controllers[index];
+}
+
+template <class CONTROLLER>
+inline
+double BottleneckSim<CONTROLLER>::queueBytes() const {
+  return d_busyUntilNs>d_nowNs ? static_cast<double>(d_busyUntilNs-d_nowNs)*d_link.d_rateBps*1e-9 : 0.0;
+}
+
+template <class CONTROLLER>
+inline
+double BottleneckSim<CONTROLLER>::queueArea() const {
+  return d_queueArea+queueAreaSince(d_busyUntilNs, d_areaNs, d_nowNs, d_link.d_rateBps*1e-9);
+}
+
+template <class CONTROLLER>
+inline
+double BottleneckSim<CONTROLLER>::peakQueueBytes() const {
+  return d_peakQueueBytes;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t BottleneckSim<CONTROLLER>::departedBytes() const {
+  return d_departedBytes;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t BottleneckSim<CONTROLLER>::drops() const {
+  return d_drops;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t BottleneckSim<CONTROLLER>::marks() const {
+  return d_marks;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t BottleneckSim<CONTROLLER>::processed() const {
+  return d_processed;
+}
+
+template <class CONTROLLER>
+inline
+std::size_t BottleneckSim<CONTROLLER>::pending() const {
+  std::size_t count = d_events.size();
+  for (const SimDelayLine& line: d_lines) {
+    count += line.size();
+  }
+  return count;
+}
+
+template <class CONTROLLER>
+inline
+const HdrHistogram& BottleneckSim<CONTROLLER>::rttNs() const {
+  return d_rttNs;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t BottleneckSim<CONTROLLER>::digest() const {
+  // FNV-1a over 64-bit words
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](uint64_t word) {
+    hash = (hash^word)*0x100000001b3ull;
+  };
+  mix(d_nowNs);
+  mix(d_busyUntilNs);
+  mix(d_departedBytes);
+  mix(d_drops);
+  mix(d_marks);
+  mix(d_processed);
+  for (std::size_t i=0; i<d_flows.size(); ++i) {
+    const SimFlow& flow = d_flows[i];
+    mix(flow.d_sentBytes);
+    mix(flow.d_ackedBytes);
+    mix(flow.d_packets);
+    mix(flow.d_drops);
+    mix(flow.d_marks);
+    mix(flow.d_finishNs);
+    mix(flow.d_lastRttNs);
+    const double rate = d_controllers[i].rate();
+    uint64_t bits;
+    memcpy(&bits, &rate, sizeof(bits));
+    mix(bits);
+  }
+  return hash;
+}
+
+// MANIPULATORS
+template <class CONTROLLER>
+template <class... ARGS>
+inline
+unsigned BottleneckSim<CONTROLLER>::addFlow(const SimFlowConfig& config, ARGS&&... args) {
+  assert(config.d_startNs>=d_nowNs);
+  assert(config.d_forwardNs+config.d_returnNs>0);
+
+  const unsigned index = static_cast<unsigned>(d_flows.size());
+  SimFlow flow = SimFlow();
+  flow.d_config = config;
+  flow.d_arriveLine = lineOf(e_ARRIVE, config.d_forwardNs);
+  flow.d_ackLine = lineOf(e_ACK, config.d_returnNs);
+  flow.d_dropLine = lineOf(e_DROP, config.d_returnNs);
+  flow.d_sendQueued = true;
+  d_flows.push_back(flow);
+  d_controllers.emplace_back(std::forward<ARGS>(args)...);
+
+  SimEvent send = SimEvent();
+  send.d_timeNs = config.d_startNs;
+  send.d_order = d_order++;
+  send.d_flow = index;
+  send.d_kind = e_SEND;
+  d_events.push(send);
+  return index;
+}
+
+template <class CONTROLLER>
+inline
+void BottleneckSim<CONTROLLER>::run(uint64_t untilNs) {
+  assert(untilNs>=d_nowNs);
+  for (;;) {
+    const SimEvent *next = d_events.empty() ? 0 : &d_events.top();
+    SimDelayLine *source = 0;
+    for (SimDelayLine& line: d_lines) {
+      if (!line.empty() && (!next || SimEvent::before(line.front(), *next))) {
+        next = &line.front();
+        source = &line;
+      }
+    }
+    if (!next || next->d_timeNs>untilNs) {
+      break;
+    }
+
+    // Handlers see a copy, since they schedule more events
+    const SimEvent event = *next;
+    if (source) {
+      source->pop();
+    } else if (event.d_kind!=e_SEND) {
+      d_events.pop();
+    }
+    d_nowNs = event.d_timeNs;
+    ++d_processed;
+    switch (event.d_kind) {
+      case e_SEND:
+        onSend(event);
+        break;
+      case e_ARRIVE:
+        onArrive(event);
+        break;
+      case e_ACK:
+      case e_MARKED_ACK:
+        onAck(event);
+        break;
+      default:
+        onDrop(event);
+        break;
+    }
+  }
+  d_nowNs = untilNs;
+}
+
+template <class CONTROLLER>
+inline
+void BottleneckSim<CONTROLLER>::resetPeakQueue() {
+  d_peakQueueBytes = queueBytes();
+}
+
+} // namespace Experiment
@@ -0,0 +1,443 @@
+#pragma once
+
+// Purpose: Carousel timing wheel releasing packets at times set by each flow's rate
+//
+// Classes:
+//   Experiment::CarouselPacket: A queued packet: flow, size, release time and caller's cookie
+//   Experiment::Carousel: Timing wheel of packets keyed by TSC release time with O(1) enqueue and dequeue
+//
+// Thread Safety: not-thread-safe. One pacing thread owns a 'Carousel'.
+//
+// Exception Policy: No exceptions
+//
+// Carousel [8] replaces a token bucket and queue per flow with one time-indexed queue. Each flow keeps only the
+// earliest time it may next send and its rate, as ticks per byte. A packet of 'bytes' enqueued at 'now' is
+// stamped
+//
+//   release = max(now, next)
+//   next    = release + bytes*ticksPerByte
+//
+// and put in the slot of its release time. eRPC paces the same way. 'setRate' takes 'Timely::rate()' bytes/sec. A
+// slot is '2^k' TSC ticks, picked nearest to the requested slot width (about 1us), so the slot of a time is a shift.
+// There are 'slots' slots, a power of 2, covering a horizon of 'slots' slot widths (about 8ms by default). Each slot
+// is a FIFO linked through a preallocated packet pool, so enqueue and dequeue never allocate. A bitmap of non-empty
+// slots lets 'dequeue' skip idle stretches a word (64 slots) at a time.
+//
+// Packets are released in slot order, then FIFO within a slot, once 'now' reaches the start of their slot. If 'dequeue'
+// is called at least once per slot, a packet leaves less than one slot width before or after its release time. A
+// release time beyond the horizon goes into the last slot of the horizon. When 'dequeue' reaches it the packet is
+// re-inserted, not released, so it is never sent early. 'clamped' counts how often that happened. Packets of one flow
+// keep their order.
+//
+// Completions are deferred [8] 4.2: a packet counts against its flow's in-flight budget from 'enqueue' until
+// 'dequeue' hands it to the visitor, and that call is the completion. 'enqueue' refuses a flow at its budget, so a
+// sender whose rate fell stops producing until a completion arrives, rather than filling the wheel. The default
+// budget is 'capacity/flows', which never lets one flow take another's share of the pool. The in-flight count drops
+// before the visitor runs, so the visitor may enqueue the flow's next packet.
+//
+// [8] Carousel: Scalable Traffic Shaping at End Hosts, SIGCOMM 2017
+
+#include <probemacro.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace Experiment {
+
+struct CarouselPacket {
+  // DATA
+  uint64_t                      d_releaseTicks;     // TSC at or after which the packet may leave
+  uint64_t                      d_cookie;           // caller's value, e.g. a buffer index
+  uint32_t                      d_flow;             // flow id
+  uint32_t                      d_bytes;            // packet size
+  uint32_t                      d_next;             // next packet in the same slot or free list
+};
+
+class Carousel {
+public:
+  // CONSTANTS
+  enum {
+    k_defaultSlots = 8192,                          // slots in the wheel
+    k_null = 0xffffffff                             // end of a list
+  };
+  static constexpr uint64_t k_defaultSlotNs = 1000; // requested slot width (1us)
+  static constexpr double k_initialRateBps = 15*1000*1000; // rate before 'setRate': eRPC's minimum Timely rate
+
+private:
+  // TYPES
+  struct Flow {
+    uint64_t                    d_nextTicks;        // earliest TSC the next packet may be released at
+    uint64_t                    d_ticksPerByte;     // Q32.32 TSC ticks per byte at the flow's rate
+    uint32_t                    d_inFlight;         // packets queued and not yet completed
+    uint32_t                    d_budget;           // most packets the flow may have in flight
+  };
+
+  struct Slot {
+    uint32_t                    d_head;             // first packet or 'k_null'
+    uint32_t                    d_tail;             // last packet or 'k_null'
+  };
+
+  // DATA
+  double                        d_ghz;              // TSC ticks per nanosecond
+  unsigned                      d_shift;            // slot width is '2^d_shift' ticks
+  uint64_t                      d_slotMask;         // 'slots-1'
+  uint64_t                      d_cursor;           // absolute slot 'dequeue' drains next
+  uint32_t                      d_size;             // packets queued
+  uint32_t                      d_free;             // head of the free packet list
+  uint64_t                      d_clamped;          // packets placed at the horizon instead of their slot
+  uint64_t                      d_throttled;        // enqueues refused because the flow was at its budget
+  std::vector<Flow>             d_flows;            // indexed by flow id
+  std::vector<CarouselPacket>   d_packets;          // pool
+  std::vector<Slot>             d_slots;            // wheel
+  std::vector<uint64_t>         d_occupied;         // bit 's' set if slot 's' is not empty
+
+  // PRIVATE ACCESSORS
+  uint64_t nextOccupied(uint64_t slot) const;
+    // Return the first absolute slot at or after 'slot' holding packets. Behavior is defined provided 'd_size>0'
+
+  // PRIVATE MANIPULATORS
+  void insert(uint32_t index);
+    // Append packet 'index' to the slot of its release time, clamped to '[d_cursor, d_cursor+slots)'
+
+public:
+  // CREATORS
+  Carousel(unsigned flows, uint32_t capacity, double ghz, uint64_t slotNs = k_defaultSlotNs,
+    unsigned slots = k_defaultSlots);
+    // Create a wheel for flow ids '[0, flows)' holding up to 'capacity' packets, for a TSC of 'ghz' ticks per ns.
+    // Every flow starts at 'k_initialRateBps' with a budget of 'max(1, capacity/flows)' packets. Behavior is defined
+    // provided 'slots' is a power of 2 no less than 64 and 'capacity<k_null'
+
+  Carousel(const Carousel& other) = delete;
+    // Copy constructor not provided
+
+  ~Carousel() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint32_t size() const;
+    // Return packets queued
+
+  uint32_t capacity() const;
+    // Return most packets that can be queued
+
+  unsigned flows() const;
+    // Return number of flow ids
+
+  uint64_t slotTicks() const;
+    // Return slot width in TSC ticks
+
+  double horizonNs() const;
+    // Return how far ahead of the cursor a release time can be placed exactly
+
+  uint64_t clamped() const;
+    // Return packets placed at the horizon because their release time was beyond it
+
+  uint64_t nextReleaseTicks(unsigned flow) const;
+    // Return earliest TSC the next packet of 'flow' would be released at
+
+  double rate(unsigned flow) const;
+    // Return rate of 'flow' in bytes/sec as stored
+
+  uint32_t inFlight(unsigned flow) const;
+    // Return packets of 'flow' enqueued and not yet completed
+
+  uint32_t budget(unsigned flow) const;
+    // Return most packets 'flow' may have in flight
+
+  bool canEnqueue(unsigned flow) const;
+    // Return true if 'flow' is below its budget and the pool has room
+
+  uint64_t throttled() const;
+    // Return enqueues refused because the flow was at its budget
+
+  // MANIPULATORS
+  void setRate(unsigned flow, double rateBps);
+    // Pace 'flow' at 'rateBps' bytes/sec from its next packet on. Behavior is defined provided 'rateBps>0'
+
+  void setBudget(unsigned flow, uint32_t packets);
+    // Let 'flow' have up to 'packets' in flight. Packets already queued stay. Behavior is defined provided 'packets>0'
+
+  bool enqueue(unsigned flow, uint32_t bytes, uint64_t nowTicks, uint64_t cookie = 0);
+    // Queue a packet of 'bytes' for 'flow' at TSC 'nowTicks' and return true, or return false if 'flow' is at its
+    // budget or the pool is full
+
+  template <class VISITOR>
+  unsigned dequeue(uint64_t nowTicks, VISITOR& visitor, unsigned limit = k_null);
+    // Complete up to 'limit' packets whose slot is at or before that of 'nowTicks' in release order: remove each,
+    // release its budget, then call 'visitor(const CarouselPacket&)'. Return how many
+
+  Carousel& operator=(const Carousel& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Carousel& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// PRIVATE ACCESSORS
+inline
+uint64_t Carousel::nextOccupied(uint64_t slot) const {
+  assert(d_size>0);
+  const std::size_t words = d_occupied.size();
+  std::size_t word = (slot&d_slotMask)>>6;
+  uint64_t bits = d_occupied[word]&(~0ull<<(slot&63));
+  uint64_t base = slot&~63ull;
+  for (std::size_t i=0; bits==0 && i<words; ++i) {
+    word = (word+1)%words;
+    base += 64;
+    bits = d_occupied[word];
+  }
+  assert(bits);
+  return base+__builtin_ctzll(bits);
+}
+
+// PRIVATE MANIPULATORS
+inline
+void Carousel::insert(uint32_t index) {
+  CarouselPacket& packet = d_packets[index];
+  uint64_t slot = std::max(packet.d_releaseTicks>>d_shift, d_cursor);
+  if (slot>d_cursor+d_slotMask) {
+    slot = d_cursor+d_slotMask;
+    ++d_clamped;
+  }
+  const uint64_t physical = slot&d_slotMask;
+  Slot& s = d_slots[physical];
+  packet.d_next = k_null;
+  if (s.d_tail==k_null) {
+    s.d_head = index;
+    d_occupied[physical>>6] |= 1ull<<(physical&63);
+  } else {
+    d_packets[s.d_tail].d_next = index;
+  }
+  s.d_tail = index;
+}
+
+// CREATORS
+inline
+Carousel::Carousel(unsigned flows, uint32_t capacity, double ghz, uint64_t slotNs, unsigned slots)
+: d_ghz(ghz)
+, d_shift(static_cast<unsigned>(std::lround(std::log2(std::max(1.0, static_cast<double>(slotNs)*ghz)))))
+, d_slotMask(slots-1)
+, d_cursor(0)
+, d_size(0)
+, d_free(capacity ? 0 : static_cast<uint32_t>(k_null))
+, d_clamped(0)
+, d_throttled(0)
+, d_flows(flows, Flow{0, 0, 0, std::max(1u, capacity/std::max(1u, flows))})
+, d_packets(capacity)
+, d_slots(slots, Slot{k_null, k_null})
+, d_occupied(slots/64, 0)
+{
+  assert(ghz>0);
+  assert(slots>=64 && (slots&(slots-1))==0);
+  assert(capacity<k_null);
+  for (uint32_t i=0; i<capacity; ++i) {
+    d_packets[i].d_next = i+1<capacity ? i+1 : static_cast<uint32_t>(k_null);
+  }
+  for (unsigned i=0; i<flows; ++i) {
+    setRate(i, k_initialRateBps);
+  }
+}
+
+// ACCESSORS
+inline
+uint32_t Carousel::size() const {
+  return d_size;
+}
+
+inline
+uint32_t Carousel::capacity() const {
+  return static_cast<uint32_t>(d_packets.size());
+}
+
+inline
+unsigned Carousel::flows() const {
+  return static_cast<unsigned>(d_flows.size());
+}
+
+inline
+uint64_t Carousel::slotTicks() const {
+  return 1ull<<d_shift;
+}
+
+inline
+double Carousel::horizonNs() const {
+  return static_cast<double>(d_slotMask+1)*static_cast<double>(slotTicks())/d_ghz;
+}
+
+inline
+uint64_t Carousel::clamped() const {
+  return d_clamped;
+}
+
+inline
+uint64_t Carousel::nextReleaseTicks(unsigned flow) const {
+  assert(flow<d_flows.size());
+  return d_flows[flow].d_nextTicks;
+}
+
+inline
+double Carousel::rate(unsigned flow) const {
+  assert(flow<d_flows.size());
+  return d_ghz*1e9*4294967296.0/static_cast<double>(d_flows[flow].d_ticksPerByte);
+}
+
+inline
+uint32_t Carousel::inFlight(unsigned flow) const {
+  assert(flow<d_flows.size());
+  return d_flows[flow].d_inFlight;
+}
+
+inline
+uint32_t Carousel::budget(unsigned flow) const {
+  assert(flow<d_flows.size());
+  return d_flows[flow].d_budget;
+}
+
+inline
+bool Carousel::canEnqueue(unsigned flow) const {
+  assert(flow<d_flows.size());
+  return d_flows[flow].d_inFlight<d_flows[flow].d_budget && d_free!=k_null;
+}
+
+inline
+uint64_t Carousel::throttled() const {
+  return d_throttled;
+}
+
+// MANIPULATORS
+inline
+void Carousel::setRate(unsigned flow, double rateBps) {
+  assert(flow<d_flows.size());
+  assert(rateBps>0);
+  d_flows[flow].d_ticksPerByte = static_cast<uint64_t>(d_ghz*1e9/rateBps*4294967296.0);
+}
+
+inline
+void Carousel::setBudget(unsigned flow, uint32_t packets) {
+  assert(flow<d_flows.size());
+  assert(packets>0);
+  d_flows[flow].d_budget = packets;
+}
+
+inline
+bool Carousel::enqueue(unsigned flow, uint32_t bytes, uint64_t nowTicks, uint64_t cookie) {
+  EXPERIMENT_PROBE("carousel.enqueue");
+  assert(flow<d_flows.size());
+  Flow& f = d_flows[flow];
+  if (f.d_inFlight>=f.d_budget) {
+    ++d_throttled;
+    return false;
+  }
+  if (d_free==k_null) {
+    return false;
+  }
+  const uint32_t index = d_free;
+  CarouselPacket& packet = d_packets[index];
+  d_free = packet.d_next;
+
+  // An empty wheel has nothing behind 'now', so move the cursor up rather than clamp far future slots
+  if (d_size==0) {
+    d_cursor = std::max(d_cursor, nowTicks>>d_shift);
+  }
+
+  const uint64_t release = std::max(nowTicks, f.d_nextTicks);
+  f.d_nextTicks = release+static_cast<uint64_t>((static_cast<unsigned __int128>(bytes)*f.d_ticksPerByte)>>32);
+
+  packet.d_releaseTicks = release;
+  packet.d_cookie = cookie;
+  packet.d_flow = flow;
+  packet.d_bytes = bytes;
+  insert(index);
+  ++d_size;
+  ++f.d_inFlight;
+  return true;
+}
+
+template <class VISITOR>
+inline
+unsigned Carousel::dequeue(uint64_t nowTicks, VISITOR& visitor, unsigned limit) {
+  EXPERIMENT_PROBE("carousel.dequeue");
+  const uint64_t nowSlot = nowTicks>>d_shift;
+  unsigned released = 0;
+  while (d_cursor<=nowSlot && released<limit) {
+    if (d_size==0) {
+      d_cursor = nowSlot+1;
+      break;
+    }
+    const uint64_t next = nextOccupied(d_cursor);
+    if (next>nowSlot) {
+      d_cursor = nowSlot+1;
+      break;
+    }
+    d_cursor = next;
+
+    // Drain the slot. A packet clamped at the horizon goes back into the wheel; the cursor slot is never its slot
+    // again because the horizon ends one slot before the cursor's
+    const uint64_t cursor = d_cursor;
+    const uint64_t physical = d_cursor&d_slotMask;
+    Slot& slot = d_slots[physical];
+    while (slot.d_head!=k_null && released<limit) {
+      const uint32_t index = slot.d_head;
+      CarouselPacket& packet = d_packets[index];
+      slot.d_head = packet.d_next;
+      if (slot.d_head==k_null) {
+        slot.d_tail = k_null;
+      }
+      if ((packet.d_releaseTicks>>d_shift)>d_cursor) {
+        insert(index);
+        continue;
+      }
+      // Complete a copy, so the visitor may enqueue at once and reuse this pool entry
+      const CarouselPacket completed = packet;
+      packet.d_next = d_free;
+      d_free = index;
+      --d_size;
+      --d_flows[completed.d_flow].d_inFlight;
+      ++released;
+      visitor(completed);
+    }
+    if (slot.d_head!=k_null) {
+      break;
+    }
+    d_occupied[physical>>6] &= ~(1ull<<(physical&63));
+    // A visitor that enqueued into the emptied wheel moved the cursor up to its packet's slot. Resume there
+    if (d_cursor==cursor) {
+      ++d_cursor;
+    }
+  }
+  return released;
+}
+
+// ASPECTS
+inline
+std::ostream& Carousel::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    flows                                : " << flows()                 << std::endl;
+  stream << "    size/capacity                        : " << d_size << "/" << capacity() << std::endl;
+  stream << "    slots                                : " << d_slotMask+1            << std::endl;
+  stream << "    slotTicks                            : " << slotTicks()             << std::endl;
+  stream << "    horizonNs                            : " << horizonNs()             << std::endl;
+  stream << "    cursor (absolute slot)               : " << d_cursor                << std::endl;
+  stream << "    clamped                              : " << d_clamped               << std::endl;
+  stream << "    throttled                            : " << d_throttled             << std::endl;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Carousel& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
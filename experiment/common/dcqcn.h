@@ -0,0 +1,389 @@
+#pragma once
+
+// Purpose: Estimate TX rate in bytes/sec from ECN congestion notifications using DCQCN, optionally falling back to
+// Timely's RTT gradient on paths that do not mark
+//
+// Classes:
+//   Experiment::DcqcnParams: Constants of the DCQCN reaction point, ECN only
+//   Experiment::DcqcnHybridParams: 'DcqcnParams' with hybrid mode: ECN when marks are seen, Timely otherwise
+//   Experiment::Dcqcn<PARAMS>: Implements DCQCN with constants taken from 'PARAMS' behind Timely's interface
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// [1] concludes DCQCN is better than Timely, but DCQCN needs switches that mark ECN. 'Dcqcn' is the reaction point
+// (sender) of DCQCN ([2] and the DCQCN paper) with Timely's 'rate' and 'update(rttUs, nowUs)' plus an overload that
+// takes the ECN mark of the ACK. So 'BottleneckSim' and the experiments run either controller unchanged. DCQCN keeps
+// a current rate 'Rc', a target rate 'Rt' and a congestion estimate 'alpha':
+//
+//   CNP received      : Rt = Rc, Rc = Rc*(1-alpha/2), alpha = (1-g)*alpha+g, and the counters below restart
+//   alpha timer       : alpha = (1-g)*alpha once per 'k_alphaTimerUs' without a CNP
+//   increase events   : one per 'k_increaseTimerUs' (timer count T) and one per 'k_byteCounterBytes' sent (byte
+//                       count BC). While T and BC are both below 'k_fastRecoverySteps' (F) it is fast recovery, and
+//                       Rt is unchanged. Once one reaches F it is additive increase: Rt += 'k_additiveBps'. Once both
+//                       reach F it is hyper increase: Rt += (min(T, BC)-F+1)*'k_hyperBps'. Every event then sets
+//                       Rc = (Rt+Rc)/2
+//
+// A receiver sends at most one CNP per flow every 'k_cnpIntervalUs' however many marked packets arrive. Here the
+// sender applies that limit to the marks carried back on its ACKs, which is the same up to the return delay. Timers
+// run off the times passed to 'update'. Bytes sent are the current rate times the time since the previous 'update'.
+// The timers start at the first 'update', which counts no bytes, so a flow that starts late or is fed absolute clock
+// times does not see its idle time as increase events.
+//
+// The object's 'Timely<PARAMS::TimelyParams>' is used only with 'k_hybrid'. Then it sees every RTT. Until a mark
+// arrives, and again once none has arrived for 'k_ecnHoldUs', the rate is Timely's, bit for bit. A mark starts DCQCN
+// from the current rate with 'alpha=1'. While DCQCN drives the rate, Timely's rate is set to it after every update,
+// so Timely's gradient state is current and it resumes from DCQCN's rate when the marks stop.
+//
+// [1] http://yibozhu.com/doc/ecndelay-conext16.pdf
+// [2] https://github.com/jitupadhye-zz/rdma
+
+#include <timely.h>
+#include <probemacro.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace Experiment {
+
+struct DcqcnParams {
+  // TYPES
+  typedef TimelyErpcParams TimelyParams;                      // Timely run in hybrid mode without marks
+
+  // CONSTANTS
+  static constexpr double k_g = 1.0/256;                      // alpha EWMA gain
+  static constexpr double k_alphaTimerUs = 55;                // alpha decays once per this without a CNP
+  static constexpr double k_increaseTimerUs = 55;             // rate increase timer period
+  static constexpr double k_byteCounterBytes = 10*1024*1024;  // bytes sent per byte counter increase event
+  static constexpr unsigned k_fastRecoverySteps = 5;          // increase events of fast recovery (F)
+  static constexpr double k_additiveBps = 5000000.0;          // additive increase 40Mbps in bytes/sec
+  static constexpr double k_hyperBps = 25000000.0;            // hyper increase step 200Mbps in bytes/sec
+  static constexpr double k_cnpIntervalUs = 50;               // at most one CNP per this
+
+  static constexpr double k_maxNicBps = 10000000000.0;        // Maximum NIC bandwidth 10GBps (bytes-per-sec)
+  static constexpr double k_minRateBps = 15*1000*1000;        // minimum transmit rate bytes/sec
+  static constexpr double k_maxRateBps = k_maxNicBps;         // maximum transmit rate bytes/sec
+
+  static constexpr bool k_hybrid = false;                     // use Timely while no marks are seen
+  static constexpr double k_ecnHoldUs = 1000;                 // hybrid: back to Timely after this without marks
+};
+
+struct DcqcnHybridParams : DcqcnParams {
+  // CONSTANTS
+  static constexpr bool k_hybrid = true;                      // use Timely while no marks are seen
+};
+
+template <class PARAMS>
+class Dcqcn {
+public:
+  // TYPES
+  typedef PARAMS Params;
+  typedef Timely<typename PARAMS::TimelyParams> RttController;
+
+  // CONSTANTS
+  static constexpr double k_g = PARAMS::k_g;
+  static constexpr double k_alphaTimerUs = PARAMS::k_alphaTimerUs;
+  static constexpr double k_increaseTimerUs = PARAMS::k_increaseTimerUs;
+  static constexpr double k_byteCounterBytes = PARAMS::k_byteCounterBytes;
+  static constexpr unsigned k_fastRecoverySteps = PARAMS::k_fastRecoverySteps;
+  static constexpr double k_additiveBps = PARAMS::k_additiveBps;
+  static constexpr double k_hyperBps = PARAMS::k_hyperBps;
+  static constexpr double k_cnpIntervalUs = PARAMS::k_cnpIntervalUs;
+  static constexpr double k_maxNicBps = PARAMS::k_maxNicBps;
+  static constexpr double k_minRateBps = PARAMS::k_minRateBps;
+  static constexpr double k_maxRateBps = PARAMS::k_maxRateBps;
+  static constexpr bool k_hybrid = PARAMS::k_hybrid;
+  static constexpr double k_ecnHoldUs = PARAMS::k_ecnHoldUs;
+
+  static constexpr double k_byteToGbits = 8.0/(1000*1000*1000); // factor to convert from bytes to Gbits (Giga bits)
+
+  static_assert(k_g>0.0 && k_g<=1.0, "g must be in (0, 1]");
+  static_assert(k_alphaTimerUs>0 && k_increaseTimerUs>0, "timers must have positive periods");
+  static_assert(k_byteCounterBytes>0, "byte counter must be positive");
+  static_assert(k_fastRecoverySteps>0, "fast recovery needs at least one step");
+  static_assert(k_minRateBps>0, "min rate must be positive");
+  static_assert(k_minRateBps<k_maxRateBps, "min rate must be less than max rate");
+  static_assert(k_maxRateBps<=k_maxNicBps, "max rate cannot exceed NIC bandwidth");
+
+private:
+  // DATA
+  double                        d_currentBps;       // current rate 'Rc' (bytes-per-second)
+  double                        d_targetBps;        // target rate 'Rt' (bytes-per-second)
+  double                        d_alpha;            // congestion estimate
+  double                        d_prevTimeUs;       // absolute time in microseconds 'update' was last called
+  double                        d_lastCnpUs;        // time of the last CNP
+  double                        d_lastMarkUs;       // time of the last marked ACK
+  double                        d_alphaTimerUs;     // start of the current alpha timer period
+  double                        d_increaseTimerUs;  // start of the current increase timer period
+  double                        d_bytes;            // bytes sent toward the next byte counter event
+  unsigned                      d_timerEvents;      // increase timer expiries since the last CNP (T)
+  unsigned                      d_byteEvents;       // byte counter events since the last CNP (BC)
+  uint64_t                      d_cnps;             // CNPs acted on
+  bool                          d_started;          // 'update' was called
+  bool                          d_ecnMode;          // hybrid: DCQCN drives the rate
+  RttController                 d_timely;           // hybrid: drives the rate while no marks are seen
+
+  // PRIVATE MANIPULATORS
+  void increase();
+    // Apply one rate increase event
+
+  void onCnp(double nowUs);
+    // Cut the rate for a CNP at 'nowUs'
+
+public:
+  // CREATORS
+  explicit Dcqcn(unsigned sessionCount = 0);
+    // Create a DCQCN object on a NIC with 'PARAMS::k_maxNicBps' bandwidth where 'sessionCount' is the number of
+    // existing sessions already running. Like 'Timely', the initial rate is 'k_maxNicBps/(sessionCount+1)'
+
+  Dcqcn(const Dcqcn& other) = delete;
+    // Copy constructor not provided
+
+  ~Dcqcn() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  double rate() const;
+    // Return the last estimated TX rate in bytes/sec
+
+  double rateAsGbps() const;
+    // Exactly like 'rate' but expressed as Gbps (Giga bits per second)
+
+  double targetRate() const;
+    // Return DCQCN's target rate in bytes/sec
+
+  double alpha() const;
+    // Return DCQCN's congestion estimate
+
+  uint64_t cnps() const;
+    // Return CNPs acted on
+
+  bool ecnMode() const;
+    // Return true if DCQCN rather than Timely drives the rate. Always true unless 'k_hybrid'
+
+  // MANIPULATORS
+  double update(double rttUs, double nowUs);
+    // Exactly like 'update(rttUs, nowUs, false)'
+
+  double update(double rttUs, double nowUs, bool ecnMarked);
+    // Return the new, estimated transmission rate in bytes/sec after an ACK at absolute time 'nowUs' (units
+    // microseconds) whose packet took 'rttUs' and was ECN marked if 'ecnMarked'. The first call starts the timers at
+    // 'nowUs'. Behavior is defined provided 'rttUs>0', 'nowUs>=0' and 'nowUs' exceeds the time of the last 'update'.
+    // Without 'k_hybrid' 'rttUs' is not used. The rate 'r' always satisfies 'k_minRateBps<=r<=k_maxRateBps'
+
+  Dcqcn& operator=(const Dcqcn& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+// FREE OPERATORS
+template <class PARAMS>
+std::ostream& operator<<(std::ostream& stream, const Dcqcn<PARAMS>& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// PRIVATE MANIPULATORS
+template <class PARAMS>
+inline
+void Dcqcn<PARAMS>::increase() {
+  const unsigned least = std::min(d_timerEvents, d_byteEvents);
+  const unsigned most = std::max(d_timerEvents, d_byteEvents);
+  if (least>=k_fastRecoverySteps) {
+    d_targetBps += (least-k_fastRecoverySteps+1)*k_hyperBps;
+  } else if (most>=k_fastRecoverySteps) {
+    d_targetBps += k_additiveBps;
+  }
+  d_targetBps = std::min(k_maxRateBps, d_targetBps);
+  d_currentBps = std::min(k_maxRateBps, (d_targetBps+d_currentBps)*0.5);
+}
+
+template <class PARAMS>
+inline
+void Dcqcn<PARAMS>::onCnp(double nowUs) {
+  d_targetBps = d_currentBps;
+  d_currentBps = std::max(k_minRateBps, d_currentBps*(1-d_alpha*0.5));
+  d_alpha = (1-k_g)*d_alpha+k_g;
+  d_lastCnpUs = nowUs;
+  d_alphaTimerUs = nowUs;
+  d_increaseTimerUs = nowUs;
+  d_bytes = 0;
+  d_timerEvents = 0;
+  d_byteEvents = 0;
+  ++d_cnps;
+}
+
+// CREATORS
+template <class PARAMS>
+inline
+Dcqcn<PARAMS>::Dcqcn(unsigned sessionCount)
+: d_currentBps(k_maxNicBps/(sessionCount+1.0))
+, d_targetBps(d_currentBps)
+, d_alpha(1)
+, d_prevTimeUs(0)
+, d_lastCnpUs(-k_cnpIntervalUs)
+, d_lastMarkUs(0)
+, d_alphaTimerUs(0)
+, d_increaseTimerUs(0)
+, d_bytes(0)
+, d_timerEvents(0)
+, d_byteEvents(0)
+, d_cnps(0)
+, d_started(false)
+, d_ecnMode(!k_hybrid)
+, d_timely(sessionCount)
+{
+}
+
+// ACCESSORS
+template <class PARAMS>
+inline
+double Dcqcn<PARAMS>::rate() const {
+  return d_currentBps;
+}
+
+template <class PARAMS>
+inline
+double Dcqcn<PARAMS>::rateAsGbps() const {
+  return d_currentBps * k_byteToGbits;
+}
+
+template <class PARAMS>
+inline
+double Dcqcn<PARAMS>::targetRate() const {
+  return d_targetBps;
+}
+
+template <class PARAMS>
+inline
+double Dcqcn<PARAMS>::alpha() const {
+  return d_alpha;
+}
+
+template <class PARAMS>
+inline
+uint64_t Dcqcn<PARAMS>::cnps() const {
+  return d_cnps;
+}
+
+template <class PARAMS>
+inline
+bool Dcqcn<PARAMS>::ecnMode() const {
+  return d_ecnMode;
+}
+
+// MANIPULATORS
+template <class PARAMS>
+inline
+double Dcqcn<PARAMS>::update(double rttUs, double nowUs) {
+  return update(rttUs, nowUs, false);
+}
+
+template <class PARAMS>
+inline
+double Dcqcn<PARAMS>::update(double rttUs, double nowUs, bool ecnMarked) {
+  EXPERIMENT_PROBE("dcqcn.update");
+  assert(rttUs>0);
+  assert(nowUs>=0);
+  assert(!d_started || nowUs>d_prevTimeUs);
+
+  if (!d_started) {
+    d_started = true;
+    d_prevTimeUs = nowUs;
+    d_alphaTimerUs = nowUs;
+    d_increaseTimerUs = nowUs;
+  }
+  const double elapsedUs = nowUs-d_prevTimeUs;
+  d_prevTimeUs = nowUs;
+
+  if constexpr (k_hybrid) {
+    if (ecnMarked) {
+      d_lastMarkUs = nowUs;
+      if (!d_ecnMode) {
+        // The path marks: start DCQCN from Timely's rate
+        d_ecnMode = true;
+        d_currentBps = d_timely.rate();
+        d_targetBps = d_currentBps;
+        d_alpha = 1;
+        d_alphaTimerUs = nowUs;
+        d_increaseTimerUs = nowUs;
+        d_bytes = 0;
+        d_timerEvents = 0;
+        d_byteEvents = 0;
+      }
+    } else if (d_ecnMode && nowUs-d_lastMarkUs>k_ecnHoldUs) {
+      // No marks for a while: hand the rate back to Timely
+      d_ecnMode = false;
+      d_timely.setRate(d_currentBps);
+    }
+    d_timely.update(rttUs, nowUs);
+    if (!d_ecnMode) {
+      d_currentBps = d_timely.rate();
+      d_targetBps = d_currentBps;
+      return d_currentBps;
+    }
+  }
+
+  d_bytes += d_currentBps*elapsedUs*1e-6;
+  if (ecnMarked && nowUs-d_lastCnpUs>=k_cnpIntervalUs) {
+    onCnp(nowUs);
+  } else {
+    // Alpha decays once per whole timer period without a CNP
+    const double alphaPeriods = std::floor((nowUs-d_alphaTimerUs)/k_alphaTimerUs);
+    if (alphaPeriods>0) {
+      d_alpha *= std::pow(1-k_g, alphaPeriods);
+      d_alphaTimerUs += alphaPeriods*k_alphaTimerUs;
+    }
+    while (nowUs-d_increaseTimerUs>=k_increaseTimerUs) {
+      d_increaseTimerUs += k_increaseTimerUs;
+      ++d_timerEvents;
+      increase();
+    }
+    while (d_bytes>=k_byteCounterBytes) {
+      d_bytes -= k_byteCounterBytes;
+      ++d_byteEvents;
+      increase();
+    }
+  }
+
+  if constexpr (k_hybrid) {
+    d_timely.setRate(d_currentBps);
+  }
+  return d_currentBps;
+}
+
+// ASPECTS
+template <class PARAMS>
+inline
+std::ostream& Dcqcn<PARAMS>::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    rateGbps (current rate)              : " << rateAsGbps()            << std::endl;
+  stream << "    rateBps (current rate)               : " << d_currentBps            << std::endl;
+  stream << "    targetBps (target rate)              : " << d_targetBps             << std::endl;
+  stream << "    alpha (congestion estimate)          : " << d_alpha                 << std::endl;
+  stream << "    cnps (CNPs acted on)                 : " << d_cnps                  << std::endl;
+  stream << "    timerEvents (T since last CNP)       : " << d_timerEvents           << std::endl;
+  stream << "    byteEvents (BC since last CNP)       : " << d_byteEvents            << std::endl;
+  stream << "    prevTimeUs (last reported abs time)  : " << d_prevTimeUs            << std::endl;
+  if constexpr (k_hybrid) {
+    stream << "    ecnMode (DCQCN drives the rate)      : " << d_ecnMode               << std::endl;
+  }
+  stream << "    g (alpha gain)                       : " << k_g                     << std::endl;
+  stream << "    minimum rate (bytes/sec)             : " << k_minRateBps            << std::endl;
+  stream << "    maximum rate (bytes/sec)             : " << k_maxRateBps            << std::endl;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+template <class PARAMS>
+inline
+std::ostream& operator<<(std::ostream& stream, const Dcqcn<PARAMS>& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
@@ -0,0 +1,759 @@
+#pragma once
+
+// Purpose: Conservative parallel discrete-event simulation of paced flows crossing a fabric of bottleneck links
+//
+// Classes:
+//   Experiment::SimBarrier: Reusable barrier for a fixed number of threads
+//   Experiment::FabricLinkConfig: One link's rate, switch buffer and propagation delay to the next hop
+//   Experiment::FabricFlow: One flow's configuration, path and counters
+//   Experiment::FabricSim<CONTROLLER>: Flows paced by their own controller across links simulated by worker threads
+//
+// Thread Safety: not-thread-safe. 'run' starts and joins its own workers.
+//
+// Exception Policy: No exceptions
+//
+// 'BottleneckSim' (see 'bottlenecksim.h') runs one link on one thread. A leaf-spine fabric has a bottleneck in every
+// ToR uplink and spine downlink, and a flow crosses several of them. Here each link is a partition: its switch queue,
+// the senders whose first hop it is, and a 'SimEventQueue' of its own. Link queues work as in 'BottleneckSim'. A
+// packet accepted by link 'h' of its path reaches link 'h+1' the link's propagation delay after it departs. After the
+// last link its ACK reaches the sender the flow's return delay later. The RTT given to the controller leaves out
+// the packet's serialization at every link. A drop is reported to the sender the return delay after it happens.
+//
+// Partition 'p' is simulated by worker 'p%threads'. Events only cross partitions by propagating along a link or back
+// to a sender, so an event one partition schedules for another lands at least
+//
+//   lookahead = min(every link's propagation delay, every flow's return delay)
+//
+// later. 'run' advances in windows '[T, T+lookahead)'. Within a window each worker handles its partitions' events
+// without hearing from any other partition, and appends cross-partition events to an outbox per destination. After a
+// barrier each partition pulls its inbound events from the outboxes of partitions 0, 1, ... in that order. A bitmap
+// per destination, set by a source's first event for it in the window, lets it skip empty outboxes. After a second
+// barrier the next window starts at the earliest pending event, which skips idle time. What a partition does, and the
+// order its ties break in, depend only on the partitions and never on which thread ran them or when. So a run's
+// results are bit identical for any thread count, and 'digest' shows it. The price is two barriers per window. A 2us
+// lookahead is 500k windows per second of virtual time, so threads pay off when windows are full of events.
+
+#include <bottlenecksim.h>
+#include <hdrhistogram.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Experiment {
+
+class SimBarrier {
+  // DATA
+  std::mutex                    d_lock;             // guards 'd_waiting'
+  std::condition_variable       d_wakeup;           // signalled when the last thread arrives
+  unsigned                      d_parties;          // threads taking part
+  unsigned                      d_waiting;          // threads arrived in this generation
+  std::atomic<uint64_t>         d_generation;       // completed generations
+
+public:
+  // CONSTANTS
+  enum {
+    k_spins = 4096,                                 // checks of 'd_generation' before sleeping
+  };
+
+  // CREATORS
+  explicit SimBarrier(unsigned parties);
+    // Create a barrier for 'parties' threads. Behavior is defined provided 'parties>0'
+
+  SimBarrier(const SimBarrier& other) = delete;
+    // Copy constructor not provided
+
+  ~SimBarrier() = default;
+    // Destroy this object
+
+  // MANIPULATORS
+  void arriveAndWait();
+    // Return once all 'parties' threads have called this method in the current generation. The last to arrive
+    // returns at once. The others spin briefly, then sleep. Writes before the call are visible to every thread after
+
+  SimBarrier& operator=(const SimBarrier& rhs) = delete;
+    // Assignment operator not provided
+};
+
+struct FabricLinkConfig {
+  // DATA
+  double                        d_rateBps = 1.25e9;         // bytes/sec (10Gbps)
+  uint64_t                      d_bufferBytes = 1u<<20;     // switch buffer; a packet that would overflow it drops
+  uint64_t                      d_propagationNs = 2000;     // from leaving this link to the next link or receiver
+};
+
+struct FabricFlow {
+  // DATA
+  SimFlowConfig                 d_config;           // as given to 'addFlow'. 'd_forwardNs' is sender to first link
+  unsigned                      d_pathBegin;        // index of the first link of the path in 'FabricSim::d_paths'
+  unsigned                      d_hops;             // links in the path
+  uint64_t                      d_sentBytes;        // bytes sent and not reported dropped
+  uint64_t                      d_ackedBytes;       // bytes acknowledged
+  uint64_t                      d_packets;          // packets sent including resends
+  uint64_t                      d_drops;            // drops reported to the sender
+  uint64_t                      d_finishNs;         // time the last of 'd_config.d_bytes' was acknowledged; 0 until
+  uint64_t                      d_lastRttNs;        // last RTT given to the controller
+  bool                          d_sendQueued;       // a send event is queued
+};
+
+template <class CONTROLLER>
+class FabricSim {
+public:
+  // TYPES
+  enum EventKind {
+    e_SEND = 0,                                     // flow may send its next packet
+    e_ARRIVE = 1,                                   // packet reaches link 'd_hop' of its path
+    e_ACK = 2,                                      // packet's ACK reaches the sender
+    e_DROP = 3,                                     // sender learns the packet was dropped
+  };
+
+private:
+  struct Partition {
+    FabricLinkConfig            d_link;             // the link simulated
+    double                      d_nsPerByte;        // '1e9/d_link.d_rateBps'
+    SimEventQueue               d_events;           // pending events of this link and the flows starting on it
+    uint64_t                    d_order;            // events queued here
+    std::vector<std::vector<SimEvent>> d_outbox;    // events for other partitions by partition, this window
+    std::unique_ptr<std::atomic<uint64_t>[]> d_senders; // bit 's' set if partition 's' has events for this one
+    uint64_t                    d_busyUntilNs;      // time the last accepted packet finishes leaving the link
+    uint64_t                    d_areaNs;           // time up to which 'd_queueArea' is computed
+    double                      d_queueArea;        // integral of queued bytes over time, bytes*ns
+    double                      d_peakQueueBytes;   // most bytes queued at an arrival
+    uint64_t                    d_departedBytes;    // bytes accepted by the link
+    uint64_t                    d_drops;            // packets dropped by the link
+    uint64_t                    d_processed;        // events handled
+    HdrHistogram                d_rttNs;            // RTTs given to controllers of flows starting here, ns
+
+    explicit Partition(const FabricLinkConfig& link);
+  };
+
+  // DATA
+  std::vector<std::unique_ptr<Partition>> d_partitions; // one per link
+  std::vector<FabricFlow>       d_flows;            // per flow state, touched only by the first link's partition
+  std::deque<CONTROLLER>        d_controllers;      // per flow rate controller
+  std::vector<unsigned>         d_paths;            // every flow's links, concatenated
+  uint32_t                      d_packetBytes;      // bytes per packet
+  uint64_t                      d_nowNs;            // virtual time all partitions have reached
+  uint64_t                      d_lookaheadNs;      // least delay of an event between partitions
+  uint64_t                      d_windows;          // windows run
+
+  // PRIVATE ACCESSORS
+  unsigned partitionOf(const SimEvent& event) const;
+    // Return the partition 'event' is handled by
+
+  uint64_t serializationNs(const Partition& partition, uint32_t bytes) const;
+    // Return the time 'bytes' take to leave the link of 'partition'
+
+  // PRIVATE MANIPULATORS
+  void schedule(unsigned from, SimEvent event);
+    // Queue 'event' in partition 'from' if it is handled there, else in the outbox of 'from' to its partition
+
+  void process(unsigned index, uint64_t endNs);
+    // Handle every event of partition 'index' before 'endNs'
+
+  void deliver(unsigned index);
+    // Queue in partition 'index' the events every outbox holds for it, then empty those outboxes
+
+  void onSend(unsigned index, uint64_t nowNs, const SimEvent& event);
+  void onArrive(unsigned index, uint64_t nowNs, const SimEvent& event);
+  void onAck(unsigned index, uint64_t nowNs, const SimEvent& event);
+  void onDrop(unsigned index, uint64_t nowNs, const SimEvent& event);
+    // Handle 'event' in partition 'index' at 'nowNs'. A send is still the top of the partition's queue and its
+    // handler replaces or pops it. Every other event has been popped
+
+public:
+  // CREATORS
+  explicit FabricSim(uint32_t packetBytes = 4096);
+    // Create a fabric of no links and no flows at time 0 sending packets of 'packetBytes'. Behavior is defined
+    // provided 'packetBytes>0'
+
+  FabricSim(const FabricSim& other) = delete;
+    // Copy constructor not provided
+
+  ~FabricSim() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint64_t nowNs() const;
+    // Return virtual time
+
+  uint64_t lookaheadNs() const;
+    // Return the window length 'run' uses
+
+  uint64_t windows() const;
+    // Return windows run
+
+  unsigned linkCount() const;
+    // Return links added
+
+  const FabricLinkConfig& link(unsigned index) const;
+    // Return the configuration of link 'index'
+
+  uint64_t departedBytes(unsigned index) const;
+    // Return bytes accepted by link 'index'
+
+  uint64_t drops(unsigned index) const;
+    // Return packets dropped by link 'index'
+
+  double queueArea(unsigned index) const;
+    // Return the integral of bytes queued at link 'index' over '[0, nowNs]' in bytes*ns
+
+  double peakQueueBytes(unsigned index) const;
+    // Return the most bytes a packet found queued at link 'index'
+
+  unsigned flowCount() const;
+    // Return flows added
+
+  const FabricFlow& flow(unsigned index) const;
+    // Return the state of flow 'index'
+
+  const CONTROLLER& controller(unsigned index) const;
+    // Return the controller of flow 'index'
+
+  unsigned path(unsigned index, unsigned hop) const;
+    // Return link 'hop' of flow 'index's path. Behavior is defined provided 'hop<flow(index).d_hops'
+
+  uint64_t processed() const;
+    // Return events handled
+
+  HdrHistogram rttNs() const;
+    // Return every RTT given to a controller, ns
+
+  uint64_t digest() const;
+    // Return a hash of the counters of every link and flow and every controller's rate bit pattern
+
+  // MANIPULATORS
+  unsigned addLink(const FabricLinkConfig& link);
+    // Add a link returning its index. Behavior is defined provided no flow was added yet, 'link.d_rateBps>0' and
+    // 'link.d_propagationNs>0'
+
+  template <class... ARGS>
+  unsigned addFlow(const SimFlowConfig& config, const std::vector<unsigned>& path, ARGS&&... args);
+    // Add a flow crossing the links 'path' in order whose controller is 'CONTROLLER(args...)' returning its index.
+    // 'config.d_forwardNs' is the delay from the sender to the first link and 'config.d_returnNs' the delay of the
+    // ACK from the receiver back to the sender. Behavior is defined provided '!path.empty()', every link is valid,
+    // 'config.d_startNs>=nowNs()' and 'config.d_returnNs>0'
+
+  void run(uint64_t untilNs, unsigned threads = 1);
+    // Handle every event before 'untilNs' using 'threads' threads, the calling thread being one, then set 'nowNs()'
+    // to 'untilNs'. The result does not depend on 'threads'. Behavior is defined provided 'untilNs>=nowNs()' and
+    // 'threads>0'
+
+  FabricSim& operator=(const FabricSim& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// SimBarrier
+// CREATORS
+inline
+SimBarrier::SimBarrier(unsigned parties)
+: d_parties(parties)
+, d_waiting(0)
+, d_generation(0)
+{
+  assert(parties>0);
+}
+
+// MANIPULATORS
+inline
+void SimBarrier::arriveAndWait() {
+  const uint64_t generation = d_generation.load(std::memory_order_acquire);
+  {
+    std::lock_guard<std::mutex> guard(d_lock);
+    if (++d_waiting==d_parties) {
+      d_waiting = 0;
+      d_generation.store(generation+1, std::memory_order_release);
+      d_wakeup.notify_all();
+      return;
+    }
+  }
+  for (unsigned i=0; i<k_spins; ++i) {
+    if (d_generation.load(std::memory_order_acquire)!=generation) {
+      return;
+    }
+  }
+  std::unique_lock<std::mutex> guard(d_lock);
+  d_wakeup.wait(guard, [this, generation] { return d_generation.load(std::memory_order_acquire)!=generation; });
+}
+
+// FabricSim::Partition
+template <class CONTROLLER>
+inline
+FabricSim<CONTROLLER>::Partition::Partition(const FabricLinkConfig& link)
+: d_link(link)
+, d_nsPerByte(1e9/link.d_rateBps)
+, d_order(0)
+, d_busyUntilNs(0)
+, d_areaNs(0)
+, d_queueArea(0)
+, d_peakQueueBytes(0)
+, d_departedBytes(0)
+, d_drops(0)
+, d_processed(0)
+, d_rttNs(1e9)
+{
+}
+
+// FabricSim
+// PRIVATE ACCESSORS
+template <class CONTROLLER>
+inline
+unsigned FabricSim<CONTROLLER>::partitionOf(const SimEvent& event) const {
+  const FabricFlow& flow = d_flows[event.d_flow];
+  return event.d_kind==e_ARRIVE ? d_paths[flow.d_pathBegin+event.d_hop] : d_paths[flow.d_pathBegin];
+}
+
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::serializationNs(const Partition& partition, uint32_t bytes) const {
+  return std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(bytes*partition.d_nsPerByte)));
+}
+
+// PRIVATE MANIPULATORS
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::schedule(unsigned from, SimEvent event) {
+  const unsigned to = partitionOf(event);
+  Partition& partition = *d_partitions[from];
+  if (to==from) {
+    event.d_order = partition.d_order++;
+    partition.d_events.push(event);
+  } else {
+    std::vector<SimEvent>& outbox = partition.d_outbox[to];
+    if (outbox.empty()) {
+      d_partitions[to]->d_senders[from/64].fetch_or(1ull<<(from%64), std::memory_order_relaxed);
+    }
+    outbox.push_back(event);
+  }
+}
+
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::process(unsigned index, uint64_t endNs) {
+  Partition& partition = *d_partitions[index];
+  while (!partition.d_events.empty() && partition.d_events.top().d_timeNs<endNs) {
+    // Handlers see a copy, since they schedule more events
+    const SimEvent event = partition.d_events.top();
+    if (event.d_kind!=e_SEND) {
+      partition.d_events.pop();
+    }
+    ++partition.d_processed;
+    switch (event.d_kind) {
+      case e_SEND:
+        onSend(index, event.d_timeNs, event);
+        break;
+      case e_ARRIVE:
+        onArrive(index, event.d_timeNs, event);
+        break;
+      case e_ACK:
+        onAck(index, event.d_timeNs, event);
+        break;
+      default:
+        onDrop(index, event.d_timeNs, event);
+        break;
+    }
+  }
+}
+
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::deliver(unsigned index) {
+  Partition& partition = *d_partitions[index];
+  const unsigned words = static_cast<unsigned>((d_partitions.size()+63)/64);
+  for (unsigned word=0; word<words; ++word) {
+    // The barrier ordered the sources' writes before this; no source writes again until the next window
+    uint64_t senders = partition.d_senders[word].exchange(0, std::memory_order_relaxed);
+    while (senders) {
+      const unsigned from = word*64+static_cast<unsigned>(__builtin_ctzll(senders));
+      senders &= senders-1;
+      std::vector<SimEvent>& inbound = d_partitions[from]->d_outbox[index];
+      for (SimEvent event: inbound) {
+        event.d_order = partition.d_order++;
+        partition.d_events.push(event);
+      }
+      inbound.clear();
+    }
+  }
+}
+
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::onSend(unsigned index, uint64_t nowNs, const SimEvent& event) {
+  Partition& partition = *d_partitions[index];
+  FabricFlow& flow = d_flows[event.d_flow];
+  const SimFlowConfig& config = flow.d_config;
+  const uint64_t remaining = config.d_bytes ? config.d_bytes-flow.d_sentBytes : d_packetBytes;
+  if (nowNs>=config.d_stopNs || remaining==0) {
+    // Nothing to send until a drop hands bytes back
+    flow.d_sendQueued = false;
+    partition.d_events.pop();
+    return;
+  }
+
+  const uint32_t bytes = static_cast<uint32_t>(std::min<uint64_t>(remaining, d_packetBytes));
+  flow.d_sentBytes += bytes;
+  ++flow.d_packets;
+
+  const double rate = d_controllers[event.d_flow].rate();
+  const uint64_t gapNs = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(bytes*1e9/rate)));
+
+  SimEvent next = event;
+  next.d_timeNs = nowNs+gapNs;
+  next.d_order = partition.d_order++;
+  partition.d_events.replaceTop(next);
+
+  // The first link is this partition
+  SimEvent arrive = event;
+  arrive.d_kind = e_ARRIVE;
+  arrive.d_hop = 0;
+  arrive.d_timeNs = nowNs+config.d_forwardNs;
+  arrive.d_order = partition.d_order++;
+  arrive.d_sendNs = nowNs;
+  arrive.d_bytes = bytes;
+  partition.d_events.push(arrive);
+}
+
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::onArrive(unsigned index, uint64_t nowNs, const SimEvent& event) {
+  Partition& partition = *d_partitions[index];
+  const FabricFlow& flow = d_flows[event.d_flow];
+
+  const double bytesPerNs = partition.d_link.d_rateBps*1e-9;
+  partition.d_queueArea += queueAreaSince(partition.d_busyUntilNs, partition.d_areaNs, nowNs, bytesPerNs);
+  partition.d_areaNs = nowNs;
+  const double queued = partition.d_busyUntilNs>nowNs ?
+    static_cast<double>(partition.d_busyUntilNs-nowNs)*bytesPerNs : 0.0;
+  partition.d_peakQueueBytes = std::max(partition.d_peakQueueBytes, queued);
+
+  SimEvent reply = event;
+  if (queued+event.d_bytes>static_cast<double>(partition.d_link.d_bufferBytes)) {
+    ++partition.d_drops;
+    reply.d_kind = e_DROP;
+    reply.d_timeNs = nowNs+flow.d_config.d_returnNs;
+  } else {
+    partition.d_busyUntilNs = std::max(nowNs, partition.d_busyUntilNs)+serializationNs(partition, event.d_bytes);
+    partition.d_departedBytes += event.d_bytes;
+    reply.d_timeNs = partition.d_busyUntilNs+partition.d_link.d_propagationNs;
+    if (event.d_hop+1<flow.d_hops) {
+      reply.d_hop = event.d_hop+1;
+    } else {
+      reply.d_kind = e_ACK;
+      reply.d_timeNs += flow.d_config.d_returnNs;
+    }
+  }
+  schedule(index, reply);
+}
+
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::onAck(unsigned index, uint64_t nowNs, const SimEvent& event) {
+  Partition& partition = *d_partitions[index];
+  FabricFlow& flow = d_flows[event.d_flow];
+  flow.d_ackedBytes += event.d_bytes;
+  if (flow.d_config.d_bytes && flow.d_ackedBytes==flow.d_config.d_bytes) {
+    flow.d_finishNs = nowNs;
+  }
+  uint64_t rttNs = nowNs-event.d_sendNs;
+  for (unsigned hop=0; hop<flow.d_hops; ++hop) {
+    rttNs -= serializationNs(*d_partitions[d_paths[flow.d_pathBegin+hop]], event.d_bytes);
+  }
+  flow.d_lastRttNs = rttNs;
+  partition.d_rttNs.recordUnits(rttNs);
+  d_controllers[event.d_flow].update(static_cast<double>(rttNs)*1e-3, static_cast<double>(nowNs)*1e-3);
+}
+
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::onDrop(unsigned index, uint64_t nowNs, const SimEvent& event) {
+  Partition& partition = *d_partitions[index];
+  FabricFlow& flow = d_flows[event.d_flow];
+  ++flow.d_drops;
+  flow.d_sentBytes -= event.d_bytes;
+  if (!flow.d_sendQueued && flow.d_config.d_bytes) {
+    // The flow had sent everything; wake it to resend these bytes
+    SimEvent send = event;
+    send.d_kind = e_SEND;
+    send.d_hop = 0;
+    send.d_timeNs = nowNs;
+    send.d_order = partition.d_order++;
+    send.d_bytes = 0;
+    flow.d_sendQueued = true;
+    partition.d_events.push(send);
+  }
+}
+
+// CREATORS
+template <class CONTROLLER>
+inline
+FabricSim<CONTROLLER>::FabricSim(uint32_t packetBytes)
+: d_packetBytes(packetBytes)
+, d_nowNs(0)
+, d_lookaheadNs(~0ull)
+, d_windows(0)
+{
+  assert(packetBytes>0);
+}
+
+// ACCESSORS
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::nowNs() const {
+  return d_nowNs;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::lookaheadNs() const {
+  return d_lookaheadNs;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::windows() const {
+  return d_windows;
+}
+
+template <class CONTROLLER>
+inline
+unsigned FabricSim<CONTROLLER>::linkCount() const {
+  return static_cast<unsigned>(d_partitions.size());
+}
+
+template <class CONTROLLER>
+inline
+const FabricLinkConfig& FabricSim<CONTROLLER>::link(unsigned index) const {
+  assert(index<d_partitions.size());
+  return d_partitions[index]->d_link;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::departedBytes(unsigned index) const {
+  assert(index<d_partitions.size());
+  return d_partitions[index]->d_departedBytes;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::drops(unsigned index) const {
+  assert(index<d_partitions.size());
+  return d_partitions[index]->d_drops;
+}
+
+template <class CONTROLLER>
+inline
+double FabricSim<CONTROLLER>::queueArea(unsigned index) const {
+  assert(index<d_partitions.size());
+  const Partition& partition = *d_partitions[index];
+  return partition.d_queueArea+queueAreaSince(partition.d_busyUntilNs, partition.d_areaNs, d_nowNs,
+    partition.d_link.d_rateBps*1e-9);
+}
+
+template <class CONTROLLER>
+inline
+double FabricSim<CONTROLLER>::peakQueueBytes(unsigned index) const {
+  assert(index<d_partitions.size());
+  return d_partitions[index]->d_peakQueueBytes;
+}
+
+template <class CONTROLLER>
+inline
+unsigned FabricSim<CONTROLLER>::flowCount() const {
+  return static_cast<unsigned>(d_flows.size());
+}
+
+template <class CONTROLLER>
+inline
+const FabricFlow& FabricSim<CONTROLLER>::flow(unsigned index) const {
+  assert(index<d_flows.size());
+  return d_flows[index];
+}
+
+template <class CONTROLLER>
+inline
+const CONTROLLER& FabricSim<CONTROLLER>::controller(unsigned index) const {
+  assert(index<d_controllers.size());
+  return d_controllers[index];
+}
+
+template <class CONTROLLER>
+inline
+unsigned FabricSim<CONTROLLER>::path(unsigned index, unsigned hop) const {
+  assert(index<d_flows.size());
+  assert(hop<d_flows[index].d_hops);
+  return d_paths[d_flows[index].d_pathBegin+hop];
+}
+
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::processed() const {
+  uint64_t count = 0;
+  for (const std::unique_ptr<Partition>& partition: d_partitions) {
+    count += partition->d_processed;
+  }
+  return count;
+}
+
+template <class CONTROLLER>
+inline
+HdrHistogram FabricSim<CONTROLLER>::rttNs() const {
+  HdrHistogram merged(1e9);
+  for (const std::unique_ptr<Partition>& partition: d_partitions) {
+    merged.merge(partition->d_rttNs);
+  }
+  return merged;
+}
+
+template <class CONTROLLER>
+inline
+uint64_t FabricSim<CONTROLLER>::digest() const {
+  // FNV-1a over 64-bit words
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](uint64_t word) {
+    hash = (hash^word)*0x100000001b3ull;
+  };
+  auto mixDouble = [&mix](double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    mix(bits);
+  };
+  mix(d_nowNs);
+  for (const std::unique_ptr<Partition>& partition: d_partitions) {
+    mix(partition->d_busyUntilNs);
+    mix(partition->d_departedBytes);
+    mix(partition->d_drops);
+    mix(partition->d_processed);
+    mixDouble(partition->d_queueArea);
+  }
+  for (std::size_t i=0; i<d_flows.size(); ++i) {
+    const FabricFlow& flow = d_flows[i];
+    mix(flow.d_sentBytes);
+    mix(flow.d_ackedBytes);
+    mix(flow.d_packets);
+    mix(flow.d_drops);
+    mix(flow.d_finishNs);
+    mix(flow.d_lastRttNs);
+    mixDouble(d_controllers[i].rate());
+  }
+  return hash;
+}
+
+// MANIPULATORS
+template <class CONTROLLER>
+inline
+unsigned FabricSim<CONTROLLER>::addLink(const FabricLinkConfig& link) {
+  assert(d_flows.empty());
+  assert(link.d_rateBps>0);
+  assert(link.d_propagationNs>0);
+  d_partitions.emplace_back(new Partition(link));
+  const std::size_t words = (d_partitions.size()+63)/64;
+  for (const std::unique_ptr<Partition>& partition: d_partitions) {
+    partition->d_outbox.resize(d_partitions.size());
+    partition->d_senders.reset(new std::atomic<uint64_t>[words]);
+    for (std::size_t word=0; word<words; ++word) {
+      partition->d_senders[word].store(0, std::memory_order_relaxed);
+    }
+  }
+  d_lookaheadNs = std::min(d_lookaheadNs, link.d_propagationNs);
+  return static_cast<unsigned>(d_partitions.size()-1);
+}
+
+template <class CONTROLLER>
+template <class... ARGS>
+inline
+unsigned FabricSim<CONTROLLER>::addFlow(const SimFlowConfig& config, const std::vector<unsigned>& path,
+  ARGS&&... args) {
+  assert(!path.empty());
+  assert(config.d_startNs>=d_nowNs);
+  assert(config.d_returnNs>0);
+
+  const unsigned index = static_cast<unsigned>(d_flows.size());
+  FabricFlow flow = FabricFlow();
+  flow.d_config = config;
+  flow.d_pathBegin = static_cast<unsigned>(d_paths.size());
+  flow.d_hops = static_cast<unsigned>(path.size());
+  flow.d_sendQueued = true;
+  for (unsigned link: path) {
+    assert(link<d_partitions.size());
+    d_paths.push_back(link);
+  }
+  d_flows.push_back(flow);
+  d_controllers.emplace_back(std::forward<ARGS>(args)...);
+  d_lookaheadNs = std::min(d_lookaheadNs, config.d_returnNs);
+
+  Partition& partition = *d_partitions[path.front()];
+  SimEvent send = SimEvent();
+  send.d_timeNs = config.d_startNs;
+  send.d_order = partition.d_order++;
+  send.d_flow = index;
+  send.d_kind = e_SEND;
+  partition.d_events.push(send);
+  return index;
+}
+
+template <class CONTROLLER>
+inline
+void FabricSim<CONTROLLER>::run(uint64_t untilNs, unsigned threads) {
+  assert(untilNs>=d_nowNs);
+  assert(threads>0);
+  const unsigned partitions = static_cast<unsigned>(d_partitions.size());
+  threads = std::max(1u, std::min(threads, partitions));
+
+  // Each worker leaves the earliest pending event of its partitions here between the two barriers of a window
+  std::vector<uint64_t> earliest(threads);
+  SimBarrier barrier(threads);
+  uint64_t windows = 0;
+
+  auto work = [&](unsigned worker) {
+    uint64_t startNs = d_nowNs;
+    uint64_t count = 0;
+    while (startNs<untilNs) {
+      const uint64_t endNs = std::min(untilNs, startNs+d_lookaheadNs);
+      for (unsigned p=worker; p<partitions; p+=threads) {
+        process(p, endNs);
+      }
+      barrier.arriveAndWait();
+
+      uint64_t next = ~0ull;
+      for (unsigned p=worker; p<partitions; p+=threads) {
+        deliver(p);
+        if (!d_partitions[p]->d_events.empty()) {
+          next = std::min(next, d_partitions[p]->d_events.top().d_timeNs);
+        }
+      }
+      earliest[worker] = next;
+      barrier.arriveAndWait();
+
+      // Every worker computes the same start, so they agree on every window without more synchronization
+      startNs = std::max(endNs, *std::min_element(earliest.begin(), earliest.end()));
+      ++count;
+    }
+    if (worker==0) {
+      windows = count;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned worker=1; worker<threads; ++worker) {
+    workers.emplace_back(work, worker);
+  }
+  work(0);
+  for (std::thread& thread: workers) {
+    thread.join();
+  }
+  d_windows += windows;
+  d_nowNs = untilNs;
+}
+
+} // namespace Experiment
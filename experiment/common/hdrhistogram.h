@@ -0,0 +1,319 @@
+#pragma once
+
+// Purpose: High dynamic range log-linear histogram for latency style distributions with mergeable tail percentiles
+//
+// Classes:
+//   Experiment::HdrHistogram: O(1) record, bounded relative error, merge and percentile queries
+//
+// Thread Safety: not-thread-safe. Record into one histogram per thread and 'merge' them afterwards.
+//
+// Exception Policy: No exceptions
+//
+// 'StreamHistogram' (see 'streamstats.h') has equal width bins so its resolution is set by the whole range. One
+// 10ms outlier among 50us RTTs leaves every bin wider than the body of the distribution. That hides the p99.9 tail.
+// This is the HdrHistogram layout (Gil Tene). Values are integers in units of 'resolution'. Bucket 0 holds
+// '[0, 2^S)' at unit width. Bucket 'b>0' holds '[2^(S-1+b), 2^(S+b))' split into '2^(S-1)' sub-buckets of width
+// '2^b', where 'S' is 'significantBits'. So every value is counted with a relative error below '2^-(S-1)', e.g.
+// 0.2% with the default 'S==10'. Finding a value's counter is a count-leading-zeros, a shift and an add:
+//
+//   bucket = 64 - clz(units | (2^S-1)) - S
+//   sub    = units >> bucket
+//   index  = (bucket+1)*2^(S-1) + sub - 2^(S-1)
+//
+// Memory is '8*(log2(maxValue/resolution)-S+2)*2^(S-1)' bytes, e.g. about 90KB for RTTs of up to 1s at 1ns resolution.
+// Two histograms with the same 'maxValue', 'resolution' and 'significantBits' merge by adding counters, so the
+// percentiles of a merge are those of one histogram fed every sample. Values above 'maxValue' are counted at
+// 'maxValue' and reported by 'overflows'.
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <stdio.h>
+#include <vector>
+
+namespace Experiment {
+
+class HdrHistogram {
+  // DATA
+  double                        d_resolution;       // value of one unit
+  double                        d_unitsPerValue;    // '1/d_resolution'
+  unsigned                      d_significantBits;  // 'S': sub-bucket count is '2^S'
+  uint64_t                      d_subBucketMask;    // '2^S-1'
+  uint64_t                      d_maxUnits;         // largest trackable value in units
+  std::vector<uint64_t>         d_counts;           // counters in index order
+  uint64_t                      d_total;            // values recorded
+  uint64_t                      d_overflows;        // values recorded above 'd_maxUnits'
+  uint64_t                      d_minUnits;         // smallest value recorded in units
+  uint64_t                      d_maxRecordedUnits; // largest value recorded in units
+  double                        d_sum;              // sum of values recorded, before quantization
+
+  // PRIVATE ACCESSORS
+  std::size_t indexOf(uint64_t units) const;
+    // Return the counter of 'units'
+
+  uint64_t lowestUnits(std::size_t index) const;
+    // Return the smallest value in units counted by counter 'index'
+
+  uint64_t highestUnits(std::size_t index) const;
+    // Return the largest value in units counted by counter 'index'
+
+  // PRIVATE MANIPULATORS
+  void countUnits(uint64_t units);
+    // Count 'units' in its counter clamping it to 'd_maxUnits'. 'd_sum' is left to the caller
+
+public:
+  // CREATORS
+  explicit HdrHistogram(double maxValue, double resolution = 1.0, unsigned significantBits = 10);
+    // Create a histogram of values in '[0, maxValue]' where values closer than 'resolution' need not be told apart.
+    // Relative error is below '2^-(significantBits-1)'. Behavior is defined provided 'resolution>0',
+    // 'maxValue>=resolution' and '2<=significantBits<=20'
+
+  HdrHistogram(const HdrHistogram& other) = default;
+    // Create a copy of 'other'
+
+  ~HdrHistogram() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint64_t count() const;
+    // Return number of values recorded
+
+  uint64_t overflows() const;
+    // Return number of values recorded above the maximum trackable value
+
+  double min() const;
+    // Return smallest value recorded to within the histogram's precision, or 0 if empty
+
+  double max() const;
+    // Return largest value recorded to within the histogram's precision, or 0 if empty
+
+  double mean() const;
+    // Return exact mean of the values recorded, or 0 if empty
+
+  double percentile(double p) const;
+    // Return the value at or below which 'p' percent of recorded values fall, with 'p' in [0, 100]. As in
+    // HdrHistogram the result is the largest value equivalent to that sample at this precision. Return 0 if empty
+
+  double relativeError() const;
+    // Return the largest relative error of a recorded value above '2^S*resolution'
+
+  std::size_t bytes() const;
+    // Return memory held by the counters
+
+  bool isCompatible(const HdrHistogram& other) const;
+    // Return true if 'other' has the same layout so 'merge' is defined
+
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' count, min, mean, p50 through p99.999 and max, returning 'stream'
+
+  // MANIPULATORS
+  void record(double value);
+    // Count 'value'. Negative values count as 0. Values above the maximum count as the maximum
+
+  void recordUnits(uint64_t units);
+    // Count a value of 'units*resolution'
+
+  void merge(const HdrHistogram& other);
+    // Add every value of 'other'. Behavior is defined provided 'isCompatible(other)'
+
+  void reset();
+    // Forget all values
+
+  HdrHistogram& operator=(const HdrHistogram& rhs) = default;
+    // Assign 'rhs' to this object
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const HdrHistogram& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// PRIVATE ACCESSORS
+inline
+std::size_t HdrHistogram::indexOf(uint64_t units) const {
+  const unsigned bucket = 64-__builtin_clzll(units|d_subBucketMask)-d_significantBits;
+  const uint64_t sub = units>>bucket;
+  const uint64_t halfCount = (d_subBucketMask+1)>>1;
+  return static_cast<std::size_t>((bucket+1)*halfCount+sub-halfCount);
+}
+
+inline
+uint64_t HdrHistogram::lowestUnits(std::size_t index) const {
+  const uint64_t halfCount = (d_subBucketMask+1)>>1;
+  const uint64_t bucket = index<2*halfCount ? 0 : index/halfCount-1;
+  const uint64_t sub = index-(bucket+1)*halfCount+halfCount;
+  return sub<<bucket;
+}
+
+inline
+uint64_t HdrHistogram::highestUnits(std::size_t index) const {
+  const uint64_t halfCount = (d_subBucketMask+1)>>1;
+  const uint64_t bucket = index<2*halfCount ? 0 : index/halfCount-1;
+  return lowestUnits(index)+(1ull<<bucket)-1;
+}
+
+// PRIVATE MANIPULATORS
+inline
+void HdrHistogram::countUnits(uint64_t units) {
+  if (units>d_maxUnits) {
+    ++d_overflows;
+    units = d_maxUnits;
+  }
+  ++d_counts[indexOf(units)];
+  ++d_total;
+  d_minUnits = std::min(d_minUnits, units);
+  d_maxRecordedUnits = std::max(d_maxRecordedUnits, units);
+}
+
+// CREATORS
+inline
+HdrHistogram::HdrHistogram(double maxValue, double resolution, unsigned significantBits)
+: d_resolution(resolution)
+, d_unitsPerValue(1.0/resolution)
+, d_significantBits(significantBits)
+, d_subBucketMask((1ull<<significantBits)-1)
+, d_maxUnits(static_cast<uint64_t>(std::ceil(maxValue/resolution)))
+, d_total(0)
+, d_overflows(0)
+, d_minUnits(UINT64_MAX)
+, d_maxRecordedUnits(0)
+, d_sum(0)
+{
+  assert(resolution>0);
+  assert(maxValue>=resolution);
+  assert(significantBits>=2 && significantBits<=20);
+  assert(d_maxUnits<(1ull<<62));
+  d_counts.resize(indexOf(d_maxUnits)+1, 0);
+}
+
+// ACCESSORS
+inline
+uint64_t HdrHistogram::count() const {
+  return d_total;
+}
+
+inline
+uint64_t HdrHistogram::overflows() const {
+  return d_overflows;
+}
+
+inline
+double HdrHistogram::min() const {
+  return d_total ? static_cast<double>(d_minUnits)*d_resolution : 0.0;
+}
+
+inline
+double HdrHistogram::max() const {
+  return d_total ? static_cast<double>(d_maxRecordedUnits)*d_resolution : 0.0;
+}
+
+inline
+double HdrHistogram::mean() const {
+  return d_total ? d_sum/static_cast<double>(d_total) : 0.0;
+}
+
+inline
+double HdrHistogram::percentile(double p) const {
+  if (d_total==0) {
+    return 0.0;
+  }
+  p = std::max(0.0, std::min(100.0, p));
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p/100.0*static_cast<double>(d_total))));
+  uint64_t seen = 0;
+  for (std::size_t i=0; i<d_counts.size(); ++i) {
+    seen += d_counts[i];
+    if (seen>=rank) {
+      const uint64_t units = std::min(std::max(highestUnits(i), d_minUnits), d_maxRecordedUnits);
+      return static_cast<double>(units)*d_resolution;
+    }
+  }
+  return max();
+}
+
+inline
+double HdrHistogram::relativeError() const {
+  return std::ldexp(1.0, 1-static_cast<int>(d_significantBits));
+}
+
+inline
+std::size_t HdrHistogram::bytes() const {
+  return d_counts.size()*sizeof(uint64_t);
+}
+
+inline
+bool HdrHistogram::isCompatible(const HdrHistogram& other) const {
+  return d_resolution==other.d_resolution && d_significantBits==other.d_significantBits &&
+         d_maxUnits==other.d_maxUnits;
+}
+
+inline
+std::ostream& HdrHistogram::print(std::ostream& stream) const {
+  const double percentiles[] = { 50, 90, 99, 99.9, 99.99, 99.999 };
+  char line[128];
+  snprintf(line, sizeof(line), "# count %lu  min %.8g  mean %.8g  max %.8g  (relative error < %g)\n",
+    d_total, min(), mean(), max(), relativeError());
+  stream << line;
+  for (double p: percentiles) {
+    snprintf(line, sizeof(line), "# p%-7g = %.8g\n", p, percentile(p));
+    stream << line;
+  }
+  if (d_overflows) {
+    stream << "# " << d_overflows << " values above the maximum were counted at the maximum" << std::endl;
+  }
+  return stream;
+}
+
+// MANIPULATORS
+inline
+void HdrHistogram::record(double value) {
+  // Round to whole units first so 'countUnits' decides overflow in integers. The 'double' comparison only keeps the
+  // conversion defined: anything past 'd_maxUnits+1' overflows either way
+  const double units = std::floor(value*d_unitsPerValue+0.5);
+  if (!(units>=1.0)) {
+    countUnits(0);
+  } else if (units>static_cast<double>(d_maxUnits+1)) {
+    countUnits(d_maxUnits+1);
+  } else {
+    countUnits(static_cast<uint64_t>(units));
+  }
+  d_sum += value;
+}
+
+inline
+void HdrHistogram::recordUnits(uint64_t units) {
+  countUnits(units);
+  d_sum += static_cast<double>(units)*d_resolution;
+}
+
+inline
+void HdrHistogram::merge(const HdrHistogram& other) {
+  assert(isCompatible(other));
+  for (std::size_t i=0; i<d_counts.size(); ++i) {
+    d_counts[i] += other.d_counts[i];
+  }
+  d_total += other.d_total;
+  d_overflows += other.d_overflows;
+  d_minUnits = std::min(d_minUnits, other.d_minUnits);
+  d_maxRecordedUnits = std::max(d_maxRecordedUnits, other.d_maxRecordedUnits);
+  d_sum += other.d_sum;
+}
+
+inline
+void HdrHistogram::reset() {
+  std::fill(d_counts.begin(), d_counts.end(), 0);
+  d_total = 0;
+  d_overflows = 0;
+  d_minUnits = UINT64_MAX;
+  d_maxRecordedUnits = 0;
+  d_sum = 0;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const HdrHistogram& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
@@ -0,0 +1,204 @@
+#pragma once
+
+// Purpose: Drop and reorder datagrams on their way to the socket to exercise reliable delivery
+//
+// Classes:
+//   Experiment::LossInjector: Seeded drop/reorder stage with a fixed number of held datagrams
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// Loopback and veth never drop or reorder a datagram the socket buffers have room for, so sequence numbers and
+// retransmission would go untested. A 'LossInjector' sits between the code building a datagram and the call that
+// sends it. Each datagram 'submit'ted is dropped with one probability, held back with another, or passed on at once
+// through the caller's 'emit'. A held datagram is copied into one of a fixed set of buffers and passed on after 1 to
+// 'maxDelay' later submissions, so it arrives behind datagrams sent after it. When every buffer is in use a datagram
+// that would be held passes instead. Decisions come from a seeded xorshift generator, so a run is repeatable for a
+// given seed and order of submissions. Nothing allocates after construction.
+
+#include <assert.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Experiment {
+
+class LossInjector {
+  // DATA
+  uint64_t                      d_state;            // xorshift64 state; never 0
+  uint64_t                      d_dropBelow;        // drop if a draw is below this
+  uint64_t                      d_holdBelow;        // hold if a draw is below this and not dropped
+  unsigned                      d_maxDelay;         // most submissions a held datagram waits
+  uint32_t                      d_maxBytes;         // largest datagram held
+  unsigned                      d_holding;          // datagrams held
+  uint64_t                      d_passed;           // datagrams passed on at once
+  uint64_t                      d_dropped;          // datagrams dropped
+  uint64_t                      d_reordered;        // datagrams held back
+  std::vector<char>             d_buffers;          // 'capacity' buffers of 'd_maxBytes'
+  std::vector<uint32_t>         d_bytes;            // size of each held datagram; 0 if the buffer is free
+  std::vector<unsigned>         d_countdown;        // submissions left before release; 0 once due
+
+  // PRIVATE MANIPULATORS
+  uint64_t draw();
+    // Return the next pseudo random value
+
+public:
+  // CREATORS
+  LossInjector(double dropProbability, double reorderProbability, unsigned maxDelay, uint32_t maxBytes,
+    unsigned capacity = 64, uint64_t seed = 1);
+    // Create a stage dropping each datagram with 'dropProbability' and holding it back behind 1 to 'maxDelay'
+    // later ones with 'reorderProbability', holding up to 'capacity' datagrams of at most 'maxBytes'. Behavior is
+    // defined provided both probabilities are in '[0, 1]', 'maxDelay>0' and 'capacity>0'
+
+  LossInjector(const LossInjector& other) = delete;
+    // Copy constructor not provided
+
+  ~LossInjector() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint64_t passed() const;
+    // Return datagrams passed on when submitted
+
+  uint64_t dropped() const;
+    // Return datagrams dropped
+
+  uint64_t reordered() const;
+    // Return datagrams held back
+
+  unsigned holding() const;
+    // Return datagrams held now
+
+  // MANIPULATORS
+  template <class EMIT>
+  void submit(const void *data, uint32_t bytes, EMIT& emit);
+    // Drop, hold or pass on the datagram of 'bytes' at 'data', then pass on every held datagram whose delay is over.
+    // Datagrams are passed on by 'emit(const char *data, uint32_t bytes)'. Behavior is defined provided
+    // '0<bytes<=maxBytes'
+
+  template <class EMIT>
+  void flush(EMIT& emit);
+    // Pass on every held datagram at once, soonest due first
+
+  LossInjector& operator=(const LossInjector& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// PRIVATE MANIPULATORS
+inline
+uint64_t LossInjector::draw() {
+  d_state ^= d_state<<13;
+  d_state ^= d_state>>7;
+  d_state ^= d_state<<17;
+  return d_state;
+}
+
+// CREATORS
+inline
+LossInjector::LossInjector(double dropProbability, double reorderProbability, unsigned maxDelay,
+  uint32_t maxBytes, unsigned capacity, uint64_t seed)
+: d_state(seed ? seed : 1)
+, d_dropBelow(dropProbability>=1.0 ? ~0ull : static_cast<uint64_t>(dropProbability*18446744073709551616.0))
+, d_holdBelow(reorderProbability>=1.0 ? ~0ull : static_cast<uint64_t>(reorderProbability*18446744073709551616.0))
+, d_maxDelay(maxDelay)
+, d_maxBytes(maxBytes)
+, d_holding(0)
+, d_passed(0)
+, d_dropped(0)
+, d_reordered(0)
+, d_buffers(static_cast<std::size_t>(capacity)*maxBytes)
+, d_bytes(capacity, 0)
+, d_countdown(capacity, 0)
+{
+  assert(dropProbability>=0 && dropProbability<=1);
+  assert(reorderProbability>=0 && reorderProbability<=1);
+  assert(maxDelay>0);
+  assert(capacity>0);
+}
+
+// ACCESSORS
+inline
+uint64_t LossInjector::passed() const {
+  return d_passed;
+}
+
+inline
+uint64_t LossInjector::dropped() const {
+  return d_dropped;
+}
+
+inline
+uint64_t LossInjector::reordered() const {
+  return d_reordered;
+}
+
+inline
+unsigned LossInjector::holding() const {
+  return d_holding;
+}
+
+// MANIPULATORS
+template <class EMIT>
+inline
+void LossInjector::submit(const void *data, uint32_t bytes, EMIT& emit) {
+  assert(bytes>0 && bytes<=d_maxBytes);
+  const char *datagram = static_cast<const char*>(data);
+
+  // Count down the datagrams already held before this one can be added with a delay of its own
+  unsigned due = 0;
+  if (d_holding) {
+    for (unsigned& countdown: d_countdown) {
+      if (countdown && --countdown==0) {
+        ++due;
+      }
+    }
+  }
+
+  if (d_dropBelow && draw()<d_dropBelow) {
+    ++d_dropped;
+  } else if (d_holdBelow && draw()<d_holdBelow && d_holding<d_countdown.size()) {
+    // A buffer is free when it holds nothing, not merely when its countdown is over
+    unsigned i = 0;
+    while (d_countdown[i] || d_bytes[i]) {
+      ++i;
+    }
+    memcpy(&d_buffers[static_cast<std::size_t>(i)*d_maxBytes], datagram, bytes);
+    d_bytes[i] = bytes;
+    d_countdown[i] = 1+static_cast<unsigned>(draw()%d_maxDelay);
+    ++d_holding;
+    ++d_reordered;
+  } else {
+    ++d_passed;
+    emit(datagram, bytes);
+  }
+
+  for (unsigned i=0; due; ++i) {
+    if (d_countdown[i]==0 && d_bytes[i]) {
+      emit(&d_buffers[static_cast<std::size_t>(i)*d_maxBytes], d_bytes[i]);
+      d_bytes[i] = 0;
+      --d_holding;
+      --due;
+    }
+  }
+}
+
+template <class EMIT>
+inline
+void LossInjector::flush(EMIT& emit) {
+  while (d_holding) {
+    unsigned soonest = 0;
+    for (unsigned i=1; i<d_countdown.size(); ++i) {
+      if (d_countdown[i] && (d_countdown[soonest]==0 || d_countdown[i]<d_countdown[soonest])) {
+        soonest = i;
+      }
+    }
+    emit(&d_buffers[static_cast<std::size_t>(soonest)*d_maxBytes], d_bytes[soonest]);
+    d_countdown[soonest] = 0;
+    d_bytes[soonest] = 0;
+    --d_holding;
+  }
+}
+
+} // namespace Experiment
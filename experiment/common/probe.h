@@ -0,0 +1,527 @@
+#pragma once
+
+// Purpose: Named TSC probes recording per-thread into lock-free rings drained by a collector into cycle histograms
+//
+// Classes:
+//   Experiment::ProbeRing: Single producer single consumer ring of (probe, cycles) records owned by one thread
+//   Experiment::ProbeCollector: Registry of probe names and rings; drains rings into one histogram per probe
+//   Experiment::ProbeScope: Records the cycles between its construction and destruction under a probe
+//
+// Thread Safety: thread-safe. Any thread may record; 'drain', 'start', 'stop' and the accessors may be called from
+// any thread.
+//
+// Exception Policy: No exceptions
+//
+// Put 'EXPERIMENT_PROBE("name");' at the top of a block to time the rest of the block. The macro is in
+// 'probemacro.h', which includes this header only when 'EXPERIMENT_PROBES' is defined. Without it the macro expands to
+// nothing, so a build has no probe code at all. With it, the probe is:
+//
+// * A function-local static holding the probe id. It is registered by name once. Probes with the same name in
+//   different functions share an id.
+// * 'rdtsc' at entry and at exit. The probe uses bare 'rdtsc' (see 'timestamp.h'). It measures the block as the
+//   out-of-order core sees it, and it does not add fences to the code being measured.
+// * A push of one 8 byte record onto the calling thread's ring: one store and one release store of the head. The
+//   producer caches the consumer's tail, so it reads the collector's cache line only when its cached copy says the
+//   ring is full. A full ring drops the record and counts it.
+//
+// The first probe a thread hits allocates its ring and registers it. Nothing allocates after that. A thread exit
+// retires the ring. The collector frees it after the last drain. A probe that fires later in the thread's teardown
+// (e.g. in another 'thread_local' destructor) finds no ring and is counted as dropped. 'start' runs a thread that
+// drains every ring periodically into 'HdrHistogram's of cycles. 'drain' does the same on demand. Both go through a
+// mutex, so draining never blocks a recording thread.
+//
+// Probes in the tree: 'timely.update', 'timely.dynamic.update', 'dcqcn.update', 'tscclock.nowNs',
+// 'tscclock.reanchor', 'carousel.enqueue' and 'carousel.dequeue'. A full ring drops rather than blocks, so size
+// 'k_capacity' for the records one thread makes while the collector is not running, e.g. a scheduler time slice when
+// it shares a core.
+
+#include <hdrhistogram.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <x86intrin.h>
+
+namespace Experiment {
+
+struct ProbeRecord {
+  // DATA
+  uint32_t                      d_probe;            // probe id
+  uint32_t                      d_cycles;           // TSC ticks spent, saturated at 2^32-1
+};
+
+class ProbeRing {
+public:
+  // CONSTANTS
+  enum {
+    k_capacity = 32768                              // records (256KB); a power of 2
+  };
+
+private:
+  // DATA
+  alignas(64) std::atomic<uint64_t> d_head;         // next record to write; written by the producer only
+  uint64_t                      d_cachedTail;       // producer's copy of 'd_tail'
+  std::atomic<uint64_t>         d_dropped;          // records dropped because the ring was full
+  alignas(64) std::atomic<uint64_t> d_tail;         // next record to read; written by the consumer only
+  std::atomic<bool>             d_retired;          // set when the producing thread exits
+  alignas(64) ProbeRecord       d_records[k_capacity];
+
+public:
+  // CREATORS
+  ProbeRing();
+    // Create an empty ring
+
+  ProbeRing(const ProbeRing& other) = delete;
+    // Copy constructor not provided
+
+  ~ProbeRing() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint64_t dropped() const;
+    // Return records dropped because the ring was full
+
+  bool isRetired() const;
+    // Return true if the producing thread has exited
+
+  // MANIPULATORS
+  void push(uint32_t probe, uint64_t cycles);
+    // Append a record. Called only by the owning thread
+
+  template <class VISITOR>
+  uint64_t drain(VISITOR& visitor);
+    // Call 'visitor(const ProbeRecord&)' on each record written so far and return how many. One consumer at a time
+
+  void retire();
+    // Mark the ring as no longer written
+
+  ProbeRing& operator=(const ProbeRing& rhs) = delete;
+    // Assignment operator not provided
+};
+
+class ProbeCollector {
+public:
+  // CONSTANTS
+  enum {
+    k_maxProbes = 64,                               // distinct probe names
+    k_nameLength = 48,                              // bytes of a name kept, including the terminator
+    k_significantBits = 10                          // precision of the per-probe histograms (0.2%)
+  };
+  static constexpr double k_maxCycles = 1e10;       // largest cycle count the histograms track
+  static constexpr uint64_t k_defaultPeriodUs = 500; // drain period of the collector thread
+
+private:
+  // TYPES
+  struct RingOwner {
+    // Retires its ring when the owning thread exits
+    ProbeRing *d_ring_p;
+    ~RingOwner();
+  };
+
+  // DATA
+  mutable std::mutex            d_mutex;            // guards everything below
+  unsigned                      d_probes;           // probe ids handed out
+  char                          d_names[k_maxProbes][k_nameLength];
+  std::vector<HdrHistogram>     d_histograms;       // cycles per probe, indexed by id
+  std::vector<std::unique_ptr<ProbeRing>> d_rings;  // every ring not yet freed
+  uint64_t                      d_retiredDropped;   // drops of rings already freed
+  std::atomic<uint64_t>         d_exitedDropped;    // records made after their thread's ring was retired
+  uint64_t                      d_droppedBase;      // drops before the last 'reset'
+  std::thread                   d_thread;           // collector thread when started
+  std::condition_variable       d_wakeup;           // wakes the collector thread to stop
+  bool                          d_running;          // true while the collector thread should run
+
+  // CLASS DATA
+  static thread_local ProbeRing *s_ring_p;          // calling thread's ring or 0
+  static thread_local bool      s_exited;           // true once the calling thread's ring was retired
+
+  // PRIVATE MANIPULATORS
+  ProbeRing *registerThread();
+    // Allocate and register a ring for the calling thread
+
+  void drainLocked();
+    // Drain every ring and free retired ones. 'd_mutex' must be held
+
+  uint64_t droppedLocked() const;
+    // Return records dropped since the last 'reset'. 'd_mutex' must be held
+
+  // PRIVATE CREATORS
+  ProbeCollector();
+    // Create a collector with no probes
+
+public:
+  // CLASS METHODS
+  static ProbeCollector& instance();
+    // Return the process wide collector. It is never destroyed so probes may fire during static destruction
+
+  static ProbeRing *localRing();
+    // Return the calling thread's ring, registering one on first use. Return 0 once the thread's ring was retired
+    // at thread exit
+
+  // CREATORS
+  ProbeCollector(const ProbeCollector& other) = delete;
+    // Copy constructor not provided
+
+  // ACCESSORS
+  unsigned probes() const;
+    // Return number of probe names registered
+
+  const char *name(unsigned probe) const;
+    // Return name of 'probe'
+
+  HdrHistogram histogram(unsigned probe) const;
+    // Return copy of the cycles recorded under 'probe' as of the last drain
+
+  uint64_t dropped() const;
+    // Return records dropped by full rings or made after their thread's ring was retired since the last 'reset'
+
+  // MANIPULATORS
+  unsigned id(const char *name);
+    // Return id of probe 'name', registering it if new. Behavior is defined provided fewer than 'k_maxProbes' names
+
+  void drain();
+    // Aggregate every record written so far
+
+  void dropExited();
+    // Count a record made on a thread whose ring was retired as dropped
+
+  void start(uint64_t periodUs = k_defaultPeriodUs);
+    // Start a thread draining every 'periodUs'. No effect if already started
+
+  void stop();
+    // Stop the collector thread if started, then drain once more
+
+  void reset();
+    // Drain and then forget every recorded cycle count and drop; names and ids are kept
+
+  ProbeCollector& operator=(const ProbeCollector& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream, double ghz = 0) const;
+    // Print to specified 'stream' per-probe count, mean, percentiles and max in cycles, and in ns if 'ghz>0'
+};
+
+class ProbeScope {
+  // DATA
+  uint32_t                      d_probe;            // probe id
+  uint64_t                      d_start;            // TSC at construction
+
+public:
+  // CREATORS
+  explicit ProbeScope(unsigned probe);
+    // Start timing under 'probe'
+
+  ProbeScope(const ProbeScope& other) = delete;
+    // Copy constructor not provided
+
+  ~ProbeScope();
+    // Record the ticks since construction on the calling thread's ring
+
+  // MANIPULATORS
+  ProbeScope& operator=(const ProbeScope& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const ProbeCollector& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// ProbeRing
+// CREATORS
+inline
+ProbeRing::ProbeRing()
+: d_head(0)
+, d_cachedTail(0)
+, d_dropped(0)
+, d_tail(0)
+, d_retired(false)
+{
+  static_assert((k_capacity&(k_capacity-1))==0, "capacity must be a power of 2");
+}
+
+// ACCESSORS
+inline
+uint64_t ProbeRing::dropped() const {
+  return d_dropped.load(std::memory_order_relaxed);
+}
+
+inline
+bool ProbeRing::isRetired() const {
+  return d_retired.load(std::memory_order_acquire);
+}
+
+// MANIPULATORS
+inline
+void ProbeRing::push(uint32_t probe, uint64_t cycles) {
+  const uint64_t head = d_head.load(std::memory_order_relaxed);
+  if (head-d_cachedTail>=k_capacity) {
+    d_cachedTail = d_tail.load(std::memory_order_acquire);
+    if (head-d_cachedTail>=k_capacity) {
+      d_dropped.store(d_dropped.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  ProbeRecord& record = d_records[head&(k_capacity-1)];
+  record.d_probe = probe;
+  record.d_cycles = cycles<UINT32_MAX ? static_cast<uint32_t>(cycles) : UINT32_MAX;
+  d_head.store(head+1, std::memory_order_release);
+}
+
+template <class VISITOR>
+inline
+uint64_t ProbeRing::drain(VISITOR& visitor) {
+  const uint64_t tail = d_tail.load(std::memory_order_relaxed);
+  const uint64_t head = d_head.load(std::memory_order_acquire);
+  for (uint64_t i=tail; i<head; ++i) {
+    visitor(d_records[i&(k_capacity-1)]);
+  }
+  d_tail.store(head, std::memory_order_release);
+  return head-tail;
+}
+
+inline
+void ProbeRing::retire() {
+  d_retired.store(true, std::memory_order_release);
+}
+
+// ProbeCollector
+inline
+thread_local ProbeRing *ProbeCollector::s_ring_p = 0;
+
+inline
+thread_local bool ProbeCollector::s_exited = false;
+
+inline
+ProbeCollector::RingOwner::~RingOwner() {
+  // The collector frees the ring after its next drain, so later probes on this thread must not find it
+  s_ring_p = 0;
+  s_exited = true;
+  d_ring_p->retire();
+}
+
+// PRIVATE MANIPULATORS
+inline
+ProbeRing *ProbeCollector::registerThread() {
+  thread_local RingOwner owner = { 0 };
+  std::lock_guard<std::mutex> guard(d_mutex);
+  d_rings.emplace_back(new ProbeRing());
+  owner.d_ring_p = d_rings.back().get();
+  return owner.d_ring_p;
+}
+
+inline
+void ProbeCollector::drainLocked() {
+  auto record = [this](const ProbeRecord& r) {
+    d_histograms[r.d_probe].recordUnits(r.d_cycles);
+  };
+  for (std::size_t i=0; i<d_rings.size(); ) {
+    // Read retirement first: a ring seen retired has no writes after the drain below
+    const bool retired = d_rings[i]->isRetired();
+    d_rings[i]->drain(record);
+    if (retired) {
+      d_retiredDropped += d_rings[i]->dropped();
+      d_rings[i] = std::move(d_rings.back());
+      d_rings.pop_back();
+    } else {
+      ++i;
+    }
+  }
+}
+
+inline
+uint64_t ProbeCollector::droppedLocked() const {
+  uint64_t result = d_retiredDropped+d_exitedDropped.load(std::memory_order_relaxed);
+  for (const std::unique_ptr<ProbeRing>& ring: d_rings) {
+    result += ring->dropped();
+  }
+  return result-d_droppedBase;
+}
+
+// PRIVATE CREATORS
+inline
+ProbeCollector::ProbeCollector()
+: d_probes(0)
+, d_retiredDropped(0)
+, d_exitedDropped(0)
+, d_droppedBase(0)
+, d_running(false)
+{
+  d_histograms.reserve(k_maxProbes);
+}
+
+// CLASS METHODS
+inline
+ProbeCollector& ProbeCollector::instance() {
+  static ProbeCollector *collector = new ProbeCollector();
+  return *collector;
+}
+
+inline
+ProbeRing *ProbeCollector::localRing() {
+  if (s_ring_p==0 && !s_exited) {
+    s_ring_p = instance().registerThread();
+  }
+  return s_ring_p;
+}
+
+// ACCESSORS
+inline
+unsigned ProbeCollector::probes() const {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  return d_probes;
+}
+
+inline
+const char *ProbeCollector::name(unsigned probe) const {
+  assert(probe<k_maxProbes);
+  return d_names[probe];
+}
+
+inline
+HdrHistogram ProbeCollector::histogram(unsigned probe) const {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  assert(probe<d_probes);
+  return d_histograms[probe];
+}
+
+inline
+uint64_t ProbeCollector::dropped() const {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  return droppedLocked();
+}
+
+// MANIPULATORS
+inline
+unsigned ProbeCollector::id(const char *name) {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  for (unsigned i=0; i<d_probes; ++i) {
+    if (strncmp(d_names[i], name, k_nameLength-1)==0) {
+      return i;
+    }
+  }
+  assert(d_probes<k_maxProbes);
+  snprintf(d_names[d_probes], k_nameLength, "%s", name);
+  d_histograms.emplace_back(k_maxCycles, 1.0, k_significantBits);
+  return d_probes++;
+}
+
+inline
+void ProbeCollector::drain() {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  drainLocked();
+}
+
+inline
+void ProbeCollector::dropExited() {
+  d_exitedDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline
+void ProbeCollector::start(uint64_t periodUs) {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  if (d_running) {
+    return;
+  }
+  d_running = true;
+  d_thread = std::thread([this, periodUs]() {
+    std::unique_lock<std::mutex> lock(d_mutex);
+    while (d_running) {
+      drainLocked();
+      d_wakeup.wait_for(lock, std::chrono::microseconds(periodUs));
+    }
+  });
+}
+
+inline
+void ProbeCollector::stop() {
+  {
+    std::lock_guard<std::mutex> guard(d_mutex);
+    if (!d_running) {
+      drainLocked();
+      return;
+    }
+    d_running = false;
+  }
+  d_wakeup.notify_all();
+  d_thread.join();
+  drain();
+}
+
+inline
+void ProbeCollector::reset() {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  drainLocked();
+  for (HdrHistogram& histogram: d_histograms) {
+    histogram.reset();
+  }
+  d_droppedBase += droppedLocked();
+}
+
+// ASPECTS
+inline
+std::ostream& ProbeCollector::print(std::ostream& stream, double ghz) const {
+  std::lock_guard<std::mutex> guard(d_mutex);
+  char line[256];
+  snprintf(line, sizeof(line), "%-28s %12s %9s %9s %9s %9s %9s%s\n", "probe (cycles)", "count", "mean", "p50",
+    "p99", "p99.9", "max", ghz>0 ? "   mean ns   p99 ns" : "");
+  stream << line;
+  for (unsigned i=0; i<d_probes; ++i) {
+    const HdrHistogram& h = d_histograms[i];
+    if (h.count()==0) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "%-28s %12lu %9.1f %9.0f %9.0f %9.0f %9.0f", d_names[i], h.count(), h.mean(),
+      h.percentile(50), h.percentile(99), h.percentile(99.9), h.max());
+    stream << line;
+    if (ghz>0) {
+      snprintf(line, sizeof(line), " %9.1f %8.1f", h.mean()/ghz, h.percentile(99)/ghz);
+      stream << line;
+    }
+    stream << std::endl;
+  }
+  const uint64_t dropped = droppedLocked();
+  if (dropped) {
+    stream << "# " << dropped << " records dropped by full rings or exited threads" << std::endl;
+  }
+  return stream;
+}
+
+// ProbeScope
+// CREATORS
+inline
+ProbeScope::ProbeScope(unsigned probe)
+: d_probe(probe)
+, d_start(__rdtsc())
+{
+}
+
+inline
+ProbeScope::~ProbeScope() {
+  const uint64_t end = __rdtsc();
+  ProbeRing *ring = ProbeCollector::localRing();
+  if (ring) {
+    ring->push(d_probe, end-d_start);
+  } else {
+    ProbeCollector::instance().dropExited();
+  }
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const ProbeCollector& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
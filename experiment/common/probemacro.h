@@ -0,0 +1,28 @@
+#pragma once
+
+// Purpose: The 'EXPERIMENT_PROBE' macro, which times a block when 'EXPERIMENT_PROBES' is defined and is empty otherwise
+//
+// Classes: None
+//
+// Thread Safety: thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// Headers on the hot path ('timely.h', 'tscclock.h', 'carousel.h', ...) include this instead of 'probe.h'. Without
+// 'EXPERIMENT_PROBES' it defines an empty macro and nothing else, so those headers do not pull in the collector,
+// '<thread>', '<mutex>' or 'hdrhistogram.h'. With it, it includes 'probe.h' and the macro expands to a probe (see
+// 'probe.h').
+
+#ifdef EXPERIMENT_PROBES
+#include <probe.h>
+
+#define EXPERIMENT_PROBE_CAT2(A, B) A##B
+#define EXPERIMENT_PROBE_CAT(A, B) EXPERIMENT_PROBE_CAT2(A, B)
+#define EXPERIMENT_PROBE(NAME)                                                                                     \
+  static const unsigned EXPERIMENT_PROBE_CAT(experimentProbeId, __LINE__) =                                        \
+    Experiment::ProbeCollector::instance().id(NAME);                                                                \
+  Experiment::ProbeScope EXPERIMENT_PROBE_CAT(experimentProbeScope, __LINE__)(                                     \
+    EXPERIMENT_PROBE_CAT(experimentProbeId, __LINE__))
+#else
+#define EXPERIMENT_PROBE(NAME)
+#endif
@@ -0,0 +1,768 @@
+#pragma once
+
+// Purpose: Per-session reliable delivery: sequence numbers, reorder window, SACKs and retransmit timers
+//
+// Classes:
+//   Experiment::ReorderWindow: Receiver's bitmap ring of sequences received ahead of the next in-order one
+//   Experiment::RetransmitWheel: Timing wheel of retransmit deadlines keyed by TSC with O(1) arm and cancel
+//   Experiment::ReliableSender: Sender's sequence state of many sessions driven by SACKs and a 'RetransmitWheel'
+//
+// Thread Safety: not-thread-safe. One thread owns each object.
+//
+// Exception Policy: No exceptions
+//
+// Milestone 6: detect drop and reorder with sequence numbers and resend lost data so the receiver delivers it in
+// order. Each session numbers its datagrams from an initial sequence, 0 by default, with 32-bit sequences compared
+// modulo 2^32, so they may wrap. A real endpoint picks a random initial sequence, so wrap is not a rare event.
+//
+// The receiver keeps one 'ReorderWindow' per session: 'next', the lowest sequence not yet received, and a ring of
+// 'window' bits for the sequences above it. A datagram at 'next' advances 'next' over every bit already set, a word
+// at a time, and everything passed over is deliverable in order. A datagram above 'next' only sets its bit. Its
+// answer is a SACK carrying 'next' as the cumulative acknowledgement, a 64-bit map of the sequences received above
+// it, and the echo of the datagram's TSC send stamp. The echo gives an RTT sample for every SACK, retransmission or
+// not, so there is no retransmission ambiguity and the same sample can drive Timely.
+//
+// The sender keeps per session the next sequence, the lowest unacknowledged one, and a ring of 'window' packet
+// records. A session may have at most 'window' sequences unacknowledged. Every outstanding packet has a retransmit
+// deadline in one 'RetransmitWheel' shared by all sessions, not a timer of its own. The wheel's nodes are the packet
+// records, 'session*window + sequence%window', so arming, cancelling and firing never allocate. A SACK cancels the
+// timers of what it acknowledges. Holes below the highest sequence the SACK covers are judged lost when a datagram
+// sent more than a quarter of an RTT after the hole's last transmission has arrived (RACK, RFC 8985). Their timers
+// are moved to now. Otherwise a timer fires at the retransmission timeout of RFC 6298, doubling per retransmission.
+// 'expire' hands due packets to the caller to resend, in deadline order, so lost data is resent in order.
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace Experiment {
+
+class ReorderWindow {
+  // DATA
+  std::vector<uint64_t>         d_bits;             // bit 's%window' set if 's' above 'd_next' was received
+  uint32_t                      d_mask;             // 'window-1'
+  uint32_t                      d_next;             // lowest sequence not received
+
+  // PRIVATE MANIPULATORS
+  uint32_t advance();
+    // Move 'd_next' past every received sequence at and above it, clearing their bits. Return how many
+
+public:
+  // TYPES
+  enum Result {
+    e_IN_ORDER,                                     // was 'next'; it and maybe more are deliverable
+    e_OUT_OF_ORDER,                                 // above 'next' and new; held
+    e_DUPLICATE,                                    // below 'next' or already held
+    e_BEYOND_WINDOW                                 // 'window' or more above 'next'; dropped
+  };
+
+  // CONSTANTS
+  enum {
+    k_defaultWindow = 1024                          // sequences tracked above 'next'
+  };
+
+  // CREATORS
+  explicit ReorderWindow(uint32_t window = k_defaultWindow, uint32_t initialSequence = 0);
+    // Create a window expecting 'initialSequence' first that holds up to 'window' sequences. Behavior is defined
+    // provided 'window' is a power of 2 no less than 128
+
+  ReorderWindow(const ReorderWindow& other) = default;
+    // Create a copy of 'other'
+
+  ~ReorderWindow() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint32_t next() const;
+    // Return the lowest sequence not received: every sequence before it has been delivered in order
+
+  uint32_t window() const;
+    // Return sequences tracked above 'next'
+
+  uint64_t sackBits() const;
+    // Return the map of sequences received above 'next': bit 'i' is set if 'next()+1+i' was received
+
+  // MANIPULATORS
+  Result receive(uint32_t sequence, uint32_t *delivered);
+    // Record 'sequence' as received. Set 'delivered' to how many sequences from the old 'next' on are now
+    // deliverable in order, 0 unless the result is 'e_IN_ORDER'. Return how 'sequence' was taken
+
+  ReorderWindow& operator=(const ReorderWindow& rhs) = default;
+    // Assign 'rhs' to this object returning a reference to it
+};
+
+class RetransmitWheel {
+public:
+  // CONSTANTS
+  enum {
+    k_defaultSlots = 4096,                          // slots in the wheel
+    k_null = 0xffffffff                             // end of a list, or the slot of a node not armed
+  };
+  static constexpr uint64_t k_defaultSlotNs = 16000; // requested slot width (16us)
+
+private:
+  // TYPES
+  struct Node {
+    uint64_t                    d_deadlineTicks;    // TSC at which the node is due
+    uint32_t                    d_next;             // next node in the same slot or 'k_null'
+    uint32_t                    d_prev;             // previous node in the same slot or 'k_null'
+    uint32_t                    d_slot;             // physical slot holding the node or 'k_null' if not armed
+  };
+
+  // DATA
+  unsigned                      d_shift;            // slot width is '2^d_shift' ticks
+  uint64_t                      d_slotMask;         // 'slots-1'
+  uint64_t                      d_cursor;           // absolute slot 'expire' drains next
+  uint32_t                      d_size;             // nodes armed
+  uint64_t                      d_clamped;          // nodes placed at the horizon instead of their slot
+  std::vector<Node>             d_nodes;            // indexed by node id
+  std::vector<uint32_t>         d_heads;            // first node of each slot or 'k_null'
+  std::vector<uint64_t>         d_occupied;         // bit 's' set if slot 's' is not empty
+
+  // PRIVATE ACCESSORS
+  uint64_t nextOccupied(uint64_t slot) const;
+    // Return the first absolute slot at or after 'slot' holding nodes. Behavior is defined provided 'd_size>0'
+
+  // PRIVATE MANIPULATORS
+  void insert(uint32_t node);
+    // Push 'node' onto the slot of its deadline, clamped to '[d_cursor, d_cursor+slots)'
+
+  void unlink(uint32_t node);
+    // Remove armed 'node' from its slot
+
+public:
+  // CREATORS
+  RetransmitWheel(uint32_t nodes, double ghz, uint64_t slotNs = k_defaultSlotNs, unsigned slots = k_defaultSlots);
+    // Create a wheel of node ids '[0, nodes)', none armed, for a TSC of 'ghz' ticks per ns. Behavior is defined
+    // provided 'slots' is a power of 2 no less than 64 and 'nodes<k_null'
+
+  RetransmitWheel(const RetransmitWheel& other) = delete;
+    // Copy constructor not provided
+
+  ~RetransmitWheel() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint32_t size() const;
+    // Return nodes armed
+
+  uint64_t slotTicks() const;
+    // Return slot width in TSC ticks
+
+  uint64_t clamped() const;
+    // Return nodes placed at the horizon because their deadline was beyond it
+
+  bool isArmed(uint32_t node) const;
+    // Return true if 'node' is armed
+
+  uint64_t deadlineTicks(uint32_t node) const;
+    // Return the deadline 'node' was last armed with
+
+  // MANIPULATORS
+  void arm(uint32_t node, uint64_t deadlineTicks, uint64_t nowTicks);
+    // Make 'node' due at TSC 'deadlineTicks', replacing any deadline it had, at TSC 'nowTicks'. A deadline already
+    // past fires at the next 'expire'
+
+  void cancel(uint32_t node);
+    // Disarm 'node' if armed
+
+  template <class VISITOR>
+  unsigned expire(uint64_t nowTicks, VISITOR& visitor);
+    // Disarm every node whose slot is at or before that of 'nowTicks', earliest slot first, and call
+    // 'visitor(uint32_t node)' on each. Return how many. The visitor may arm or cancel only the node it is given
+
+  RetransmitWheel& operator=(const RetransmitWheel& rhs) = delete;
+    // Assignment operator not provided
+};
+
+class ReliableSender {
+public:
+  // CONSTANTS
+  enum {
+    k_defaultWindow = 1024,                         // sequences a session may have unacknowledged
+    k_maxBackoff = 6                                // a timeout at most doubles the RTO this many times
+  };
+  static constexpr uint64_t k_defaultMinRtoNs = 1000000;   // RTO floor (1ms)
+  static constexpr uint64_t k_defaultMaxRtoNs = 100000000; // RTO ceiling (100ms)
+
+private:
+  // TYPES
+  enum State {
+    e_FREE,                                         // acknowledged or never sent
+    e_OUTSTANDING,                                  // sent and not acknowledged; timer armed
+    e_SACKED                                        // selectively acknowledged above a hole
+  };
+
+  struct Session {
+    uint32_t                    d_next;             // next new sequence
+    uint32_t                    d_unacked;          // lowest sequence not cumulatively acknowledged
+    uint64_t                    d_srttTicks;        // smoothed RTT or 0 before the first sample
+    uint64_t                    d_rttVarTicks;      // RTT variation
+    uint64_t                    d_rtoTicks;         // retransmission timeout
+  };
+
+  struct Packet {
+    uint64_t                    d_sendTicks;        // TSC of the latest transmission
+    uint32_t                    d_sequence;         // sequence held in this record
+    uint16_t                    d_transmissions;    // times sent
+    uint8_t                     d_state;            // 'State'
+    uint8_t                     d_lost;             // 1 if judged lost by a SACK and not yet resent
+  };
+
+  // DATA
+  unsigned                      d_windowShift;      // 'window' is '2^d_windowShift'
+  uint64_t                      d_minRtoTicks;      // RTO floor
+  uint64_t                      d_maxRtoTicks;      // RTO ceiling
+  uint64_t                      d_timeouts;         // retransmissions after a timer ran out
+  uint64_t                      d_fastRetransmits;  // retransmissions of holes judged lost by a SACK
+  std::vector<Session>          d_sessions;         // indexed by session
+  std::vector<Packet>           d_packets;          // 'session*window + sequence%window'
+  RetransmitWheel               d_wheel;            // one node per packet record
+
+  // PRIVATE MANIPULATORS
+  void sample(Session& session, uint64_t rttTicks);
+    // Fold 'rttTicks' into the RTT estimate and RTO of 'session' (RFC 6298)
+
+public:
+  // CREATORS
+  ReliableSender(unsigned sessions, uint32_t window, double ghz, uint64_t minRtoNs = k_defaultMinRtoNs,
+    uint64_t maxRtoNs = k_defaultMaxRtoNs, uint32_t initialSequence = 0);
+    // Create state for sessions '[0, sessions)', each starting at 'initialSequence' with up to 'window'
+    // unacknowledged, for a TSC of 'ghz' ticks per ns. The RTO starts at 'minRtoNs' and stays in
+    // '[minRtoNs, maxRtoNs]'. Behavior is defined provided 'window' is a power of 2 no more than 2^31 and
+    // 'sessions*window<RetransmitWheel::k_null'
+
+  ReliableSender(const ReliableSender& other) = delete;
+    // Copy constructor not provided
+
+  ~ReliableSender() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  unsigned sessions() const;
+    // Return number of sessions
+
+  uint32_t window() const;
+    // Return sequences a session may have unacknowledged
+
+  uint32_t nextSequence(unsigned session) const;
+    // Return the sequence 'send' gives next in 'session'
+
+  uint32_t unacknowledged(unsigned session) const;
+    // Return the lowest sequence of 'session' not cumulatively acknowledged
+
+  uint32_t inFlight(unsigned session) const;
+    // Return sequences of 'session' sent and not cumulatively acknowledged
+
+  bool canSend(unsigned session) const;
+    // Return true if 'session' has room in its window for a new sequence
+
+  uint64_t srttTicks(unsigned session) const;
+    // Return smoothed RTT of 'session' in TSC ticks, or 0 before the first sample
+
+  uint64_t rtoTicks(unsigned session) const;
+    // Return retransmission timeout of 'session' in TSC ticks
+
+  uint32_t timersArmed() const;
+    // Return packets awaiting acknowledgement with a retransmit timer
+
+  uint64_t timeouts() const;
+    // Return retransmissions after a timer ran out
+
+  uint64_t fastRetransmits() const;
+    // Return retransmissions of packets a SACK showed lost
+
+  // MANIPULATORS
+  uint32_t send(unsigned session, uint64_t sendTicks);
+    // Take the next sequence of 'session' for a datagram stamped 'sendTicks', arm its retransmit timer and return
+    // it. Behavior is defined provided 'canSend(session)'
+
+  unsigned acknowledge(unsigned session, uint32_t cumulative, uint64_t sackBits, uint64_t echoTicks,
+    uint64_t nowTicks);
+    // Apply a SACK of 'session' received at 'nowTicks': every sequence before 'cumulative', and 'cumulative+1+i' for
+    // each bit 'i' set in 'sackBits', arrived. 'echoTicks' is the send stamp the SACK echoes. Return sequences newly
+    // acknowledged. A SACK older than one already applied only adds its selective part
+
+  template <class VISITOR>
+  unsigned expire(uint64_t nowTicks, VISITOR& visitor);
+    // Call 'visitor(unsigned session, uint32_t sequence)' for each packet whose timer has run out or that a SACK
+    // showed lost, in deadline order, and count it as sent again at 'nowTicks' with a backed off timer. The visitor
+    // must resend the datagram. Return how many
+
+  ReliableSender& operator=(const ReliableSender& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// ReorderWindow
+// PRIVATE MANIPULATORS
+inline
+uint32_t ReorderWindow::advance() {
+  uint32_t count = 0;
+  for (;;) {
+    const uint32_t index = d_next&d_mask;
+    const unsigned bit = index&63;
+    uint64_t& word = d_bits[index>>6];
+    // Zero bits of 'run' are received sequences from 'd_next' on; the shift fills the top with ones
+    const uint64_t run = ~(word>>bit);
+    const unsigned received = run ? static_cast<unsigned>(__builtin_ctzll(run)) : 64;
+    if (received==0) {
+      break;
+    }
+    word &= ~((received==64 ? ~0ull : (1ull<<received)-1)<<bit);
+    d_next += received;
+    count += received;
+    if (bit+received<64) {
+      break;
+    }
+  }
+  return count;
+}
+
+// CREATORS
+inline
+ReorderWindow::ReorderWindow(uint32_t window, uint32_t initialSequence)
+: d_bits(window/64, 0)
+, d_mask(window-1)
+, d_next(initialSequence)
+{
+  assert(window>=128 && (window&(window-1))==0);
+}
+
+// ACCESSORS
+inline
+uint32_t ReorderWindow::next() const {
+  return d_next;
+}
+
+inline
+uint32_t ReorderWindow::window() const {
+  return d_mask+1;
+}
+
+inline
+uint64_t ReorderWindow::sackBits() const {
+  const uint32_t index = (d_next+1)&d_mask;
+  const unsigned bit = index&63;
+  const std::size_t word = index>>6;
+  const uint64_t low = d_bits[word]>>bit;
+  return bit ? low|(d_bits[(word+1)%d_bits.size()]<<(64-bit)) : low;
+}
+
+// MANIPULATORS
+inline
+ReorderWindow::Result ReorderWindow::receive(uint32_t sequence, uint32_t *delivered) {
+  assert(delivered);
+  *delivered = 0;
+  const uint32_t offset = sequence-d_next;
+  if (offset>=0x80000000u) {
+    return e_DUPLICATE;
+  }
+  if (offset>d_mask) {
+    return e_BEYOND_WINDOW;
+  }
+  const uint32_t index = sequence&d_mask;
+  uint64_t& word = d_bits[index>>6];
+  const uint64_t bit = 1ull<<(index&63);
+  if (word&bit) {
+    return e_DUPLICATE;
+  }
+  word |= bit;
+  if (offset) {
+    return e_OUT_OF_ORDER;
+  }
+  *delivered = advance();
+  return e_IN_ORDER;
+}
+
+// RetransmitWheel
+// PRIVATE ACCESSORS
+inline
+uint64_t RetransmitWheel::nextOccupied(uint64_t slot) const {
+  assert(d_size>0);
+  const std::size_t words = d_occupied.size();
+  std::size_t word = (slot&d_slotMask)>>6;
+  uint64_t bits = d_occupied[word]&(~0ull<<(slot&63));
+  uint64_t base = slot&~63ull;
+  for (std::size_t i=0; bits==0 && i<words; ++i) {
+    word = (word+1)%words;
+    base += 64;
+    bits = d_occupied[word];
+  }
+  assert(bits);
+  return base+__builtin_ctzll(bits);
+}
+
+// PRIVATE MANIPULATORS
+inline
+void RetransmitWheel::insert(uint32_t node) {
+  Node& n = d_nodes[node];
+  uint64_t slot = std::max(n.d_deadlineTicks>>d_shift, d_cursor);
+  if (slot>d_cursor+d_slotMask) {
+    slot = d_cursor+d_slotMask;
+    ++d_clamped;
+  }
+  const uint32_t physical = static_cast<uint32_t>(slot&d_slotMask);
+  n.d_slot = physical;
+  n.d_prev = k_null;
+  n.d_next = d_heads[physical];
+  if (n.d_next!=k_null) {
+    d_nodes[n.d_next].d_prev = node;
+  }
+  d_heads[physical] = node;
+  d_occupied[physical>>6] |= 1ull<<(physical&63);
+}
+
+inline
+void RetransmitWheel::unlink(uint32_t node) {
+  Node& n = d_nodes[node];
+  assert(n.d_slot!=k_null);
+  if (n.d_prev!=k_null) {
+    d_nodes[n.d_prev].d_next = n.d_next;
+  } else {
+    d_heads[n.d_slot] = n.d_next;
+    if (n.d_next==k_null) {
+      d_occupied[n.d_slot>>6] &= ~(1ull<<(n.d_slot&63));
+    }
+  }
+  if (n.d_next!=k_null) {
+    d_nodes[n.d_next].d_prev = n.d_prev;
+  }
+  n.d_slot = k_null;
+}
+
+// CREATORS
+inline
+RetransmitWheel::RetransmitWheel(uint32_t nodes, double ghz, uint64_t slotNs, unsigned slots)
+: d_shift(0)
+, d_slotMask(slots-1)
+, d_cursor(0)
+, d_size(0)
+, d_clamped(0)
+, d_nodes(nodes)
+, d_heads(slots, static_cast<uint32_t>(k_null))
+, d_occupied(slots/64, 0)
+{
+  assert(slots>=64 && (slots&(slots-1))==0);
+  assert(nodes<k_null);
+  assert(ghz>0);
+  const double ticks = std::max(1.0, static_cast<double>(slotNs)*ghz);
+  d_shift = static_cast<unsigned>(std::lround(std::log2(ticks)));
+  for (Node& node: d_nodes) {
+    node.d_deadlineTicks = 0;
+    node.d_next = node.d_prev = node.d_slot = k_null;
+  }
+}
+
+// ACCESSORS
+inline
+uint32_t RetransmitWheel::size() const {
+  return d_size;
+}
+
+inline
+uint64_t RetransmitWheel::slotTicks() const {
+  return 1ull<<d_shift;
+}
+
+inline
+uint64_t RetransmitWheel::clamped() const {
+  return d_clamped;
+}
+
+inline
+bool RetransmitWheel::isArmed(uint32_t node) const {
+  assert(node<d_nodes.size());
+  return d_nodes[node].d_slot!=k_null;
+}
+
+inline
+uint64_t RetransmitWheel::deadlineTicks(uint32_t node) const {
+  assert(node<d_nodes.size());
+  return d_nodes[node].d_deadlineTicks;
+}
+
+// MANIPULATORS
+inline
+void RetransmitWheel::arm(uint32_t node, uint64_t deadlineTicks, uint64_t nowTicks) {
+  assert(node<d_nodes.size());
+  if (d_nodes[node].d_slot!=k_null) {
+    unlink(node);
+  } else {
+    // An empty wheel has nothing behind 'now', so move the cursor up rather than clamp far future slots
+    if (d_size==0) {
+      d_cursor = std::max(d_cursor, nowTicks>>d_shift);
+    }
+    ++d_size;
+  }
+  d_nodes[node].d_deadlineTicks = deadlineTicks;
+  insert(node);
+}
+
+inline
+void RetransmitWheel::cancel(uint32_t node) {
+  assert(node<d_nodes.size());
+  if (d_nodes[node].d_slot!=k_null) {
+    unlink(node);
+    --d_size;
+  }
+}
+
+template <class VISITOR>
+inline
+unsigned RetransmitWheel::expire(uint64_t nowTicks, VISITOR& visitor) {
+  const uint64_t nowSlot = nowTicks>>d_shift;
+  unsigned fired = 0;
+  while (d_cursor<=nowSlot) {
+    if (d_size==0) {
+      d_cursor = nowSlot+1;
+      break;
+    }
+    const uint64_t next = nextOccupied(d_cursor);
+    if (next>nowSlot) {
+      d_cursor = nowSlot+1;
+      break;
+    }
+    d_cursor = next;
+
+    // Detach the slot's list, so a node the visitor re-arms into this slot waits for the next call. A node clamped
+    // at the horizon goes back into the wheel; its slot is never the cursor's again
+    const uint32_t physical = static_cast<uint32_t>(d_cursor&d_slotMask);
+    uint32_t node = d_heads[physical];
+    d_heads[physical] = k_null;
+    d_occupied[physical>>6] &= ~(1ull<<(physical&63));
+    while (node!=k_null) {
+      Node& n = d_nodes[node];
+      const uint32_t following = n.d_next;
+      if ((n.d_deadlineTicks>>d_shift)>d_cursor) {
+        insert(node);
+      } else {
+        n.d_slot = k_null;
+        --d_size;
+        ++fired;
+        visitor(node);
+      }
+      node = following;
+    }
+    if (d_heads[physical]!=k_null) {
+      break;
+    }
+    ++d_cursor;
+  }
+  return fired;
+}
+
+// ReliableSender
+// PRIVATE MANIPULATORS
+inline
+void ReliableSender::sample(Session& session, uint64_t rttTicks) {
+  if (session.d_srttTicks==0) {
+    session.d_srttTicks = std::max<uint64_t>(1, rttTicks);
+    session.d_rttVarTicks = rttTicks/2;
+  } else {
+    const uint64_t error = session.d_srttTicks>rttTicks ? session.d_srttTicks-rttTicks :
+      rttTicks-session.d_srttTicks;
+    session.d_rttVarTicks = (3*session.d_rttVarTicks+error)/4;
+    session.d_srttTicks = std::max<uint64_t>(1, (7*session.d_srttTicks+rttTicks)/8);
+  }
+  session.d_rtoTicks = std::min(d_maxRtoTicks,
+    std::max(d_minRtoTicks, session.d_srttTicks+std::max(d_wheel.slotTicks(), 4*session.d_rttVarTicks)));
+}
+
+// CREATORS
+inline
+ReliableSender::ReliableSender(unsigned sessions, uint32_t window, double ghz, uint64_t minRtoNs,
+  uint64_t maxRtoNs, uint32_t initialSequence)
+: d_windowShift(static_cast<unsigned>(__builtin_ctz(window)))
+, d_minRtoTicks(static_cast<uint64_t>(static_cast<double>(minRtoNs)*ghz))
+, d_maxRtoTicks(static_cast<uint64_t>(static_cast<double>(maxRtoNs)*ghz))
+, d_timeouts(0)
+, d_fastRetransmits(0)
+, d_sessions(sessions)
+, d_packets(static_cast<std::size_t>(sessions)*window)
+, d_wheel(static_cast<uint32_t>(static_cast<std::size_t>(sessions)*window), ghz)
+{
+  assert(window>0 && (window&(window-1))==0 && window<=0x80000000u);
+  assert(minRtoNs<=maxRtoNs);
+  for (Session& session: d_sessions) {
+    session.d_next = session.d_unacked = initialSequence;
+    session.d_srttTicks = session.d_rttVarTicks = 0;
+    session.d_rtoTicks = d_minRtoTicks;
+  }
+  for (Packet& packet: d_packets) {
+    packet.d_sendTicks = 0;
+    packet.d_sequence = 0;
+    packet.d_transmissions = 0;
+    packet.d_state = e_FREE;
+    packet.d_lost = 0;
+  }
+}
+
+// ACCESSORS
+inline
+unsigned ReliableSender::sessions() const {
+  return static_cast<unsigned>(d_sessions.size());
+}
+
+inline
+uint32_t ReliableSender::window() const {
+  return 1u<<d_windowShift;
+}
+
+inline
+uint32_t ReliableSender::nextSequence(unsigned session) const {
+  assert(session<d_sessions.size());
+  return d_sessions[session].d_next;
+}
+
+inline
+uint32_t ReliableSender::unacknowledged(unsigned session) const {
+  assert(session<d_sessions.size());
+  return d_sessions[session].d_unacked;
+}
+
+inline
+uint32_t ReliableSender::inFlight(unsigned session) const {
+  assert(session<d_sessions.size());
+  return d_sessions[session].d_next-d_sessions[session].d_unacked;
+}
+
+inline
+bool ReliableSender::canSend(unsigned session) const {
+  return inFlight(session)<window();
+}
+
+inline
+uint64_t ReliableSender::srttTicks(unsigned session) const {
+  assert(session<d_sessions.size());
+  return d_sessions[session].d_srttTicks;
+}
+
+inline
+uint64_t ReliableSender::rtoTicks(unsigned session) const {
+  assert(session<d_sessions.size());
+  return d_sessions[session].d_rtoTicks;
+}
+
+inline
+uint32_t ReliableSender::timersArmed() const {
+  return d_wheel.size();
+}
+
+inline
+uint64_t ReliableSender::timeouts() const {
+  return d_timeouts;
+}
+
+inline
+uint64_t ReliableSender::fastRetransmits() const {
+  return d_fastRetransmits;
+}
+
+// MANIPULATORS
+inline
+uint32_t ReliableSender::send(unsigned session, uint64_t sendTicks) {
+  assert(canSend(session));
+  Session& s = d_sessions[session];
+  const uint32_t sequence = s.d_next++;
+  const uint32_t node = (static_cast<uint32_t>(session)<<d_windowShift)|(sequence&(window()-1));
+  Packet& packet = d_packets[node];
+  packet.d_sendTicks = sendTicks;
+  packet.d_sequence = sequence;
+  packet.d_transmissions = 1;
+  packet.d_state = e_OUTSTANDING;
+  packet.d_lost = 0;
+  d_wheel.arm(node, sendTicks+s.d_rtoTicks, sendTicks);
+  return sequence;
+}
+
+inline
+unsigned ReliableSender::acknowledge(unsigned session, uint32_t cumulative, uint64_t sackBits, uint64_t echoTicks,
+  uint64_t nowTicks) {
+  assert(session<d_sessions.size());
+  Session& s = d_sessions[session];
+  const uint32_t mask = window()-1;
+  const uint32_t base = static_cast<uint32_t>(session)<<d_windowShift;
+  const uint32_t outstanding = s.d_next-s.d_unacked;
+  if (cumulative-s.d_unacked>outstanding && s.d_unacked-cumulative>=0x80000000u) {
+    // Acknowledges what was never sent
+    return 0;
+  }
+  if (echoTicks && echoTicks<=nowTicks) {
+    sample(s, nowTicks-echoTicks);
+  }
+
+  unsigned acknowledged = 0;
+  for (; s.d_unacked-cumulative>=0x80000000u; ++s.d_unacked) {
+    Packet& packet = d_packets[base|(s.d_unacked&mask)];
+    if (packet.d_state==e_OUTSTANDING) {
+      d_wheel.cancel(base|(s.d_unacked&mask));
+      ++acknowledged;
+    }
+    packet.d_state = e_FREE;
+  }
+  if (sackBits==0) {
+    return acknowledged;
+  }
+
+  // Selective part: sequences above 'cumulative', which may be below 'd_unacked' if this SACK is stale
+  const uint32_t highest = cumulative+1+static_cast<uint32_t>(63-__builtin_clzll(sackBits));
+  const uint64_t reorderTicks = s.d_srttTicks/4;
+  for (uint32_t sequence=cumulative; sequence!=highest; ++sequence) {
+    if (sequence-s.d_unacked>=s.d_next-s.d_unacked) {
+      continue;
+    }
+    const uint32_t node = base|(sequence&mask);
+    Packet& packet = d_packets[node];
+    if (packet.d_state!=e_OUTSTANDING) {
+      continue;
+    }
+    const uint32_t offset = sequence-cumulative;
+    if (offset && (sackBits>>(offset-1))&1) {
+      d_wheel.cancel(node);
+      packet.d_state = e_SACKED;
+      ++acknowledged;
+    } else if (!packet.d_lost && packet.d_sendTicks+reorderTicks<echoTicks) {
+      // A datagram sent well after this one's last transmission arrived: resend it now
+      packet.d_lost = 1;
+      d_wheel.arm(node, nowTicks, nowTicks);
+    }
+  }
+  // 'highest' itself was received
+  if (highest-s.d_unacked<s.d_next-s.d_unacked) {
+    const uint32_t node = base|(highest&mask);
+    Packet& packet = d_packets[node];
+    if (packet.d_state==e_OUTSTANDING) {
+      d_wheel.cancel(node);
+      packet.d_state = e_SACKED;
+      ++acknowledged;
+    }
+  }
+  return acknowledged;
+}
+
+template <class VISITOR>
+inline
+unsigned ReliableSender::expire(uint64_t nowTicks, VISITOR& visitor) {
+  auto resend = [&](uint32_t node) {
+    Packet& packet = d_packets[node];
+    assert(packet.d_state==e_OUTSTANDING);
+    const unsigned session = node>>d_windowShift;
+    if (packet.d_lost) {
+      ++d_fastRetransmits;
+    } else {
+      ++d_timeouts;
+    }
+    packet.d_lost = 0;
+    packet.d_sendTicks = nowTicks;
+    const unsigned backoff = std::min<unsigned>(packet.d_transmissions, k_maxBackoff);
+    ++packet.d_transmissions;
+    d_wheel.arm(node, nowTicks+std::min(d_maxRtoTicks, d_sessions[session].d_rtoTicks<<backoff), nowTicks);
+    visitor(session, packet.d_sequence);
+  };
+  return d_wheel.expire(nowTicks, resend);
+}
+
+} // namespace Experiment
@@ -0,0 +1,470 @@
+#pragma once
+
+// Purpose: One-pass, fixed memory, mergeable summary statistics of a stream of doubles
+//
+// Classes:
+//   Experiment::StreamHistogram: Equal width histogram whose bin width doubles as the observed range grows
+//   Experiment::StreamStats: Count, min, max, Welford mean and variance plus a 'StreamHistogram'
+//
+// Thread Safety: not-thread-safe. Give each thread its own object and 'merge' them afterwards.
+//
+// Exception Policy: No exceptions
+//
+// 'CommFunc::summarize' used to need every sample in memory. It made separate passes for the min, max, mean and
+// variance before binning. 'StreamStats::add' does all of that per sample in O(1) time and constant memory.
+//
+// Mean and variance use Welford's update, which does not lose precision the way a sum of squares does. Two
+// accumulators combine with Chan et al.'s pairwise formula, so per-thread results merge exactly as if one object had
+// seen every sample.
+//
+// 'StreamHistogram' keeps 'k_bins' counters. Bin 'i' covers '[(d_base+i)*w, (d_base+i+1)*w)' where the width 'w' is
+// a power of 2. The first sample picks a fine width. When a sample falls outside the bins the width doubles and
+// neighbouring counters are added pairwise, until the range fits. Because bin edges are multiples of a power of 2,
+// two histograms align by coarsening the finer one, so 'merge' is exact. A histogram with 'k_bins' bins always
+// resolves its observed range to at least 1/512 of that range. That is plenty to redraw 'summarize''s 'log2(N)+1'
+// bins and to estimate quantiles.
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+namespace Experiment {
+
+class StreamHistogram {
+public:
+  // CONSTANTS
+  enum {
+    k_bins = 1024,                                  // counters kept
+    k_initialBits = 20                              // first width is '2^-k_initialBits' of the first sample
+  };
+
+private:
+  // DATA
+  std::vector<uint64_t>         d_counts;           // 'k_bins' counters; bin 'i' holds index 'd_base+i'
+  uint64_t                      d_total;            // samples counted
+  int64_t                       d_base;             // absolute bin index of 'd_counts[0]'
+  int64_t                       d_lo;               // lowest absolute bin index with a sample
+  int64_t                       d_hi;               // highest absolute bin index with a sample
+  int                           d_exponent;         // bin width is '2^d_exponent'
+
+  // PRIVATE ACCESSORS
+  static int64_t floorHalf(int64_t index);
+    // Return 'floor(index/2)'
+
+  bool indexOf(double value, int64_t *index) const;
+    // Load into 'index' the absolute bin of 'value' at the current width. Return false if it does not fit 'int64_t'
+
+  // PRIVATE MANIPULATORS
+  void coarsen();
+    // Double the bin width adding counters pairwise
+
+  void rebase(int64_t lo);
+    // Move 'd_base' to 'lo' keeping every counter. Behavior is defined provided 'lo<=d_lo' and 'd_hi-lo<k_bins'
+
+public:
+  // CREATORS
+  StreamHistogram();
+    // Create an empty histogram
+
+  StreamHistogram(const StreamHistogram& other) = default;
+    // Create a copy of 'other'
+
+  ~StreamHistogram() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint64_t count() const;
+    // Return number of samples added
+
+  double width() const;
+    // Return current bin width. Behavior is defined provided 'count()>0'
+
+  double binLow(int64_t index) const;
+    // Return the inclusive lower edge of absolute bin 'index'
+
+  int64_t lowIndex() const;
+    // Return the lowest absolute bin index holding a sample. Behavior is defined provided 'count()>0'
+
+  int64_t highIndex() const;
+    // Return the highest absolute bin index holding a sample. Behavior is defined provided 'count()>0'
+
+  uint64_t binCount(int64_t index) const;
+    // Return the samples in absolute bin 'index'
+
+  double quantile(double q, double min, double max) const;
+    // Return an estimate of the 'q' quantile with 'q' in [0, 1]. It interpolates inside the bin and clamps to the
+    // exact sample 'min' and 'max'. Behavior is defined provided 'count()>0'
+
+  // MANIPULATORS
+  void add(double value);
+    // Count 'value'. Behavior is defined provided 'value' is finite
+
+  void merge(const StreamHistogram& other);
+    // Add every sample of 'other' to this histogram
+
+  StreamHistogram& operator=(const StreamHistogram& rhs) = default;
+    // Assign 'rhs' to this object
+};
+
+class StreamStats {
+  // DATA
+  uint64_t                      d_count;            // samples added
+  double                        d_min;              // smallest sample
+  double                        d_max;              // largest sample
+  double                        d_mean;             // running mean
+  double                        d_m2;               // running sum of squared differences from the mean
+  StreamHistogram               d_histogram;        // distribution
+
+public:
+  // CREATORS
+  StreamStats();
+    // Create an empty accumulator
+
+  StreamStats(const StreamStats& other) = default;
+    // Create a copy of 'other'
+
+  ~StreamStats() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  uint64_t count() const;
+    // Return number of samples added
+
+  double min() const;
+    // Return smallest sample or +infinity if empty
+
+  double max() const;
+    // Return largest sample or -infinity if empty
+
+  double mean() const;
+    // Return mean of the samples or 0 if empty
+
+  double variance() const;
+    // Return unbiased sample variance or 0 with fewer than 2 samples
+
+  double stddev() const;
+    // Return 'sqrt(variance())'
+
+  double quantile(double q) const;
+    // Return an estimate of the 'q' quantile with 'q' in [0, 1]. Behavior is defined provided 'count()>0'
+
+  const StreamHistogram& histogram() const;
+    // Return the distribution of samples
+
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object returning 'stream'
+
+  // MANIPULATORS
+  void add(double value);
+    // Account for 'value'. Behavior is defined provided 'value' is finite
+
+  void merge(const StreamStats& other);
+    // Account for every sample of 'other' as if each had been added to this object
+
+  void reset();
+    // Forget all samples
+
+  StreamStats& operator=(const StreamStats& rhs) = default;
+    // Assign 'rhs' to this object
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const StreamStats& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// PRIVATE ACCESSORS
+inline
+int64_t StreamHistogram::floorHalf(int64_t index) {
+  return index>=0 ? index/2 : -((-index+1)/2);
+}
+
+inline
+bool StreamHistogram::indexOf(double value, int64_t *index) const {
+  const double scaled = std::floor(std::ldexp(value, -d_exponent));
+  if (std::fabs(scaled)>=std::ldexp(1.0, 62)) {
+    return false;
+  }
+  *index = static_cast<int64_t>(scaled);
+  return true;
+}
+
+// PRIVATE MANIPULATORS
+inline
+void StreamHistogram::coarsen() {
+  const int64_t base = floorHalf(d_base);
+  std::vector<uint64_t> counts(k_bins, 0);
+  for (int64_t i=d_lo-d_base; i<=d_hi-d_base; ++i) {
+    counts[floorHalf(d_base+i)-base] += d_counts[i];
+  }
+  d_counts.swap(counts);
+  d_base = base;
+  d_lo = floorHalf(d_lo);
+  d_hi = floorHalf(d_hi);
+  ++d_exponent;
+}
+
+inline
+void StreamHistogram::rebase(int64_t lo) {
+  assert(lo<=d_lo && d_hi-lo<k_bins);
+  if (lo==d_base) {
+    return;
+  }
+  std::vector<uint64_t> counts(k_bins, 0);
+  for (int64_t i=d_lo; i<=d_hi; ++i) {
+    counts[i-lo] = d_counts[i-d_base];
+  }
+  d_counts.swap(counts);
+  d_base = lo;
+}
+
+// CREATORS
+inline
+StreamHistogram::StreamHistogram()
+: d_counts(k_bins, 0)
+, d_total(0)
+, d_base(0)
+, d_lo(0)
+, d_hi(0)
+, d_exponent(0)
+{
+}
+
+// ACCESSORS
+inline
+uint64_t StreamHistogram::count() const {
+  return d_total;
+}
+
+inline
+double StreamHistogram::width() const {
+  return std::ldexp(1.0, d_exponent);
+}
+
+inline
+double StreamHistogram::binLow(int64_t index) const {
+  return std::ldexp(static_cast<double>(index), d_exponent);
+}
+
+inline
+int64_t StreamHistogram::lowIndex() const {
+  assert(d_total>0);
+  return d_lo;
+}
+
+inline
+int64_t StreamHistogram::highIndex() const {
+  assert(d_total>0);
+  return d_hi;
+}
+
+inline
+uint64_t StreamHistogram::binCount(int64_t index) const {
+  if (d_total==0 || index<d_lo || index>d_hi) {
+    return 0;
+  }
+  return d_counts[index-d_base];
+}
+
+inline
+double StreamHistogram::quantile(double q, double min, double max) const {
+  assert(d_total>0);
+  q = std::max(0.0, std::min(1.0, q));
+  const double rank = q*static_cast<double>(d_total);
+  double seen(0);
+  for (int64_t i=d_lo; i<=d_hi; ++i) {
+    const double count = static_cast<double>(d_counts[i-d_base]);
+    if (count>0 && seen+count>=rank) {
+      const double value = binLow(i)+width()*((rank-seen)/count);
+      return std::max(min, std::min(max, value));
+    }
+    seen += count;
+  }
+  return max;
+}
+
+// MANIPULATORS
+inline
+void StreamHistogram::add(double value) {
+  assert(std::isfinite(value));
+
+  if (d_total==0) {
+    int exponent(0);
+    std::frexp(value, &exponent);
+    d_exponent = (value==0) ? -k_initialBits : exponent-k_initialBits;
+    int64_t index(0);
+    indexOf(value, &index);
+    d_base = d_lo = d_hi = index;
+  }
+
+  int64_t index(0);
+  while (!indexOf(value, &index) || std::max(d_hi, index)-std::min(d_lo, index)>=k_bins) {
+    coarsen();
+  }
+
+  // Leave the most room on the side the range is growing towards
+  if (index<d_base) {
+    rebase(d_hi-k_bins+1);
+  } else if (index>=d_base+k_bins) {
+    rebase(d_lo);
+  }
+
+  ++d_counts[index-d_base];
+  d_lo = std::min(d_lo, index);
+  d_hi = std::max(d_hi, index);
+  ++d_total;
+}
+
+inline
+void StreamHistogram::merge(const StreamHistogram& other) {
+  if (other.d_total==0) {
+    return;
+  }
+  if (d_total==0) {
+    *this = other;
+    return;
+  }
+
+  StreamHistogram rhs(other);
+  while (rhs.d_exponent<d_exponent) {
+    rhs.coarsen();
+  }
+  while (d_exponent<rhs.d_exponent) {
+    coarsen();
+  }
+  while (std::max(d_hi, rhs.d_hi)-std::min(d_lo, rhs.d_lo)>=k_bins) {
+    coarsen();
+    rhs.coarsen();
+  }
+
+  const int64_t lo = std::min(d_lo, rhs.d_lo);
+  const int64_t hi = std::max(d_hi, rhs.d_hi);
+  if (lo<d_base || hi>=d_base+k_bins) {
+    rebase(lo);
+  }
+  for (int64_t i=rhs.d_lo; i<=rhs.d_hi; ++i) {
+    d_counts[i-d_base] += rhs.d_counts[i-rhs.d_base];
+  }
+  d_lo = lo;
+  d_hi = hi;
+  d_total += rhs.d_total;
+}
+
+// CREATORS
+inline
+StreamStats::StreamStats()
+: d_count(0)
+, d_min(std::numeric_limits<double>::infinity())
+, d_max(-std::numeric_limits<double>::infinity())
+, d_mean(0)
+, d_m2(0)
+{
+}
+
+// ACCESSORS
+inline
+uint64_t StreamStats::count() const {
+  return d_count;
+}
+
+inline
+double StreamStats::min() const {
+  return d_min;
+}
+
+inline
+double StreamStats::max() const {
+  return d_max;
+}
+
+inline
+double StreamStats::mean() const {
+  return d_mean;
+}
+
+inline
+double StreamStats::variance() const {
+  return d_count>1 ? d_m2/static_cast<double>(d_count-1) : 0.0;
+}
+
+inline
+double StreamStats::stddev() const {
+  return std::sqrt(variance());
+}
+
+inline
+double StreamStats::quantile(double q) const {
+  return d_histogram.quantile(q, d_min, d_max);
+}
+
+inline
+const StreamHistogram& StreamStats::histogram() const {
+  return d_histogram;
+}
+
+inline
+std::ostream& StreamStats::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    count                                : " << d_count                 << std::endl;
+  stream << "    min                                  : " << d_min                   << std::endl;
+  stream << "    max                                  : " << d_max                   << std::endl;
+  stream << "    mean                                 : " << d_mean                  << std::endl;
+  stream << "    stddev                               : " << stddev()                << std::endl;
+  if (d_count>0) {
+    stream << "    p50/p90/p99                          : " << quantile(0.5) << "/" << quantile(0.9) << "/"
+                                                             << quantile(0.99)        << std::endl;
+  }
+  stream << "]" << std::endl;
+  return stream;
+}
+
+// MANIPULATORS
+inline
+void StreamStats::add(double value) {
+  ++d_count;
+  d_min = std::min(d_min, value);
+  d_max = std::max(d_max, value);
+  const double delta = value-d_mean;
+  d_mean += delta/static_cast<double>(d_count);
+  d_m2 += delta*(value-d_mean);
+  d_histogram.add(value);
+}
+
+inline
+void StreamStats::merge(const StreamStats& other) {
+  if (other.d_count==0) {
+    return;
+  }
+  if (d_count==0) {
+    *this = other;
+    return;
+  }
+
+  const double n1 = static_cast<double>(d_count);
+  const double n2 = static_cast<double>(other.d_count);
+  const double n = n1+n2;
+  const double delta = other.d_mean-d_mean;
+  d_mean += delta*n2/n;
+  d_m2 += other.d_m2+delta*delta*n1*n2/n;
+  d_count += other.d_count;
+  d_min = std::min(d_min, other.d_min);
+  d_max = std::max(d_max, other.d_max);
+  d_histogram.merge(other.d_histogram);
+}
+
+inline
+void StreamStats::reset() {
+  *this = StreamStats();
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const StreamStats& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
@@ -0,0 +1,356 @@
+#pragma once
+
+// Purpose: Estimate TX rate in bytes/sec for next transmission based on last RTT using the Timely algorithm
+//
+// Classes:
+//   Experiment::TimelyErpcParams: Constants and switches replicating eRPC's Timely with 'kPatched==True'
+//   Experiment::TimelyBasicParams: Constants and switches for the patched algorithm in [1] section 4.3
+//   Experiment::TimelyTracedParams<PARAMS>: 'PARAMS' with the unbounded rate kept for traces
+//   Experiment::Timely<PARAMS>: Implements Timely with constants and variant switches taken from 'PARAMS'
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// 'PARAMS' is a policy type holding 'static constexpr' members only. Since every constant is known at compile time a
+// 'Timely' object carries just its state: 4 doubles (32 bytes). The unbounded rate is only plotted, so the production
+// parameter sets do not keep it; drivers that trace it use 'TimelyTracedParams', which adds a fifth. The compiler folds
+// the constants into 'update', and the variant switches below are resolved with 'if constexpr' so a disabled variant
+// costs nothing:
+//
+//   k_erpcBypass   : skip the update when running at line rate and 'rttUs<=k_minModelRttUs' (eRPC)
+//   k_deltaFactor  : scale additive increase and multiplicative decrease by time since the last RTT (eRPC)
+//   k_halfRateFloor: never let one update decrease the rate below half its previous value (eRPC)
+//   k_patchedError : normalize the gradient band error by 'k_minModelRttUs' rather than 'k_minRttUs' ([1] 4.3)
+//   k_keepRawRate  : keep the rate before bounding, available through 'rawRate'
+//
+// A 'PARAMS' type must provide every member of 'TimelyErpcParams' with the same meaning.
+
+#include <probemacro.h>
+
+#include <stdio.h>
+#include <iostream>
+#include <assert.h>
+#include <algorithm>
+
+namespace Experiment {
+
+struct TimelyErpcParams {
+  // CONSTANTS
+  static constexpr double k_alpha = 0.46;                     // EWMA smoothing factor (needs research)
+  static constexpr double k_beta = 0.26;                      // multiplicative decrease factor
+  static constexpr double k_delta = 5*1000*1000.0;            // additive rate increase 5 million bytes/second
+
+  static constexpr double k_minRttUs = 2;                     // RTT <= (2us) not considered; state unchanged
+  static constexpr double k_minModelRttUs = 50;               // minimum model RTT limit (50us)
+  static constexpr double k_maxModelRttUs = 1000;             // maximum model RTT limit (1000 us)
+
+  static constexpr double k_maxNicBps = 10000000000.0;        // Maximum NIC bandwidth 10GBps (bytes-per-sec)
+  static constexpr double k_minRateBps = 15*1000*1000;        // minimum transmit rate bytes/sec
+  static constexpr double k_maxRateBps = k_maxNicBps;         // maximum transmit rate bytes/sec
+
+  static constexpr bool k_erpcBypass = true;                  // eRPC "by-pass" at line rate
+  static constexpr bool k_deltaFactor = true;                 // eRPC increase/decrease scaling
+  static constexpr bool k_halfRateFloor = true;               // eRPC 0.5x decrease floor
+  static constexpr bool k_patchedError = true;                // error normalized by min model RTT
+  static constexpr bool k_keepRawRate = false;                // keep unbounded rate
+};
+
+struct TimelyBasicParams {
+  // CONSTANTS
+  static constexpr double k_alpha = 0.875;                    // EWMA smoothing factor (needs research)
+  static constexpr double k_beta = 0.8;                       // multiplicative decrease factor
+  static constexpr double k_delta = 10000000.0;               // additive rate increase 10 million bytes/second
+
+  static constexpr double k_minRttUs = 20;                    // RTT <= (20us) not considered; state unchanged
+  static constexpr double k_minModelRttUs = 50;               // minimum model RTT limit (50us)
+  static constexpr double k_maxModelRttUs = 500;              // maximum model RTT limit (500 us)
+
+  static constexpr double k_maxNicBps = 10000000000.0;        // Maximum NIC bandwidth 10GBps (bytes-per-sec)
+  static constexpr double k_minRateBps = 500000.0;            // minimum transmit rate bytes/sec
+  static constexpr double k_maxRateBps = k_maxNicBps;         // maximum transmit rate bytes/sec
+
+  static constexpr bool k_erpcBypass = false;                 // eRPC "by-pass" at line rate
+  static constexpr bool k_deltaFactor = false;                // eRPC increase/decrease scaling
+  static constexpr bool k_halfRateFloor = false;              // eRPC 0.5x decrease floor
+  static constexpr bool k_patchedError = false;               // error normalized by min model RTT
+  static constexpr bool k_keepRawRate = false;                // keep unbounded rate
+};
+
+template <class PARAMS>
+struct TimelyTracedParams : PARAMS {
+  // CONSTANTS
+  static constexpr bool k_keepRawRate = true;                 // keep unbounded rate
+};
+
+template <bool KEEP>
+class TimelyRawRate {
+  // Storage for the unbounded rate when 'KEEP' is true
+  double d_rawLineRateBps;                                    // calculated TX rate (bytes-per-second) before bounding
+
+public:
+  explicit TimelyRawRate(double rateBps) : d_rawLineRateBps(rateBps) {}
+  double rawRateBps() const { return d_rawLineRateBps; }
+  void setRawRateBps(double rateBps) { d_rawLineRateBps = rateBps; }
+};
+
+template <>
+class TimelyRawRate<false> {
+  // No storage; the empty base optimization makes this cost 0 bytes
+public:
+  explicit TimelyRawRate(double) {}
+  double rawRateBps() const { return 0; }
+  void setRawRateBps(double) {}
+};
+
+template <class PARAMS>
+class Timely : private TimelyRawRate<PARAMS::k_keepRawRate> {
+public:
+  // TYPES
+  typedef PARAMS Params;
+
+  // CONSTANTS
+  static constexpr double k_alpha = PARAMS::k_alpha;
+  static constexpr double k_beta = PARAMS::k_beta;
+  static constexpr double k_delta = PARAMS::k_delta;
+  static constexpr double k_minRttUs = PARAMS::k_minRttUs;
+  static constexpr double k_minModelRttUs = PARAMS::k_minModelRttUs;
+  static constexpr double k_maxModelRttUs = PARAMS::k_maxModelRttUs;
+  static constexpr double k_maxNicBps = PARAMS::k_maxNicBps;
+  static constexpr double k_minRateBps = PARAMS::k_minRateBps;
+  static constexpr double k_maxRateBps = PARAMS::k_maxRateBps;
+
+  static constexpr double k_byteToGbits = 8.0/(1000*1000*1000); // factor to convert from bytes to Gbits (Giga bits)
+
+  static_assert(k_alpha>0.0 && k_alpha<=1.0, "alpha must be in (0, 1]");
+  static_assert(k_beta>0.0 && k_beta<=1.0, "beta must be in (0, 1]");
+  static_assert(k_delta>=1000000.0, "delta must be at least 1e6 bytes/sec");
+  static_assert(k_minRateBps>0, "min rate must be positive");
+  static_assert(k_minRateBps<k_maxRateBps, "min rate must be less than max rate");
+  static_assert(k_maxRateBps<=k_maxNicBps, "max rate cannot exceed NIC bandwidth");
+  static_assert(k_maxNicBps>=1000000.0, "NIC bandwidth must be at least 1e6 bytes/sec");
+  static_assert(k_minRttUs>=0, "min RTT cannot be negative");
+  static_assert(k_minRttUs<k_minModelRttUs, "min RTT must be less than min model RTT");
+  static_assert(k_minModelRttUs<k_maxModelRttUs, "min model RTT must be less than max model RTT");
+
+private:
+  typedef TimelyRawRate<PARAMS::k_keepRawRate> RawRate;
+
+  double d_lineRateBps;                             // calculated TX rate (bytes-per-second)
+  double d_prevTimeUs;                              // absolute time in microseconds 'update' was last called
+  double d_prevRttUs;                               // last RTT provided in 'update'
+  double d_weightedRttDiffUs;                       // weighted RTT difference
+
+public:
+  // CREATORS
+  explicit Timely(unsigned sessionCount = 0);
+    // Create a Timely object to estimate TX rate in bytes/sec on a NIC with 'PARAMS::k_maxNicBps' bandwidth where
+    // 'sessionCount' is the number of existing sessions (not including the new session co-managed by this object)
+    // already running. Upon creation, 'd_lineRateBps' is initialized to be 'k_maxNicBps/(sessionCount+1)'.
+
+  Timely(const Timely& other) = delete;
+    // Copy constructor not provided
+
+  ~Timely() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  double rate() const;
+    // Return the last estimated TX rate in bytes/sec. Note that, if called immediately following construction,
+    // this returns the initial, estimated rate
+
+  double rateAsGbps() const;
+    // Exactly like 'rate' but expressed as Gbps (Giga bits per second)
+
+  double rawRate() const;
+    // Return the last estimated TX rate in bytes/sec before it was bounded by '[k_minRateBps, k_maxRateBps]'. This
+    // is the raw Timely computed value without any repair. Only available if 'PARAMS::k_keepRawRate'
+
+  double rawRateAsGbps() const;
+    // Exactly like 'rawRate' but expressed as Gbps (Giga bits per second)
+
+  // MANIPULATORS
+  double update(double rttUs, double nowUs);
+    // Return the new, estimated transmission rate in bytes/sec based on the specified 'rttUs' (units microseconds)
+    // and the absolute wall-clock time 'nowUs' (units microseconds). Behavior is defined provided 'rttUs>0' and
+    // 'nowUs>d_prevTimeUs'. 'rttUs' represents the most recent RTT (round trip time) completed and should not include
+    // any serialization time. Note that 'rttUs' less than or equal 'k_minRttUs' are ignored, and state is not
+    // changed. Also note the calculated rate 'r' will always satisfy 'k_minRateBps<=r<=k_maxRateBps'. With
+    // 'TimelyErpcParams' this method replicates eRPC's Timely implementation in https://github.com/erpc-io/eRPC with
+    // 'kPatched==True'. eRPC's code runs with RTTs expressed as difference between two 'rdtsc()' values. Ultimately
+    // the RTT sample value is converted to micro-seconds before Timely code is hit. With 'TimelyBasicParams' this
+    // method uses the patched algoritm in [1]s section 4.3
+
+  void setRate(double rateBps);
+    // Set the estimated TX rate, and the raw rate if kept, to 'rateBps' bounded by '[k_minRateBps, k_maxRateBps]'.
+    // The RTT state is kept, so the next 'update' continues from 'rateBps'. This lets a controller that sometimes
+    // sets the rate by other means, such as 'Dcqcn' in hybrid mode, hand it back to Timely
+
+  Timely& operator=(const Timely& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+static_assert(sizeof(Timely<TimelyErpcParams>)==4*sizeof(double), "per-session state must stay 4 doubles");
+
+// FREE OPERATORS
+template <class PARAMS>
+std::ostream& operator<<(std::ostream& stream, const Timely<PARAMS>& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CREATORS
+template <class PARAMS>
+inline
+Timely<PARAMS>::Timely(unsigned sessionCount)
+: RawRate(k_maxNicBps/(sessionCount+1.0))
+, d_lineRateBps(k_maxNicBps/(sessionCount+1.0))
+, d_prevTimeUs(0)
+, d_prevRttUs(k_minRttUs)
+, d_weightedRttDiffUs(0)
+{
+}
+
+// ACCESSORS
+template <class PARAMS>
+inline
+double Timely<PARAMS>::rate() const {
+  return d_lineRateBps;
+}
+
+template <class PARAMS>
+inline
+double Timely<PARAMS>::rateAsGbps() const {
+  return d_lineRateBps * k_byteToGbits;
+}
+
+template <class PARAMS>
+inline
+double Timely<PARAMS>::rawRate() const {
+  static_assert(PARAMS::k_keepRawRate, "raw rate not kept; set 'k_keepRawRate'");
+  return RawRate::rawRateBps();
+}
+
+template <class PARAMS>
+inline
+double Timely<PARAMS>::rawRateAsGbps() const {
+  return rawRate() * k_byteToGbits;
+}
+
+// MANIPULATORS
+template <class PARAMS>
+inline
+double Timely<PARAMS>::update(double rttUs, double nowUs) {
+  EXPERIMENT_PROBE("timely.update");
+  assert(rttUs>0);
+  assert(nowUs>d_prevTimeUs);
+
+  // eRPC Timely "by-pass"
+  if constexpr (PARAMS::k_erpcBypass) {
+    if (d_lineRateBps==k_maxNicBps && rttUs<=k_minModelRttUs) {
+      // Do nothing
+      return d_lineRateBps;
+    }
+  }
+
+  // When 'rttUs' is too small, skip Timely update
+  if (rttUs<=k_minRttUs) {
+    return d_lineRateBps;
+  }
+
+  // Calculate difference in current and previous RTT
+  const double newRttDiff = rttUs - d_prevRttUs;
+
+  // Update weighted diff
+  d_weightedRttDiffUs = ((1-k_alpha)*d_weightedRttDiffUs) + (k_alpha*newRttDiff);
+
+  // eRPC other "factor" helpers. Delta is a unitless constant requring all
+  // subterms use the same units
+  double addIncreaseFactor = k_delta;
+  double multDecreaseFactor = k_beta;
+  if constexpr (PARAMS::k_deltaFactor) {
+    const double deltaFactor = std::min((nowUs-d_prevRttUs)/k_minRttUs, 1.0);
+    addIncreaseFactor = k_delta * deltaFactor;
+    multDecreaseFactor = k_beta * deltaFactor;
+  }
+
+  d_prevRttUs = rttUs;
+  d_prevTimeUs = nowUs;
+
+  double calculatedRate(0);
+
+  if (rttUs < k_minModelRttUs) {
+    calculatedRate = d_lineRateBps + addIncreaseFactor;
+  } else if (rttUs > k_maxModelRttUs) {
+    calculatedRate = d_lineRateBps * (1 - multDecreaseFactor*(1-k_maxModelRttUs/rttUs));
+  } else {
+    const double rttGradient = d_weightedRttDiffUs / k_minRttUs;
+    double weight(-1.0);
+    if (rttGradient <= -0.25) {
+      weight = 0.0;
+    } else if (rttGradient >= 0.25) {
+      weight = 1.0;
+    } else {
+      weight = 2*rttGradient + 0.5;
+    }
+    const double errorBaseUs = PARAMS::k_patchedError ? k_minModelRttUs : k_minRttUs;
+    const double error = (rttUs-errorBaseUs) / errorBaseUs;
+    calculatedRate = d_lineRateBps*(1.0-multDecreaseFactor*weight*error)+addIncreaseFactor*(1-weight);
+  }
+
+  // Store Timely value as calculated
+  RawRate::setRawRateBps(calculatedRate);
+
+  // Bound calculated rate with post-calc checks/balances
+  double boundedRate = calculatedRate;
+  if constexpr (PARAMS::k_halfRateFloor) {
+    boundedRate = std::max(calculatedRate, d_lineRateBps*0.5);
+  }
+  d_lineRateBps = std::min(k_maxRateBps, boundedRate);
+  d_lineRateBps = std::max(k_minRateBps, d_lineRateBps);
+
+  return d_lineRateBps;
+}
+
+template <class PARAMS>
+inline
+void Timely<PARAMS>::setRate(double rateBps) {
+  RawRate::setRawRateBps(rateBps);
+  d_lineRateBps = std::max(k_minRateBps, std::min(k_maxRateBps, rateBps));
+}
+
+// ASPECTS
+template <class PARAMS>
+inline
+std::ostream& Timely<PARAMS>::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    rateGbps (last estimated rate)       : " << rateAsGbps()            << std::endl;
+  stream << "    rateBps (last estimated rate)        : " << d_lineRateBps           << std::endl;
+  if constexpr (PARAMS::k_keepRawRate) {
+    stream << "    rawRateBps (last estimated raw rate) : " << rawRate()             << std::endl;
+  }
+  stream << "    prevTimeUs (last reported abs time)  : " << d_prevTimeUs            << std::endl;
+  stream << "    prevRttUs (last reported RTT)        : " << d_prevRttUs             << std::endl;
+  stream << "    alpha (EWMA smoothing factor)        : " << k_alpha                 << std::endl;
+  stream << "    beta (multiplicative decrease factor): " << k_beta                  << std::endl;
+  stream << "    delta (additive increase factor)     : " << k_delta                 << std::endl;
+  stream << "    minRttUs (RTTs <= ignored)           : " << k_minRttUs              << std::endl;
+  stream << "    minModelRttUs (min model RTT model)  : " << k_minModelRttUs         << std::endl;
+  stream << "    maxModelRttUs (max model RTT model)  : " << k_maxModelRttUs         << std::endl;
+  stream << "    NIC bandwidth (bytes/sec)            : " << k_maxNicBps             << std::endl;
+  stream << "    minimum computed rate (bytes/sec)    : " << k_minRateBps            << std::endl;
+  stream << "    maximum computed rate (bytes/sec)    : " << k_maxRateBps            << std::endl;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+template <class PARAMS>
+inline
+std::ostream& operator<<(std::ostream& stream, const Timely<PARAMS>& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
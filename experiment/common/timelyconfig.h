@@ -0,0 +1,331 @@
+#pragma once
+
+// Purpose: Runtime Timely parameter sets shared by all sessions and swapped atomically while traffic flows
+//
+// Classes:
+//   Experiment::TimelyConfig: One complete set of Timely constants and variant switches
+//   Experiment::TimelyConfigDomain: Publishes the current 'TimelyConfig' and reclaims replaced ones RCU-style
+//   Experiment::TimelyConfigReader: Registers one reader thread with a domain and reports its quiescent states
+//
+// Thread Safety: 'TimelyConfig' is a value type; not-thread-safe. 'TimelyConfigDomain::current' is thread-safe and
+// lock-free. 'publish', 'reclaim' and 'synchronize' may be called from any thread; they serialize on a mutex readers
+// never touch. A 'TimelyConfigReader' must only be used by the thread that created it.
+//
+// Exception Policy: No exceptions
+//
+// 'Timely<PARAMS>' fixes its constants at compile time which is ideal in production but means every experiment with
+// alpha/beta/delta or the model RTT limits needs a rebuild. Here all sessions share one 'TimelyConfig' through a
+// pointer held by a 'TimelyConfigDomain'. The update path reads that pointer with one acquire load and never locks.
+//
+// Replacing the config is quiescent-state based RCU. 'publish' stores a pointer to a new immutable copy, then bumps
+// the domain's epoch, and retires the old copy tagged with that epoch. Each reader thread promises not to hold a
+// 'const TimelyConfig*' across a call to 'TimelyConfigReader::quiescent'. That is natural at the top of a dispatch
+// loop iteration. 'quiescent' records the epoch the reader has seen. A retired config is freed once every registered
+// reader has seen its epoch, so no reader can still be using it. 'reclaim' frees what is safe without waiting.
+// 'synchronize' waits until everything retired so far can be freed.
+//
+// Usage:
+//   TimelyConfigDomain domain(TimelyConfig::fromParams<TimelyErpcParams>());
+//
+//   // Reader thread
+//   TimelyConfigReader reader(domain);
+//   while (running) {
+//     reader.quiescent();
+//     ... sessions call 'domain.current()' inside 'update' ...
+//   }
+//
+//   // Control thread
+//   TimelyConfig config = *domain.current();
+//   config.d_alpha = 0.3;
+//   domain.publish(config);
+//   domain.synchronize();
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Experiment {
+
+struct TimelyConfig {
+  // DATA
+  double d_alpha;                                   // EWMA smoothing factor
+  double d_beta;                                    // multiplicative decrease factor
+  double d_delta;                                   // additive rate increase bytes/second
+  double d_minRttUs;                                // RTT <= this not considered; state unchanged
+  double d_minModelRttUs;                           // minimum model RTT limit
+  double d_maxModelRttUs;                           // maximum model RTT limit
+  double d_maxNicBps;                               // Maximum NIC bandwidth (bytes-per-sec)
+  double d_minRateBps;                              // minimum transmit rate bytes/sec
+  double d_maxRateBps;                              // maximum transmit rate bytes/sec
+  bool   d_erpcBypass;                              // eRPC "by-pass" at line rate
+  bool   d_deltaFactor;                             // eRPC increase/decrease scaling
+  bool   d_halfRateFloor;                           // eRPC 0.5x decrease floor
+  bool   d_patchedError;                            // error normalized by min model RTT
+
+  // CLASS METHODS
+  template <class PARAMS>
+  static TimelyConfig fromParams();
+    // Return a config with the same values as the compile-time policy 'PARAMS' (see 'timely.h')
+
+  // ACCESSORS
+  bool isValid() const;
+    // Return true if this config satisfies the constraints 'Timely<PARAMS>' checks with 'static_assert'
+
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object returning 'stream'
+};
+
+class TimelyConfigReader;
+
+class TimelyConfigDomain {
+  // DATA
+  alignas(64) std::atomic<const TimelyConfig*> d_current;     // config readers see; never null
+  alignas(64) std::atomic<uint64_t> d_epoch;                  // incremented by each 'publish'
+  std::mutex d_lock;                                          // serializes writers and registration
+  std::vector<const TimelyConfigReader*> d_readers;           // registered readers
+  std::vector<std::pair<uint64_t, const TimelyConfig*>> d_retired; // replaced configs and the epoch they were retired
+
+  friend class TimelyConfigReader;
+
+  // PRIVATE MANIPULATORS
+  std::size_t reclaimLocked();
+    // Free retired configs every registered reader has moved past and return the number remaining. 'd_lock' held
+
+public:
+  // CREATORS
+  explicit TimelyConfigDomain(const TimelyConfig& initial);
+    // Create a domain whose current config is a copy of 'initial'. Behavior is defined provided 'initial.isValid()'
+
+  TimelyConfigDomain(const TimelyConfigDomain& other) = delete;
+    // Copy constructor not provided
+
+  ~TimelyConfigDomain();
+    // Destroy this object freeing all configs. Behavior is defined provided no readers remain registered
+
+  // ACCESSORS
+  const TimelyConfig *current() const;
+    // Return the current config. The pointer remains valid until the calling reader's next 'quiescent'
+
+  uint64_t epoch() const;
+    // Return the number of times 'publish' has been called
+
+  // MANIPULATORS
+  void publish(const TimelyConfig& config);
+    // Make a copy of 'config' the current config and retire the previous one. Readers see the new config on their
+    // next 'current'. Behavior is defined provided 'config.isValid()'
+
+  std::size_t reclaim();
+    // Free retired configs every registered reader has moved past without waiting. Return the number still retired
+
+  void synchronize();
+    // Wait until every registered reader has passed a quiescent state after the latest 'publish', then free all
+    // retired configs
+
+  TimelyConfigDomain& operator=(const TimelyConfigDomain& rhs) = delete;
+    // Assignment operator not provided
+};
+
+class TimelyConfigReader {
+  // DATA
+  TimelyConfigDomain&            d_domain;          // domain read
+  alignas(64) std::atomic<uint64_t> d_seenEpoch;    // latest domain epoch this reader observed at a quiescent state
+
+  friend class TimelyConfigDomain;
+
+public:
+  // CREATORS
+  explicit TimelyConfigReader(TimelyConfigDomain& domain);
+    // Register the calling thread as a reader of 'domain'
+
+  TimelyConfigReader(const TimelyConfigReader& other) = delete;
+    // Copy constructor not provided
+
+  ~TimelyConfigReader();
+    // Unregister from the domain. After this no 'const TimelyConfig*' obtained through this reader may be used
+
+  // MANIPULATORS
+  void quiescent();
+    // Declare that the calling thread holds no 'const TimelyConfig*' obtained before this call
+
+  TimelyConfigReader& operator=(const TimelyConfigReader& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const TimelyConfig& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+template <class PARAMS>
+inline
+TimelyConfig TimelyConfig::fromParams() {
+  TimelyConfig config;
+  config.d_alpha = PARAMS::k_alpha;
+  config.d_beta = PARAMS::k_beta;
+  config.d_delta = PARAMS::k_delta;
+  config.d_minRttUs = PARAMS::k_minRttUs;
+  config.d_minModelRttUs = PARAMS::k_minModelRttUs;
+  config.d_maxModelRttUs = PARAMS::k_maxModelRttUs;
+  config.d_maxNicBps = PARAMS::k_maxNicBps;
+  config.d_minRateBps = PARAMS::k_minRateBps;
+  config.d_maxRateBps = PARAMS::k_maxRateBps;
+  config.d_erpcBypass = PARAMS::k_erpcBypass;
+  config.d_deltaFactor = PARAMS::k_deltaFactor;
+  config.d_halfRateFloor = PARAMS::k_halfRateFloor;
+  config.d_patchedError = PARAMS::k_patchedError;
+  return config;
+}
+
+// ACCESSORS
+inline
+bool TimelyConfig::isValid() const {
+  return d_alpha>0.0 && d_alpha<=1.0 &&
+         d_beta>0.0 && d_beta<=1.0 &&
+         d_delta>=1000000.0 &&
+         d_minRateBps>0 &&
+         d_minRateBps<d_maxRateBps &&
+         d_maxRateBps<=d_maxNicBps &&
+         d_maxNicBps>=1000000.0 &&
+         d_minRttUs>=0 &&
+         d_minRttUs<d_minModelRttUs &&
+         d_minModelRttUs<d_maxModelRttUs;
+}
+
+inline
+std::ostream& TimelyConfig::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    alpha (EWMA smoothing factor)        : " << d_alpha                 << std::endl;
+  stream << "    beta (multiplicative decrease factor): " << d_beta                  << std::endl;
+  stream << "    delta (additive increase factor)     : " << d_delta                 << std::endl;
+  stream << "    minRttUs (RTTs <= ignored)           : " << d_minRttUs              << std::endl;
+  stream << "    minModelRttUs (min model RTT model)  : " << d_minModelRttUs         << std::endl;
+  stream << "    maxModelRttUs (max model RTT model)  : " << d_maxModelRttUs         << std::endl;
+  stream << "    NIC bandwidth (bytes/sec)            : " << d_maxNicBps             << std::endl;
+  stream << "    minimum computed rate (bytes/sec)    : " << d_minRateBps            << std::endl;
+  stream << "    maximum computed rate (bytes/sec)    : " << d_maxRateBps            << std::endl;
+  stream << "    erpcBypass/deltaFactor/halfRateFloor : " << d_erpcBypass << "/" << d_deltaFactor << "/"
+                                                           << d_halfRateFloor         << std::endl;
+  stream << "    patchedError                         : " << d_patchedError          << std::endl;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+// CREATORS
+inline
+TimelyConfigDomain::TimelyConfigDomain(const TimelyConfig& initial)
+: d_current(new TimelyConfig(initial))
+, d_epoch(0)
+{
+  assert(initial.isValid());
+}
+
+inline
+TimelyConfigDomain::~TimelyConfigDomain() {
+  assert(d_readers.empty());
+  for (auto& retired: d_retired) {
+    delete retired.second;
+  }
+  delete d_current.load();
+}
+
+// ACCESSORS
+inline
+const TimelyConfig *TimelyConfigDomain::current() const {
+  return d_current.load(std::memory_order_acquire);
+}
+
+inline
+uint64_t TimelyConfigDomain::epoch() const {
+  return d_epoch.load(std::memory_order_acquire);
+}
+
+// PRIVATE MANIPULATORS
+inline
+std::size_t TimelyConfigDomain::reclaimLocked() {
+  uint64_t oldest = std::numeric_limits<uint64_t>::max();
+  for (const TimelyConfigReader *reader: d_readers) {
+    oldest = std::min(oldest, reader->d_seenEpoch.load(std::memory_order_acquire));
+  }
+
+  std::size_t kept = 0;
+  for (std::size_t i=0; i<d_retired.size(); ++i) {
+    if (d_retired[i].first<=oldest) {
+      delete d_retired[i].second;
+    } else {
+      d_retired[kept++] = d_retired[i];
+    }
+  }
+  d_retired.resize(kept);
+  return kept;
+}
+
+// MANIPULATORS
+inline
+void TimelyConfigDomain::publish(const TimelyConfig& config) {
+  assert(config.isValid());
+  const TimelyConfig *fresh = new TimelyConfig(config);
+
+  std::lock_guard<std::mutex> guard(d_lock);
+  const TimelyConfig *previous = d_current.exchange(fresh, std::memory_order_seq_cst);
+  const uint64_t epoch = d_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+  d_retired.push_back(std::make_pair(epoch, previous));
+  reclaimLocked();
+}
+
+inline
+std::size_t TimelyConfigDomain::reclaim() {
+  std::lock_guard<std::mutex> guard(d_lock);
+  return reclaimLocked();
+}
+
+inline
+void TimelyConfigDomain::synchronize() {
+  while (reclaim()!=0) {
+    std::this_thread::yield();
+  }
+}
+
+// CREATORS
+inline
+TimelyConfigReader::TimelyConfigReader(TimelyConfigDomain& domain)
+: d_domain(domain)
+, d_seenEpoch(0)
+{
+  std::lock_guard<std::mutex> guard(d_domain.d_lock);
+  d_seenEpoch.store(d_domain.epoch(), std::memory_order_seq_cst);
+  d_domain.d_readers.push_back(this);
+}
+
+inline
+TimelyConfigReader::~TimelyConfigReader() {
+  std::lock_guard<std::mutex> guard(d_domain.d_lock);
+  for (std::size_t i=0; i<d_domain.d_readers.size(); ++i) {
+    if (d_domain.d_readers[i]==this) {
+      d_domain.d_readers[i] = d_domain.d_readers.back();
+      d_domain.d_readers.pop_back();
+      break;
+    }
+  }
+}
+
+// MANIPULATORS
+inline
+void TimelyConfigReader::quiescent() {
+  d_seenEpoch.store(d_domain.d_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const TimelyConfig& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
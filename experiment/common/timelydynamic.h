@@ -0,0 +1,211 @@
+#pragma once
+
+// Purpose: Timely whose constants and variant switches are read at run time from a shared 'TimelyConfigDomain'
+//
+// Classes:
+//   Experiment::TimelyDynamic: Implements Timely exactly like 'Timely<PARAMS>' with a runtime 'TimelyConfig'
+//
+// Thread Safety: not-thread-safe. Many 'TimelyDynamic' objects on many threads may share one domain provided each
+// thread is registered with a 'TimelyConfigReader' (see 'timelyconfig.h').
+//
+// Exception Policy: No exceptions
+//
+// Each object holds a pointer to the domain plus the same 4 doubles of state as 'Timely<PARAMS>'. 'update' loads the
+// current config once and reads every constant from it, so a 'publish' takes effect on the next 'update' of every
+// session without touching the sessions. The cost compared with 'Timely<PARAMS>' is one acquire load (a plain load on
+// x86), loads of the constants instead of immediates, and tests of the switches instead of compiled out branches.
+// Given equal constants the result is bit for bit that of 'Timely<PARAMS>'. The raw rate is always kept.
+
+#include <timelyconfig.h>
+#include <probemacro.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <iostream>
+
+namespace Experiment {
+
+class TimelyDynamic {
+  // DATA
+  const TimelyConfigDomain     *d_domain_p;         // shared config
+  double                        d_lineRateBps;      // calculated TX rate (bytes-per-second)
+  double                        d_rawLineRateBps;   // calculated TX rate (bytes-per-second) before bounding
+  double                        d_prevTimeUs;       // absolute time in microseconds 'update' was last called
+  double                        d_prevRttUs;        // last RTT provided in 'update'
+  double                        d_weightedRttDiffUs;// weighted RTT difference
+
+public:
+  // CONSTANTS
+  static constexpr double k_byteToGbits = 8.0/(1000*1000*1000); // factor to convert from bytes to Gbits (Giga bits)
+
+  // CREATORS
+  explicit TimelyDynamic(const TimelyConfigDomain *domain, unsigned sessionCount = 0);
+    // Create a Timely object reading its constants from 'domain' where 'sessionCount' is the number of existing
+    // sessions (not including the new session co-managed by this object) already running. Upon creation the rate is
+    // 'd_maxNicBps/(sessionCount+1)' of the domain's current config. Behavior is defined provided 'domain' outlives
+    // this object
+
+  TimelyDynamic(const TimelyDynamic& other) = delete;
+    // Copy constructor not provided
+
+  ~TimelyDynamic() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  double rate() const;
+    // Return the last estimated TX rate in bytes/sec
+
+  double rateAsGbps() const;
+    // Exactly like 'rate' but expressed as Gbps (Giga bits per second)
+
+  double rawRate() const;
+    // Return the last estimated TX rate in bytes/sec before it was bounded by '[d_minRateBps, d_maxRateBps]'
+
+  double rawRateAsGbps() const;
+    // Exactly like 'rawRate' but expressed as Gbps (Giga bits per second)
+
+  // MANIPULATORS
+  double update(double rttUs, double nowUs);
+    // Return the new, estimated transmission rate in bytes/sec based on the specified 'rttUs' and absolute time
+    // 'nowUs' (units microseconds) using the domain's current config. Semantics are those of 'Timely<PARAMS>::update'
+    // with 'PARAMS' replaced by the config. Behavior is defined provided 'rttUs>0' and 'nowUs>d_prevTimeUs'
+
+  TimelyDynamic& operator=(const TimelyDynamic& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const TimelyDynamic& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+TimelyDynamic::TimelyDynamic(const TimelyConfigDomain *domain, unsigned sessionCount)
+: d_domain_p(domain)
+, d_lineRateBps(domain->current()->d_maxNicBps/(sessionCount+1.0))
+, d_rawLineRateBps(d_lineRateBps)
+, d_prevTimeUs(0)
+, d_prevRttUs(domain->current()->d_minRttUs)
+, d_weightedRttDiffUs(0)
+{
+}
+
+// ACCESSORS
+inline
+double TimelyDynamic::rate() const {
+  return d_lineRateBps;
+}
+
+inline
+double TimelyDynamic::rateAsGbps() const {
+  return d_lineRateBps * k_byteToGbits;
+}
+
+inline
+double TimelyDynamic::rawRate() const {
+  return d_rawLineRateBps;
+}
+
+inline
+double TimelyDynamic::rawRateAsGbps() const {
+  return d_rawLineRateBps * k_byteToGbits;
+}
+
+// MANIPULATORS
+inline
+double TimelyDynamic::update(double rttUs, double nowUs) {
+  EXPERIMENT_PROBE("timely.dynamic.update");
+  assert(rttUs>0);
+  assert(nowUs>d_prevTimeUs);
+
+  const TimelyConfig& config = *d_domain_p->current();
+
+  // eRPC Timely "by-pass"
+  if (config.d_erpcBypass && d_lineRateBps==config.d_maxNicBps && rttUs<=config.d_minModelRttUs) {
+    // Do nothing
+    return d_lineRateBps;
+  }
+
+  // When 'rttUs' is too small, skip Timely update
+  if (rttUs<=config.d_minRttUs) {
+    return d_lineRateBps;
+  }
+
+  // Calculate difference in current and previous RTT
+  const double newRttDiff = rttUs - d_prevRttUs;
+
+  // Update weighted diff
+  d_weightedRttDiffUs = ((1-config.d_alpha)*d_weightedRttDiffUs) + (config.d_alpha*newRttDiff);
+
+  // eRPC other "factor" helpers
+  double addIncreaseFactor = config.d_delta;
+  double multDecreaseFactor = config.d_beta;
+  if (config.d_deltaFactor) {
+    const double deltaFactor = std::min((nowUs-d_prevRttUs)/config.d_minRttUs, 1.0);
+    addIncreaseFactor = config.d_delta * deltaFactor;
+    multDecreaseFactor = config.d_beta * deltaFactor;
+  }
+
+  d_prevRttUs = rttUs;
+  d_prevTimeUs = nowUs;
+
+  double calculatedRate(0);
+
+  if (rttUs < config.d_minModelRttUs) {
+    calculatedRate = d_lineRateBps + addIncreaseFactor;
+  } else if (rttUs > config.d_maxModelRttUs) {
+    calculatedRate = d_lineRateBps * (1 - multDecreaseFactor*(1-config.d_maxModelRttUs/rttUs));
+  } else {
+    const double rttGradient = d_weightedRttDiffUs / config.d_minRttUs;
+    double weight(-1.0);
+    if (rttGradient <= -0.25) {
+      weight = 0.0;
+    } else if (rttGradient >= 0.25) {
+      weight = 1.0;
+    } else {
+      weight = 2*rttGradient + 0.5;
+    }
+    const double errorBaseUs = config.d_patchedError ? config.d_minModelRttUs : config.d_minRttUs;
+    const double error = (rttUs-errorBaseUs) / errorBaseUs;
+    calculatedRate = d_lineRateBps*(1.0-multDecreaseFactor*weight*error)+addIncreaseFactor*(1-weight);
+  }
+
+  // Store Timely value as calculated
+  d_rawLineRateBps = calculatedRate;
+
+  // Bound calculated rate with post-calc checks/balances
+  double boundedRate = calculatedRate;
+  if (config.d_halfRateFloor) {
+    boundedRate = std::max(calculatedRate, d_lineRateBps*0.5);
+  }
+  d_lineRateBps = std::min(config.d_maxRateBps, boundedRate);
+  d_lineRateBps = std::max(config.d_minRateBps, d_lineRateBps);
+
+  return d_lineRateBps;
+}
+
+// ASPECTS
+inline
+std::ostream& TimelyDynamic::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    rateGbps (last estimated rate)       : " << rateAsGbps()            << std::endl;
+  stream << "    rateBps (last estimated rate)        : " << d_lineRateBps           << std::endl;
+  stream << "    rawRateBps (last estimated raw rate) : " << d_rawLineRateBps        << std::endl;
+  stream << "    prevTimeUs (last reported abs time)  : " << d_prevTimeUs            << std::endl;
+  stream << "    prevRttUs (last reported RTT)        : " << d_prevRttUs             << std::endl;
+  stream << "    config                               : " << *d_domain_p->current();
+  stream << "]" << std::endl;
+  return stream;
+}
+
+inline
+std::ostream& operator<<(std::ostream& stream, const TimelyDynamic& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
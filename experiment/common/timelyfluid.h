@@ -0,0 +1,415 @@
+#pragma once
+
+// Purpose: Fluid model of Timely flows sharing one bottleneck with delayed feedback, for many parameter sets at once
+//
+// Classes:
+//   Experiment::TimelyFluidConfig: The bottleneck, the flows and the integration step shared by every parameter set
+//   Experiment::TimelyFluidResult: What one parameter set did over the end of the run, and its stability flags
+//   Experiment::TimelyFluidModel: Integrates the model for an array of 'TimelyConfig', one vector of lanes at a time
+//
+// Thread Safety: not-thread-safe. Use one model per thread.
+//
+// Exception Policy: No exceptions
+//
+// 'BottleneckSim' handles every packet and every ACK. To find which (alpha, beta, delta, minModelRtt, maxModelRtt)
+// are stable, that is far more detail than needed. Following the fluid model in [1] section 4, the flows are split
+// into two groups of equal size. Each group has a rate 'R' and a smoothed RTT difference 'g' (the
+// 'd_weightedRttDiffUs' of 'Timely'), and the switch has a queue 'q'. With link rate 'C' and propagation RTT 'T':
+//
+//   dq/dt = nA*RA + nB*RB - C                            clamped to [0, buffer]
+//   rtt   = T + q(t-d)/C                                 d = T + q(t)/C, the feedback delay
+//   prev  = T + q(t-d-u)/C                               u = max(segment/R, minRtt), the time between updates
+//   dg/dt = alpha*(rtt-prev-g)/u
+//   dR/dt = Timely's rate change for 'rtt' and 'g'/u     as in 'Timely::update', without the eRPC switches
+//
+// A group starting lower than the other tells whether Timely evens them out. [1] shows it need not: Timely has no
+// unique fixed point. A flow that sees 'rtt<=minRtt' does not update, exactly like 'Timely::update'. The delayed
+// queue is read from a ring of past queue values, one per step, and the lookback 'u' is capped at the longest
+// feedback delay.
+//
+// The model runs 'TimelySimd*::k_width' parameter sets together, one per lane, and every step is branch-free vector
+// code written once over the 'timelysimd.h' wrappers. Each lane reads its delayed queue with a gather. With
+// 'TimelySimdScalar' the same code is the scalar reference: compiled with '-ffp-contract=off' it gives the same bits
+// as the vector kernels. Over the last 'd_tailFraction' of the run the model records the queue and the offered rate,
+// and sets the 'TimelyFluidResult::Flag' bits from them.
+//
+// [1] shows Timely settles into a limit cycle rather than a fixed point, so nearly every parameter set keeps some
+// swing. 'e_OSCILLATING' therefore marks only a swing that is large and sustained: over the second half of the tail
+// the queue still swings by more than the band of the buffer, and by at least 1 minus the band of its swing over the
+// first half. A swing that is small next to the buffer, or dying out, is not flagged.
+//
+// [1] http://yibozhu.com/doc/ecndelay-conext16.pdf
+
+#include <timelyconfig.h>
+#include <timelysimd.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace Experiment {
+
+struct TimelyFluidConfig {
+  // DATA
+  double                        d_linkBps = 1.25e9;         // bottleneck bytes/sec (10Gbps)
+  double                        d_bufferBytes = 1u<<20;     // switch buffer; the queue never exceeds it
+  double                        d_baseRttUs = 10;           // propagation RTT
+  double                        d_segmentBytes = 4096;      // bytes acknowledged per rate update
+  unsigned                      d_flows = 10;               // flows; group A has half, rounded down
+  double                        d_startRatio = 4;           // A starts at maxNic/flows and B at that over this
+  double                        d_stepUs = 1;               // integration step
+  double                        d_durationUs = 20000;       // time integrated
+  double                        d_tailFraction = 0.25;      // end of the run the results are taken over
+  double                        d_band = 0.1;               // relative tolerance of every flag
+};
+
+struct TimelyFluidResult {
+  // TYPES
+  enum Flag {
+    e_OSCILLATING = 1,                              // queue swing is over the band of the buffer and not decaying
+    e_OVERFLOW = 2,                                 // queue reached the buffer: packets would drop
+    e_UNFAIR = 4,                                   // one group's mean rate is below the other's by more than the band
+    e_IDLE = 8,                                     // utilization below 1 minus the band
+  };
+
+  // DATA
+  double                        d_queueMeanBytes;   // time-averaged queue
+  double                        d_queueSwingBytes;  // most minus least queued
+  double                        d_queueDecay;       // swing over the tail's second half over that of its first half
+  double                        d_rateMeanBps;      // time-averaged rate offered by all flows
+  double                        d_rateSwingBps;     // most minus least offered
+  double                        d_utilization;      // bytes sent over what the link could send
+  double                        d_fairness;         // lower group mean rate over the higher one
+  double                        d_overflowUs;       // time the queue was at the buffer
+  double                        d_dropBytes;        // bytes offered to a full buffer
+  unsigned                      d_flags;            // 'Flag' bits; 0 is stable
+};
+
+class TimelyFluidModel {
+public:
+  // CONSTANTS
+  enum { k_maxWidth = 8 };                          // most lanes of any 'timelysimd.h' wrapper
+
+private:
+  // DATA
+  TimelyFluidConfig             d_config;           // shared by every parameter set
+  unsigned                      d_maxDelaySteps;    // longest feedback delay or lookback in steps
+  unsigned                      d_historySlots;     // queue values kept per lane, a power of 2
+  std::vector<double>           d_history;          // ring of queue values, one row of lanes per step
+
+  // PRIVATE MANIPULATORS
+  template <class SIMD>
+  void evaluateBlock(const TimelyConfig *points, std::size_t count, TimelyFluidResult *results);
+    // Integrate the model for 'count<=SIMD::k_width' parameter sets starting at 'points' into 'results'
+
+public:
+  // CREATORS
+  explicit TimelyFluidModel(const TimelyFluidConfig& config = TimelyFluidConfig());
+    // Create a model of 'config'. Behavior is defined provided 'config.d_flows>=2', 'config.d_stepUs>0', and the
+    // rates, buffer, delays and duration are positive
+
+  TimelyFluidModel(const TimelyFluidModel& other) = delete;
+    // Copy constructor not provided
+
+  ~TimelyFluidModel() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  const TimelyFluidConfig& config() const;
+    // Return the configuration
+
+  unsigned historySlots() const;
+    // Return the queue values kept per lane
+
+  // MANIPULATORS
+  void evaluate(const TimelyConfig *points, std::size_t count, TimelyFluidResult *results);
+    // Integrate the model for each of the 'count' parameter sets starting at 'points' and write its result to the
+    // same index of 'results', with the widest vector kernel the target supports. Only 'd_alpha', 'd_beta',
+    // 'd_delta', 'd_minRttUs', 'd_minModelRttUs', 'd_maxModelRttUs', 'd_maxNicBps', 'd_minRateBps', 'd_maxRateBps' and
+    // 'd_patchedError' are used. Behavior is defined provided every point 'isValid()'
+
+  template <class SIMD>
+  void evaluate(const TimelyConfig *points, std::size_t count, TimelyFluidResult *results);
+    // Exactly like 'evaluate' above but with the kernel for 'SIMD' (see 'timelysimd.h'). 'TimelySimdScalar' is the
+    // reference the vector kernels must match bit for bit
+
+  TimelyFluidModel& operator=(const TimelyFluidModel& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+TimelyFluidModel::TimelyFluidModel(const TimelyFluidConfig& config)
+: d_config(config)
+, d_maxDelaySteps(0)
+, d_historySlots(1)
+{
+  assert(config.d_flows>=2);
+  assert(config.d_stepUs>0);
+  assert(config.d_linkBps>0 && config.d_bufferBytes>0 && config.d_baseRttUs>0 && config.d_durationUs>0);
+
+  // The feedback delay is at most the RTT with a full buffer. The read with the lookback 'u' behind it must still be
+  // in the ring, so keep twice that
+  const double maxRttUs = config.d_baseRttUs+config.d_bufferBytes/config.d_linkBps*1e6;
+  d_maxDelaySteps = static_cast<unsigned>(std::ceil(maxRttUs/config.d_stepUs))+1;
+  while (d_historySlots<2*d_maxDelaySteps+2) {
+    d_historySlots *= 2;
+  }
+  d_history.resize(static_cast<std::size_t>(d_historySlots)*k_maxWidth);
+}
+
+// ACCESSORS
+inline
+const TimelyFluidConfig& TimelyFluidModel::config() const {
+  return d_config;
+}
+
+inline
+unsigned TimelyFluidModel::historySlots() const {
+  return d_historySlots;
+}
+
+// MANIPULATORS
+inline
+void TimelyFluidModel::evaluate(const TimelyConfig *points, std::size_t count, TimelyFluidResult *results) {
+#if defined(EXPERIMENT_TIMELY_SIMD_AVX512)
+  this->template evaluate<TimelySimdAvx512>(points, count, results);
+#elif defined(EXPERIMENT_TIMELY_SIMD_AVX2)
+  this->template evaluate<TimelySimdAvx2>(points, count, results);
+#else
+  this->template evaluate<TimelySimdScalar>(points, count, results);
+#endif
+}
+
+template <class SIMD>
+inline
+void TimelyFluidModel::evaluate(const TimelyConfig *points, std::size_t count, TimelyFluidResult *results) {
+  static_assert(static_cast<int>(SIMD::k_width)<=static_cast<int>(k_maxWidth),
+    "history rows are too narrow for this wrapper");
+  for (std::size_t i=0; i<count; i+=SIMD::k_width) {
+    evaluateBlock<SIMD>(points+i, std::min<std::size_t>(SIMD::k_width, count-i), results+i);
+  }
+}
+
+template <class SIMD>
+inline
+void TimelyFluidModel::evaluateBlock(const TimelyConfig *points, std::size_t count, TimelyFluidResult *results) {
+  typedef typename SIMD::Vec Vec;
+  typedef typename SIMD::Mask Mask;
+  enum { W = SIMD::k_width };
+
+  // Per lane constants. Lanes past 'count' repeat the last point and are not reported
+  alignas(64) double alpha[W], beta[W], delta[W], minRtt[W], minModel[W], maxModel[W], errorBase[W], minRate[W];
+  alignas(64) double maxRate[W], startA[W], startB[W];
+  const double flowsA = d_config.d_flows/2;
+  const double flowsB = d_config.d_flows-flowsA;
+  for (unsigned lane=0; lane<W; ++lane) {
+    const TimelyConfig& point = points[std::min<std::size_t>(lane, count-1)];
+    alpha[lane] = point.d_alpha;
+    beta[lane] = point.d_beta;
+    delta[lane] = point.d_delta;
+    minRtt[lane] = point.d_minRttUs;
+    minModel[lane] = point.d_minModelRttUs;
+    maxModel[lane] = point.d_maxModelRttUs;
+    errorBase[lane] = point.d_patchedError ? point.d_minModelRttUs : point.d_minRttUs;
+    minRate[lane] = point.d_minRateBps;
+    maxRate[lane] = point.d_maxRateBps;
+    startA[lane] = std::min(point.d_maxRateBps, point.d_maxNicBps/d_config.d_flows);
+    startB[lane] = std::max(point.d_minRateBps, startA[lane]/d_config.d_startRatio);
+  }
+  const Vec vAlpha = SIMD::load(alpha);
+  const Vec vBeta = SIMD::load(beta);
+  const Vec vDelta = SIMD::load(delta);
+  const Vec vMinRtt = SIMD::load(minRtt);
+  const Vec vMinModel = SIMD::load(minModel);
+  const Vec vMaxModel = SIMD::load(maxModel);
+  const Vec vErrorBase = SIMD::load(errorBase);
+  const Vec vMinRate = SIMD::load(minRate);
+  const Vec vMaxRate = SIMD::load(maxRate);
+
+  const Vec zero = SIMD::set1(0);
+  const Vec one = SIMD::set1(1);
+  const Vec half = SIMD::set1(0.5);
+  const Vec two = SIMD::set1(2);
+  const Vec step = SIMD::set1(d_config.d_stepUs);
+  const Vec perStep = SIMD::set1(1/d_config.d_stepUs);
+  const Vec baseRtt = SIMD::set1(d_config.d_baseRttUs);
+  const Vec usPerByte = SIMD::set1(1e6/d_config.d_linkBps);
+  const Vec segmentUs = SIMD::set1(d_config.d_segmentBytes*1e6);
+  const Vec link = SIMD::set1(d_config.d_linkBps);
+  const Vec buffer = SIMD::set1(d_config.d_bufferBytes);
+  const Vec secondsPerStep = SIMD::set1(d_config.d_stepUs*1e-6);
+  const Vec maxDelay = SIMD::set1(d_maxDelaySteps);
+  const Vec slots = SIMD::set1(d_historySlots);
+  const Vec width = SIMD::set1(W);
+  const Vec lanes = SIMD::iota();
+  const Vec groupA = SIMD::set1(flowsA);
+  const Vec groupB = SIMD::set1(flowsB);
+
+  double *history = d_history.data();
+  std::fill(history, history+static_cast<std::size_t>(d_historySlots)*W, 0.0);
+
+  // Return the slot 'back' steps before 'slot'
+  auto behind = [&](Vec slot, Vec back) {
+    const Vec index = SIMD::sub(slot, back);
+    return SIMD::blend(SIMD::lt(index, zero), index, SIMD::add(index, slots));
+  };
+
+  // Return each lane's queue in 'slot'
+  auto queueAt = [&](Vec slot) {
+    return SIMD::gather(history, SIMD::add(SIMD::mul(slot, width), lanes));
+  };
+
+  // Return 'us' rounded to whole steps, at most 'maxDelay'
+  auto steps = [&](Vec us) {
+    return SIMD::min(SIMD::truncate(SIMD::add(SIMD::mul(us, perStep), half)), maxDelay);
+  };
+
+  // Advance one group's smoothed RTT difference and rate by one step
+  auto advance = [&](Vec rtt, Vec from, Mask active, Vec *grad, Vec *rate) {
+    const Vec interval = SIMD::max(SIMD::div(segmentUs, *rate), vMinRtt);
+    const Vec prevRtt = SIMD::add(baseRtt, SIMD::mul(queueAt(behind(from, steps(interval))), usPerByte));
+    const Vec fraction = SIMD::min(SIMD::div(step, interval), one);
+
+    const Vec diff = SIMD::sub(SIMD::sub(rtt, prevRtt), *grad);
+    *grad = SIMD::blend(active, *grad, SIMD::add(*grad, SIMD::mul(fraction, SIMD::mul(vAlpha, diff))));
+
+    const Vec gradient = SIMD::div(*grad, vMinRtt);
+    const Vec weight = SIMD::min(SIMD::max(SIMD::add(SIMD::mul(two, gradient), half), zero), one);
+    const Vec error = SIMD::div(SIMD::sub(rtt, vErrorBase), vErrorBase);
+    const Vec increase = SIMD::mul(vDelta, SIMD::sub(one, weight));
+    const Vec decrease = SIMD::mul(SIMD::mul(vBeta, SIMD::mul(weight, error)), *rate);
+    Vec change = SIMD::sub(increase, decrease);
+    const Vec above = SIMD::mul(SIMD::mul(vBeta, SIMD::sub(one, SIMD::div(vMaxModel, rtt))), *rate);
+    change = SIMD::blend(SIMD::lt(vMaxModel, rtt), change, SIMD::sub(zero, above));
+    change = SIMD::blend(SIMD::lt(rtt, vMinModel), change, vDelta);
+
+    const Vec next = SIMD::max(SIMD::min(SIMD::add(*rate, SIMD::mul(fraction, change)), vMaxRate), vMinRate);
+    *rate = SIMD::blend(active, *rate, next);
+  };
+
+  Vec queue = zero;
+  Vec rateA = SIMD::load(startA);
+  Vec rateB = SIMD::load(startB);
+  Vec gradA = zero;
+  Vec gradB = zero;
+
+  const Vec inf = SIMD::set1(std::numeric_limits<double>::infinity());
+  Vec queueSum = zero;
+  Vec queueMin = inf;
+  Vec queueMax = zero;
+  Vec rateSum = zero;
+  Vec rateMin = inf;
+  Vec rateMax = zero;
+  Vec sumA = zero;
+  Vec sumB = zero;
+  Vec sent = zero;
+  Vec overflow = zero;
+  Vec dropped = zero;
+  Vec firstMin = inf;
+  Vec firstMax = zero;
+  Vec secondMin = inf;
+  Vec secondMax = zero;
+
+  const uint64_t total = static_cast<uint64_t>(d_config.d_durationUs/d_config.d_stepUs);
+  const uint64_t tailStart = total-static_cast<uint64_t>(total*d_config.d_tailFraction);
+  const uint64_t tailMiddle = tailStart+(total-tailStart)/2;
+  const uint64_t slotMask = d_historySlots-1;
+  for (uint64_t k=0; k<total; ++k) {
+    const uint64_t slotIndex = k & slotMask;
+    SIMD::store(history+slotIndex*W, queue);
+
+    // The RTT a sender learns now is the one a packet saw a feedback delay ago
+    const Vec slot = SIMD::set1(static_cast<double>(slotIndex));
+    const Vec feedback = SIMD::add(baseRtt, SIMD::mul(queue, usPerByte));
+    const Vec from = behind(slot, steps(feedback));
+    const Vec rtt = SIMD::add(baseRtt, SIMD::mul(queueAt(from), usPerByte));
+    const Mask active = SIMD::lt(vMinRtt, rtt);
+    advance(rtt, from, active, &gradA, &rateA);
+    advance(rtt, from, active, &gradB, &rateB);
+
+    const Vec offered = SIMD::add(SIMD::mul(groupA, rateA), SIMD::mul(groupB, rateB));
+    const Vec filled = SIMD::add(queue, SIMD::mul(SIMD::sub(offered, link), secondsPerStep));
+    const Mask full = SIMD::lt(buffer, filled);
+    queue = SIMD::min(SIMD::max(filled, zero), buffer);
+
+    if (k>=tailStart) {
+      queueSum = SIMD::add(queueSum, queue);
+      queueMin = SIMD::min(queueMin, queue);
+      queueMax = SIMD::max(queueMax, queue);
+      rateSum = SIMD::add(rateSum, offered);
+      rateMin = SIMD::min(rateMin, offered);
+      rateMax = SIMD::max(rateMax, offered);
+      sumA = SIMD::add(sumA, rateA);
+      sumB = SIMD::add(sumB, rateB);
+      sent = SIMD::add(sent, SIMD::blend(SIMD::lt(zero, queue), SIMD::min(offered, link), link));
+      overflow = SIMD::add(overflow, SIMD::blend(full, zero, step));
+      dropped = SIMD::add(dropped, SIMD::blend(full, zero, SIMD::sub(filled, buffer)));
+      if (k<tailMiddle) {
+        firstMin = SIMD::min(firstMin, queue);
+        firstMax = SIMD::max(firstMax, queue);
+      } else {
+        secondMin = SIMD::min(secondMin, queue);
+        secondMax = SIMD::max(secondMax, queue);
+      }
+    }
+  }
+
+  alignas(64) double qSum[W], qMin[W], qMax[W], rSum[W], rMin[W], rMax[W], aSum[W], bSum[W], sentSum[W], over[W];
+  alignas(64) double drop[W], fMin[W], fMax[W], sMin[W], sMax[W];
+  SIMD::store(qSum, queueSum);
+  SIMD::store(qMin, queueMin);
+  SIMD::store(qMax, queueMax);
+  SIMD::store(rSum, rateSum);
+  SIMD::store(rMin, rateMin);
+  SIMD::store(rMax, rateMax);
+  SIMD::store(aSum, sumA);
+  SIMD::store(bSum, sumB);
+  SIMD::store(sentSum, sent);
+  SIMD::store(over, overflow);
+  SIMD::store(drop, dropped);
+  SIMD::store(fMin, firstMin);
+  SIMD::store(fMax, firstMax);
+  SIMD::store(sMin, secondMin);
+  SIMD::store(sMax, secondMax);
+
+  const double samples = static_cast<double>(total-tailStart);
+  const double band = d_config.d_band;
+  for (std::size_t lane=0; lane<count; ++lane) {
+    TimelyFluidResult& result = results[lane];
+    result.d_queueMeanBytes = qSum[lane]/samples;
+    result.d_queueSwingBytes = qMax[lane]-qMin[lane];
+    result.d_rateMeanBps = rSum[lane]/samples;
+    result.d_rateSwingBps = rMax[lane]-rMin[lane];
+    result.d_utilization = sentSum[lane]/samples/d_config.d_linkBps;
+    result.d_fairness = std::min(aSum[lane], bSum[lane])/std::max(aSum[lane], bSum[lane]);
+    result.d_overflowUs = over[lane];
+    result.d_dropBytes = drop[lane];
+
+    // A queue that did not move in the first half has decay 0 if it still does not, and infinite decay if it started
+    const double firstSwing = fMax[lane]-fMin[lane];
+    const double secondSwing = sMax[lane]-sMin[lane];
+    result.d_queueDecay = firstSwing>0 ? secondSwing/firstSwing :
+      (secondSwing>0 ? std::numeric_limits<double>::infinity() : 0.0);
+
+    result.d_flags = 0;
+    if (secondSwing>band*d_config.d_bufferBytes && result.d_queueDecay>=1-band) {
+      result.d_flags |= TimelyFluidResult::e_OSCILLATING;
+    }
+    if (result.d_overflowUs>0) {
+      result.d_flags |= TimelyFluidResult::e_OVERFLOW;
+    }
+    if (!(result.d_fairness>=1-band)) {
+      result.d_flags |= TimelyFluidResult::e_UNFAIR;
+    }
+    if (result.d_utilization<1-band) {
+      result.d_flags |= TimelyFluidResult::e_IDLE;
+    }
+  }
+}
+
+} // namespace Experiment
@@ -0,0 +1,183 @@
+#pragma once
+
+// Purpose: Thin wrappers over AVX-512 and AVX2 double precision intrinsics used by the vectorized Timely kernels
+//
+// Classes:
+//   Experiment::TimelySimdAvx512: 8 lanes per vector; masks are '__mmask8'
+//   Experiment::TimelySimdAvx2: 4 lanes per vector; masks are all-ones/all-zeros lanes of '__m256d'
+//   Experiment::TimelySimdScalar: 1 lane; vectors are 'double' and masks are 'bool'
+//
+// Thread Safety: thread-safe. All members are static functions without state.
+//
+// Exception Policy: No exceptions
+//
+// 'TimelyBank::updateSimd' is written once as a template over one of these types. Each type exposes the same static
+// functions so the kernel reads like the scalar code. Comparisons are ordered and quiet which matches the C++ scalar
+// operators '<', '<=', '==' on the non-NaN inputs Timely sees. 'blend(m, a, b)' returns 'b' in lanes where 'm' is set
+// and 'a' elsewhere; it is used for the regime selection and to mirror 'std::min' and 'std::max' exactly. 'min(a, b)'
+// and 'max(a, b)' are the instructions' own 'a<b ? a : b' and 'a>b ? a : b'. Which type is available depends on the
+// target ISA. '-march=native' on an AVX-512 host defines '__AVX512F__'. 'TimelySimdScalar' is always available. A
+// kernel run with it gives, lane for lane, the same bits as with the vector types, so it is the reference.
+
+#include <cmath>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace Experiment {
+
+#if defined(__AVX512F__) && defined(__AVX512CD__) && defined(__AVX512VL__)
+#define EXPERIMENT_TIMELY_SIMD_AVX512 1
+struct TimelySimdAvx512 {
+  // TYPES
+  typedef __m512d Vec;
+  typedef __mmask8 Mask;
+
+  // CONSTANTS
+  enum { k_width = 8 };
+
+  // CLASS METHODS
+  static Vec set1(double v)                    { return _mm512_set1_pd(v); }
+  static Vec load(const double *p)             { return _mm512_loadu_pd(p); }
+  static void store(double *p, Vec v)          { _mm512_storeu_pd(p, v); }
+  static Vec add(Vec a, Vec b)                 { return _mm512_add_pd(a, b); }
+  static Vec sub(Vec a, Vec b)                 { return _mm512_sub_pd(a, b); }
+  static Vec mul(Vec a, Vec b)                 { return _mm512_mul_pd(a, b); }
+  static Vec div(Vec a, Vec b)                 { return _mm512_div_pd(a, b); }
+  static Mask lt(Vec a, Vec b)                 { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+  static Mask le(Vec a, Vec b)                 { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+  static Mask eq(Vec a, Vec b)                 { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+  static Mask andMask(Mask a, Mask b)          { return a & b; }
+  static Mask orMask(Mask a, Mask b)           { return a | b; }
+  static Mask notMask(Mask a)                  { return static_cast<Mask>(~a); }
+  static unsigned bits(Mask a)                 { return a; }
+  static Vec blend(Mask m, Vec a, Vec b)       { return _mm512_mask_blend_pd(m, a, b); }
+  static Vec iota()                            { return _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0); }
+
+  // The masked forms below avoid GCC's uninitialized source warning on the unmasked intrinsics
+  static Vec min(Vec a, Vec b)                 { return _mm512_mask_min_pd(a, 0xff, a, b); }
+  static Vec max(Vec a, Vec b)                 { return _mm512_mask_max_pd(a, 0xff, a, b); }
+  static Vec truncate(Vec a)                   { return _mm512_mask_roundscale_pd(a, 0xff, a, _MM_FROUND_TO_ZERO); }
+
+  static Vec gather(const double *base, Vec idx) {
+    // Return 'base[idx[i]]' in lane 'i' where 'idx' holds whole numbers below 2^31
+    const __m256i index = _mm512_mask_cvttpd_epi32(_mm256_setzero_si256(), 0xff, idx);
+    return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xff, index, base, 8);
+  }
+
+  static Vec gather(const double *base, const uint32_t *idx) {
+    // Return 'base[idx[i]]' in lane 'i'. The masked form avoids GCC's uninitialized source warning
+    return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xff,
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), base, 8);
+  }
+
+  static void scatter(double *base, const uint32_t *idx, Mask m, Vec v) {
+    // Store lane 'i' of 'v' into 'base[idx[i]]' for lanes set in 'm'
+    _mm512_mask_i32scatter_pd(base, m, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), v, 8);
+  }
+
+  static bool unique(const uint32_t *idx) {
+    // Return true if the 'k_width' values in 'idx' are pairwise distinct
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx));
+    return _mm256_testz_si256(_mm256_conflict_epi32(v), _mm256_conflict_epi32(v));
+  }
+};
+#endif
+
+#if defined(__AVX2__)
+#define EXPERIMENT_TIMELY_SIMD_AVX2 1
+struct TimelySimdAvx2 {
+  // TYPES
+  typedef __m256d Vec;
+  typedef __m256d Mask;
+
+  // CONSTANTS
+  enum { k_width = 4 };
+
+  // CLASS METHODS
+  static Vec set1(double v)                    { return _mm256_set1_pd(v); }
+  static Vec load(const double *p)             { return _mm256_loadu_pd(p); }
+  static void store(double *p, Vec v)          { _mm256_storeu_pd(p, v); }
+  static Vec add(Vec a, Vec b)                 { return _mm256_add_pd(a, b); }
+  static Vec sub(Vec a, Vec b)                 { return _mm256_sub_pd(a, b); }
+  static Vec mul(Vec a, Vec b)                 { return _mm256_mul_pd(a, b); }
+  static Vec div(Vec a, Vec b)                 { return _mm256_div_pd(a, b); }
+  static Mask lt(Vec a, Vec b)                 { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+  static Mask le(Vec a, Vec b)                 { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+  static Mask eq(Vec a, Vec b)                 { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+  static Mask andMask(Mask a, Mask b)          { return _mm256_and_pd(a, b); }
+  static Mask orMask(Mask a, Mask b)           { return _mm256_or_pd(a, b); }
+  static Mask notMask(Mask a)                  { return _mm256_xor_pd(a, _mm256_castsi256_pd(_mm256_set1_epi64x(-1))); }
+  static unsigned bits(Mask a)                 { return static_cast<unsigned>(_mm256_movemask_pd(a)); }
+  static Vec blend(Mask m, Vec a, Vec b)       { return _mm256_blendv_pd(a, b, m); }
+  static Vec min(Vec a, Vec b)                 { return _mm256_min_pd(a, b); }
+  static Vec max(Vec a, Vec b)                 { return _mm256_max_pd(a, b); }
+  static Vec truncate(Vec a)                   { return _mm256_round_pd(a, _MM_FROUND_TO_ZERO|_MM_FROUND_NO_EXC); }
+  static Vec iota()                            { return _mm256_set_pd(3, 2, 1, 0); }
+
+  static Vec gather(const double *base, Vec idx) {
+    // Return 'base[idx[i]]' in lane 'i' where 'idx' holds whole numbers below 2^31
+    return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, _mm256_cvttpd_epi32(idx),
+      _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+  }
+
+  static Vec gather(const double *base, const uint32_t *idx) {
+    // Return 'base[idx[i]]' in lane 'i'. The masked form avoids GCC's uninitialized source warning
+    return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, _mm_loadu_si128(reinterpret_cast<const __m128i*>(idx)),
+      _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+  }
+
+  static void scatter(double *base, const uint32_t *idx, Mask m, Vec v) {
+    // Store lane 'i' of 'v' into 'base[idx[i]]' for lanes set in 'm'. AVX2 has no scatter instruction
+    alignas(32) double lanes[k_width];
+    _mm256_store_pd(lanes, v);
+    const unsigned set = bits(m);
+    for (unsigned i=0; i<k_width; ++i) {
+      if (set & (1u<<i)) {
+        base[idx[i]] = lanes[i];
+      }
+    }
+  }
+
+  static bool unique(const uint32_t *idx) {
+    // Return true if the 'k_width' values in 'idx' are pairwise distinct
+    return idx[0]!=idx[1] && idx[0]!=idx[2] && idx[0]!=idx[3] &&
+           idx[1]!=idx[2] && idx[1]!=idx[3] && idx[2]!=idx[3];
+  }
+};
+#endif
+
+struct TimelySimdScalar {
+  // TYPES
+  typedef double Vec;
+  typedef bool Mask;
+
+  // CONSTANTS
+  enum { k_width = 1 };
+
+  // CLASS METHODS
+  static Vec set1(double v)                    { return v; }
+  static Vec load(const double *p)             { return *p; }
+  static void store(double *p, Vec v)          { *p = v; }
+  static Vec add(Vec a, Vec b)                 { return a+b; }
+  static Vec sub(Vec a, Vec b)                 { return a-b; }
+  static Vec mul(Vec a, Vec b)                 { return a*b; }
+  static Vec div(Vec a, Vec b)                 { return a/b; }
+  static Mask lt(Vec a, Vec b)                 { return a<b; }
+  static Mask le(Vec a, Vec b)                 { return a<=b; }
+  static Mask eq(Vec a, Vec b)                 { return a==b; }
+  static Mask andMask(Mask a, Mask b)          { return a && b; }
+  static Mask orMask(Mask a, Mask b)           { return a || b; }
+  static Mask notMask(Mask a)                  { return !a; }
+  static unsigned bits(Mask a)                 { return a; }
+  static Vec blend(Mask m, Vec a, Vec b)       { return m ? b : a; }
+  static Vec min(Vec a, Vec b)                 { return a<b ? a : b; }
+  static Vec max(Vec a, Vec b)                 { return a>b ? a : b; }
+  static Vec truncate(Vec a)                   { return std::trunc(a); }
+  static Vec iota()                            { return 0; }
+  static Vec gather(const double *base, Vec idx) { return base[static_cast<int32_t>(idx)]; }
+  static Vec gather(const double *base, const uint32_t *idx) { return base[*idx]; }
+  static void scatter(double *base, const uint32_t *idx, Mask m, Vec v) { if (m) { base[*idx] = v; } }
+  static bool unique(const uint32_t *) { return true; }
+};
+
+} // namespace Experiment
@@ -0,0 +1,159 @@
+#pragma once
+
+// Purpose: Compile-time choice of how a timestamp is taken: bare or fenced 'rdtsc'/'rdtscp', or 'clock_gettime'
+//
+// Classes:
+//   Experiment::TimestampRdtsc: 'rdtsc' alone
+//   Experiment::TimestampLfenceRdtsc: 'lfence; rdtsc'
+//   Experiment::TimestampRdtscp: 'rdtscp' alone
+//   Experiment::TimestampRdtscpLfence: 'rdtscp; lfence'
+//   Experiment::TimestampMfenceRdtsc: 'mfence; rdtsc'
+//   Experiment::TimestampClockGettime: 'clock_gettime(CLOCK_MONOTONIC)' through the vDSO
+//   Experiment::Timestamp<POLICY>: Takes timestamps with 'POLICY' and converts their differences to nanoseconds
+//
+// Thread Safety: thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// 'rdtsc' is not serializing [1] 17.17: it may read the counter before earlier instructions finish, and later
+// instructions may start before it does. Around a packet send or receive that moves the stamp by up to the work
+// still in flight, e.g. an outstanding cache miss. The fences trade cost for placement:
+//
+//   rdtsc          : cheapest. May execute before earlier work completes and after later work starts
+//   lfence; rdtsc  : waits for earlier instructions to complete. Use for a start stamp
+//   rdtscp         : waits for earlier instructions and loads, but later instructions may start before it
+//   rdtscp; lfence : as 'rdtscp' and later instructions wait for it. Use for an end stamp
+//   mfence; rdtsc  : also drains earlier stores. On AMD 'mfence' serializes 'rdtsc' where 'lfence' may not
+//   clock_gettime  : vDSO 'rdtsc' plus scaling into ns; 'k_isTsc==false' so values are already nanoseconds
+//
+// A 'POLICY' provides 'static uint64_t now()', 'static constexpr bool k_isTsc' and 'static const char *name()'.
+// 'Timestamp<POLICY>' is a stateless facade so a hot path written against it picks the instruction sequence with a
+// template argument and pays only for that sequence. 'timestamp_rdtsc' measures the cost, resolution and reordering
+// error of each policy.
+//
+// [1] Intel® 64 and IA-32 Architectures Software Developer's Manual Volume 3
+
+#include <cstdint>
+#include <time.h>
+#include <x86intrin.h>
+
+#include <tscclock.h>
+
+namespace Experiment {
+
+struct TimestampRdtsc {
+  // CONSTANTS
+  static constexpr bool k_isTsc = true;                       // 'now' returns TSC ticks
+
+  // CLASS METHODS
+  static const char *name() { return "rdtsc"; }
+  static uint64_t now() { return __rdtsc(); }
+};
+
+struct TimestampLfenceRdtsc {
+  // CONSTANTS
+  static constexpr bool k_isTsc = true;                       // 'now' returns TSC ticks
+
+  // CLASS METHODS
+  static const char *name() { return "lfence;rdtsc"; }
+  static uint64_t now() { _mm_lfence(); return __rdtsc(); }
+};
+
+struct TimestampRdtscp {
+  // CONSTANTS
+  static constexpr bool k_isTsc = true;                       // 'now' returns TSC ticks
+
+  // CLASS METHODS
+  static const char *name() { return "rdtscp"; }
+  static uint64_t now() { unsigned aux; return __rdtscp(&aux); }
+};
+
+struct TimestampRdtscpLfence {
+  // CONSTANTS
+  static constexpr bool k_isTsc = true;                       // 'now' returns TSC ticks
+
+  // CLASS METHODS
+  static const char *name() { return "rdtscp;lfence"; }
+  static uint64_t now() { unsigned aux; const uint64_t ticks = __rdtscp(&aux); _mm_lfence(); return ticks; }
+};
+
+struct TimestampMfenceRdtsc {
+  // CONSTANTS
+  static constexpr bool k_isTsc = true;                       // 'now' returns TSC ticks
+
+  // CLASS METHODS
+  static const char *name() { return "mfence;rdtsc"; }
+  static uint64_t now() { _mm_mfence(); return __rdtsc(); }
+};
+
+struct TimestampClockGettime {
+  // CONSTANTS
+  static constexpr bool k_isTsc = false;                      // 'now' returns nanoseconds
+
+  // CLASS METHODS
+  static const char *name() { return "clock_gettime"; }
+  static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ull+static_cast<uint64_t>(ts.tv_nsec);
+  }
+};
+
+template <class POLICY>
+class Timestamp {
+public:
+  // TYPES
+  typedef POLICY Policy;
+
+  // CONSTANTS
+  static constexpr bool k_isTsc = POLICY::k_isTsc;
+
+  // CLASS METHODS
+  static const char *name();
+    // Return printable name of the instruction sequence
+
+  static uint64_t now();
+    // Return a timestamp: TSC ticks if 'k_isTsc' else nanoseconds
+
+  static uint64_t toNs(uint64_t delta, const TscClock& clock);
+    // Return difference of two timestamps 'delta' in nanoseconds, converting with 'clock' if 'k_isTsc'
+
+  static double toUs(uint64_t delta, const TscClock& clock);
+    // Return difference of two timestamps 'delta' in microseconds, converting with 'clock' if 'k_isTsc'
+};
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+template <class POLICY>
+inline
+const char *Timestamp<POLICY>::name() {
+  return POLICY::name();
+}
+
+template <class POLICY>
+inline
+uint64_t Timestamp<POLICY>::now() {
+  return POLICY::now();
+}
+
+template <class POLICY>
+inline
+uint64_t Timestamp<POLICY>::toNs(uint64_t delta, const TscClock& clock) {
+  if constexpr (k_isTsc) {
+    return clock.toNs(delta);
+  } else {
+    return delta;
+  }
+}
+
+template <class POLICY>
+inline
+double Timestamp<POLICY>::toUs(uint64_t delta, const TscClock& clock) {
+  if constexpr (k_isTsc) {
+    return clock.toUs(delta);
+  } else {
+    return static_cast<double>(delta)/1000.0;
+  }
+}
+
+} // namespace Experiment
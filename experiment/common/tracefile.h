@@ -0,0 +1,376 @@
+#pragma once
+
+// Purpose: Append-only columnar binary trace files of double precision samples with an mmap based reader
+//
+// Classes:
+//   Experiment::TraceFileHeader: On disk file header
+//   Experiment::TraceBlockHeader: On disk header of one block of rows
+//   Experiment::TraceWriter: Buffers rows in a fixed size block and appends full blocks to a trace file
+//   Experiment::TraceReader: Maps a trace file read-only and exposes its blocks as column arrays
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions. Failures are reported through return values and 'isOpen'.
+//
+// Formatting each sample with 'fprintf' costs far more than the simulation producing it. A 'TraceWriter' copies
+// each row into a block held in memory, one array per column. When the block fills it is written with one 'write'
+// call. The file layout is:
+//
+//   TraceFileHeader                       4096 bytes: magic, version, columns, rows per block, column
+//                                         names, free text comment
+//   block 0: TraceBlockHeader             64 bytes: rows used in this block
+//            column 0: double[blockRows]
+//            ...
+//            column N-1: double[blockRows]
+//   block 1: ...
+//
+// Every block has the same size, so block 'i' is at a fixed offset and a reader can map the file and index it
+// directly. Only the last block may be partially used. Nothing written is ever rewritten, so a trace cut short by a
+// crash is readable up to its last complete block. Values are stored in host byte order; the magic detects a file
+// from a host of the other byte order.
+
+#include <assert.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Experiment {
+
+struct TraceFileHeader {
+  // CONSTANTS
+  static constexpr uint64_t k_magic = 0x31435254594c4d54ull; // "TMLYTRC1" in little endian
+  static constexpr uint32_t k_version = 1;
+  enum {
+    k_maxColumns = 8,                               // most columns a trace may have
+    k_nameBytes = 16,                               // bytes per column name including terminating 0
+  };
+
+  // DATA
+  uint64_t                      d_magic;            // 'k_magic'
+  uint32_t                      d_version;          // 'k_version'
+  uint32_t                      d_columns;          // number of columns
+  uint32_t                      d_blockRows;        // rows per block
+  uint32_t                      d_commentBytes;     // bytes used in 'd_comment'
+  char                          d_names[k_maxColumns][k_nameBytes]; // 0 terminated column names
+  char                          d_comment[4096-24-k_maxColumns*k_nameBytes]; // free text, not 0 terminated
+};
+
+struct TraceBlockHeader {
+  // DATA
+  uint64_t                      d_rows;             // rows used in this block
+  uint64_t                      d_reserved[7];      // 0; pads the header to a cache line
+};
+
+static_assert(sizeof(TraceFileHeader)==4096, "file header must be one page so block 0 starts on a page boundary");
+static_assert(sizeof(TraceBlockHeader)==64, "block header must be one cache line");
+
+class TraceWriter {
+  // DATA
+  int                           d_fd;               // open trace file or -1
+  unsigned                      d_columns;          // columns per row
+  unsigned                      d_blockRows;        // rows per block
+  unsigned                      d_rows;             // rows buffered in 'd_block'
+  uint64_t                      d_totalRows;        // rows appended since open
+  std::vector<double>           d_block;            // column 'c' row 'r' at 'c*d_blockRows+r'
+  bool                          d_failed;           // true if a write failed
+
+  // PRIVATE MANIPULATORS
+  void flush();
+    // Append the buffered block, used or not, to the file and empty the buffer
+
+public:
+  // CONSTANTS
+  enum {
+    k_defaultBlockRows = 4096                       // 128KB per block for 4 columns
+  };
+
+  // CREATORS
+  TraceWriter(const char *path, const std::vector<std::string>& names, const std::string& comment,
+    unsigned blockRows = k_defaultBlockRows);
+    // Create 'path', truncating it if it exists, for rows of 'names.size()' columns. 'comment' is stored verbatim
+    // (e.g. lines starting with '#' to carry into a CSV). 'isOpen' reports failure. Behavior is defined provided
+    // '0<names.size()<=k_maxColumns', each name is shorter than 'k_nameBytes', the comment fits in the header, and
+    // 'blockRows>0'
+
+  TraceWriter(const TraceWriter& other) = delete;
+    // Copy constructor not provided
+
+  ~TraceWriter();
+    // Close the trace if still open
+
+  // ACCESSORS
+  bool isOpen() const;
+    // Return true if the file is open and no write has failed
+
+  uint64_t rows() const;
+    // Return number of rows appended
+
+  // MANIPULATORS
+  void append(const double *values);
+    // Append one row whose 'i'th column is 'values[i]'
+
+  int close();
+    // Write any buffered rows and close the file. Return 0 on success and non-zero if any write or the close failed
+
+  TraceWriter& operator=(const TraceWriter& rhs) = delete;
+    // Assignment operator not provided
+};
+
+class TraceReader {
+  // DATA
+  int                           d_fd;               // open file or -1
+  const char                   *d_base_p;           // mapping of the whole file or 0
+  std::size_t                   d_bytes;            // length of the mapping
+  const TraceFileHeader        *d_header_p;         // header at 'd_base_p'
+  std::size_t                   d_blockBytes;       // bytes per block including its header
+  std::size_t                   d_blocks;           // complete blocks in the file
+  uint64_t                      d_rows;             // rows over all blocks
+
+public:
+  // CREATORS
+  explicit TraceReader(const char *path);
+    // Map 'path' read-only. 'isOpen' reports whether it is a valid trace
+
+  TraceReader(const TraceReader& other) = delete;
+    // Copy constructor not provided
+
+  ~TraceReader();
+    // Unmap and close the file
+
+  // ACCESSORS
+  bool isOpen() const;
+    // Return true if the file was mapped and its header is valid
+
+  unsigned columns() const;
+    // Return number of columns
+
+  const char *name(unsigned column) const;
+    // Return 0 terminated name of 'column'
+
+  std::string comment() const;
+    // Return the free text comment
+
+  uint64_t rows() const;
+    // Return total number of rows
+
+  std::size_t blocks() const;
+    // Return number of complete blocks
+
+  std::size_t blockRows(std::size_t block) const;
+    // Return number of rows used in 'block'
+
+  const double *column(std::size_t block, unsigned column) const;
+    // Return the values of 'column' in 'block'. 'blockRows(block)' of them are valid
+
+  TraceReader& operator=(const TraceReader& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+TraceWriter::TraceWriter(const char *path, const std::vector<std::string>& names, const std::string& comment,
+  unsigned blockRows)
+: d_fd(-1)
+, d_columns(static_cast<unsigned>(names.size()))
+, d_blockRows(blockRows)
+, d_rows(0)
+, d_totalRows(0)
+, d_block(names.size()*blockRows, 0.0)
+, d_failed(false)
+{
+  assert(d_columns>0 && d_columns<=TraceFileHeader::k_maxColumns);
+  assert(blockRows>0);
+
+  TraceFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.d_magic = TraceFileHeader::k_magic;
+  header.d_version = TraceFileHeader::k_version;
+  header.d_columns = d_columns;
+  header.d_blockRows = d_blockRows;
+  for (unsigned i=0; i<d_columns; ++i) {
+    assert(names[i].size()<TraceFileHeader::k_nameBytes);
+    strncpy(header.d_names[i], names[i].c_str(), TraceFileHeader::k_nameBytes-1);
+  }
+  assert(comment.size()<=sizeof(header.d_comment));
+  header.d_commentBytes = static_cast<uint32_t>(std::min(comment.size(), sizeof(header.d_comment)));
+  memcpy(header.d_comment, comment.data(), header.d_commentBytes);
+
+  d_fd = ::open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (d_fd>=0 && ::write(d_fd, &header, sizeof(header))!=static_cast<ssize_t>(sizeof(header))) {
+    d_failed = true;
+  }
+}
+
+inline
+TraceWriter::~TraceWriter() {
+  close();
+}
+
+// ACCESSORS
+inline
+bool TraceWriter::isOpen() const {
+  return d_fd>=0 && !d_failed;
+}
+
+inline
+uint64_t TraceWriter::rows() const {
+  return d_totalRows;
+}
+
+// PRIVATE MANIPULATORS
+inline
+void TraceWriter::flush() {
+  TraceBlockHeader header;
+  memset(&header, 0, sizeof(header));
+  header.d_rows = d_rows;
+
+  // Unused rows of a partial block are zeroed so the file content does not depend on earlier blocks
+  for (unsigned c=0; c<d_columns && d_rows<d_blockRows; ++c) {
+    std::fill(d_block.begin()+c*d_blockRows+d_rows, d_block.begin()+(c+1)*d_blockRows, 0.0);
+  }
+
+  const ssize_t blockBytes = static_cast<ssize_t>(d_block.size()*sizeof(double));
+  if (::write(d_fd, &header, sizeof(header))!=static_cast<ssize_t>(sizeof(header)) ||
+      ::write(d_fd, d_block.data(), blockBytes)!=blockBytes) {
+    d_failed = true;
+  }
+  d_rows = 0;
+}
+
+// MANIPULATORS
+inline
+void TraceWriter::append(const double *values) {
+  assert(d_fd>=0);
+  double *slot = d_block.data()+d_rows;
+  for (unsigned c=0; c<d_columns; ++c) {
+    slot[c*d_blockRows] = values[c];
+  }
+  ++d_totalRows;
+  if (++d_rows==d_blockRows) {
+    flush();
+  }
+}
+
+inline
+int TraceWriter::close() {
+  if (d_fd<0) {
+    return d_failed ? -1 : 0;
+  }
+  if (d_rows>0) {
+    flush();
+  }
+  if (::close(d_fd)!=0) {
+    d_failed = true;
+  }
+  d_fd = -1;
+  return d_failed ? -1 : 0;
+}
+
+// CREATORS
+inline
+TraceReader::TraceReader(const char *path)
+: d_fd(::open(path, O_RDONLY))
+, d_base_p(0)
+, d_bytes(0)
+, d_header_p(0)
+, d_blockBytes(0)
+, d_blocks(0)
+, d_rows(0)
+{
+  struct stat info;
+  if (d_fd<0 || fstat(d_fd, &info)!=0 || static_cast<std::size_t>(info.st_size)<sizeof(TraceFileHeader)) {
+    return;
+  }
+
+  d_bytes = static_cast<std::size_t>(info.st_size);
+  void *base = mmap(0, d_bytes, PROT_READ, MAP_PRIVATE, d_fd, 0);
+  if (base==MAP_FAILED) {
+    d_bytes = 0;
+    return;
+  }
+  madvise(base, d_bytes, MADV_SEQUENTIAL);
+  d_base_p = static_cast<const char*>(base);
+
+  const TraceFileHeader *header = reinterpret_cast<const TraceFileHeader*>(d_base_p);
+  if (header->d_magic!=TraceFileHeader::k_magic || header->d_version!=TraceFileHeader::k_version ||
+      header->d_columns==0 || header->d_columns>TraceFileHeader::k_maxColumns || header->d_blockRows==0 ||
+      header->d_commentBytes>sizeof(header->d_comment)) {
+    return;
+  }
+  d_header_p = header;
+  d_blockBytes = sizeof(TraceBlockHeader)+sizeof(double)*header->d_columns*header->d_blockRows;
+  d_blocks = (d_bytes-sizeof(TraceFileHeader))/d_blockBytes;
+  for (std::size_t b=0; b<d_blocks; ++b) {
+    d_rows += blockRows(b);
+  }
+}
+
+inline
+TraceReader::~TraceReader() {
+  if (d_base_p) {
+    munmap(const_cast<char*>(d_base_p), d_bytes);
+  }
+  if (d_fd>=0) {
+    ::close(d_fd);
+  }
+}
+
+// ACCESSORS
+inline
+bool TraceReader::isOpen() const {
+  return d_header_p!=0;
+}
+
+inline
+unsigned TraceReader::columns() const {
+  assert(isOpen());
+  return d_header_p->d_columns;
+}
+
+inline
+const char *TraceReader::name(unsigned column) const {
+  assert(column<columns());
+  return d_header_p->d_names[column];
+}
+
+inline
+std::string TraceReader::comment() const {
+  assert(isOpen());
+  return std::string(d_header_p->d_comment, d_header_p->d_commentBytes);
+}
+
+inline
+uint64_t TraceReader::rows() const {
+  return d_rows;
+}
+
+inline
+std::size_t TraceReader::blocks() const {
+  return d_blocks;
+}
+
+inline
+std::size_t TraceReader::blockRows(std::size_t block) const {
+  assert(block<d_blocks);
+  const TraceBlockHeader *header = reinterpret_cast<const TraceBlockHeader*>(
+    d_base_p+sizeof(TraceFileHeader)+block*d_blockBytes);
+  return std::min<std::size_t>(header->d_rows, d_header_p->d_blockRows);
+}
+
+inline
+const double *TraceReader::column(std::size_t block, unsigned column) const {
+  assert(block<d_blocks);
+  assert(column<columns());
+  return reinterpret_cast<const double*>(d_base_p+sizeof(TraceFileHeader)+block*d_blockBytes+
+    sizeof(TraceBlockHeader))+static_cast<std::size_t>(column)*d_header_p->d_blockRows;
+}
+
+} // namespace Experiment
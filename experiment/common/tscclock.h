@@ -0,0 +1,622 @@
+#pragma once
+
+// Purpose: Calibrated TSC clock with multiply-shift tick conversion and periodic re-anchoring to CLOCK_MONOTONIC_RAW
+//
+// Classes:
+//   Experiment::TscCalibration: Result of measuring or reading the TSC frequency
+//   Experiment::TscClock: Reads 'rdtsc' and converts ticks to nanoseconds and microseconds
+//
+// Thread Safety: thread-safe. Conversions may run on any thread concurrently with 'reanchor' on another.
+//
+// Exception Policy: No exceptions
+//
+// 'timestamp_rdtsc/main.cpp' measures the TSC frequency the way eRPC does and prints a histogram, but nothing uses
+// the result. 'TscClock' is that result made reusable:
+//
+// * 'calibrateFast', used by the default constructor, takes well under 1ms. It first asks the hardware. CPUID leaf
+//   0x15 gives the TSC/crystal ratio and, on most parts, the crystal frequency. Failing that it tries the hypervisor
+//   timing leaf 0x40000010 when CPUID reports a hypervisor, then '/sys/devices/system/cpu/cpu0/tsc_freq_khz' where
+//   the kernel exports it, and last the whole MHz base frequency of leaf 0x16, which is only good to about 1000ppm.
+//   Where none of these exist (many VMs) it fits a least squares line through 'k_fastPoints' (ticks, ns) pairs
+//   spread over 'k_fastWindowNs' and reports a 95% confidence interval of the slope.
+// * 'calibrate' runs 'k_calibrationRuns' windows of 2ms. Each end of a window is the tightest of several
+//   (rdtsc, clock_gettime, rdtsc) brackets, so a preemption inside one read does not skew it. Runs further than 3
+//   scaled median absolute deviations from the median are rejected and the rest averaged. It takes about 22ms and
+//   serves as a reference for 'calibrateFast'.
+// * 'toNs' is '(ticks*d_nsMult)>>32'. 'd_nsMult' is nanoseconds per tick in Q32.32, so there is no division on the
+//   hot path. The product is formed in 128 bits so any 64 bit tick count converts. 'toUs' multiplies by a
+//   precomputed microseconds per tick.
+// * The TSC and 'CLOCK_MONOTONIC_RAW' are both crystal driven but not by the same crystal, so a frequency estimated
+//   over a few milliseconds drifts by parts per million. 'reanchor' re-estimates the frequency over the whole
+//   baseline since calibration, which shrinks the error as the baseline grows. It then re-bases 'nowNs' on a fresh
+//   (ticks, ns) pair. 'maybeReanchor' does this when 'k_defaultReanchorNs' has passed and is cheap to call often.
+//
+// * 'rdtsc' is per core. 'setSkewTable' installs per-core offsets measured by 'TscSkewTable' (see 'tscskew.h'), and
+//   'referenceTicks' then reads 'rdtscp' and removes the offset of whatever core it ran on. Use it in place of
+//   'nowTicks' when the two ends of an interval are stamped on different cores.
+//
+// The conversion state is published with a sequence lock. Readers retry only if they overlap a 'reanchor' and never
+// write shared memory. 'nowNs' can step by the measured drift at a re-anchor, but tick differences converted with
+// 'toNs' never step.
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cpuid.h>
+#include <cstdint>
+#include <iostream>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include <x86intrin.h>
+
+#include <probemacro.h>
+#include <tscskew.h>
+
+namespace Experiment {
+
+struct TscCalibration {
+  // TYPES
+  enum Source {
+    e_CPUID_CRYSTAL,                                // CPUID 0x15 ratio times its crystal frequency
+    e_HYPERVISOR,                                   // hypervisor CPUID 0x40000010 TSC kHz
+    e_SYSFS,                                        // '/sys/devices/system/cpu/cpu0/tsc_freq_khz'
+    e_CPUID_BASE,                                   // CPUID 0x16 base frequency in whole MHz taken as the TSC rate
+    e_REGRESSION,                                   // least squares fit against CLOCK_MONOTONIC_RAW
+    e_WINDOWS                                       // outlier rejected mean of windows ('TscClock::calibrate')
+  };
+
+  // DATA
+  double                        d_ghz;              // estimated TSC frequency in ticks per nanosecond
+  double                        d_stddevGhz;        // standard deviation of accepted runs; 0 unless 'e_WINDOWS'
+  double                        d_ciGhz;            // half width of the 95% confidence interval; 0 if read
+                                                    // exactly, half a MHz for 'e_CPUID_BASE'
+  unsigned                      d_runs;             // runs or regression points measured
+  unsigned                      d_rejected;         // runs rejected as outliers
+  uint64_t                      d_elapsedNs;        // wall time calibration took
+  Source                        d_source;           // where 'd_ghz' came from
+
+  // CLASS METHODS
+  static const char *sourceName(Source source);
+    // Return printable name of 'source'
+
+  // ACCESSORS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object returning 'stream'
+};
+
+class TscClock {
+public:
+  // CONSTANTS
+  enum {
+    k_calibrationRuns = 11,                         // windows measured by 'calibrate'
+    k_bracketTries = 5,                             // (rdtsc, clock_gettime, rdtsc) brackets per window end
+    k_shift = 32,                                   // fraction bits of 'd_nsMult'
+    k_fastPoints = 16                               // (ticks, ns) pairs in the 'calibrateFast' regression
+  };
+  static constexpr uint64_t k_calibrationWindowNs = 2000000;   // length of each calibration window (2ms)
+  static constexpr uint64_t k_fastWindowNs = 300000;           // span of the 'calibrateFast' regression (300us)
+  static constexpr uint64_t k_defaultReanchorNs = 1000000000;  // 'maybeReanchor' period (1s)
+  static constexpr uint64_t k_minBaselineNs = 100000000;       // shortest baseline 'reanchor' re-estimates over
+
+private:
+  // DATA
+  alignas(64) std::atomic<uint32_t> d_sequence;     // odd while 'reanchor' is updating the fields below
+  std::atomic<uint64_t>         d_anchorTicks;      // TSC at the last anchor
+  std::atomic<uint64_t>         d_anchorNs;         // CLOCK_MONOTONIC_RAW ns at the last anchor
+  std::atomic<uint64_t>         d_nsMult;           // ns per tick in Q32.32
+  std::atomic<double>           d_usPerTick;        // us per tick
+  std::atomic<double>           d_ghz;              // ticks per ns
+
+  alignas(64) std::atomic<uint64_t> d_nextReanchorTicks; // 'maybeReanchor' re-anchors after this TSC
+  uint64_t                      d_reanchorTicks;    // re-anchor period in ticks
+  uint64_t                      d_baseTicks;        // TSC at calibration; start of the drift baseline
+  uint64_t                      d_baseNs;           // CLOCK_MONOTONIC_RAW ns at calibration
+  std::atomic<int64_t>          d_lastDriftNs;      // predicted minus actual ns at the last re-anchor
+  std::atomic<uint32_t>         d_reanchorLock;     // 1 while a thread is in 'reanchor'
+  TscCalibration                d_calibration;      // result of calibration
+  const TscSkewTable           *d_skew_p;           // per-core offsets or 0 (held, not owned)
+
+  // PRIVATE MANIPULATORS
+  void publish(uint64_t anchorTicks, uint64_t anchorNs, double ghz);
+    // Store a new anchor and frequency under the sequence lock
+
+public:
+  // CLASS METHODS
+  static uint64_t nowTicks();
+    // Return the current TSC. Not serializing: see 'timestamp_rdtsc/README.md'
+
+  static uint64_t monotonicRawNs();
+    // Return 'CLOCK_MONOTONIC_RAW' in nanoseconds
+
+  static void readPair(uint64_t *ticks, uint64_t *ns);
+    // Load a simultaneous TSC and 'CLOCK_MONOTONIC_RAW' reading: the tightest of 'k_bracketTries' brackets
+
+  static TscCalibration calibrate(unsigned runs = k_calibrationRuns, uint64_t windowNs = k_calibrationWindowNs);
+    // Measure the TSC frequency over 'runs' windows of 'windowNs' rejecting outliers. Takes about 'runs*windowNs'.
+    // The caller should be pinned to one core
+
+  static bool readFrequency(TscCalibration *result);
+    // Load into 'result' the TSC frequency reported by CPUID or sysfs and return true, or return false if none is
+    // available. Costs a few microseconds
+
+  static TscCalibration regress(uint64_t windowNs = k_fastWindowNs);
+    // Fit the TSC frequency from 'k_fastPoints' (ticks, ns) pairs evenly spread over 'windowNs'
+
+  static TscCalibration calibrateFast();
+    // Return 'readFrequency' if available and otherwise 'regress()'
+
+  // CREATORS
+  TscClock();
+    // Create a clock calibrated with 'calibrateFast()'
+
+  explicit TscClock(const TscCalibration& calibration);
+    // Create a clock using an existing 'calibration', anchored now
+
+  TscClock(const TscClock& other) = delete;
+    // Copy constructor not provided
+
+  ~TscClock() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  const TscCalibration& calibration() const;
+    // Return the calibration this clock started with
+
+  double ghz() const;
+    // Return current frequency estimate in ticks per nanosecond
+
+  uint64_t toNs(uint64_t ticks) const;
+    // Return 'ticks' as nanoseconds by multiply-shift
+
+  double toUs(uint64_t ticks) const;
+    // Return 'ticks' as microseconds by multiplication
+
+  uint64_t nowNs() const;
+    // Return current time on the 'CLOCK_MONOTONIC_RAW' scale computed from the TSC
+
+  int64_t lastDriftNs() const;
+    // Return how far the TSC extrapolation had drifted from 'CLOCK_MONOTONIC_RAW' at the last re-anchor
+
+  uint64_t referenceTicks() const;
+    // Return the TSC on the skew table's reference core timeline, or 'nowTicks()' if no table is set
+
+  // MANIPULATORS
+  bool reanchor();
+    // Re-estimate the frequency over the baseline since calibration and anchor 'nowNs' to 'CLOCK_MONOTONIC_RAW'.
+    // Return true, or false without doing anything if another thread is re-anchoring
+
+  bool maybeReanchor(uint64_t ticks);
+    // Re-anchor if the re-anchor period has passed by TSC 'ticks' and return true if this call re-anchored. Return
+    // false if the period has not passed or another thread is re-anchoring. Costs one load otherwise
+
+  void setReanchorPeriod(uint64_t ns);
+    // Set the 'maybeReanchor' period to 'ns'
+
+  void setSkewTable(const TscSkewTable *table);
+    // Apply per-core offsets 'table' in 'referenceTicks', or none if 0. The table must outlive this clock and
+    // should be relative to the core the clock was calibrated on. Not thread-safe with 'referenceTicks'
+
+  TscClock& operator=(const TscClock& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const TscCalibration& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+std::ostream& operator<<(std::ostream& stream, const TscClock& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+inline
+const char *TscCalibration::sourceName(Source source) {
+  switch (source) {
+    case e_CPUID_CRYSTAL: return "cpuid 0x15 crystal";
+    case e_HYPERVISOR:    return "hypervisor cpuid 0x40000010";
+    case e_SYSFS:         return "sysfs tsc_freq_khz";
+    case e_CPUID_BASE:    return "cpuid 0x16 base MHz";
+    case e_REGRESSION:    return "regression vs CLOCK_MONOTONIC_RAW";
+    case e_WINDOWS:       return "windows vs CLOCK_MONOTONIC_RAW";
+  }
+  return "unknown";
+}
+
+// ACCESSORS
+inline
+std::ostream& TscCalibration::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    source                               : " << sourceName(d_source)    << std::endl;
+  stream << "    ghz (TSC ticks per ns)               : " << d_ghz                   << std::endl;
+  stream << "    ciGhz (95% confidence half width)    : " << d_ciGhz                 << std::endl;
+  stream << "    stddevGhz (accepted runs)            : " << d_stddevGhz             << std::endl;
+  stream << "    runs/rejected                        : " << d_runs << "/" << d_rejected << std::endl;
+  stream << "    elapsedNs (calibration time)         : " << d_elapsedNs             << std::endl;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+// CLASS METHODS
+inline
+uint64_t TscClock::nowTicks() {
+  return __rdtsc();
+}
+
+inline
+uint64_t TscClock::monotonicRawNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return static_cast<uint64_t>(ts.tv_sec)*1000000000ull+static_cast<uint64_t>(ts.tv_nsec);
+}
+
+inline
+void TscClock::readPair(uint64_t *ticks, uint64_t *ns) {
+  uint64_t best = UINT64_MAX;
+  for (unsigned i=0; i<k_bracketTries; ++i) {
+    const uint64_t before = __rdtsc();
+    const uint64_t clockNs = monotonicRawNs();
+    const uint64_t after = __rdtsc();
+    if (after-before<best) {
+      best = after-before;
+      *ticks = before+(after-before)/2;
+      *ns = clockNs;
+    }
+  }
+}
+
+inline
+TscCalibration TscClock::calibrate(unsigned runs, uint64_t windowNs) {
+  assert(runs>0);
+  const uint64_t startNs = monotonicRawNs();
+
+  std::vector<double> ghz(runs);
+  for (unsigned i=0; i<runs; ++i) {
+    uint64_t ticks0(0), ns0(0), ticks1(0), ns1(0);
+    readPair(&ticks0, &ns0);
+    while (monotonicRawNs()-ns0<windowNs) {
+    }
+    readPair(&ticks1, &ns1);
+    ghz[i] = static_cast<double>(ticks1-ticks0)/static_cast<double>(ns1-ns0);
+  }
+
+  // Reject runs more than 3 scaled MADs from the median; 1.4826 scales MAD to a standard deviation for normal data
+  std::vector<double> sorted(ghz);
+  std::sort(sorted.begin(), sorted.end());
+  const double median = sorted[runs/2];
+  std::vector<double> deviation(runs);
+  for (unsigned i=0; i<runs; ++i) {
+    deviation[i] = std::fabs(ghz[i]-median);
+  }
+  std::sort(deviation.begin(), deviation.end());
+  const double limit = std::max(3*1.4826*deviation[runs/2], median*1e-9);
+
+  double sum(0), sumSq(0);
+  unsigned accepted(0);
+  for (double g: ghz) {
+    if (std::fabs(g-median)<=limit) {
+      sum += g;
+      sumSq += g*g;
+      ++accepted;
+    }
+  }
+
+  TscCalibration result;
+  result.d_ghz = sum/accepted;
+  result.d_stddevGhz = accepted>1 ? std::sqrt(std::max(0.0, (sumSq-sum*sum/accepted)/(accepted-1))) : 0.0;
+  result.d_runs = runs;
+  result.d_ciGhz = accepted>1 ? 1.96*result.d_stddevGhz/std::sqrt(static_cast<double>(accepted)) : 0.0;
+  result.d_rejected = runs-accepted;
+  result.d_elapsedNs = monotonicRawNs()-startNs;
+  result.d_source = TscCalibration::e_WINDOWS;
+  return result;
+}
+
+inline
+bool TscClock::readFrequency(TscCalibration *result) {
+  const uint64_t startNs = monotonicRawNs();
+  double ghz(0);
+  double ciGhz(0);
+  TscCalibration::Source source(TscCalibration::e_CPUID_CRYSTAL);
+
+  unsigned eax(0), ebx(0), ecx(0), edx(0);
+  const unsigned maxLeaf = __get_cpuid_max(0, 0);
+  bool tscRatio(false);
+  if (maxLeaf>=0x15) {
+    // EBX/EAX is the TSC/crystal ratio; ECX the crystal Hz when enumerated
+    __cpuid_count(0x15, 0, eax, ebx, ecx, edx);
+    tscRatio = eax!=0 && ebx!=0;
+    if (tscRatio && ecx!=0) {
+      ghz = static_cast<double>(ecx)*ebx/eax/1e9;
+    }
+  }
+
+  __cpuid(1, eax, ebx, ecx, edx);
+  const bool hypervisor = (ecx>>31)&1;
+  if (ghz==0 && hypervisor) {
+    // Hypervisors (VMware, KVM with the timing leaf) report TSC kHz in leaf 0x40000010. Without a hypervisor leaf
+    // 0x40000000 returns the highest basic leaf's data, so it is only read when CPUID.1:ECX[31] is set
+    __cpuid(0x40000000, eax, ebx, ecx, edx);
+    if (eax>=0x40000010 && eax<0x40010000) {
+      __cpuid(0x40000010, eax, ebx, ecx, edx);
+      if (eax!=0) {
+        ghz = eax/1e6;
+        source = TscCalibration::e_HYPERVISOR;
+      }
+    }
+  }
+
+  if (ghz==0) {
+    FILE *fid = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+    if (fid) {
+      unsigned long khz(0);
+      if (fscanf(fid, "%lu", &khz)==1 && khz!=0) {
+        ghz = khz/1e6;
+        source = TscCalibration::e_SYSFS;
+      }
+      fclose(fid);
+    }
+  }
+
+  if (ghz==0 && tscRatio && maxLeaf>=0x16) {
+    // No crystal: the SDM says the TSC runs at the processor base frequency on such parts. Leaf 0x16 reports it in
+    // whole MHz, so this is a last resort before measuring
+    unsigned baseMhz(0);
+    __cpuid_count(0x16, 0, baseMhz, ebx, ecx, edx);
+    if (baseMhz!=0) {
+      ghz = baseMhz/1000.0;
+      ciGhz = 0.0005;
+      source = TscCalibration::e_CPUID_BASE;
+    }
+  }
+
+  if (ghz==0) {
+    return false;
+  }
+
+  result->d_ghz = ghz;
+  result->d_stddevGhz = 0;
+  result->d_ciGhz = ciGhz;
+  result->d_runs = 0;
+  result->d_rejected = 0;
+  result->d_elapsedNs = monotonicRawNs()-startNs;
+  result->d_source = source;
+  return true;
+}
+
+inline
+TscCalibration TscClock::regress(uint64_t windowNs) {
+  const uint64_t startNs = monotonicRawNs();
+
+  // Centered on the first pair so the sums stay small and exact enough in double
+  double x[k_fastPoints], y[k_fastPoints];
+  uint64_t ticks0(0), ns0(0);
+  readPair(&ticks0, &ns0);
+  x[0] = y[0] = 0;
+  for (unsigned i=1; i<k_fastPoints; ++i) {
+    const uint64_t targetNs = ns0+windowNs*i/(k_fastPoints-1);
+    while (monotonicRawNs()<targetNs) {
+    }
+    uint64_t ticks(0), ns(0);
+    readPair(&ticks, &ns);
+    x[i] = static_cast<double>(ns-ns0);
+    y[i] = static_cast<double>(ticks-ticks0);
+  }
+
+  double meanX(0), meanY(0);
+  for (unsigned i=0; i<k_fastPoints; ++i) {
+    meanX += x[i]/k_fastPoints;
+    meanY += y[i]/k_fastPoints;
+  }
+  double sxx(0), sxy(0);
+  for (unsigned i=0; i<k_fastPoints; ++i) {
+    sxx += (x[i]-meanX)*(x[i]-meanX);
+    sxy += (x[i]-meanX)*(y[i]-meanY);
+  }
+  const double slope = sxy/sxx;
+  double sse(0);
+  for (unsigned i=0; i<k_fastPoints; ++i) {
+    const double residual = y[i]-meanY-slope*(x[i]-meanX);
+    sse += residual*residual;
+  }
+
+  // Student's t for 95% two sided with 'k_fastPoints-2==14' degrees of freedom
+  static_assert(k_fastPoints==16, "update the t quantile below");
+  const double t = 2.145;
+
+  TscCalibration result;
+  result.d_ghz = slope;
+  result.d_stddevGhz = 0;
+  result.d_ciGhz = t*std::sqrt(sse/(k_fastPoints-2)/sxx);
+  result.d_runs = k_fastPoints;
+  result.d_rejected = 0;
+  result.d_elapsedNs = monotonicRawNs()-startNs;
+  result.d_source = TscCalibration::e_REGRESSION;
+  return result;
+}
+
+inline
+TscCalibration TscClock::calibrateFast() {
+  TscCalibration result;
+  if (readFrequency(&result)) {
+    return result;
+  }
+  return regress();
+}
+
+// PRIVATE MANIPULATORS
+inline
+void TscClock::publish(uint64_t anchorTicks, uint64_t anchorNs, double ghz) {
+  const uint32_t sequence = d_sequence.load(std::memory_order_relaxed);
+  d_sequence.store(sequence+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  d_anchorTicks.store(anchorTicks, std::memory_order_relaxed);
+  d_anchorNs.store(anchorNs, std::memory_order_relaxed);
+  d_nsMult.store(static_cast<uint64_t>(std::llround(std::ldexp(1.0/ghz, k_shift))), std::memory_order_relaxed);
+  d_usPerTick.store(1.0/(ghz*1000.0), std::memory_order_relaxed);
+  d_ghz.store(ghz, std::memory_order_relaxed);
+  d_sequence.store(sequence+2, std::memory_order_release);
+}
+
+// CREATORS
+inline
+TscClock::TscClock()
+: TscClock(calibrateFast())
+{
+}
+
+inline
+TscClock::TscClock(const TscCalibration& calibration)
+: d_sequence(0)
+, d_anchorTicks(0)
+, d_anchorNs(0)
+, d_nsMult(0)
+, d_usPerTick(0)
+, d_ghz(0)
+, d_nextReanchorTicks(0)
+, d_reanchorTicks(0)
+, d_baseTicks(0)
+, d_baseNs(0)
+, d_lastDriftNs(0)
+, d_reanchorLock(0)
+, d_calibration(calibration)
+, d_skew_p(0)
+{
+  assert(calibration.d_ghz>0);
+  readPair(&d_baseTicks, &d_baseNs);
+  publish(d_baseTicks, d_baseNs, calibration.d_ghz);
+  setReanchorPeriod(k_defaultReanchorNs);
+}
+
+// ACCESSORS
+inline
+const TscCalibration& TscClock::calibration() const {
+  return d_calibration;
+}
+
+inline
+double TscClock::ghz() const {
+  return d_ghz.load(std::memory_order_relaxed);
+}
+
+inline
+uint64_t TscClock::toNs(uint64_t ticks) const {
+  const uint64_t mult = d_nsMult.load(std::memory_order_relaxed);
+  return static_cast<uint64_t>((static_cast<unsigned __int128>(ticks)*mult)>>k_shift);
+}
+
+inline
+double TscClock::toUs(uint64_t ticks) const {
+  return static_cast<double>(ticks)*d_usPerTick.load(std::memory_order_relaxed);
+}
+
+inline
+uint64_t TscClock::nowNs() const {
+  EXPERIMENT_PROBE("tscclock.nowNs");
+  uint32_t before(0);
+  uint64_t anchorTicks(0), anchorNs(0), mult(0);
+  do {
+    before = d_sequence.load(std::memory_order_acquire);
+    anchorTicks = d_anchorTicks.load(std::memory_order_relaxed);
+    anchorNs = d_anchorNs.load(std::memory_order_relaxed);
+    mult = d_nsMult.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((before&1) || before!=d_sequence.load(std::memory_order_relaxed));
+
+  const int64_t ticks = static_cast<int64_t>(__rdtsc()-anchorTicks);
+  const __int128 ns = (static_cast<__int128>(ticks)*static_cast<__int128>(mult))>>k_shift;
+  return anchorNs+static_cast<int64_t>(ns);
+}
+
+inline
+int64_t TscClock::lastDriftNs() const {
+  return d_lastDriftNs.load(std::memory_order_relaxed);
+}
+
+inline
+uint64_t TscClock::referenceTicks() const {
+  return d_skew_p ? d_skew_p->referenceTicks() : nowTicks();
+}
+
+// MANIPULATORS
+inline
+bool TscClock::reanchor() {
+  EXPERIMENT_PROBE("tscclock.reanchor");
+  uint32_t unlocked = 0;
+  if (!d_reanchorLock.compare_exchange_strong(unlocked, 1, std::memory_order_acquire)) {
+    return false;
+  }
+
+  uint64_t ticks(0), ns(0);
+  readPair(&ticks, &ns);
+
+  // Signed as in 'nowNs': on another core than the last re-anchor's, 'ticks' may be just below the anchor
+  const uint64_t anchorTicks = d_anchorTicks.load(std::memory_order_relaxed);
+  const uint64_t anchorNs = d_anchorNs.load(std::memory_order_relaxed);
+  const int64_t elapsedTicks = static_cast<int64_t>(ticks-anchorTicks);
+  const __int128 elapsedNs = (static_cast<__int128>(elapsedTicks)*
+    static_cast<__int128>(d_nsMult.load(std::memory_order_relaxed)))>>k_shift;
+  const int64_t predictedNs = static_cast<int64_t>(anchorNs)+static_cast<int64_t>(elapsedNs);
+  d_lastDriftNs.store(predictedNs-static_cast<int64_t>(ns), std::memory_order_relaxed);
+
+  // Until the baseline is much longer than calibration took, calibration is the better estimate
+  double ghz = this->ghz();
+  if (ns-d_baseNs>=k_minBaselineNs) {
+    ghz = static_cast<double>(ticks-d_baseTicks)/static_cast<double>(ns-d_baseNs);
+  }
+  publish(ticks, ns, ghz);
+  d_nextReanchorTicks.store(ticks+d_reanchorTicks, std::memory_order_relaxed);
+
+  d_reanchorLock.store(0, std::memory_order_release);
+  return true;
+}
+
+inline
+bool TscClock::maybeReanchor(uint64_t ticks) {
+  if (ticks<d_nextReanchorTicks.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  return reanchor();
+}
+
+inline
+void TscClock::setReanchorPeriod(uint64_t ns) {
+  d_reanchorTicks = static_cast<uint64_t>(static_cast<double>(ns)*ghz());
+  d_nextReanchorTicks.store(d_anchorTicks.load(std::memory_order_relaxed)+d_reanchorTicks,
+    std::memory_order_relaxed);
+}
+
+inline
+void TscClock::setSkewTable(const TscSkewTable *table) {
+  d_skew_p = table;
+}
+
+// ASPECTS
+inline
+std::ostream& TscClock::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    ghz (current estimate)               : " << ghz()                   << std::endl;
+  stream << "    nsMult (ns per tick Q32.32)          : " << d_nsMult.load()         << std::endl;
+  stream << "    lastDriftNs (at last re-anchor)      : " << lastDriftNs()           << std::endl;
+  stream << "    calibration                          : " << d_calibration;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const TscCalibration& object) {
+  return object.print(stream);
+}
+
+inline
+std::ostream& operator<<(std::ostream& stream, const TscClock& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
@@ -0,0 +1,397 @@
+#pragma once
+
+// Purpose: Measure TSC offsets between cores by cache line ping-pong and apply them as a per-core table
+//
+// Classes:
+//   Experiment::TscSkewSample: Offset and one-way latency between two cores
+//   Experiment::TscSkewTable: Per-core TSC offsets relative to a reference core
+//
+// Thread Safety: 'TscSkewTable' is not-thread-safe while being filled; once filled its accessors may be called
+// concurrently from any thread.
+//
+// Exception Policy: No exceptions
+//
+// 'rdtsc' is per core. Invariant TSCs on one socket are normally synchronized by the hardware, but the kernel,
+// firmware or a hypervisor may write 'IA32_TSC_ADJUST', and cores on different sockets reset at different times. A
+// timestamp taken on the sender's core and subtracted from one taken on the ACK core then carries that offset.
+//
+// 'measure(a, b)' pins one thread to core 'a' and one to 'b' sharing one cache line. Each round core 'a' reads its
+// TSC 't0' and flips the line. Core 'b' sees the flip, reads its TSC 'tb' and flips it back. Core 'a' sees that and
+// reads 't1'. The read on 'b' happened after 't0' and before 't1' on core 'a's timeline, so the offset 'b-a' lies in
+// '(tb-t1, tb-t0)'. Intersecting that interval over many rounds bounds the offset by the fastest round trip, whatever
+// the latency asymmetry. The midpoint is the estimate and half the width its uncertainty. Half of the fastest round
+// trip is the one-way cache line latency.
+//
+// 'TscSkewTable' holds the offset of each core from a reference core. 'referenceTicks' reads 'rdtscp', which also
+// returns the core it ran on (Linux stores the CPU number in the low 12 bits of 'IA32_TSC_AUX'), and subtracts that
+// core's offset. Ticks taken anywhere are then on the reference core's timeline. 'TscClock::setSkewTable' applies it.
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include <x86intrin.h>
+
+namespace Experiment {
+
+struct TscSkewSample {
+  // DATA
+  unsigned                      d_referenceCore;    // core 'a'
+  unsigned                      d_core;             // core 'b'
+  double                        d_offsetTicks;      // estimated TSC of 'b' minus TSC of 'a'
+  double                        d_uncertaintyTicks; // half width of the interval holding the true offset
+  uint64_t                      d_oneWayTicks;      // half the fastest round trip
+  uint64_t                      d_medianRoundTripTicks; // median round trip
+  unsigned                      d_rounds;           // round trips measured
+
+  // ACCESSORS
+  bool isValid() const;
+    // Return true if the offset interval was non-empty, i.e. the TSCs moved consistently during the measurement
+
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+class TscSkewTable {
+public:
+  // CONSTANTS
+  enum {
+    k_defaultRounds = 20000,                        // round trips per pair in 'measure'
+    k_spinsBeforeYield = 1024,                      // spins before a waiting side yields its core
+    k_coreMask = 0xfff                              // bits of 'IA32_TSC_AUX' holding the CPU number on Linux
+  };
+
+private:
+  // DATA
+  unsigned                      d_referenceCore;    // core every offset is relative to
+  std::vector<double>           d_offsetTicks;      // indexed by core; 0 for cores not measured
+  std::vector<double>           d_uncertaintyTicks; // indexed by core
+  std::vector<int64_t>          d_roundedOffset;    // 'd_offsetTicks' rounded for 'referenceTicks'
+
+public:
+  // CLASS METHODS
+  static TscSkewSample measure(unsigned referenceCore, unsigned core, unsigned rounds = k_defaultRounds);
+    // Ping-pong a cache line 'rounds' times between threads pinned to 'referenceCore' and 'core' and return the
+    // offset of 'core' from 'referenceCore'. Both may be the same core, which is a check of the method
+
+  static std::vector<unsigned> availableCores();
+    // Return the cores the calling thread may run on in increasing order
+
+  static bool pin(unsigned core);
+    // Pin the calling thread to 'core' and return true on success
+
+  // CREATORS
+  explicit TscSkewTable(unsigned referenceCore = 0);
+    // Create a table of zero offsets relative to 'referenceCore'
+
+  TscSkewTable(const TscSkewTable& other) = default;
+    // Create a copy of 'other'
+
+  ~TscSkewTable() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  unsigned referenceCore() const;
+    // Return the core offsets are relative to
+
+  unsigned size() const;
+    // Return one more than the highest core with an offset
+
+  double offsetTicks(unsigned core) const;
+    // Return offset of 'core' from the reference core, or 0 if unknown
+
+  double uncertaintyTicks(unsigned core) const;
+    // Return uncertainty of 'offsetTicks(core)', or 0 if unknown
+
+  uint64_t toReference(uint64_t ticks, unsigned core) const;
+    // Return 'ticks' read on 'core' on the reference core's timeline
+
+  uint64_t referenceTicks() const;
+    // Read the TSC with 'rdtscp' and return it on the reference core's timeline
+
+  bool save(const char *path) const;
+    // Write the table to 'path' as text, one core per line, returning true on success
+
+  // MANIPULATORS
+  void set(unsigned core, double offsetTicks, double uncertaintyTicks);
+    // Set offset of 'core' from the reference core
+
+  void measureAll(const std::vector<unsigned>& cores, unsigned rounds = k_defaultRounds);
+    // Measure every core in 'cores' against the reference core
+
+  bool load(const char *path);
+    // Replace the table with one written by 'save', returning false and leaving it unchanged on error
+
+  TscSkewTable& operator=(const TscSkewTable& rhs) = default;
+    // Assign 'rhs' to this object
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const TscSkewSample& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+std::ostream& operator<<(std::ostream& stream, const TscSkewTable& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+bool TscSkewSample::isValid() const {
+  return d_uncertaintyTicks>=0;
+}
+
+inline
+std::ostream& TscSkewSample::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    cores (reference, measured)          : " << d_referenceCore << ", " << d_core << std::endl;
+  stream << "    offsetTicks                          : " << d_offsetTicks          << std::endl;
+  stream << "    uncertaintyTicks                     : " << d_uncertaintyTicks     << std::endl;
+  stream << "    oneWayTicks                          : " << d_oneWayTicks          << std::endl;
+  stream << "    medianRoundTripTicks                 : " << d_medianRoundTripTicks << std::endl;
+  stream << "    rounds                               : " << d_rounds               << std::endl;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+// CLASS METHODS
+inline
+TscSkewSample TscSkewTable::measure(unsigned referenceCore, unsigned core, unsigned rounds) {
+  assert(rounds>0);
+
+  // The line both sides spin on. 'd_sequence' is '2k+1' once round 'k' starts and '2k+2' once 'b' answered
+  struct alignas(64) Line {
+    std::atomic<uint64_t> d_sequence;
+    std::atomic<uint64_t> d_ticks;
+  } line;
+  line.d_sequence.store(0, std::memory_order_relaxed);
+  line.d_ticks.store(0, std::memory_order_relaxed);
+  std::atomic<unsigned> ready(0);
+
+  // Waiting sides yield after a while so the pair also completes when both threads share a core
+  auto waitFor = [](const std::atomic<uint64_t>& word, uint64_t value) {
+    unsigned spins = 0;
+    while (word.load(std::memory_order_acquire)!=value) {
+      if (++spins==k_spinsBeforeYield) {
+        spins = 0;
+        sched_yield();
+      } else {
+        _mm_pause();
+      }
+    }
+  };
+
+  std::thread responder([&]() {
+    pin(core);
+    ready.fetch_add(1);
+    for (uint64_t k=0; k<rounds; ++k) {
+      waitFor(line.d_sequence, 2*k+1);
+      // lfence keeps 'rdtsc' after the load that saw the flip
+      _mm_lfence();
+      const uint64_t tb = __rdtsc();
+      line.d_ticks.store(tb, std::memory_order_relaxed);
+      line.d_sequence.store(2*k+2, std::memory_order_release);
+    }
+  });
+
+  std::vector<uint64_t> roundTrip(rounds);
+  double lower(-1e300), upper(1e300);
+  std::thread initiator([&]() {
+    pin(referenceCore);
+    ready.fetch_add(1);
+    while (ready.load()!=2) {
+      sched_yield();
+    }
+    for (uint64_t k=0; k<rounds; ++k) {
+      // lfence on both sides so 't0' precedes the store and 't1' follows the load
+      _mm_lfence();
+      const uint64_t t0 = __rdtsc();
+      _mm_lfence();
+      line.d_sequence.store(2*k+1, std::memory_order_release);
+      waitFor(line.d_sequence, 2*k+2);
+      _mm_lfence();
+      const uint64_t t1 = __rdtsc();
+      const uint64_t tb = line.d_ticks.load(std::memory_order_relaxed);
+      roundTrip[k] = t1-t0;
+      lower = std::max(lower, static_cast<double>(static_cast<int64_t>(tb-t1)));
+      upper = std::min(upper, static_cast<double>(static_cast<int64_t>(tb-t0)));
+    }
+  });
+
+  initiator.join();
+  responder.join();
+
+  std::sort(roundTrip.begin(), roundTrip.end());
+  TscSkewSample result;
+  result.d_referenceCore = referenceCore;
+  result.d_core = core;
+  result.d_offsetTicks = (lower+upper)/2;
+  result.d_uncertaintyTicks = (upper-lower)/2;
+  result.d_oneWayTicks = roundTrip[0]/2;
+  result.d_medianRoundTripTicks = roundTrip[rounds/2];
+  result.d_rounds = rounds;
+  return result;
+}
+
+inline
+std::vector<unsigned> TscSkewTable::availableCores() {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  std::vector<unsigned> cores;
+  if (sched_getaffinity(0, sizeof(mask), &mask)==0) {
+    for (unsigned i=0; i<CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &mask)) {
+        cores.push_back(i);
+      }
+    }
+  }
+  return cores;
+}
+
+inline
+bool TscSkewTable::pin(unsigned core) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(core, &mask);
+  return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask)==0;
+}
+
+// CREATORS
+inline
+TscSkewTable::TscSkewTable(unsigned referenceCore)
+: d_referenceCore(referenceCore)
+{
+}
+
+// ACCESSORS
+inline
+unsigned TscSkewTable::referenceCore() const {
+  return d_referenceCore;
+}
+
+inline
+unsigned TscSkewTable::size() const {
+  return static_cast<unsigned>(d_offsetTicks.size());
+}
+
+inline
+double TscSkewTable::offsetTicks(unsigned core) const {
+  return core<d_offsetTicks.size() ? d_offsetTicks[core] : 0.0;
+}
+
+inline
+double TscSkewTable::uncertaintyTicks(unsigned core) const {
+  return core<d_uncertaintyTicks.size() ? d_uncertaintyTicks[core] : 0.0;
+}
+
+inline
+uint64_t TscSkewTable::toReference(uint64_t ticks, unsigned core) const {
+  return core<d_roundedOffset.size() ? ticks-static_cast<uint64_t>(d_roundedOffset[core]) : ticks;
+}
+
+inline
+uint64_t TscSkewTable::referenceTicks() const {
+  unsigned aux;
+  const uint64_t ticks = __rdtscp(&aux);
+  return toReference(ticks, aux&k_coreMask);
+}
+
+inline
+bool TscSkewTable::save(const char *path) const {
+  FILE *fid = fopen(path, "wt");
+  if (fid==0) {
+    return false;
+  }
+  fprintf(fid, "# TSC offsets from core %u: core offsetTicks uncertaintyTicks\n", d_referenceCore);
+  for (unsigned i=0; i<d_offsetTicks.size(); ++i) {
+    fprintf(fid, "%u %.1f %.1f\n", i, d_offsetTicks[i], d_uncertaintyTicks[i]);
+  }
+  return fclose(fid)==0;
+}
+
+// MANIPULATORS
+inline
+void TscSkewTable::set(unsigned core, double offsetTicks, double uncertaintyTicks) {
+  if (core>=d_offsetTicks.size()) {
+    d_offsetTicks.resize(core+1, 0.0);
+    d_uncertaintyTicks.resize(core+1, 0.0);
+    d_roundedOffset.resize(core+1, 0);
+  }
+  d_offsetTicks[core] = offsetTicks;
+  d_uncertaintyTicks[core] = uncertaintyTicks;
+  d_roundedOffset[core] = static_cast<int64_t>(std::llround(offsetTicks));
+}
+
+inline
+void TscSkewTable::measureAll(const std::vector<unsigned>& cores, unsigned rounds) {
+  for (unsigned core: cores) {
+    if (core==d_referenceCore) {
+      set(core, 0.0, 0.0);
+    } else {
+      const TscSkewSample sample = measure(d_referenceCore, core, rounds);
+      set(core, sample.d_offsetTicks, sample.d_uncertaintyTicks);
+    }
+  }
+}
+
+inline
+bool TscSkewTable::load(const char *path) {
+  FILE *fid = fopen(path, "rt");
+  if (fid==0) {
+    return false;
+  }
+  TscSkewTable table;
+  char line[256];
+  bool ok = fgets(line, sizeof(line), fid)!=0 && sscanf(line, "# TSC offsets from core %u", &table.d_referenceCore)==1;
+  while (ok && fgets(line, sizeof(line), fid)) {
+    unsigned core;
+    double offset, uncertainty;
+    ok = sscanf(line, "%u %lf %lf", &core, &offset, &uncertainty)==3;
+    if (ok) {
+      table.set(core, offset, uncertainty);
+    }
+  }
+  fclose(fid);
+  if (ok) {
+    *this = table;
+  }
+  return ok;
+}
+
+// ASPECTS
+inline
+std::ostream& TscSkewTable::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    referenceCore                        : " << d_referenceCore << std::endl;
+  for (unsigned i=0; i<d_offsetTicks.size(); ++i) {
+    char line[128];
+    snprintf(line, sizeof(line), "    core %-4u offsetTicks %10.1f +/- %.1f\n", i, d_offsetTicks[i],
+      d_uncertaintyTicks[i]);
+    stream << line;
+  }
+  stream << "]" << std::endl;
+  return stream;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const TscSkewSample& object) {
+  return object.print(stream);
+}
+
+inline
+std::ostream& operator<<(std::ostream& stream, const TscSkewTable& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
@@ -0,0 +1,602 @@
+#pragma once
+
+// Purpose: Minimal IPv4 UDP socket for the loopback and veth experiments, with batched I/O and kernel timestamps
+//
+// Classes:
+//   Experiment::UdpTimestamps: Kernel software and NIC hardware timestamps of one datagram
+//   Experiment::UdpBatch: Preallocated datagram buffers and 'mmsghdr's for one 'sendmmsg' or 'recvmmsg'
+//   Experiment::UdpSocket: Owns one UDP socket; binds, connects, sends and receives datagrams singly or in batches
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions. Failures are reported through return values, 'isOpen' and 'lastError'.
+//
+// A thin owner of a file descriptor so the experiments read as protocol code rather than socket boilerplate. A
+// failing call returns false or -1 and keeps 'errno' in 'lastError' for the caller to print. 'receive' takes
+// 'MSG_DONTWAIT' per call, so one socket serves a blocking receiver and a sender that polls for ACKs between sends.
+// Buffer sizes matter on loopback: the kernel drops datagrams that do not fit the receiver's buffer, and the
+// queueing in a large buffer is delay that Timely sees as RTT.
+//
+// One 'sendto' or 'recvfrom' per datagram costs a system call each, about 1-2us, and caps a core at a few hundred
+// thousand datagrams per second. 'sendBatch' and 'receiveBatch' move up to a 'UdpBatch' of datagrams per call with
+// 'sendmmsg' and 'recvmmsg'. A 'UdpBatch' owns its buffers, 'iovec's and addresses, so a batch allocates nothing
+// after construction. Anything stamped into a datagram is written per datagram while the batch is filled; the
+// system call then sends them back to back. A receiver should stamp once when 'receiveBatch' returns.
+//
+// 'setBusyPollUs' sets 'SO_BUSY_POLL' (kernel 'Documentation/networking/napi.rst'). A blocking receive on an empty
+// socket then polls the device queue for that long before sleeping, which saves a wakeup on a NIC with NAPI.
+// Loopback and veth have no device queue to poll. Raising it above 'net.core.busy_read' needs 'CAP_NET_ADMIN'.
+// 'setNonBlocking(true)' makes every call return 'EAGAIN' instead of sleeping, for a loop spinning on a dedicated
+// core.
+//
+// 'setTimestamping' turns on 'SO_TIMESTAMPING' (kernel 'Documentation/networking/timestamping.rst'). The kernel then
+// stamps each datagram received as it enters the stack, and each datagram sent as the driver takes it. With an
+// interface name it also configures that NIC with 'SIOCSHWTSTAMP' and asks for its raw hardware stamps. Receive
+// stamps arrive as control messages, so a 'UdpBatch' made with 'timestamps' reserves control space per datagram and
+// 'timestamps(i)' parses them. Send stamps are queued on the socket's error queue, read with 'receiveErrorQueue'.
+// 'SOF_TIMESTAMPING_OPT_ID' keys each with the count of datagrams sent on the socket before it, and
+// 'SOF_TIMESTAMPING_OPT_TSONLY' keeps the payload off the error queue. Software stamps are 'CLOCK_REALTIME'; hardware
+// stamps are the NIC's clock. Differences of stamps from one clock are meaningful, absolute values are not.
+
+#include <assert.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace Experiment {
+
+struct UdpTimestamps {
+  // DATA
+  uint64_t                      d_softwareNs;       // kernel stamp, 'CLOCK_REALTIME' ns, or 0 if none
+  uint64_t                      d_hardwareNs;       // NIC raw hardware stamp ns, or 0 if none
+  uint32_t                      d_id;               // 'SOF_TIMESTAMPING_OPT_ID' key of a send stamp
+  bool                          d_hasId;            // true if 'd_id' is set: this is a send stamp
+};
+
+class UdpBatch {
+  // CONSTANTS
+  enum {
+    k_controlBytes = 256                            // control space per datagram; fits stamps and an extended error
+  };
+
+  // DATA
+  uint32_t                      d_datagramBytes;    // buffer size of each datagram
+  uint32_t                      d_controlBytes;     // 'k_controlBytes' or 0 if not receiving timestamps
+  std::vector<char>             d_buffers;          // 'capacity' buffers of 'd_datagramBytes'
+  std::vector<char>             d_control;          // 'capacity' control buffers of 'd_controlBytes'
+  std::vector<iovec>            d_iovecs;           // one per datagram
+  std::vector<sockaddr_in>      d_addresses;        // source after a receive, or destination of a send
+  std::vector<mmsghdr>          d_messages;         // one per datagram
+
+  // FRIENDS
+  friend class UdpSocket;
+
+  // PRIVATE MANIPULATORS
+  void prepareReceive();
+    // Make every datagram receive up to 'd_datagramBytes' and record its source and, if enabled, its control
+    // messages
+
+public:
+  // CREATORS
+  UdpBatch(unsigned capacity, uint32_t datagramBytes, bool timestamps = false);
+    // Create a batch of 'capacity' datagrams of up to 'datagramBytes' each, with space for the timestamps of each
+    // received if 'timestamps'. Behavior is defined provided 'capacity>0' and 'capacity<=1024', the kernel's
+    // 'UIO_MAXIOV'
+
+  UdpBatch(const UdpBatch& other) = delete;
+    // Copy constructor not provided
+
+  ~UdpBatch() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  unsigned capacity() const;
+    // Return datagrams in the batch
+
+  uint32_t datagramBytes() const;
+    // Return buffer size of each datagram
+
+  const char *data(unsigned index) const;
+    // Return buffer of datagram 'index'
+
+  uint32_t length(unsigned index) const;
+    // Return size of datagram 'index' as received
+
+  const sockaddr_in& from(unsigned index) const;
+    // Return source of datagram 'index' as received
+
+  bool timestamps(unsigned index, UdpTimestamps *result) const;
+    // Set 'result' to the timestamps received with datagram 'index', zero where absent. Return true if a software
+    // or hardware stamp was present. Always false for a batch made without 'timestamps'
+
+  // MANIPULATORS
+  char *data(unsigned index);
+    // Return buffer of datagram 'index'
+
+  void setSend(unsigned index, uint32_t bytes);
+    // Make datagram 'index' send its first 'bytes' to the connected peer
+
+  void setSendTo(unsigned index, uint32_t bytes, const sockaddr_in& peer);
+    // Make datagram 'index' send its first 'bytes' to 'peer'
+
+  UdpBatch& operator=(const UdpBatch& rhs) = delete;
+    // Assignment operator not provided
+};
+
+class UdpSocket {
+  // DATA
+  int                           d_fd;               // socket or -1
+  int                           d_lastError;        // 'errno' of the last failed call or 0
+
+  // PRIVATE MANIPULATORS
+  bool fail();
+    // Save 'errno' in 'd_lastError' and return false
+
+public:
+  // CLASS METHODS
+  static uint64_t toNs(const timespec& time);
+    // Return 'time' in nanoseconds
+
+  static bool makeAddress(const char *address, uint16_t port, sockaddr_in *result);
+    // Set 'result' to IPv4 'address' (dotted quad) and 'port' returning true, or return false if 'address' is not
+    // a dotted quad
+
+  // CREATORS
+  UdpSocket();
+    // Create an object without a socket
+
+  UdpSocket(const UdpSocket& other) = delete;
+    // Copy constructor not provided
+
+  ~UdpSocket();
+    // Close the socket if open and destroy this object
+
+  // ACCESSORS
+  bool isOpen() const;
+    // Return true if this object owns a socket
+
+  int fd() const;
+    // Return the socket or -1
+
+  int lastError() const;
+    // Return 'errno' of the last failed call or 0
+
+  uint16_t localPort() const;
+    // Return the port bound, or 0 if not open or not bound
+
+  // MANIPULATORS
+  bool open(const char *address, uint16_t port);
+    // Create a socket bound to 'address' and 'port', closing any socket already owned. Port 0 picks a free port.
+    // Return true on success
+
+  bool connect(const char *address, uint16_t port);
+    // Make 'address' and 'port' the default destination and the only source received from. Return true on success
+
+  bool setBufferBytes(int sendBytes, int receiveBytes);
+    // Ask the kernel for send and receive buffers of the specified sizes. Return true on success
+
+  bool setReceiveTimeoutUs(uint64_t us);
+    // Make a blocking 'receive' give up after 'us' microseconds; 0 waits forever. Return true on success
+
+  int send(const void *data, std::size_t bytes);
+    // Send 'bytes' of 'data' to the connected peer. Return bytes sent or -1
+
+  int sendTo(const void *data, std::size_t bytes, const sockaddr_in& peer);
+    // Send 'bytes' of 'data' to 'peer'. Return bytes sent or -1
+
+  int receive(void *data, std::size_t bytes, bool wait, sockaddr_in *from = 0);
+    // Receive one datagram of up to 'bytes' into 'data', waiting for one if 'wait', and set 'from' to its sender if
+    // not 0. Return its size, or -1 with 'lastError()' 'EAGAIN' if none arrived
+
+  int sendBatch(UdpBatch& batch, unsigned count);
+    // Send datagrams '[0, count)' of 'batch' as set by 'setSend' or 'setSendTo' with as few 'sendmmsg' calls as
+    // the kernel allows. Return datagrams sent, which is less than 'count' if the socket would block, or -1 if the
+    // first call failed. Behavior is defined provided 'count<=batch.capacity()'
+
+  int receiveBatch(UdpBatch& batch, bool wait);
+    // Receive up to 'batch.capacity()' datagrams already queued into 'batch' with one 'recvmmsg', first waiting
+    // for one if 'wait'. Return datagrams received, or -1 with 'lastError()' 'EAGAIN' if none arrived
+
+  bool setNonBlocking(bool nonBlocking);
+    // Make every call return 'EAGAIN' rather than wait if 'nonBlocking'. Return true on success
+
+  bool setBusyPollUs(unsigned us);
+    // Set 'SO_BUSY_POLL' to 'us' microseconds. Return true on success
+
+  bool setTimestamping(const char *interface = 0);
+    // Ask for kernel software stamps on every datagram sent and received, send stamps keyed by
+    // 'SOF_TIMESTAMPING_OPT_ID'. If 'interface' is not 0 also enable hardware stamping of all packets on it and ask
+    // for its raw hardware stamps. Return true on success. Needs 'CAP_NET_ADMIN' for 'interface'. Send stamps count
+    // datagrams from this call on
+
+  int receiveErrorQueue(UdpBatch& batch);
+    // Receive up to 'batch.capacity()' queued send timestamps into 'batch' without waiting. Each datagram's
+    // 'timestamps' then gives its stamp and 'd_id'. Return datagrams received, or -1 with 'lastError()' 'EAGAIN' if
+    // none were queued. Behavior is defined provided 'batch' was made with 'timestamps'
+
+  void close();
+    // Close the socket if open
+
+  UdpSocket& operator=(const UdpSocket& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// UdpBatch
+// PRIVATE MANIPULATORS
+inline
+void UdpBatch::prepareReceive() {
+  for (unsigned i=0; i<d_messages.size(); ++i) {
+    d_iovecs[i].iov_len = d_datagramBytes;
+    d_messages[i].msg_hdr.msg_name = &d_addresses[i];
+    d_messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    d_messages[i].msg_hdr.msg_control = d_controlBytes ? &d_control[static_cast<std::size_t>(i)*d_controlBytes] : 0;
+    d_messages[i].msg_hdr.msg_controllen = d_controlBytes;
+    d_messages[i].msg_len = 0;
+  }
+}
+
+// CREATORS
+inline
+UdpBatch::UdpBatch(unsigned capacity, uint32_t datagramBytes, bool timestamps)
+: d_datagramBytes(datagramBytes)
+, d_controlBytes(timestamps ? k_controlBytes : 0)
+, d_buffers(static_cast<std::size_t>(capacity)*datagramBytes, 0)
+, d_control(static_cast<std::size_t>(capacity)*d_controlBytes, 0)
+, d_iovecs(capacity)
+, d_addresses(capacity)
+, d_messages(capacity)
+{
+  assert(capacity>0 && capacity<=1024);
+  memset(d_messages.data(), 0, d_messages.size()*sizeof(mmsghdr));
+  memset(d_addresses.data(), 0, d_addresses.size()*sizeof(sockaddr_in));
+  for (unsigned i=0; i<capacity; ++i) {
+    d_iovecs[i].iov_base = &d_buffers[static_cast<std::size_t>(i)*datagramBytes];
+    d_iovecs[i].iov_len = datagramBytes;
+    d_messages[i].msg_hdr.msg_iov = &d_iovecs[i];
+    d_messages[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+// ACCESSORS
+inline
+unsigned UdpBatch::capacity() const {
+  return static_cast<unsigned>(d_messages.size());
+}
+
+inline
+uint32_t UdpBatch::datagramBytes() const {
+  return d_datagramBytes;
+}
+
+inline
+const char *UdpBatch::data(unsigned index) const {
+  assert(index<d_messages.size());
+  return static_cast<const char*>(d_iovecs[index].iov_base);
+}
+
+inline
+uint32_t UdpBatch::length(unsigned index) const {
+  assert(index<d_messages.size());
+  return d_messages[index].msg_len;
+}
+
+inline
+const sockaddr_in& UdpBatch::from(unsigned index) const {
+  assert(index<d_messages.size());
+  return d_addresses[index];
+}
+
+inline
+bool UdpBatch::timestamps(unsigned index, UdpTimestamps *result) const {
+  assert(index<d_messages.size());
+  assert(result);
+  memset(result, 0, sizeof(*result));
+  if (d_controlBytes==0) {
+    return false;
+  }
+  // 'CMSG_NXTHDR' takes a non-const header but only reads it
+  msghdr *header = const_cast<msghdr*>(&d_messages[index].msg_hdr);
+  bool found = false;
+  for (cmsghdr *message = CMSG_FIRSTHDR(header); message; message = CMSG_NXTHDR(header, message)) {
+    if (message->cmsg_level==SOL_SOCKET && message->cmsg_type==SCM_TIMESTAMPING) {
+      // ts[0] is the software stamp, ts[1] is unused, ts[2] is the raw hardware stamp
+      scm_timestamping stamps;
+      memcpy(&stamps, CMSG_DATA(message), sizeof(stamps));
+      result->d_softwareNs = UdpSocket::toNs(stamps.ts[0]);
+      result->d_hardwareNs = UdpSocket::toNs(stamps.ts[2]);
+      found = result->d_softwareNs || result->d_hardwareNs;
+    } else if (message->cmsg_level==SOL_IP && message->cmsg_type==IP_RECVERR) {
+      sock_extended_err error;
+      memcpy(&error, CMSG_DATA(message), sizeof(error));
+      if (error.ee_origin==SO_EE_ORIGIN_TIMESTAMPING) {
+        result->d_id = error.ee_data;
+        result->d_hasId = true;
+      }
+    }
+  }
+  return found;
+}
+
+// MANIPULATORS
+inline
+char *UdpBatch::data(unsigned index) {
+  assert(index<d_messages.size());
+  return static_cast<char*>(d_iovecs[index].iov_base);
+}
+
+inline
+void UdpBatch::setSend(unsigned index, uint32_t bytes) {
+  assert(index<d_messages.size());
+  assert(bytes<=d_datagramBytes);
+  d_iovecs[index].iov_len = bytes;
+  d_messages[index].msg_hdr.msg_name = 0;
+  d_messages[index].msg_hdr.msg_namelen = 0;
+  d_messages[index].msg_hdr.msg_control = 0;
+  d_messages[index].msg_hdr.msg_controllen = 0;
+}
+
+inline
+void UdpBatch::setSendTo(unsigned index, uint32_t bytes, const sockaddr_in& peer) {
+  assert(index<d_messages.size());
+  assert(bytes<=d_datagramBytes);
+  d_iovecs[index].iov_len = bytes;
+  d_addresses[index] = peer;
+  d_messages[index].msg_hdr.msg_name = &d_addresses[index];
+  d_messages[index].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+  d_messages[index].msg_hdr.msg_control = 0;
+  d_messages[index].msg_hdr.msg_controllen = 0;
+}
+
+// UdpSocket
+// PRIVATE MANIPULATORS
+inline
+bool UdpSocket::fail() {
+  d_lastError = errno;
+  return false;
+}
+
+// CLASS METHODS
+inline
+uint64_t UdpSocket::toNs(const timespec& time) {
+  return static_cast<uint64_t>(time.tv_sec)*1000000000ull+static_cast<uint64_t>(time.tv_nsec);
+}
+
+inline
+bool UdpSocket::makeAddress(const char *address, uint16_t port, sockaddr_in *result) {
+  assert(address);
+  assert(result);
+  memset(result, 0, sizeof(*result));
+  result->sin_family = AF_INET;
+  result->sin_port = htons(port);
+  return inet_pton(AF_INET, address, &result->sin_addr)==1;
+}
+
+// CREATORS
+inline
+UdpSocket::UdpSocket()
+: d_fd(-1)
+, d_lastError(0)
+{
+}
+
+inline
+UdpSocket::~UdpSocket() {
+  close();
+}
+
+// ACCESSORS
+inline
+bool UdpSocket::isOpen() const {
+  return d_fd>=0;
+}
+
+inline
+int UdpSocket::fd() const {
+  return d_fd;
+}
+
+inline
+int UdpSocket::lastError() const {
+  return d_lastError;
+}
+
+inline
+uint16_t UdpSocket::localPort() const {
+  sockaddr_in local;
+  socklen_t length = sizeof(local);
+  if (d_fd<0 || getsockname(d_fd, reinterpret_cast<sockaddr*>(&local), &length)!=0) {
+    return 0;
+  }
+  return ntohs(local.sin_port);
+}
+
+// MANIPULATORS
+inline
+bool UdpSocket::open(const char *address, uint16_t port) {
+  close();
+  sockaddr_in local;
+  if (!makeAddress(address, port, &local)) {
+    d_lastError = EINVAL;
+    return false;
+  }
+  d_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (d_fd<0) {
+    return fail();
+  }
+  const int one = 1;
+  if (setsockopt(d_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))!=0 ||
+      bind(d_fd, reinterpret_cast<const sockaddr*>(&local), sizeof(local))!=0) {
+    fail();
+    ::close(d_fd);
+    d_fd = -1;
+    return false;
+  }
+  d_lastError = 0;
+  return true;
+}
+
+inline
+bool UdpSocket::connect(const char *address, uint16_t port) {
+  sockaddr_in peer;
+  if (!makeAddress(address, port, &peer)) {
+    d_lastError = EINVAL;
+    return false;
+  }
+  if (::connect(d_fd, reinterpret_cast<const sockaddr*>(&peer), sizeof(peer))!=0) {
+    return fail();
+  }
+  return true;
+}
+
+inline
+bool UdpSocket::setBufferBytes(int sendBytes, int receiveBytes) {
+  if (setsockopt(d_fd, SOL_SOCKET, SO_SNDBUF, &sendBytes, sizeof(sendBytes))!=0 ||
+      setsockopt(d_fd, SOL_SOCKET, SO_RCVBUF, &receiveBytes, sizeof(receiveBytes))!=0) {
+    return fail();
+  }
+  return true;
+}
+
+inline
+bool UdpSocket::setReceiveTimeoutUs(uint64_t us) {
+  timeval timeout;
+  timeout.tv_sec = static_cast<time_t>(us/1000000);
+  timeout.tv_usec = static_cast<suseconds_t>(us%1000000);
+  if (setsockopt(d_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))!=0) {
+    return fail();
+  }
+  return true;
+}
+
+inline
+int UdpSocket::send(const void *data, std::size_t bytes) {
+  const ssize_t rc = ::send(d_fd, data, bytes, 0);
+  if (rc<0) {
+    fail();
+  }
+  return static_cast<int>(rc);
+}
+
+inline
+int UdpSocket::sendTo(const void *data, std::size_t bytes, const sockaddr_in& peer) {
+  const ssize_t rc = ::sendto(d_fd, data, bytes, 0, reinterpret_cast<const sockaddr*>(&peer), sizeof(peer));
+  if (rc<0) {
+    fail();
+  }
+  return static_cast<int>(rc);
+}
+
+inline
+int UdpSocket::receive(void *data, std::size_t bytes, bool wait, sockaddr_in *from) {
+  socklen_t length = sizeof(sockaddr_in);
+  const ssize_t rc = ::recvfrom(d_fd, data, bytes, wait ? 0 : MSG_DONTWAIT, reinterpret_cast<sockaddr*>(from),
+    from ? &length : 0);
+  if (rc<0) {
+    fail();
+  }
+  return static_cast<int>(rc);
+}
+
+inline
+int UdpSocket::sendBatch(UdpBatch& batch, unsigned count) {
+  assert(count<=batch.capacity());
+  unsigned sent = 0;
+  while (sent<count) {
+    const int rc = sendmmsg(d_fd, &batch.d_messages[sent], count-sent, 0);
+    if (rc<0) {
+      fail();
+      return sent ? static_cast<int>(sent) : -1;
+    }
+    sent += static_cast<unsigned>(rc);
+  }
+  return static_cast<int>(sent);
+}
+
+inline
+int UdpSocket::receiveBatch(UdpBatch& batch, bool wait) {
+  batch.prepareReceive();
+  const int rc = recvmmsg(d_fd, batch.d_messages.data(), batch.capacity(), wait ? MSG_WAITFORONE : MSG_DONTWAIT, 0);
+  if (rc<0) {
+    fail();
+  }
+  return rc;
+}
+
+inline
+bool UdpSocket::setNonBlocking(bool nonBlocking) {
+  const int flags = fcntl(d_fd, F_GETFL, 0);
+  if (flags<0 || fcntl(d_fd, F_SETFL, nonBlocking ? flags|O_NONBLOCK : flags&~O_NONBLOCK)!=0) {
+    return fail();
+  }
+  return true;
+}
+
+inline
+bool UdpSocket::setBusyPollUs(unsigned us) {
+  const int value = static_cast<int>(us);
+  if (setsockopt(d_fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value))!=0) {
+    return fail();
+  }
+  return true;
+}
+
+inline
+bool UdpSocket::setTimestamping(const char *interface) {
+  unsigned flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+    SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+  if (interface) {
+    hwtstamp_config config;
+    memset(&config, 0, sizeof(config));
+    config.tx_type = HWTSTAMP_TX_ON;
+    config.rx_filter = HWTSTAMP_FILTER_ALL;
+    ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, interface, sizeof(request.ifr_name)-1);
+    request.ifr_data = reinterpret_cast<char*>(&config);
+    if (ioctl(d_fd, SIOCSHWTSTAMP, &request)!=0) {
+      return fail();
+    }
+    flags |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+  }
+  const int value = static_cast<int>(flags);
+  if (setsockopt(d_fd, SOL_SOCKET, SO_TIMESTAMPING, &value, sizeof(value))!=0) {
+    return fail();
+  }
+  return true;
+}
+
+inline
+int UdpSocket::receiveErrorQueue(UdpBatch& batch) {
+  assert(batch.d_controlBytes);
+  batch.prepareReceive();
+  const int rc = recvmmsg(d_fd, batch.d_messages.data(), batch.capacity(), MSG_ERRQUEUE | MSG_DONTWAIT, 0);
+  if (rc<0) {
+    fail();
+  }
+  return rc;
+}
+
+inline
+void UdpSocket::close() {
+  if (d_fd>=0) {
+    ::close(d_fd);
+    d_fd = -1;
+  }
+}
+
+} // namespace Experiment
@@ -0,0 +1,82 @@
+#pragma once
+
+// Purpose: Datagram formats of the UDP sender/receiver experiments
+//
+// Classes:
+//   Experiment::UdpMessageHeader: First bytes of every datagram: magic, type and session
+//   Experiment::UdpData: Header of a data datagram, followed by payload
+//   Experiment::UdpAck: Acknowledgement of one data datagram echoing its send timestamp
+//   Experiment::UdpReliableData: Header of a sequenced data datagram of a reliable session, followed by payload
+//   Experiment::UdpSack: Cumulative and selective acknowledgement of a reliable session echoing a send timestamp
+//
+// Thread Safety: thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// The sender stamps each data datagram with its own TSC just before the send. The receiver echoes that stamp in the
+// ACK unchanged, so the sender computes the RTT from two reads of one TSC. The two hosts' clocks need not agree,
+// and the receiver's own stamp is only used to report its turnaround time. 'd_sendIndex' is echoed the same way: it
+// is the key the sender's kernel gives the datagram's send timestamp (see 'UdpSocket::setTimestamping'). Fields are
+// in host byte order. These experiments run both ends on one box or between namespaces of one box; 'k_magic' catches
+// anything else.
+
+#include <cstdint>
+
+namespace Experiment {
+
+struct UdpMessageHeader {
+  // CONSTANTS
+  static constexpr uint32_t k_magic = 0x54494d31;   // "TIM1"
+
+  // TYPES
+  enum Type {
+    e_DATA = 1,                                     // 'UdpData' and payload
+    e_ACK = 2,                                      // 'UdpAck'
+    e_FIN = 3,                                      // sender is done; receiver reports and exits
+    e_RDATA = 4,                                    // 'UdpReliableData' and payload
+    e_SACK = 5                                      // 'UdpSack'
+  };
+
+  // DATA
+  uint32_t                      d_magic;            // 'k_magic'
+  uint16_t                      d_type;             // 'Type'
+  uint16_t                      d_session;          // sender's session
+};
+
+struct UdpData {
+  // DATA
+  UdpMessageHeader              d_header;           // 'e_DATA'
+  uint32_t                      d_bytes;            // datagram size including this header
+  uint32_t                      d_sendIndex;        // datagrams the sender sent before this one, modulo 2^32
+  uint64_t                      d_sequence;         // per session, from 0
+  uint64_t                      d_sendTicks;        // sender TSC just before the send
+};
+
+struct UdpAck {
+  // DATA
+  UdpMessageHeader              d_header;           // 'e_ACK'
+  uint32_t                      d_bytes;            // size of the datagram acknowledged
+  uint32_t                      d_sendIndex;        // echo of 'UdpData::d_sendIndex'
+  uint64_t                      d_sequence;         // sequence acknowledged
+  uint64_t                      d_sendTicks;        // echo of 'UdpData::d_sendTicks'
+  uint64_t                      d_turnaroundTicks;  // receiver TSC from receive return to ACK send
+};
+
+struct UdpReliableData {
+  // DATA
+  UdpMessageHeader              d_header;           // 'e_RDATA'
+  uint32_t                      d_bytes;            // datagram size including this header
+  uint32_t                      d_sequence;         // per session, from 0, modulo 2^32
+  uint64_t                      d_sendTicks;        // sender TSC just before this transmission
+};
+
+struct UdpSack {
+  // DATA
+  UdpMessageHeader              d_header;           // 'e_SACK'
+  uint32_t                      d_cumulative;       // every sequence before this was received
+  uint32_t                      d_sequence;         // sequence of the datagram this answers
+  uint64_t                      d_sendTicks;        // echo of that datagram's 'd_sendTicks'
+  uint64_t                      d_sackBits;         // bit 'i' set if 'd_cumulative+1+i' was received
+};
+
+} // namespace Experiment
@@ -0,0 +1,225 @@
+#pragma once
+
+// Purpose: Fixed size thread pool where idle workers steal queued tasks from busy ones
+//
+// Classes:
+//   Experiment::WorkStealingPool: Runs submitted tasks on a fixed set of worker threads
+//
+// Thread Safety: thread-safe. 'submit' may be called from any thread including from inside a running task. 'wait'
+// must not be called from inside a task.
+//
+// Exception Policy: No exceptions. Tasks must not throw.
+//
+// Each worker owns a deque of tasks guarded by its own mutex. A worker pops the newest task from the back of its own
+// deque. When that is empty it steals the oldest task from the front of another worker's deque, scanning from its
+// right neighbour. Tasks submitted from outside the pool are dealt round robin onto the deques. Tasks submitted by a
+// task go on the submitting worker's deque. So a worker that is handed long jobs does not hold up short ones queued
+// behind it. The per deque mutex is uncontended unless a thief visits. It is cheap next to the coarse jobs this
+// pool is for, e.g. one simulation run per task. Workers with nothing to run or steal sleep on a condition variable.
+//
+// Tasks finish in no fixed order and on any worker. For output that does not depend on the thread count, size a
+// results vector before submitting, have each task write only its own slots, and read it after 'wait'.
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Experiment {
+
+class WorkStealingPool {
+public:
+  // TYPES
+  typedef std::function<void()> Task;
+
+private:
+  struct Queue {
+    std::mutex                  d_lock;             // guards 'd_tasks'
+    std::deque<Task>            d_tasks;            // owner pops back; thieves pop front
+  };
+
+  // DATA
+  std::vector<std::unique_ptr<Queue>> d_queues;     // one per worker
+  std::vector<std::thread>      d_threads;          // workers
+  std::mutex                    d_lock;             // guards sleeping and 'd_stop'
+  std::condition_variable       d_workCv;           // signalled when a task is queued or on stop
+  std::condition_variable       d_doneCv;           // signalled when 'd_unfinished' drops to 0
+  std::atomic<uint64_t>         d_queued;           // tasks queued but not yet taken by a worker
+  std::atomic<uint64_t>         d_unfinished;       // tasks submitted but not yet completed
+  std::atomic<uint64_t>         d_steals;           // tasks run by a worker other than the one queued on
+  std::atomic<unsigned>         d_next;             // round robin deque for external 'submit'
+  bool                          d_stop;             // true when workers should exit
+
+  static thread_local const WorkStealingPool *s_pool_p; // pool of the calling worker thread, if any
+  static thread_local unsigned  s_worker;           // index of the calling worker thread in 's_pool_p'
+
+  // PRIVATE MANIPULATORS
+  bool take(unsigned worker, Task& task);
+    // Load into 'task' the newest task of 'worker's own deque or failing that a task stolen from another deque.
+    // Return false if every deque was empty
+
+  void run(unsigned worker);
+    // Worker thread body
+
+public:
+  // CREATORS
+  explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency());
+    // Create a pool of 'threads' workers, or one if 'threads' is 0
+
+  WorkStealingPool(const WorkStealingPool& other) = delete;
+    // Copy constructor not provided
+
+  ~WorkStealingPool();
+    // Run all tasks already submitted then stop and join the workers
+
+  // ACCESSORS
+  unsigned threadCount() const;
+    // Return the number of worker threads
+
+  uint64_t steals() const;
+    // Return the number of tasks run by a worker that stole them
+
+  // MANIPULATORS
+  void submit(Task task);
+    // Queue 'task' to run on some worker
+
+  void wait();
+    // Block until every task submitted so far, and every task they submit, has completed
+
+  WorkStealingPool& operator=(const WorkStealingPool& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+inline thread_local const WorkStealingPool *WorkStealingPool::s_pool_p = 0;
+inline thread_local unsigned WorkStealingPool::s_worker = 0;
+
+// CREATORS
+inline
+WorkStealingPool::WorkStealingPool(unsigned threads)
+: d_queued(0)
+, d_unfinished(0)
+, d_steals(0)
+, d_next(0)
+, d_stop(false)
+{
+  threads = std::max(1u, threads);
+  for (unsigned i=0; i<threads; ++i) {
+    d_queues.emplace_back(new Queue);
+  }
+  for (unsigned i=0; i<threads; ++i) {
+    d_threads.emplace_back([this, i]() { run(i); });
+  }
+}
+
+inline
+WorkStealingPool::~WorkStealingPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> guard(d_lock);
+    d_stop = true;
+  }
+  d_workCv.notify_all();
+  for (std::thread& thread: d_threads) {
+    thread.join();
+  }
+}
+
+// ACCESSORS
+inline
+unsigned WorkStealingPool::threadCount() const {
+  return static_cast<unsigned>(d_threads.size());
+}
+
+inline
+uint64_t WorkStealingPool::steals() const {
+  return d_steals.load(std::memory_order_relaxed);
+}
+
+// PRIVATE MANIPULATORS
+inline
+bool WorkStealingPool::take(unsigned worker, Task& task) {
+  {
+    Queue& own = *d_queues[worker];
+    std::lock_guard<std::mutex> guard(own.d_lock);
+    if (!own.d_tasks.empty()) {
+      task = std::move(own.d_tasks.back());
+      own.d_tasks.pop_back();
+      --d_queued;
+      return true;
+    }
+  }
+
+  const unsigned count = threadCount();
+  for (unsigned i=1; i<count; ++i) {
+    Queue& victim = *d_queues[(worker+i)%count];
+    std::lock_guard<std::mutex> guard(victim.d_lock);
+    if (!victim.d_tasks.empty()) {
+      task = std::move(victim.d_tasks.front());
+      victim.d_tasks.pop_front();
+      --d_queued;
+      d_steals.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline
+void WorkStealingPool::run(unsigned worker) {
+  s_pool_p = this;
+  s_worker = worker;
+
+  Task task;
+  for (;;) {
+    if (take(worker, task)) {
+      task();
+      task = nullptr;
+      if (--d_unfinished==0) {
+        std::lock_guard<std::mutex> guard(d_lock);
+        d_doneCv.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(d_lock);
+    d_workCv.wait(guard, [this]() { return d_stop || d_queued.load()>0; });
+    if (d_stop && d_queued.load()==0) {
+      return;
+    }
+  }
+}
+
+// MANIPULATORS
+inline
+void WorkStealingPool::submit(Task task) {
+  const unsigned worker = (s_pool_p==this) ? s_worker : d_next.fetch_add(1, std::memory_order_relaxed)%threadCount();
+
+  ++d_unfinished;
+  {
+    Queue& queue = *d_queues[worker];
+    std::lock_guard<std::mutex> guard(queue.d_lock);
+    queue.d_tasks.push_back(std::move(task));
+    ++d_queued;
+  }
+
+  // Taking 'd_lock' orders this notify after any worker's predicate check so the wakeup cannot be lost
+  std::lock_guard<std::mutex> guard(d_lock);
+  d_workCv.notify_one();
+}
+
+inline
+void WorkStealingPool::wait() {
+  assert(s_pool_p!=this);
+  std::unique_lock<std::mutex> guard(d_lock);
+  d_doneCv.wait(guard, [this]() { return d_unfinished.load()==0; });
+}
+
+} // namespace Experiment
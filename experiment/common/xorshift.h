@@ -0,0 +1,37 @@
+#pragma once
+
+// Purpose: Repeatable pseudo random draws for the simulators and their scenarios
+//
+// Functions:
+//   Experiment::nextRandom: Advance an xorshift64* state and return the next 64 bit value
+//   Experiment::nextUniform: Advance an xorshift64* state and return a draw in [0, 1)
+//
+// Thread Safety: thread-safe provided each thread uses its own state.
+//
+// Exception Policy: No exceptions
+//
+// The std distributions may give different sequences on different standard libraries, so a simulator run would not
+// be repeatable from one platform to the next. xorshift64* (Vigna) is three shifts and a multiply, and gives the
+// same sequence everywhere. A state must never be 0.
+
+#include <assert.h>
+#include <cstdint>
+
+namespace Experiment {
+
+inline
+uint64_t nextRandom(uint64_t *state) {
+  assert(*state!=0);
+  *state ^= *state>>12;
+  *state ^= *state<<25;
+  *state ^= *state>>27;
+  return *state*0x2545f4914f6cdd1dull;
+}
+
+inline
+double nextUniform(uint64_t *state) {
+  // The top 53 bits fill a double's significand exactly
+  return (nextRandom(state)>>11)*(1.0/9007199254740992.0);
+}
+
+} // namespace Experiment
@@ -0,0 +1,168 @@
+#include <dcqcn.h>
+#include <timely.h>
+
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Direct checks of the DCQCN reaction point in 'dcqcn.h', one rule at a time: timers that start at the first ACK, the
+// CNP cut by alpha/2, at most one CNP per 50us, alpha decay, the move from fast recovery to additive to hyper
+// increase, and the hybrid's hand-off to DCQCN on a mark and hand-back to Timely once marks stop. Every expected rate
+// follows from the constants by hand, so the program compares exactly. It exits non-zero if any check fails.
+
+typedef Experiment::Dcqcn<Experiment::DcqcnParams> Dcqcn;
+typedef Experiment::Dcqcn<Experiment::DcqcnHybridParams> DcqcnHybrid;
+typedef Experiment::Timely<Experiment::TimelyErpcParams> TimelyErpc;
+
+const double kRttUs = 40;                           // RTT of every ACK; DCQCN without the hybrid ignores it
+const double kStartUs = 400000;                     // first ACK, long after time 0
+
+unsigned failures = 0;
+
+void checkEqual(const char *what, double got, double expected) {
+  printf("%-52s %16.10g %16.10g  %s\n", what, got, expected, got==expected ? "ok" : "FAIL");
+  failures += got!=expected;
+}
+
+// The first ACK comes long after time 0. It must not count that time as increase events or bytes sent
+void testLateStart() {
+  Dcqcn dcqcn(1);
+  const double start = dcqcn.rate();
+  dcqcn.update(kRttUs, kStartUs);
+  checkEqual("late start: rate after the first ACK", dcqcn.rate(), start);
+  dcqcn.update(kRttUs, kStartUs+10);
+  checkEqual("late start: rate 10us later", dcqcn.rate(), start);
+  checkEqual("late start: target rate", dcqcn.targetRate(), start);
+}
+
+// A CNP sets the target to the current rate and cuts the current rate by alpha/2. A second mark within 50us of the
+// CNP is ignored. Without a CNP alpha decays by 1-g per 55us, and each 55us is one increase event. Fast recovery
+// halves the gap to the target for 5 events, then each event adds 5MB/s to the target until the byte counter has
+// also counted 5 events of 10MB. From then on each event adds a multiple of 25MB/s
+void testStateMachine() {
+  const double g = Dcqcn::k_g;
+  const double additive = Dcqcn::k_additiveBps;
+  const double hyper = Dcqcn::k_hyperBps;
+  Dcqcn dcqcn(9);
+  const double start = dcqcn.rate();
+  double now = kStartUs;
+  dcqcn.update(kRttUs, now);
+
+  now += 10;
+  dcqcn.update(kRttUs, now, true);
+  const double firstCnpUs = now;
+  checkEqual("CNP: rate cut by alpha/2 with alpha 1", dcqcn.rate(), start*0.5);
+  checkEqual("CNP: target is the rate before the cut", dcqcn.targetRate(), start);
+  checkEqual("CNP: alpha = (1-g)*alpha+g", dcqcn.alpha(), (1-g)*1+g);
+  checkEqual("CNP: count", static_cast<double>(dcqcn.cnps()), 1);
+
+  now = firstCnpUs+Dcqcn::k_cnpIntervalUs-1;
+  dcqcn.update(kRttUs, now, true);
+  checkEqual("CNP limit: mark 49us after a CNP is ignored", static_cast<double>(dcqcn.cnps()), 1);
+  checkEqual("CNP limit: rate unchanged", dcqcn.rate(), start*0.5);
+  now = firstCnpUs+Dcqcn::k_cnpIntervalUs;
+  dcqcn.update(kRttUs, now, true);
+  const double cnpUs = now;
+  checkEqual("CNP limit: mark 50us after a CNP is acted on", static_cast<double>(dcqcn.cnps()), 2);
+  checkEqual("CNP limit: rate cut again", dcqcn.rate(), start*0.25);
+  checkEqual("CNP limit: target is the rate before the cut", dcqcn.targetRate(), start*0.5);
+
+  // Three timer periods at once: alpha decays three times, and three fast recovery events halve the gap three times
+  const double target = start*0.5;
+  double rate = start*0.25;
+  now = cnpUs+3*Dcqcn::k_alphaTimerUs+1;
+  dcqcn.update(kRttUs, now);
+  for (unsigned i=0; i<3; ++i) {
+    rate = (target+rate)*0.5;
+  }
+  checkEqual("alpha decay: (1-g)^3 after 3 periods", dcqcn.alpha(), std::pow(1-g, 3.0));
+  checkEqual("fast recovery: rate after 3 events", dcqcn.rate(), rate);
+  checkEqual("fast recovery: target unchanged", dcqcn.targetRate(), target);
+
+  // One timer event per update from here on
+  now = cnpUs+4*Dcqcn::k_increaseTimerUs+1;
+  dcqcn.update(kRttUs, now);
+  rate = (target+rate)*0.5;
+  checkEqual("fast recovery: rate after 4 events", dcqcn.rate(), rate);
+  checkEqual("fast recovery: target after 4 events", dcqcn.targetRate(), target);
+  now += Dcqcn::k_increaseTimerUs;
+  dcqcn.update(kRttUs, now);
+  checkEqual("additive: target after timer event 5", dcqcn.targetRate(), target+additive);
+  checkEqual("additive: rate after timer event 5", dcqcn.rate(), (target+additive+rate)*0.5);
+
+  // Every target step is additive until the byte counter reaches 5 events, then hyper until the end
+  unsigned additiveUpdates = 1;
+  unsigned hyperUpdates = 0;
+  unsigned badSteps = 0;
+  double hyperUs = 0;
+  while (hyperUpdates<10 && now<cnpUs+1e6) {
+    const double before = dcqcn.targetRate();
+    now += Dcqcn::k_increaseTimerUs;
+    dcqcn.update(kRttUs, now);
+    const double step = dcqcn.targetRate()-before;
+    if (step>=hyper) {
+      hyperUs = hyperUpdates++ ? hyperUs : now;
+      // A byte event in the same update may add one additive step before the first hyper step
+      badSteps += std::fmod(step, hyper)!=0 && std::fmod(step-additive, hyper)!=0;
+    } else {
+      ++additiveUpdates;
+      badSteps += hyperUpdates>0 || (step!=additive && step!=2*additive);
+    }
+    badSteps += dcqcn.rate()>dcqcn.targetRate();
+  }
+  // The byte counter's 5th event comes after about 50MB at the current rate
+  printf("hyper increase after %u additive updates, %.1f ms after the CNP\n", additiveUpdates, (hyperUs-cnpUs)*1e-3);
+  checkEqual("increase: hyper updates seen", hyperUpdates, 10);
+  checkEqual("increase: steps out of order or of the wrong size", badSteps, 0);
+}
+
+// Unmarked, the hybrid is eRPC's Timely bit for bit. The first mark starts DCQCN from Timely's rate with alpha 1, so it
+// cuts that rate by half. Marks keep DCQCN in charge. 1ms after the last mark the rate goes back to Timely, which saw
+// every RTT meanwhile and was set to each DCQCN rate. A reference Timely fed the same RTTs and rates must match it
+void testHybrid() {
+  DcqcnHybrid hybrid(1);
+  TimelyErpc timely(1);
+  const double markFromUs = kStartUs+5000;
+  const double markToUs = markFromUs+2000;
+  unsigned mismatches = 0;
+  unsigned handOffs = 0;
+  unsigned handBacks = 0;
+  double handBackUs = 0;
+  bool ecnMode = false;
+  for (unsigned i=0; i<2000; ++i) {
+    const double now = kStartUs+i*10;
+    // RTTs rise and fall so Timely's rate moves both ways
+    const double rtt = 60+40*std::sin(i*0.05);
+    const bool marked = now>=markFromUs && now<markToUs;
+    const double timelyBefore = timely.rate();
+    hybrid.update(rtt, now, marked);
+    timely.update(rtt, now);
+    if (hybrid.ecnMode()) {
+      timely.setRate(hybrid.rate());
+    }
+    if (hybrid.ecnMode() && !ecnMode) {
+      ++handOffs;
+      checkEqual("hybrid: first mark cuts Timely's rate by half", hybrid.rate(), timelyBefore*0.5);
+      checkEqual("hybrid: hand-off at the first mark", now, markFromUs);
+    } else if (!hybrid.ecnMode() && ecnMode) {
+      ++handBacks;
+      handBackUs = now;
+    }
+    ecnMode = hybrid.ecnMode();
+    mismatches += !ecnMode && hybrid.rate()!=timely.rate();
+  }
+  checkEqual("hybrid: hand-offs", handOffs, 1);
+  checkEqual("hybrid: hand-backs", handBacks, 1);
+  // ACKs come every 10us and marks stop at 'markToUs'. The first ACK more than 1ms after the last mark hands back
+  checkEqual("hybrid: hand-back 1ms after the last mark", handBackUs, markToUs-10+DcqcnHybrid::k_ecnHoldUs+10);
+  checkEqual("hybrid: ACKs on Timely that differ from Timely", mismatches, 0);
+}
+
+int main() {
+  printf("%-52s %16s %16s\n", "check", "got", "expected");
+  testLateStart();
+  testStateMachine();
+  testHybrid();
+  printf("%u checks failed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+#include <hdrhistogram.h>
+#include <streamstats.h>
+
+#include <cinttypes>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Checks of the accumulators in 'hdrhistogram.h' and 'streamstats.h'. 'HdrHistogram' must count a value as an overflow
+// exactly when it rounds above the maximum. Each thread of a multi-threaded driver keeps its own 'StreamStats' and
+// merges them at the end. The merged result must equal one accumulator that saw every sample: count, min, max, every
+// histogram bin and so every quantile exactly, and mean and variance up to rounding. The program exits non-zero if any
+// check fails.
+
+typedef Experiment::StreamStats StreamStats;
+typedef Experiment::StreamHistogram StreamHistogram;
+
+const unsigned kThreads = 4;                        // accumulators merged
+const unsigned kSamplesPerThread = 100000;          // samples each
+
+unsigned failures = 0;
+
+void check(const char *what, double got, double expected, double tolerance) {
+  const bool ok = std::fabs(got-expected)<=tolerance*std::fabs(expected);
+  printf("%-52s %16.10g %16.10g  %s\n", what, got, expected, ok ? "ok" : "FAIL");
+  failures += !ok;
+}
+
+void checkEqual(const char *what, double got, double expected) {
+  check(what, got, expected, 0);
+}
+
+// Return the number of bins in which 'lhs' and 'rhs' differ, counting a different bin width or range as a difference
+unsigned binsDiffering(const StreamHistogram& lhs, const StreamHistogram& rhs) {
+  if (lhs.width()!=rhs.width() || lhs.lowIndex()!=rhs.lowIndex() || lhs.highIndex()!=rhs.highIndex()) {
+    return 1+StreamHistogram::k_bins;
+  }
+  unsigned differ = 0;
+  for (int64_t i=lhs.lowIndex(); i<=lhs.highIndex(); ++i) {
+    differ += lhs.binCount(i)!=rhs.binCount(i);
+  }
+  return differ;
+}
+
+// Compare 'merged' with 'all' and name each check after 'how'
+void compare(const char *how, const StreamStats& merged, const StreamStats& all) {
+  char what[128];
+  snprintf(what, sizeof(what), "%s: count", how);
+  checkEqual(what, static_cast<double>(merged.count()), static_cast<double>(all.count()));
+  snprintf(what, sizeof(what), "%s: min", how);
+  checkEqual(what, merged.min(), all.min());
+  snprintf(what, sizeof(what), "%s: max", how);
+  checkEqual(what, merged.max(), all.max());
+  snprintf(what, sizeof(what), "%s: mean", how);
+  check(what, merged.mean(), all.mean(), 1e-12);
+  snprintf(what, sizeof(what), "%s: variance", how);
+  check(what, merged.variance(), all.variance(), 1e-12);
+  snprintf(what, sizeof(what), "%s: bin width", how);
+  checkEqual(what, merged.histogram().width(), all.histogram().width());
+  snprintf(what, sizeof(what), "%s: histogram bins that differ", how);
+  checkEqual(what, binsDiffering(merged.histogram(), all.histogram()), 0);
+  unsigned quantilesDiffering = 0;
+  for (double q: { 0.0, 0.01, 0.25, 0.5, 0.9, 0.99, 0.999, 1.0 }) {
+    quantilesDiffering += merged.quantile(q)!=all.quantile(q);
+  }
+  snprintf(what, sizeof(what), "%s: quantiles that differ", how);
+  checkEqual(what, quantilesDiffering, 0);
+}
+
+// Each thread sees a different distribution, so each accumulator picks its own bin width before the merge: a tight
+// RTT-like normal, a long exponential tail, a uniform spread and a lognormal reaching far above the others
+void testMerge() {
+  std::mt19937 rng(1);
+  std::normal_distribution<double> normal(20, 4);
+  std::exponential_distribution<double> exponential(0.05);
+  std::uniform_real_distribution<double> uniform(0, 1000);
+  std::lognormal_distribution<double> lognormal(3, 1.5);
+
+  StreamStats all;
+  std::vector<StreamStats> perThread(kThreads);
+  for (unsigned thread=0; thread<kThreads; ++thread) {
+    for (unsigned i=0; i<kSamplesPerThread; ++i) {
+      double value = 0;
+      switch (thread) {
+        case 0: value = std::fabs(normal(rng)); break;
+        case 1: value = exponential(rng); break;
+        case 2: value = uniform(rng); break;
+        default: value = lognormal(rng); break;
+      }
+      perThread[thread].add(value);
+      all.add(value);
+    }
+  }
+
+  printf("bin widths before the merge:");
+  for (const StreamStats& stats: perThread) {
+    printf(" %g", stats.histogram().width());
+  }
+  printf(", one accumulator: %g\n", all.histogram().width());
+
+  // Merge in thread order, as a driver joining its threads one at a time does
+  StreamStats inOrder;
+  for (const StreamStats& stats: perThread) {
+    inOrder.merge(stats);
+  }
+  compare("merged in order", inOrder, all);
+
+  // Merge pairwise, finer histograms into coarser ones and the other way around
+  StreamStats left(perThread[0]);
+  left.merge(perThread[1]);
+  StreamStats right(perThread[3]);
+  right.merge(perThread[2]);
+  right.merge(left);
+  compare("merged pairwise", right, all);
+
+  // Merging an empty accumulator either way changes nothing
+  StreamStats empty;
+  StreamStats withEmpty(all);
+  withEmpty.merge(empty);
+  compare("all merged with empty", withEmpty, all);
+  empty.merge(all);
+  compare("empty merged with all", empty, all);
+}
+
+// Record values at and around the RTT histogram's maximum. Values that round to at most 'maxValue' are in range. Only
+// the values above it may count as overflows
+void testHdrLimits() {
+  const double maxUs = 1000000.0;
+  Experiment::HdrHistogram rttHdr(maxUs, 0.001);
+  rttHdr.record(maxUs);
+  rttHdr.record(maxUs-0.0004);
+  rttHdr.record(maxUs+0.0004);
+  const uint64_t inRange = rttHdr.overflows();
+  rttHdr.record(maxUs+0.001);
+  rttHdr.record(1e30);
+  printf("HdrHistogram limits: %" PRIu64 " overflows at the maximum, %" PRIu64 " above it\n", inRange,
+    rttHdr.overflows()-inRange);
+  checkEqual("hdr: overflows at the maximum", static_cast<double>(inRange), 0);
+  checkEqual("hdr: overflows above the maximum", static_cast<double>(rttHdr.overflows()-inRange), 2);
+  checkEqual("hdr: count", static_cast<double>(rttHdr.count()), 5);
+  checkEqual("hdr: max", rttHdr.max(), maxUs);
+}
+
+int main() {
+  printf("%-52s %16s %16s\n", "check", "got", "expected");
+  testHdrLimits();
+  testMerge();
+  printf("%u checks failed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+#include <probe.h>
+#include <probemacro.h>
+#include <timely.h>
+#include <timestamp.h>
+#include <tscclock.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Built twice: 'probes.tsk' with 'EXPERIMENT_PROBES' and 'probes_off.tsk' without. Both time 'Timely::update' on
+// the same samples so the difference is the cost of the probe in place. 'probes.tsk' also times a bare probe, then
+// runs a send/ACK loop on several threads with the collector draining, and prints the per-probe cycle histograms.
+// Last it checks a probe fired after its thread's ring was retired is dropped rather than written to a freed ring
+
+typedef Experiment::Timely<Experiment::TimelyErpcParams> TimelyErpc;
+
+#ifdef EXPERIMENT_PROBES
+const bool kProbes = true;
+#else
+const bool kProbes = false;
+#endif
+
+const unsigned kSessions = 1024;                    // sessions per thread
+const unsigned kSamples = 1 << 20;                  // RTT samples, replayed
+const unsigned kUpdates = 10000000;                 // updates timed
+const unsigned kProbeCalls = 10000000;              // bare probes timed
+const double kPacketBytes = 4096;                   // bytes admitted per send
+
+struct Sample {
+  uint32_t                      d_sessionId;        // session updated
+  double                        d_rttUs;            // RTT
+};
+
+std::vector<Sample> makeSamples(unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint32_t> sessionDist(0, kSessions-1);
+  std::normal_distribution<double> rttDist(60.0, 40.0);
+  std::vector<Sample> samples(kSamples);
+  for (Sample& s: samples) {
+    s.d_sessionId = sessionDist(rng);
+    s.d_rttUs = std::max(0.5, rttDist(rng));
+  }
+  return samples;
+}
+
+// Smallest rate limiter: a session may send when its next send time has passed, which then moves on by the time
+// its rate takes to send the packet. Stands in until a pacer exists
+struct Admission {
+  // DATA
+  uint64_t                      d_nextTicks;        // earliest TSC the session may send at
+
+  // MANIPULATORS
+  bool admit(uint64_t nowTicks, double rateBps, double ghz) {
+    EXPERIMENT_PROBE("ratelimiter.admit");
+    if (nowTicks<d_nextTicks) {
+      return false;
+    }
+    d_nextTicks = std::max(d_nextTicks, nowTicks)+static_cast<uint64_t>(kPacketBytes/rateBps*1e9*ghz);
+    return true;
+  }
+};
+
+// Fires a probe from a 'thread_local' destructor. Constructed before a thread's first probe, it is destroyed after
+// that thread's ring is retired
+struct LateProbe {
+  ~LateProbe() {
+    EXPERIMENT_PROBE("late");
+  }
+};
+
+// Return TSC ticks per 'Timely::update' over 'kUpdates' updates
+double timeUpdates(const std::vector<Sample>& samples) {
+  std::vector<TimelyErpc> sessions(kSessions);
+  std::vector<double> nowUs(kSessions, 0.0);
+  double checksum = 0;
+  const uint64_t start = Experiment::TimestampLfenceRdtsc::now();
+  for (unsigned i=0; i<kUpdates; ++i) {
+    const Sample& s = samples[i&(kSamples-1)];
+    nowUs[s.d_sessionId] += s.d_rttUs;
+    checksum += sessions[s.d_sessionId].update(s.d_rttUs, nowUs[s.d_sessionId]);
+  }
+  const uint64_t end = Experiment::TimestampRdtscpLfence::now();
+  if (checksum==0) {
+    printf("unexpected zero checksum\n");
+  }
+  return static_cast<double>(end-start)/kUpdates;
+}
+
+// One thread of the send/ACK loop: admit a send, stamp it, and feed an RTT to Timely. Return updates run
+uint64_t sendAckLoop(const std::vector<Sample>& samples, const Experiment::TscClock& clock, unsigned iterations) {
+  std::vector<TimelyErpc> sessions(kSessions);
+  std::vector<Admission> admission(kSessions, Admission{0});
+  std::vector<double> nowUs(kSessions, 0.0);
+  uint64_t updates = 0;
+  for (unsigned i=0; i<iterations; ++i) {
+    const Sample& s = samples[i&(kSamples-1)];
+    TimelyErpc& timely = sessions[s.d_sessionId];
+    admission[s.d_sessionId].admit(Experiment::TscClock::nowTicks(), timely.rate(), clock.ghz());
+    const uint64_t sentNs = clock.nowNs();
+    nowUs[s.d_sessionId] = std::max(nowUs[s.d_sessionId]+s.d_rttUs, static_cast<double>(sentNs)/1000.0);
+    timely.update(s.d_rttUs, nowUs[s.d_sessionId]);
+    ++updates;
+  }
+  return updates;
+}
+
+int main(int argc, char **argv) {
+  const unsigned threads = argc>1 ? static_cast<unsigned>(atoi(argv[1])) : 2;
+  const Experiment::TscClock clock;
+  const std::vector<Sample> samples = makeSamples(1);
+
+  printf("probes compiled %s, TSC %.3f GHz\n", kProbes ? "in" : "out", clock.ghz());
+
+  // Warm up, then take the best of 3 so one preemption does not decide the comparison
+  timeUpdates(samples);
+  double updateTicks = 1e300;
+  for (unsigned i=0; i<3; ++i) {
+    updateTicks = std::min(updateTicks, timeUpdates(samples));
+  }
+  printf("Timely::update: %.1f TSC ticks (%.2f ns) per call over %u calls\n", updateTicks, updateTicks/clock.ghz(),
+    kUpdates);
+
+  if (!kProbes) {
+    return 0;
+  }
+
+  int failures = 0;
+  Experiment::ProbeCollector& collector = Experiment::ProbeCollector::instance();
+
+  // A bare probe around nothing, and the ring push alone. The difference is the two 'rdtsc' reads. Probes run in
+  // chunks that fit the ring and are drained between chunks outside the timed region, so no push takes the
+  // full-ring path
+  const unsigned bareId = collector.id("bare");
+  const unsigned pushId = collector.id("push");
+  Experiment::ProbeRing *ring = Experiment::ProbeCollector::localRing();
+  const unsigned kChunk = Experiment::ProbeRing::k_capacity/2;
+  double bareTicks = 1e300, pushTicks = 1e300;
+  for (unsigned round=0; round<3; ++round) {
+    uint64_t bare = 0, push = 0;
+    for (unsigned chunk=0; chunk<kProbeCalls/kChunk; ++chunk) {
+      collector.drain();
+      uint64_t start = Experiment::TimestampLfenceRdtsc::now();
+      for (unsigned i=0; i<kChunk; ++i) {
+        Experiment::ProbeScope scope(bareId);
+        asm volatile("" ::: "memory");
+      }
+      uint64_t end = Experiment::TimestampRdtscpLfence::now();
+      bare += end-start;
+
+      collector.drain();
+      start = Experiment::TimestampLfenceRdtsc::now();
+      for (unsigned i=0; i<kChunk; ++i) {
+        ring->push(pushId, i&63);
+        asm volatile("" ::: "memory");
+      }
+      end = Experiment::TimestampRdtscpLfence::now();
+      push += end-start;
+    }
+    const unsigned calls = kProbeCalls/kChunk*kChunk;
+    bareTicks = std::min(bareTicks, static_cast<double>(bare)/calls);
+    pushTicks = std::min(pushTicks, static_cast<double>(push)/calls);
+  }
+  printf("bare probe: %.1f TSC ticks per probe, of which ring push %.1f and the two rdtsc reads the rest\n",
+    bareTicks, pushTicks);
+
+  // The send/ACK loop on 'threads' threads while the collector drains
+  collector.reset();
+  collector.start();
+  const unsigned kIterations = 2000000;
+  std::atomic<uint64_t> updates(0);
+  std::vector<std::thread> workers;
+  for (unsigned t=0; t<threads; ++t) {
+    workers.emplace_back([&samples, &clock, &updates, kIterations]() {
+      updates += sendAckLoop(samples, clock, kIterations);
+    });
+  }
+  for (std::thread& worker: workers) {
+    worker.join();
+  }
+  collector.stop();
+
+  printf("\nsend/ACK loop: %u threads x %u iterations\n", threads, kIterations);
+  collector.print(std::cout, clock.ghz());
+
+  // Every update, admission and timestamp fired a probe: each was either aggregated or dropped
+  const uint64_t dropped = collector.dropped();
+  uint64_t recorded = 0;
+  for (unsigned i=0; i<collector.probes(); ++i) {
+    const std::string name(collector.name(i));
+    if (name=="timely.update" || name=="ratelimiter.admit" || name=="tscclock.nowNs") {
+      recorded += collector.histogram(i).count();
+    }
+  }
+  const uint64_t expected = 3*updates.load();
+  printf("records: %lu expected, %lu aggregated, %lu dropped\n", expected, recorded, dropped);
+  if (recorded+dropped!=expected) {
+    printf("FAIL: records lost\n");
+    ++failures;
+  }
+
+  // The late probe runs in thread teardown after the ring is retired, and the collector drains and frees the ring
+  // meanwhile. It must count as a drop
+  collector.reset();
+  std::thread late([&collector]() {
+    thread_local LateProbe lateProbe;
+    (void)lateProbe;
+    EXPERIMENT_PROBE("early");
+    collector.drain();
+  });
+  late.join();
+  collector.drain();
+  printf("probe after thread exit: %lu dropped\n", collector.dropped());
+  if (collector.dropped()!=1) {
+    printf("FAIL: probe after thread exit not dropped\n");
+    ++failures;
+  }
+
+  return failures ? 1 : 0;
+}
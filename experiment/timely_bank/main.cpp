@@ -0,0 +1,185 @@
+#include <timelybank.h>
+#include <timely.h>
+
+#include <chrono>
+#include <deque>
+#include <random>
+#include <stdio.h>
+
+typedef Experiment::Timely<Experiment::TimelyErpcParams> Timely;
+typedef Experiment::TimelyBank<Experiment::TimelyErpcParams> TimelyBank;
+
+const unsigned kBatch = 64;             // samples per 'TimelyBank::update' call
+const unsigned kSamples = 10000000;     // samples in benchmark
+const unsigned kCheckSamples = 1000000; // samples in equivalence check
+const double kSparseStepUs = 0.01;      // clock step per sample: after the first few us every update is unscaled
+const double kDenseStepUs = 0.0001;     // clock step per sample: 1M samples span 100us, about one RTT
+
+// Make 'count' samples for 'sessions' sessions in arrival order. Most RTTs are drawn from a wide Gaussian straddling
+// the min model RTT limit; one in 32 is drawn uniformly around the max model RTT limit. So each regime in
+// 'Timely::update', the 'by-pass', and the 'rttUs<=d_minRttUs' skip are hit in an unpredictable order. The clock
+// advances by 'stepUs' per sample so 'nowUs' is strictly increasing for every session.
+std::vector<Experiment::TimelySample> makeSamples(unsigned count, unsigned sessions, unsigned seed,
+  double stepUs = kSparseStepUs) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint32_t> sessionDist(0, sessions-1);
+  std::normal_distribution<double> rttDist(60.0, 40.0);
+  std::uniform_real_distribution<double> highRttDist(900.0, 1500.0);
+
+  std::vector<Experiment::TimelySample> samples(count);
+  double nowUs = 0;
+  for (unsigned i=0; i<count; ++i) {
+    double rttUs = (i%32==31) ? highRttDist(rng) : rttDist(rng);
+    if (rttUs<=0) {
+      rttUs = 1.0;
+    }
+    nowUs += stepUs;
+    samples[i].d_sessionId = sessionDist(rng);
+    samples[i].d_rttUs = rttUs;
+    samples[i].d_nowUs = nowUs;
+  }
+  return samples;
+}
+
+std::deque<Timely> *makeScalar(unsigned sessions) {
+  std::deque<Timely> *scalar = new std::deque<Timely>;
+  for (unsigned i=0; i<sessions; ++i) {
+    scalar->emplace_back();
+  }
+  return scalar;
+}
+
+// Batch update kernels of 'TimelyBank' under test. Each applies 'count' samples to 'bank'
+typedef void (*BankKernel)(TimelyBank& bank, const Experiment::TimelySample *samples, std::size_t count);
+
+void scalarKernel(TimelyBank& bank, const Experiment::TimelySample *samples, std::size_t count) {
+  bank.update(samples, count);
+}
+
+void simdKernel(TimelyBank& bank, const Experiment::TimelySample *samples, std::size_t count) {
+  bank.updateSimd(samples, count);
+}
+
+#if defined(EXPERIMENT_TIMELY_SIMD_AVX2)
+void avx2Kernel(TimelyBank& bank, const Experiment::TimelySample *samples, std::size_t count) {
+  bank.updateSimd<Experiment::TimelySimdAvx2>(samples, count);
+}
+#endif
+
+#if defined(EXPERIMENT_TIMELY_SIMD_AVX512)
+void avx512Kernel(TimelyBank& bank, const Experiment::TimelySample *samples, std::size_t count) {
+  bank.updateSimd<Experiment::TimelySimdAvx512>(samples, count);
+}
+#endif
+
+struct NamedKernel {
+  const char *d_name;
+  BankKernel  d_kernel;
+};
+
+const NamedKernel kernels[] = {
+  { "TimelyBank::update", scalarKernel },
+  { "TimelyBank::updateSimd", simdKernel },
+#if defined(EXPERIMENT_TIMELY_SIMD_AVX2)
+  { "TimelyBank::updateSimd<AVX2>", avx2Kernel },
+#endif
+#if defined(EXPERIMENT_TIMELY_SIMD_AVX512)
+  { "TimelyBank::updateSimd<AVX512>", avx512Kernel },
+#endif
+};
+
+// Return 0 if 'kernel' reproduces 'Timely::update' bit-for-bit on a shared stream of samples, and non-zero
+// otherwise. The comparison is done after every batch so the first diverging batch is reported. With few 'sessions'
+// most vector groups name some session twice, which exercises the in-order fallback of 'updateSimd'. eRPC scales
+// increase and decrease by 'min((nowUs-prevRttUs)/k_minRttUs, 1)', which is below 1 only while the clock is within
+// an RTT of the start. A clock step of 'kDenseStepUs' keeps the whole stream there, so many updates are scaled.
+int checkEquivalence(const NamedKernel& kernel, unsigned sessions, double stepUs) {
+  const std::vector<Experiment::TimelySample> samples = makeSamples(kCheckSamples, sessions, 1, stepUs);
+  std::deque<Timely> *scalar = makeScalar(sessions);
+  TimelyBank bank(sessions);
+
+  // The previous RTT of each session, as 'Timely::update' keeps it, to count the updates it scaled
+  std::vector<double> prevRttUs(sessions, Timely::k_minRttUs);
+  unsigned scaled = 0;
+  unsigned mismatches = 0;
+  for (unsigned i=0; i<samples.size(); i+=kBatch) {
+    const unsigned count = std::min<unsigned>(kBatch, samples.size()-i);
+    for (unsigned j=i; j<i+count; ++j) {
+      const Experiment::TimelySample& sample = samples[j];
+      Timely& timely = (*scalar)[sample.d_sessionId];
+      const bool bypass = timely.rate()==Timely::k_maxNicBps && sample.d_rttUs<=Timely::k_minModelRttUs;
+      if (!bypass && sample.d_rttUs>Timely::k_minRttUs) {
+        scaled += sample.d_nowUs-prevRttUs[sample.d_sessionId]<Timely::k_minRttUs;
+        prevRttUs[sample.d_sessionId] = sample.d_rttUs;
+      }
+      timely.update(sample.d_rttUs, sample.d_nowUs);
+    }
+    kernel.d_kernel(bank, samples.data()+i, count);
+    for (unsigned j=i; j<i+count; ++j) {
+      const uint32_t id = samples[j].d_sessionId;
+      if ((*scalar)[id].rate()!=bank.rate(id)) {
+        if (++mismatches<10) {
+          printf("mismatch: sample %u session %u scalar %.17g bank %.17g\n", j, id, (*scalar)[id].rate(),
+            bank.rate(id));
+        }
+      }
+    }
+  }
+
+  delete scalar;
+  printf("equivalence check %s: %u samples %gus apart, %u sessions, %u scaled updates, %u mismatches\n",
+    kernel.d_name, kCheckSamples, stepUs, sessions, scaled, mismatches);
+  return mismatches==0 ? 0 : 1;
+}
+
+void benchmark(unsigned sessions) {
+  const std::vector<Experiment::TimelySample> samples = makeSamples(kSamples, sessions, 2);
+  std::deque<Timely> *scalar = makeScalar(sessions);
+
+  // Scalar path: one object per session, one update per sample
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i=0; i<samples.size(); ++i) {
+    (*scalar)[samples[i].d_sessionId].update(samples[i].d_rttUs, samples[i].d_nowUs);
+  }
+  auto end = std::chrono::steady_clock::now();
+  const double scalarSec = std::chrono::duration<double>(end-start).count();
+
+  printf("\nsessions %u, samples %u, batch %u\n", sessions, kSamples, kBatch);
+  printf("%-30s: %8.2f M updates/sec\n", "Timely::update", kSamples/scalarSec/1e6);
+
+  // Batched paths
+  for (const NamedKernel& kernel: kernels) {
+    TimelyBank bank(sessions);
+    start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<samples.size(); i+=kBatch) {
+      kernel.d_kernel(bank, samples.data()+i, std::min<unsigned>(kBatch, samples.size()-i));
+    }
+    end = std::chrono::steady_clock::now();
+    const double bankSec = std::chrono::duration<double>(end-start).count();
+
+    // Consume results so neither loop is optimized away
+    double sum = 0;
+    for (unsigned i=0; i<sessions; ++i) {
+      sum += (*scalar)[i].rate() - bank.rate(i);
+    }
+
+    printf("%-30s: %8.2f M updates/sec, speedup %5.2fx, checksum %g\n", kernel.d_name, kSamples/bankSec/1e6,
+      scalarSec/bankSec, sum);
+  }
+
+  delete scalar;
+}
+
+int main() {
+  for (const NamedKernel& kernel: kernels) {
+    for (double stepUs: { kSparseStepUs, kDenseStepUs }) {
+      if (checkEquivalence(kernel, 16, stepUs)!=0 || checkEquivalence(kernel, 10000, stepUs)!=0) {
+        return 1;
+      }
+    }
+  }
+  benchmark(10000);
+  benchmark(100000);
+  benchmark(1000000);
+  return 0;
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+// Purpose: Estimate TX rates for many sessions at once using the eRPC Timely algorithm with structure-of-arrays state
+//
+// Classes:
+//   Experiment::TimelySample: One RTT sample for one session
+//   Experiment::TimelyBank<PARAMS>: Timely state for 'sessionCount' sessions updated in batches
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// 'Experiment::Timely' holds one session's state in one object, and 'update' handles one RTT sample. A host running
+// 10k+ sessions per core pays a branchy scalar update per ACK plus a cache miss on each session object. This bank
+// keeps the per-session state (rate, previous RTT, previous time, weighted RTT diff) in four parallel arrays indexed
+// by session id, and consumes a batch of samples per call. Within a batch the state of upcoming sessions is
+// prefetched, and the common regimes (below min model RTT, gradient band) plus the gradient weight clamp are chosen
+// with selects rather than branches. The rare above max model RTT regime keeps its branch so its divide by 'rttUs'
+// is only paid when taken. Samples are applied in batch order so that a session appearing more than once in a batch
+// sees its updates in the same order as the scalar code.
+//
+// 'updateSimd' goes further: it updates 4 (AVX2) or 8 (AVX-512) distinct sessions per instruction. Session state is
+// gathered, all three regimes plus the weight clamp and rate bounds are evaluated in every lane and chosen with masked
+// blends, and lanes whose sample is skipped ('by-pass' or 'rttUs<=k_minRttUs') are masked out of the scatter. A group
+// of samples naming the same session twice cannot be updated in parallel; it is applied with the scalar code in
+// sample order. Without AVX2 'updateSimd' is the scalar batch 'update'.
+//
+// Results are bit-for-bit identical to 'Experiment::Timely<PARAMS>::update' for the eRPC variant provided
+// both are compiled with the same floating point flags ('-ffp-contract=off').
+
+#include <timely.h>
+#include <timelysimd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Experiment {
+
+struct TimelySample {
+  // DATA
+  uint32_t d_sessionId;                             // session in '[0, TimelyBank::sessionCount())'
+  double   d_rttUs;                                 // RTT sample (units microseconds)
+  double   d_nowUs;                                 // absolute wall-clock time sample taken (units microseconds)
+};
+
+template <class PARAMS>
+class TimelyBank {
+public:
+  // CONSTANTS
+  static constexpr double k_alpha = PARAMS::k_alpha;
+  static constexpr double k_beta = PARAMS::k_beta;
+  static constexpr double k_delta = PARAMS::k_delta;
+  static constexpr double k_minRttUs = PARAMS::k_minRttUs;
+  static constexpr double k_minModelRttUs = PARAMS::k_minModelRttUs;
+  static constexpr double k_maxModelRttUs = PARAMS::k_maxModelRttUs;
+  static constexpr double k_maxNicBps = PARAMS::k_maxNicBps;
+  static constexpr double k_minRateBps = PARAMS::k_minRateBps;
+  static constexpr double k_maxRateBps = PARAMS::k_maxRateBps;
+
+  static_assert(PARAMS::k_erpcBypass && PARAMS::k_deltaFactor && PARAMS::k_halfRateFloor && PARAMS::k_patchedError,
+    "TimelyBank implements the eRPC variant only");
+
+  static constexpr unsigned k_prefetchDistance = 8;  // prefetch session state this many samples ahead
+
+private:
+  std::vector<double> d_lineRateBps;                // calculated TX rate (bytes-per-second) per session
+  std::vector<double> d_prevTimeUs;                 // absolute time in microseconds session last updated
+  std::vector<double> d_prevRttUs;                  // last RTT provided per session
+  std::vector<double> d_weightedRttDiffUs;          // weighted RTT difference per session
+
+public:
+  // CREATORS
+  explicit TimelyBank(unsigned sessionCount);
+    // Create a bank of 'sessionCount' Timely sessions each estimating TX rate in bytes/sec on a NIC with
+    // 'PARAMS::k_maxNicBps' bandwidth. Upon creation every session's rate is initialized to 'k_maxNicBps' exactly as
+    // 'Timely<PARAMS>()'.
+
+  TimelyBank() = delete;
+    // Default constructor not provided
+
+  TimelyBank(const TimelyBank& other) = delete;
+    // Copy constructor not provided
+
+  ~TimelyBank() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  unsigned sessionCount() const;
+    // Return the number of sessions in this bank
+
+  double rate(unsigned sessionId) const;
+    // Return the last estimated TX rate in bytes/sec for specified 'sessionId'. Behavior is defined provided
+    // 'sessionId<sessionCount()'
+
+  const double *rates() const;
+    // Return a pointer to 'sessionCount()' contiguous rates in bytes/sec indexed by session id
+
+  // MANIPULATORS
+  double update(unsigned sessionId, double rttUs, double nowUs);
+    // Return the new, estimated transmission rate in bytes/sec for 'sessionId' based on specified 'rttUs' and
+    // 'nowUs'. This is exactly 'Timely::update' applied to the state of 'sessionId'. Behavior is defined provided
+    // 'sessionId<sessionCount()', 'rttUs>0' and 'nowUs' exceeds the time of the session's last update.
+
+  void update(const TimelySample *samples, std::size_t count);
+    // Apply specified 'count' samples starting at 'samples' in order. Each sample must satisfy the preconditions of
+    // the single sample 'update' above. A session may appear more than once in the batch.
+
+  void updateSimd(const TimelySample *samples, std::size_t count);
+    // Exactly like the batch 'update' above but using the widest vector kernel the target supports. Falls back to the
+    // scalar batch 'update' when neither AVX2 nor AVX-512 is available.
+
+  template <class SIMD>
+  void updateSimd(const TimelySample *samples, std::size_t count);
+    // Exactly like the batch 'update' above but using the vector kernel for specified 'SIMD' wrapper (see
+    // 'timelysimd.h'). Provided so the AVX2 kernel can be exercised on AVX-512 hosts.
+
+  TimelyBank& operator=(const TimelyBank& rhs) = delete;
+    // Assignment operator not provided
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+template <class PARAMS>
+inline
+TimelyBank<PARAMS>::TimelyBank(unsigned sessionCount)
+: d_lineRateBps(sessionCount, k_maxNicBps)
+, d_prevTimeUs(sessionCount, 0)
+, d_prevRttUs(sessionCount, k_minRttUs)
+, d_weightedRttDiffUs(sessionCount, 0)
+{
+}
+
+// ACCESSORS
+template <class PARAMS>
+inline
+unsigned TimelyBank<PARAMS>::sessionCount() const {
+  return static_cast<unsigned>(d_lineRateBps.size());
+}
+
+template <class PARAMS>
+inline
+double TimelyBank<PARAMS>::rate(unsigned sessionId) const {
+  assert(sessionId<d_lineRateBps.size());
+  return d_lineRateBps[sessionId];
+}
+
+template <class PARAMS>
+inline
+const double *TimelyBank<PARAMS>::rates() const {
+  return d_lineRateBps.data();
+}
+
+// MANIPULATORS
+template <class PARAMS>
+inline
+double TimelyBank<PARAMS>::update(unsigned sessionId, double rttUs, double nowUs) {
+  assert(sessionId<d_lineRateBps.size());
+  assert(rttUs>0);
+  assert(nowUs>d_prevTimeUs[sessionId]);
+
+  const double rateBps = d_lineRateBps[sessionId];
+
+  // eRPC Timely "by-pass", and RTTs too small to consider: state unchanged
+  if ((rateBps==k_maxNicBps && rttUs<=k_minModelRttUs) || rttUs<=k_minRttUs) {
+    return rateBps;
+  }
+
+  const double prevRttUs = d_prevRttUs[sessionId];
+  const double newRttDiff = rttUs - prevRttUs;
+  const double weightedRttDiffUs = ((1-k_alpha)*d_weightedRttDiffUs[sessionId]) + (k_alpha*newRttDiff);
+
+  // Note: like 'Timely::update' this uses the previous RTT not the previous time
+  const double deltaFactor = std::min((nowUs-prevRttUs)/k_minRttUs, 1.0);
+  const double addIncreaseFactor = k_delta * deltaFactor;
+  const double multDecreaseFactor = k_beta * deltaFactor;
+
+  double calculatedRate(0);
+  if (rttUs > k_maxModelRttUs) {
+    calculatedRate = rateBps * (1 - multDecreaseFactor*(1-k_maxModelRttUs/rttUs));
+  } else {
+    // Below and in the gradient band are selected without branches; each candidate is computed exactly as in
+    // 'Timely::update'
+    const double rttGradient = weightedRttDiffUs / k_minRttUs;
+    double weight = 2*rttGradient + 0.5;
+    weight = (rttGradient <= -0.25) ? 0.0 : weight;
+    weight = (rttGradient >= 0.25) ? 1.0 : weight;
+    const double error = (rttUs-k_minModelRttUs) / k_minModelRttUs;
+    const double rateGradient = rateBps*(1.0-multDecreaseFactor*weight*error)+addIncreaseFactor*(1-weight);
+    const double rateBelow = rateBps + addIncreaseFactor;
+    calculatedRate = (rttUs < k_minModelRttUs) ? rateBelow : rateGradient;
+  }
+
+  double newRateBps = std::max(calculatedRate, rateBps*0.5);
+  newRateBps = std::min(k_maxRateBps, newRateBps);
+  newRateBps = std::max(k_minRateBps, newRateBps);
+
+  d_lineRateBps[sessionId] = newRateBps;
+  d_prevRttUs[sessionId] = rttUs;
+  d_prevTimeUs[sessionId] = nowUs;
+  d_weightedRttDiffUs[sessionId] = weightedRttDiffUs;
+
+  return d_lineRateBps[sessionId];
+}
+
+template <class PARAMS>
+inline
+void TimelyBank<PARAMS>::update(const TimelySample *samples, std::size_t count) {
+  assert(samples!=0 || count==0);
+
+  for (std::size_t i=0; i<count; ++i) {
+    if (i+k_prefetchDistance<count) {
+      const uint32_t ahead = samples[i+k_prefetchDistance].d_sessionId;
+      __builtin_prefetch(d_lineRateBps.data()+ahead, 1);
+      __builtin_prefetch(d_prevRttUs.data()+ahead, 1);
+      __builtin_prefetch(d_prevTimeUs.data()+ahead, 1);
+      __builtin_prefetch(d_weightedRttDiffUs.data()+ahead, 1);
+    }
+    update(samples[i].d_sessionId, samples[i].d_rttUs, samples[i].d_nowUs);
+  }
+}
+
+template <class PARAMS>
+inline
+void TimelyBank<PARAMS>::updateSimd(const TimelySample *samples, std::size_t count) {
+#if defined(EXPERIMENT_TIMELY_SIMD_AVX512)
+  this->template updateSimd<TimelySimdAvx512>(samples, count);
+#elif defined(EXPERIMENT_TIMELY_SIMD_AVX2)
+  this->template updateSimd<TimelySimdAvx2>(samples, count);
+#else
+  update(samples, count);
+#endif
+}
+
+template <class PARAMS>
+template <class SIMD>
+inline
+void TimelyBank<PARAMS>::updateSimd(const TimelySample *samples, std::size_t count) {
+  typedef typename SIMD::Vec Vec;
+  typedef typename SIMD::Mask Mask;
+  const unsigned width = SIMD::k_width;
+
+  assert(samples!=0 || count==0);
+
+  const Vec alpha = SIMD::set1(k_alpha);
+  const Vec oneMinusAlpha = SIMD::set1(1-k_alpha);
+  const Vec beta = SIMD::set1(k_beta);
+  const Vec delta = SIMD::set1(k_delta);
+  const Vec minRttUs = SIMD::set1(k_minRttUs);
+  const Vec minModelRttUs = SIMD::set1(k_minModelRttUs);
+  const Vec maxModelRttUs = SIMD::set1(k_maxModelRttUs);
+  const Vec maxNicBps = SIMD::set1(k_maxNicBps);
+  const Vec maxRateBps = SIMD::set1(k_maxRateBps);
+  const Vec minRateBps = SIMD::set1(k_minRateBps);
+  const Vec zero = SIMD::set1(0.0);
+  const Vec half = SIMD::set1(0.5);
+  const Vec one = SIMD::set1(1.0);
+  const Vec two = SIMD::set1(2.0);
+  const Vec lowGradient = SIMD::set1(-0.25);
+  const Vec highGradient = SIMD::set1(0.25);
+
+  alignas(64) uint32_t ids[width];
+  alignas(64) double rtts[width];
+  alignas(64) double nows[width];
+
+  std::size_t i = 0;
+  for (; i+width<=count; i+=width) {
+    for (unsigned lane=0; lane<width; ++lane) {
+      ids[lane] = samples[i+lane].d_sessionId;
+      rtts[lane] = samples[i+lane].d_rttUs;
+      nows[lane] = samples[i+lane].d_nowUs;
+    }
+
+    if (i+2*width<=count) {
+      for (unsigned lane=0; lane<width; ++lane) {
+        const uint32_t ahead = samples[i+width+lane].d_sessionId;
+        __builtin_prefetch(d_lineRateBps.data()+ahead, 1);
+        __builtin_prefetch(d_prevRttUs.data()+ahead, 1);
+        __builtin_prefetch(d_prevTimeUs.data()+ahead, 1);
+        __builtin_prefetch(d_weightedRttDiffUs.data()+ahead, 1);
+      }
+    }
+
+    if (!SIMD::unique(ids)) {
+      // Lanes depend on each other: apply in sample order
+      for (unsigned lane=0; lane<width; ++lane) {
+        update(ids[lane], rtts[lane], nows[lane]);
+      }
+      continue;
+    }
+
+    const Vec rttUs = SIMD::load(rtts);
+    const Vec nowUs = SIMD::load(nows);
+    const Vec rateBps = SIMD::gather(d_lineRateBps.data(), ids);
+    const Vec prevRttUs = SIMD::gather(d_prevRttUs.data(), ids);
+    const Vec prevWeightedRttDiffUs = SIMD::gather(d_weightedRttDiffUs.data(), ids);
+
+    // eRPC "by-pass" and too small RTTs leave state unchanged
+    const Mask skip = SIMD::orMask(SIMD::andMask(SIMD::eq(rateBps, maxNicBps), SIMD::le(rttUs, minModelRttUs)),
+                                   SIMD::le(rttUs, minRttUs));
+    const Mask active = SIMD::notMask(skip);
+    if (SIMD::bits(active)==0) {
+      continue;
+    }
+
+    const Vec newRttDiff = SIMD::sub(rttUs, prevRttUs);
+    const Vec weightedRttDiffUs = SIMD::add(SIMD::mul(oneMinusAlpha, prevWeightedRttDiffUs),
+                                            SIMD::mul(alpha, newRttDiff));
+
+    // std::min((nowUs-prevRttUs)/k_minRttUs, 1.0)
+    Vec deltaFactor = SIMD::div(SIMD::sub(nowUs, prevRttUs), minRttUs);
+    deltaFactor = SIMD::blend(SIMD::lt(one, deltaFactor), deltaFactor, one);
+    const Vec addIncreaseFactor = SIMD::mul(delta, deltaFactor);
+    const Vec multDecreaseFactor = SIMD::mul(beta, deltaFactor);
+
+    // Below 'k_minModelRttUs'
+    const Vec rateBelow = SIMD::add(rateBps, addIncreaseFactor);
+
+    // Above 'k_maxModelRttUs'
+    const Vec rateAbove = SIMD::mul(rateBps,
+      SIMD::sub(one, SIMD::mul(multDecreaseFactor, SIMD::sub(one, SIMD::div(maxModelRttUs, rttUs)))));
+
+    // Gradient band with clamped weight
+    const Vec rttGradient = SIMD::div(weightedRttDiffUs, minRttUs);
+    Vec weight = SIMD::add(SIMD::mul(two, rttGradient), half);
+    weight = SIMD::blend(SIMD::le(rttGradient, lowGradient), weight, zero);
+    weight = SIMD::blend(SIMD::le(highGradient, rttGradient), weight, one);
+    const Vec error = SIMD::div(SIMD::sub(rttUs, minModelRttUs), minModelRttUs);
+    const Vec rateGradient = SIMD::add(
+      SIMD::mul(rateBps, SIMD::sub(one, SIMD::mul(SIMD::mul(multDecreaseFactor, weight), error))),
+      SIMD::mul(addIncreaseFactor, SIMD::sub(one, weight)));
+
+    Vec calculatedRate = rateGradient;
+    calculatedRate = SIMD::blend(SIMD::lt(maxModelRttUs, rttUs), calculatedRate, rateAbove);
+    calculatedRate = SIMD::blend(SIMD::lt(rttUs, minModelRttUs), calculatedRate, rateBelow);
+
+    // std::max(calculatedRate, rateBps*0.5), std::min(k_maxRateBps, r), std::max(k_minRateBps, r)
+    const Vec halfRate = SIMD::mul(rateBps, half);
+    Vec newRateBps = SIMD::blend(SIMD::lt(calculatedRate, halfRate), calculatedRate, halfRate);
+    newRateBps = SIMD::blend(SIMD::lt(newRateBps, maxRateBps), maxRateBps, newRateBps);
+    newRateBps = SIMD::blend(SIMD::lt(minRateBps, newRateBps), minRateBps, newRateBps);
+
+    SIMD::scatter(d_lineRateBps.data(), ids, active, newRateBps);
+    SIMD::scatter(d_prevRttUs.data(), ids, active, rttUs);
+    SIMD::scatter(d_prevTimeUs.data(), ids, active, nowUs);
+    SIMD::scatter(d_weightedRttDiffUs.data(), ids, active, weightedRttDiffUs);
+  }
+
+  // Tail shorter than one vector
+  for (; i<count; ++i) {
+    update(samples[i].d_sessionId, samples[i].d_rttUs, samples[i].d_nowUs);
+  }
+}
+
+} // namespace Experiment
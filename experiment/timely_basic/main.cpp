@@ -1,19 +1,22 @@
 #include <timely.h>
 #include <random>
 #include <CommFunc.h>
+#include <hdrhistogram.h>
 
-const double nicRate = 10000000000.0; // NIC line rate 10GBps (giga bytes/sec) as bytes/sec
+typedef Experiment::Timely<Experiment::TimelyTracedParams<Experiment::TimelyBasicParams>> Timely;
+
+const double nicRate = Timely::k_maxNicBps; // NIC line rate 10GBps (giga bytes/sec) as bytes/sec
 
 void test1() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate, 0);
+  Timely timely;
 
   // Setup random generators
   std::random_device dev;
   std::mt19937 rng(dev());
 
   // Sample from Guassian distribution
-  const double mean = (timely.d_minModelRttUs-2.0);
+  const double mean = (Timely::k_minModelRttUs-2.0);
   const double stddev = 4.0;
   std::normal_distribution<double> rttDist(mean, stddev);
 
@@ -27,76 +30,90 @@ void test1() {
   // there's no overhead to transmit the packet, the elapsed time form the last simulated transmission to now is just
   // 'rttUs'. 
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
   fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   while (nowUs < 10000000.0) {
     double rttUs = rttDist(rng);
-    data.push_back(rttUs); 
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
     fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
   }
 
   fclose(fid);
   std::cerr << "test1: Timely Final State: " << timely << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 void test2() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate, 0);
+  Timely timely;
 
   const double inc  = 5;
   const double smallInc  = 0.5;
   const double stopRatio = 0.8;
-  const double mean = (timely.d_maxModelRttUs-timely.d_minModelRttUs)/2.0;
+  const double mean = (Timely::k_maxModelRttUs-Timely::k_minModelRttUs)/2.0;
 
   FILE *fid = fopen("./test2.dat", "wt");
   assert(fid!=0);
-  fprintf(fid, "# NIC Rate (bytes/sec): %lf. RTTs start at mean %lf rising to max %lf\n", nicRate, mean, timely.d_maxModelRttUs);
-  fprintf(fid, "# in %lf us increments until the min TX rate %lf is reached. Then RTTs decrease\n", inc, timely.d_minRateBps);
+  fprintf(fid, "# NIC Rate (bytes/sec): %lf. RTTs start at mean %lf rising to max %lf\n", nicRate, mean, Timely::k_maxModelRttUs);
+  fprintf(fid, "# in %lf us increments until the min TX rate %lf is reached. Then RTTs decrease\n", inc, Timely::k_minRateBps);
   fprintf(fid, "# in %lf increments until %lf of NIC bandwidth reached\n", smallInc, stopRatio); 
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
   fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   double rttUs = mean;
   do {
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
     fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
     rttUs += inc;
-  } while (rttUs<=timely.d_maxModelRttUs);
+  } while (rttUs<=Timely::k_maxModelRttUs);
 
   do {
     rttUs -= smallInc;
     nowUs += rttUs;
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     timely.update(rttUs, nowUs);
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
     fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
-  } while (rttUs>timely.d_minRttUs && timely.rate()<=(nicRate*stopRatio));
+  } while (rttUs>Timely::k_minRttUs && timely.rate()<=(nicRate*stopRatio));
 
   fclose(fid);
   std::cerr << "test2: Timely Final State: " << timely << std::endl << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 void test3() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate, 0);
+  Timely timely;
 
   // Setup random generators
   std::random_device dev;
   std::mt19937 rng(dev());
 
   // Sample from Guassian distribution
-  const double mean = (timely.d_minModelRttUs+10);
+  const double mean = (Timely::k_minModelRttUs+10);
   const double stddev = 4.0;
   std::normal_distribution<double> rttDist(mean, stddev);
 
@@ -110,34 +127,40 @@ void test3() {
   // there's no overhead to transmit the packet, the elapsed time form the last simulated transmission to now is just
   // 'rttUs'. 
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
   fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   while (nowUs < 10000000.0) {
     double rttUs = rttDist(rng);
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
     fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
   }
 
   fclose(fid);
   std::cerr << "test3: Timely Final State: " << timely << std::endl << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 void test4() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate, 0);
+  Timely timely;
 
   // Setup random generators
   std::random_device dev;
   std::mt19937 rng(dev());
 
   // Sample from Guassian distribution
-  const double mean = (timely.d_minModelRttUs-5);
+  const double mean = (Timely::k_minModelRttUs-5);
   const double stddev = 2.0;
   std::normal_distribution<double> rttDist(mean, stddev);
 
@@ -151,22 +174,28 @@ void test4() {
   // there's no overhead to transmit the packet, the elapsed time form the last simulated transmission to now is just
   // 'rttUs'. 
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
   fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   while (nowUs < 30000000.0) {
     double rttUs = rttDist(rng);
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
     fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
   }
 
   fclose(fid);
   std::cerr << "test4: Timely Final State: " << timely << std::endl << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 int main() {
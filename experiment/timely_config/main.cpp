@@ -0,0 +1,193 @@
+#include <timelydynamic.h>
+#include <timelyconfig.h>
+#include <timely.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+typedef Experiment::Timely<Experiment::TimelyErpcParams> TimelyErpc;
+typedef Experiment::Timely<Experiment::TimelyBasicParams> TimelyBasic;
+typedef Experiment::TimelyTracedParams<Experiment::TimelyErpcParams> TracedErpcParams;   // compare raw rates too
+typedef Experiment::TimelyTracedParams<Experiment::TimelyBasicParams> TracedBasicParams; // compare raw rates too
+
+struct Sample {
+  uint32_t d_sessionId;                             // session updated
+  double   d_rttUs;                                 // RTT
+  double   d_nowUs;                                 // absolute time of sample
+};
+
+// Return 'count' samples over 'sessions' sessions. RTTs are mostly near the min model RTT with one in 32 above the
+// max model RTT so every regime of 'update' is exercised. Time advances per session
+std::vector<Sample> makeSamples(unsigned sessions, unsigned count, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint32_t> sessionDist(0, sessions-1);
+  std::normal_distribution<double> rttDist(60.0, 40.0);
+  std::uniform_real_distribution<double> bigRttDist(900.0, 1500.0);
+  std::vector<double> nowUs(sessions, 0.0);
+  std::vector<Sample> samples(count);
+  for (unsigned i=0; i<count; ++i) {
+    Sample& s = samples[i];
+    s.d_sessionId = sessionDist(rng);
+    s.d_rttUs = (i%32==31) ? bigRttDist(rng) : std::max(0.5, rttDist(rng));
+    nowUs[s.d_sessionId] += s.d_rttUs;
+    s.d_nowUs = nowUs[s.d_sessionId];
+  }
+  return samples;
+}
+
+// Run 'samples' through 'Timely<PARAMS>' and 'TimelyDynamic' configured with the same values. Return mismatches
+template <class PARAMS>
+unsigned checkEquivalence(const char *name, unsigned sessions, const std::vector<Sample>& samples) {
+  Experiment::TimelyConfigDomain domain(Experiment::TimelyConfig::fromParams<PARAMS>());
+  Experiment::TimelyConfigReader reader(domain);
+
+  std::deque<Experiment::Timely<PARAMS>> fixed;
+  std::deque<Experiment::TimelyDynamic> dynamic;
+  for (unsigned i=0; i<sessions; ++i) {
+    fixed.emplace_back(sessions-1);
+    dynamic.emplace_back(&domain, sessions-1);
+  }
+
+  unsigned mismatches = 0;
+  for (const Sample& s: samples) {
+    const double a = fixed[s.d_sessionId].update(s.d_rttUs, s.d_nowUs);
+    const double b = dynamic[s.d_sessionId].update(s.d_rttUs, s.d_nowUs);
+    if (a!=b || fixed[s.d_sessionId].rawRate()!=dynamic[s.d_sessionId].rawRate()) {
+      ++mismatches;
+    }
+  }
+
+  printf("%-6s sessions %6u  samples %8zu  mismatches %u  %s\n", name, sessions, samples.size(), mismatches,
+    mismatches==0 ? "ok" : "FAIL");
+  return mismatches;
+}
+
+// Time 'samples' through 'sessions' objects made by 'make'. Return ns per update
+template <class TIMELY, class MAKE>
+double timeUpdates(unsigned sessions, const std::vector<Sample>& samples, MAKE make, double *checksum) {
+  std::deque<TIMELY> bank;
+  for (unsigned i=0; i<sessions; ++i) {
+    make(bank);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  for (const Sample& s: samples) {
+    bank[s.d_sessionId].update(s.d_rttUs, s.d_nowUs);
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  *checksum = 0;
+  for (const TIMELY& t: bank) {
+    *checksum += t.rate();
+  }
+  return std::chrono::duration<double, std::nano>(end-start).count()/samples.size();
+}
+
+// Per-update cost of reading constants through the shared config against compile-time constants
+void benchmark(unsigned sessions) {
+  const unsigned kSamples = 10000000;
+  const std::vector<Sample> samples = makeSamples(sessions, kSamples, 7);
+
+  Experiment::TimelyConfigDomain domain(Experiment::TimelyConfig::fromParams<Experiment::TimelyErpcParams>());
+  Experiment::TimelyConfigReader reader(domain);
+
+  double fixedSum(0), dynamicSum(0);
+  const double fixedNs = timeUpdates<TimelyErpc>(sessions, samples,
+    [sessions](std::deque<TimelyErpc>& bank) { bank.emplace_back(sessions-1); }, &fixedSum);
+  const double dynamicNs = timeUpdates<Experiment::TimelyDynamic>(sessions, samples,
+    [&domain, sessions](std::deque<Experiment::TimelyDynamic>& bank) { bank.emplace_back(&domain, sessions-1); },
+    &dynamicSum);
+
+  printf("sessions %7u  Timely<TimelyErpcParams> %6.2f ns/update  TimelyDynamic %6.2f ns/update  added %+6.2f ns  %s\n",
+    sessions, fixedNs, dynamicNs, dynamicNs-fixedNs, fixedSum==dynamicSum ? "same rates" : "RATES DIFFER");
+}
+
+// One reader thread updates sessions while a control thread flips alpha between two values. The reader reports a
+// quiescent state every 'kQuiescentEvery' updates; each flip is followed by 'synchronize'. Return true if the reader
+// only ever saw one of the published configs and nothing was left to reclaim
+bool hotSwap() {
+  const unsigned kSessions = 10000;
+  const unsigned kSamples = 20000000;
+  const unsigned kQuiescentEvery = 256;
+  const std::vector<Sample> samples = makeSamples(kSessions, kSamples, 11);
+
+  Experiment::TimelyConfig configA = Experiment::TimelyConfig::fromParams<Experiment::TimelyErpcParams>();
+  Experiment::TimelyConfig configB = configA;
+  configB.d_alpha = 0.3;
+  configB.d_beta = 0.5;
+
+  Experiment::TimelyConfigDomain domain(configA);
+  std::atomic<bool> done(false);
+  std::atomic<unsigned> badConfigs(0);
+  double readerNs(0);
+  uint64_t configChanges(0);
+
+  std::thread readerThread([&]() {
+    Experiment::TimelyConfigReader reader(domain);
+    std::deque<Experiment::TimelyDynamic> bank;
+    for (unsigned i=0; i<kSessions; ++i) {
+      bank.emplace_back(&domain, kSessions-1);
+    }
+    double lastAlpha = domain.current()->d_alpha;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<kSamples; ++i) {
+      if (i%kQuiescentEvery==0) {
+        reader.quiescent();
+        const double alpha = domain.current()->d_alpha;
+        if (alpha!=configA.d_alpha && alpha!=configB.d_alpha) {
+          ++badConfigs;
+        }
+        if (alpha!=lastAlpha) {
+          ++configChanges;
+          lastAlpha = alpha;
+        }
+      }
+      const Sample& s = samples[i];
+      bank[s.d_sessionId].update(s.d_rttUs, s.d_nowUs);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    readerNs = std::chrono::duration<double, std::nano>(end-start).count()/kSamples;
+    done = true;
+  });
+
+  uint64_t publishes = 0;
+  while (!done) {
+    domain.publish((publishes%2==0) ? configB : configA);
+    domain.synchronize();
+    ++publishes;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  readerThread.join();
+  const std::size_t leftover = domain.reclaim();
+
+  const bool ok = badConfigs==0 && leftover==0;
+  printf("\nhot swap: %lu publishes, reader saw %lu config changes, %.2f ns/update while swapping, "
+    "%zu configs unreclaimed, %u bad configs  %s\n", publishes, configChanges, readerNs, leftover,
+    badConfigs.load(), ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main() {
+  unsigned mismatches = 0;
+
+  for (unsigned sessions: {1u, 16u, 10000u}) {
+    const std::vector<Sample> samples = makeSamples(sessions, 1000000, sessions);
+    mismatches += checkEquivalence<TracedErpcParams>("erpc", sessions, samples);
+    mismatches += checkEquivalence<TracedBasicParams>("basic", sessions, samples);
+  }
+
+  printf("\n");
+  for (unsigned sessions: {1u, 10000u, 1000000u}) {
+    benchmark(sessions);
+  }
+
+  const bool swapOk = hotSwap();
+
+  return (mismatches==0 && swapOk) ? 0 : 1;
+}
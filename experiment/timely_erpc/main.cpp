@@ -1,172 +1,215 @@
 #include <timely.h>
+#include <tracefile.h>
 #include <random>
 #include <CommFunc.h>
+#include <hdrhistogram.h>
 
-const double nicRate = 10000000000.0; // NIC line rate 10GBps (giga bytes/sec) as bytes/sec
+typedef Experiment::Timely<Experiment::TimelyTracedParams<Experiment::TimelyErpcParams>> Timely;
+
+const double nicRate = Timely::k_maxNicBps; // NIC line rate 10GBps (giga bytes/sec) as bytes/sec
+
+// Columns of every 'testN.trc' file. 'trace2csv.tsk' turns a trace back into the CSV 'plot.r' reads
+const std::vector<std::string> traceColumns = { "Time", "RTT", "Rate", "RawRate" };
 
 void test1() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate);
+  Timely timely;
 
   // Setup random generators
   std::random_device dev;
   std::mt19937 rng(dev());
 
   // Sample from Guassian distribution
-  const double mean = (timely.d_minModelRttUs-2.0);
+  const double mean = (Timely::k_minModelRttUs-2.0);
   const double stddev = 4.0;
   std::normal_distribution<double> rttDist(mean, stddev);
 
-  FILE *fid = fopen("./test1.dat", "wt");
-  assert(fid!=0);
-  fprintf(fid, "# NIC Rate (bytes/sec): %lf, RTTs sampled from Guassian distribution mean=%lf, stddev=%lf\n",
+  char comment[256];
+  snprintf(comment, sizeof(comment),
+    "# NIC Rate (bytes/sec): %lf, RTTs sampled from Guassian distribution mean=%lf, stddev=%lf\n",
     nicRate, mean, stddev);
+  Experiment::TraceWriter trace("./test1.trc", traceColumns, comment);
+  assert(trace.isOpen());
 
   // Now simulate 10s (10,000,000 microseconds) of packet transmissions. At each iteration we randomly sample a RTT
   // from 'rttDist'. This RTT time represents a bonafide RTT without serialization. Call this time 'rttUs'. Assuming
   // there's no overhead to transmit the packet, the elapsed time form the last simulated transmission to now is just
   // 'rttUs'. 
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
-  fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   while (nowUs < 10000000.0) {
     double rttUs = rttDist(rng);
-    data.push_back(rttUs); 
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
-    fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
+    const double row[] = { nowUs, rttUs, timely.rate(), timely.rawRate() };
+    trace.append(row);
   }
 
-  fclose(fid);
+  trace.close();
   std::cerr << "test1: Timely Final State: " << timely << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 void test2() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate);
+  Timely timely;
 
   const double inc  = 5;
   const double smallInc  = 0.5;
   const double stopRatio = 0.8;
-  const double mean = (timely.d_maxModelRttUs-timely.d_minModelRttUs)/2.0;
+  const double mean = (Timely::k_maxModelRttUs-Timely::k_minModelRttUs)/2.0;
 
-  FILE *fid = fopen("./test2.dat", "wt");
-  assert(fid!=0);
-  fprintf(fid, "# NIC Rate (bytes/sec): %lf. RTTs start at mean %lf rising to max %lf\n", nicRate, mean, timely.d_maxModelRttUs);
-  fprintf(fid, "# in %lf us increments until the min TX rate %lf is reached. Then RTTs decrease\n", inc, timely.d_minRateBps);
-  fprintf(fid, "# in %lf increments until %lf of NIC bandwidth reached\n", smallInc, stopRatio); 
+  char comment[512];
+  snprintf(comment, sizeof(comment),
+    "# NIC Rate (bytes/sec): %lf. RTTs start at mean %lf rising to max %lf\n"
+    "# in %lf us increments until the min TX rate %lf is reached. Then RTTs decrease\n"
+    "# in %lf increments until %lf of NIC bandwidth reached\n",
+    nicRate, mean, Timely::k_maxModelRttUs, inc, Timely::k_minRateBps, smallInc, stopRatio);
+  Experiment::TraceWriter trace("./test2.trc", traceColumns, comment);
+  assert(trace.isOpen());
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
-  fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   double rttUs = mean;
   do {
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
-    fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
+    const double row[] = { nowUs, rttUs, timely.rate(), timely.rawRate() };
+    trace.append(row);
     rttUs += inc;
-  } while (rttUs<=timely.d_maxModelRttUs);
+  } while (rttUs<=Timely::k_maxModelRttUs);
 
   do {
     rttUs -= smallInc;
     nowUs += rttUs;
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     timely.update(rttUs, nowUs);
-    fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
-  } while (rttUs>timely.d_minRttUs && timely.rate()<=(nicRate*stopRatio));
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
+    const double row[] = { nowUs, rttUs, timely.rate(), timely.rawRate() };
+    trace.append(row);
+  } while (rttUs>Timely::k_minRttUs && timely.rate()<=(nicRate*stopRatio));
 
-  fclose(fid);
+  trace.close();
   std::cerr << "test2: Timely Final State: " << timely << std::endl << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 void test3() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate);
+  Timely timely;
 
   // Setup random generators
   std::random_device dev;
   std::mt19937 rng(dev());
 
   // Sample from Guassian distribution
-  const double mean = (timely.d_minModelRttUs+10);
+  const double mean = (Timely::k_minModelRttUs+10);
   const double stddev = 4.0;
   std::normal_distribution<double> rttDist(mean, stddev);
 
-  FILE *fid = fopen("./test3.dat", "wt");
-  assert(fid!=0);
-  fprintf(fid, "# NIC Rate (bytes/sec): %lf, RTTs sampled from Guassian distribution mean=%lf, stddev=%lf\n",
+  char comment[256];
+  snprintf(comment, sizeof(comment),
+    "# NIC Rate (bytes/sec): %lf, RTTs sampled from Guassian distribution mean=%lf, stddev=%lf\n",
     nicRate, mean, stddev);
+  Experiment::TraceWriter trace("./test3.trc", traceColumns, comment);
+  assert(trace.isOpen());
 
   // Now simulate 10s (10,000,000 microseconds) of packet transmissions. At each iteration we randomly sample a RTT
   // from 'rttDist'. This RTT time represents a bonafide RTT without serialization. Call this time 'rttUs'. Assuming
   // there's no overhead to transmit the packet, the elapsed time form the last simulated transmission to now is just
   // 'rttUs'. 
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
-  fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   while (nowUs < 10000000.0) {
     double rttUs = rttDist(rng);
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
-    fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
+    const double row[] = { nowUs, rttUs, timely.rate(), timely.rawRate() };
+    trace.append(row);
   }
 
-  fclose(fid);
+  trace.close();
   std::cerr << "test3: Timely Final State: " << timely << std::endl << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 void test4() {
   // The Timely TX rate estimator
-  Experiment::Timely timely(nicRate);
+  Timely timely;
 
   // Setup random generators
   std::random_device dev;
   std::mt19937 rng(dev());
 
   // Sample from Guassian distribution
-  const double mean = (timely.d_minModelRttUs-5);
+  const double mean = (Timely::k_minModelRttUs-5);
   const double stddev = 2.0;
   std::normal_distribution<double> rttDist(mean, stddev);
 
-  FILE *fid = fopen("./test4.dat", "wt");
-  assert(fid!=0);
-  fprintf(fid, "# NIC Rate (bytes/sec): %lf, RTTs sampled from Guassian distribution mean=%lf, stddev=%lf\n",
+  char comment[256];
+  snprintf(comment, sizeof(comment),
+    "# NIC Rate (bytes/sec): %lf, RTTs sampled from Guassian distribution mean=%lf, stddev=%lf\n",
     nicRate, mean, stddev);
+  Experiment::TraceWriter trace("./test4.trc", traceColumns, comment);
+  assert(trace.isOpen());
 
   // Now simulate 30s (30,000,000 microseconds) of packet transmissions. At each iteration we randomly sample a RTT
   // from 'rttDist'. This RTT time represents a bonafide RTT without serialization. Call this time 'rttUs'. Assuming
   // there's no overhead to transmit the packet, the elapsed time form the last simulated transmission to now is just
   // 'rttUs'. 
 
-  std::vector<double> data;
+  Experiment::StreamStats rttStats;
+  Experiment::HdrHistogram rttHdr(1000000.0, 0.001);  // RTTs up to 1s at 1ns resolution
+  Experiment::HdrHistogram rateHdr(100.0, 0.000001);  // rates up to 100Gbps at 1Kbps resolution
 
-  fprintf(fid, "Time,RTT,Rate,RawRate\n");
   double nowUs = 0;
   while (nowUs < 30000000.0) {
     double rttUs = rttDist(rng);
-    data.push_back(rttUs);
+    rttStats.add(rttUs);
     nowUs += rttUs;
     timely.update(rttUs, nowUs);
-    fprintf(fid, "%lf,%lf,%lf,%lf\n", nowUs, rttUs, timely.rate(), timely.rawRate());
+    rttHdr.record(rttUs);
+    rateHdr.record(timely.rateAsGbps());
+    const double row[] = { nowUs, rttUs, timely.rate(), timely.rawRate() };
+    trace.append(row);
   }
 
-  fclose(fid);
+  trace.close();
   std::cerr << "test4: Timely Final State: " << timely << std::endl << std::endl;
 
-  CommFunc::summarize(data);
+  CommFunc::summarize(rttStats);
+  std::cout << "# RTT (units us) percentiles" << std::endl << rttHdr;
+  std::cout << "# Rate (units Gbps) percentiles" << std::endl << rateHdr;
 }
 
 int main() {
@@ -0,0 +1,154 @@
+#include <fabricsim.h>
+#include <timely.h>
+#include <xorshift.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// eRPC Timely flows across a leaf-spine fabric, simulated in parallel. 'racks' ToR switches each have an uplink to
+// every one of 'spines' spine switches, and every spine has a downlink to every ToR. Every link is a bottleneck with
+// its own switch queue and a partition of its own. Each flow goes from a random rack to another random rack through
+// one spine picked per flow, as ECMP would, so it crosses an uplink and a downlink. The flows, their racks, spines
+// and start times come from 'seed'. The same fabric runs for 'seconds' of virtual time with 1, 2, 4, ... up to
+// 'threads' threads. Each run must give the same digest, and the program exits non-zero if one differs
+
+typedef Experiment::Timely<Experiment::TimelyErpcParams> Timely;
+
+const uint64_t kPropagationNs = 2000;               // link to next hop
+const uint64_t kForwardNs = 1000;                   // sender to its ToR uplink
+const uint64_t kReturnNs = 4000;                    // receiver back to sender for ACKs
+const uint64_t kStartSpreadNs = 1000000;            // flows start at random in the first 1ms
+
+struct Fabric {
+  unsigned                      d_flows;            // flows
+  unsigned                      d_racks;            // ToR switches
+  unsigned                      d_spines;           // spine switches
+  uint64_t                      d_seed;             // picks racks, spines and start times
+  double                        d_linkBps;          // every link's bytes/sec
+};
+
+unsigned uplink(const Fabric& fabric, unsigned rack, unsigned spine) {
+  return rack*fabric.d_spines+spine;
+}
+
+unsigned downlink(const Fabric& fabric, unsigned spine, unsigned rack) {
+  return fabric.d_racks*fabric.d_spines+spine*fabric.d_racks+rack;
+}
+
+void build(const Fabric& fabric, Experiment::FabricSim<Timely> *sim) {
+  Experiment::FabricLinkConfig link;
+  link.d_rateBps = fabric.d_linkBps;
+  link.d_propagationNs = kPropagationNs;
+  for (unsigned i=0; i<2*fabric.d_racks*fabric.d_spines; ++i) {
+    sim->addLink(link);
+  }
+
+  uint64_t state = fabric.d_seed ? fabric.d_seed : 1;
+  std::vector<unsigned> path(2);
+  Experiment::SimFlowConfig flow;
+  flow.d_forwardNs = kForwardNs;
+  flow.d_returnNs = kReturnNs;
+  const unsigned flowsPerUplink = std::max(1u, fabric.d_flows/(fabric.d_racks*fabric.d_spines));
+  for (unsigned i=0; i<fabric.d_flows; ++i) {
+    const unsigned from = static_cast<unsigned>(Experiment::nextRandom(&state)%fabric.d_racks);
+    const unsigned hop = static_cast<unsigned>(Experiment::nextRandom(&state)%(fabric.d_racks-1));
+    const unsigned to = (from+1+hop)%fabric.d_racks;
+    const unsigned spine = static_cast<unsigned>(Experiment::nextRandom(&state)%fabric.d_spines);
+    path[0] = uplink(fabric, from, spine);
+    path[1] = downlink(fabric, spine, to);
+    flow.d_startNs = Experiment::nextRandom(&state)%kStartSpreadNs;
+    // Like 'timely_sim', a flow's initial rate assumes the flows of an average uplink share its NIC
+    sim->addFlow(flow, path, flowsPerUplink-1);
+  }
+}
+
+void report(const Fabric& fabric, const Experiment::FabricSim<Timely>& sim, double seconds) {
+  const unsigned tierLinks = fabric.d_racks*fabric.d_spines;
+  const char *names[] = { "uplinks", "downlinks" };
+  printf("\n%-10s %8s %8s %10s %10s %10s %10s\n", "tier", "util", "util", "queue mean", "queue max", "peak max",
+    "drops");
+  printf("%-10s %8s %8s %10s %10s %10s %10s\n", "", "mean %", "max %", "KB", "KB", "KB", "");
+  for (unsigned tier=0; tier<2; ++tier) {
+    double utilSum = 0;
+    double utilMax = 0;
+    double queueSum = 0;
+    double queueMax = 0;
+    double peakMax = 0;
+    uint64_t drops = 0;
+    for (unsigned i=tier*tierLinks; i<(tier+1)*tierLinks; ++i) {
+      const double util = 100.0*sim.departedBytes(i)/(sim.link(i).d_rateBps*seconds);
+      const double queue = sim.queueArea(i)/(seconds*1e9)/1024;
+      utilSum += util;
+      utilMax = std::max(utilMax, util);
+      queueSum += queue;
+      queueMax = std::max(queueMax, queue);
+      peakMax = std::max(peakMax, sim.peakQueueBytes(i)/1024);
+      drops += sim.drops(i);
+    }
+    printf("%-10s %8.1f %8.1f %10.1f %10.1f %10.1f %10lu\n", names[tier], utilSum/tierLinks, utilMax,
+      queueSum/tierLinks, queueMax, peakMax, drops);
+  }
+
+  std::vector<double> goodput;
+  for (unsigned i=0; i<sim.flowCount(); ++i) {
+    goodput.push_back(sim.flow(i).d_ackedBytes/seconds*1e-6);
+  }
+  std::sort(goodput.begin(), goodput.end());
+  const Experiment::HdrHistogram rtt = sim.rttNs();
+  printf("per-flow goodput MB/s: min %.2f p50 %.2f max %.2f\n", goodput.front(), goodput[goodput.size()/2],
+    goodput.back());
+  printf("RTT us: min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", rtt.min()*1e-3,
+    rtt.percentile(50)*1e-3, rtt.percentile(90)*1e-3, rtt.percentile(99)*1e-3, rtt.percentile(99.9)*1e-3,
+    rtt.max()*1e-3);
+}
+
+int main(int argc, char **argv) {
+  Fabric fabric;
+  fabric.d_flows = argc>1 ? static_cast<unsigned>(atoi(argv[1])) : 1000;
+  const double seconds = argc>2 ? atof(argv[2]) : 0.2;
+  fabric.d_racks = argc>3 ? static_cast<unsigned>(atoi(argv[3])) : 8;
+  fabric.d_spines = argc>4 ? static_cast<unsigned>(atoi(argv[4])) : 4;
+  const unsigned maxThreads = argc>5 ? static_cast<unsigned>(atoi(argv[5])) : 4;
+  fabric.d_seed = argc>6 ? strtoull(argv[6], 0, 0) : 1;
+  fabric.d_linkBps = (argc>7 ? atof(argv[7]) : 10.0)*1e9/8;
+  if (fabric.d_flows==0 || seconds<=0 || fabric.d_racks<2 || fabric.d_spines==0 || maxThreads==0 ||
+    fabric.d_linkBps<=0) {
+    fprintf(stderr, "usage: timely_fabric.tsk [flows] [seconds] [racks>1] [spines] [threads] [seed] [linkGbps]\n");
+    return 2;
+  }
+
+  printf("%u flows, %u racks, %u spines, %u links of %.1f Gbps, %.3f s virtual, seed %lu\n", fabric.d_flows,
+    fabric.d_racks, fabric.d_spines, 2*fabric.d_racks*fabric.d_spines, fabric.d_linkBps*8e-9, seconds,
+    fabric.d_seed);
+  printf("%7s %8s %10s %12s %10s %18s\n", "threads", "wall s", "M events", "M events/s", "windows", "digest");
+
+  const uint64_t endNs = static_cast<uint64_t>(seconds*1e9);
+  uint64_t expected = 0;
+  bool ok = true;
+  for (unsigned threads=1; threads<=maxThreads; threads*=2) {
+    Experiment::FabricSim<Timely> sim;
+    build(fabric, &sim);
+    const auto start = std::chrono::steady_clock::now();
+    sim.run(endNs, threads);
+    const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    printf("%7u %8.2f %10.2f %12.2f %10lu   %016lx\n", threads, wallSeconds, sim.processed()*1e-6,
+      sim.processed()/wallSeconds*1e-6, sim.windows(), sim.digest());
+
+    if (threads==1) {
+      expected = sim.digest();
+      report(fabric, sim, seconds);
+      printf("\n");
+      if (sim.processed()==0) {
+        printf("FAIL: no events\n");
+        ok = false;
+      }
+    } else if (sim.digest()!=expected) {
+      printf("FAIL: %u threads digest %016lx differs from 1 thread %016lx\n", threads, sim.digest(), expected);
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,448 @@
+#include <bottlenecksim.h>
+#include <dcqcn.h>
+#include <timely.h>
+#include <workstealingpool.h>
+#include <xorshift.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Fairness and convergence of competing Timely or DCQCN flows. One job is one (scenario, variant) pair. Each job
+// runs the scenario's flows through a 'BottleneckSim' and samples every flow's goodput once per interval. From the
+// samples it computes Jain's index, the time to come within 10% of the fair share after every change in the set of
+// flows, queue occupancy and link utilization. Results go to a CSV file with one row per job. The simulator is
+// deterministic, so the file only changes when a controller, the simulator or the scenarios do. Diff it between
+// versions. The switch marks ECN for every variant but 'hybrid-rtt', which shows the hybrid DCQCN on a path that does
+// not mark. It must match eRPC's Timely exactly, and the program exits non-zero if it does not.
+
+enum Scenario {
+  e_INCAST,                                         // 32 flows of 2MB start together
+  e_STAGGERED,                                      // 8 flows arrive 50ms apart then leave last-in first-out
+  e_MIXED_RTT,                                      // 8 flows with a 30us base RTT against 8 with 300us
+  e_ELEPHANT_MICE,                                  // 4 long flows and Poisson 64KB flows at 20% load
+  e_SCENARIO_COUNT
+};
+
+enum Variant {
+  e_ERPC,                                           // Timely<TimelyErpcParams>
+  e_BASIC,                                          // Timely<TimelyBasicParams>
+  e_DCQCN,                                          // Dcqcn<DcqcnParams>
+  e_HYBRID,                                         // Dcqcn<DcqcnHybridParams>
+  e_HYBRID_RTT,                                     // Dcqcn<DcqcnHybridParams> with a switch that does not mark
+  e_VARIANT_COUNT
+};
+
+const char *scenarioName[e_SCENARIO_COUNT] = { "incast", "staggered", "mixedrtt", "elephantmice" };
+const char *variantName[e_VARIANT_COUNT] = { "erpc", "basic", "dcqcn", "hybrid", "hybrid-rtt" };
+
+const double kLinkBps = 1.25e9;                     // bottleneck bytes/sec (10Gbps)
+const uint64_t kBufferBytes = 1u<<20;               // switch buffer
+const uint32_t kPacketBytes = 4096;                 // packet size
+const double kFairBand = 0.1;                       // a flow within +/- this fraction of its fair share is fair
+const uint64_t kMouseBytes = 64*1024;               // size of each short flow in 'e_ELEPHANT_MICE'
+const double kMouseLoad = 0.2;                      // fraction of the link the short flows offer
+const uint64_t kEcnMinBytes = 5*1024;               // queue at which ECN marking starts
+const uint64_t kEcnMaxBytes = 200*1024;             // queue from which every packet is marked
+const double kEcnMaxProbability = 0.01;             // marking probability just below 'kEcnMaxBytes'
+
+struct FlowSpec {
+  Experiment::SimFlowConfig     d_config;           // start, stop, size and delays
+  unsigned                      d_sessionCount;     // passed to the controller: flows assumed already running
+  bool                          d_tracked;          // counted in fairness and convergence
+};
+
+struct Setup {
+  std::vector<FlowSpec>         d_flows;            // every flow of the scenario
+  uint64_t                      d_endNs;            // stop sampling; scenarios of finite flows stop when all finish
+  uint64_t                      d_sampleNs;         // goodput sampling interval
+};
+
+struct Result {
+  unsigned                      d_flows;            // flows in the scenario
+  double                        d_seconds;          // virtual time sampled
+  double                        d_jainMean;         // mean Jain's index over intervals with 2+ tracked flows
+  double                        d_jainMin;          // smallest such index
+  unsigned                      d_epochs;           // stretches with an unchanged set of tracked flows
+  unsigned                      d_unconverged;      // epochs that ended with a flow outside the fair band
+  double                        d_convergeMeanMs;   // mean time to converge over converged epochs
+  double                        d_convergeMaxMs;    // longest time to converge
+  double                        d_queueMeanKB;      // time averaged switch queue
+  double                        d_queuePeakKB;      // most queued at an arrival
+  double                        d_utilization;      // bytes accepted over what the link could send
+  uint64_t                      d_drops;            // packets dropped
+  uint64_t                      d_marks;            // packets ECN marked
+  double                        d_completionMs;     // 'e_INCAST': time the last flow finished
+  double                        d_shortLongRatio;   // 'e_MIXED_RTT': goodput of short RTT flows over long RTT ones
+  double                        d_miceFctP50Us;     // 'e_ELEPHANT_MICE': median short flow completion time
+  double                        d_miceFctP99Us;     // 'e_ELEPHANT_MICE': 99th percentile short flow completion time
+  double                        d_wallSeconds;      // time the job took
+};
+
+FlowSpec makeFlow(uint64_t startNs, uint64_t stopNs, uint64_t bytes, uint64_t rttNs, unsigned sessionCount,
+  bool tracked) {
+  FlowSpec spec;
+  spec.d_config.d_startNs = startNs;
+  spec.d_config.d_stopNs = stopNs;
+  spec.d_config.d_bytes = bytes;
+  spec.d_config.d_forwardNs = rttNs/2;
+  spec.d_config.d_returnNs = rttNs-rttNs/2;
+  spec.d_sessionCount = sessionCount;
+  spec.d_tracked = tracked;
+  return spec;
+}
+
+Setup makeSetup(Scenario scenario) {
+  // Base RTTs are at least 30us. The basic Timely ignores RTTs at or below its 20us 'k_minRttUs', so on a shorter
+  // path an idle queue tells it nothing and it never climbs off its floor (see 'timely_sim')
+  const uint64_t ms = 1000000;
+  Setup setup;
+  switch (scenario) {
+    case e_INCAST: {
+      // Every sender answers at once and knows the others are answering too
+      for (unsigned i=0; i<32; ++i) {
+        setup.d_flows.push_back(makeFlow(0, ~0ull, 2*1024*1024, 30000, 31, true));
+      }
+      setup.d_endNs = 1000*ms;
+      setup.d_sampleNs = 5*ms;
+      break;
+    }
+    case e_STAGGERED: {
+      // Flow i arrives at 50i ms knowing i flows are running, and leaves at 750-50i ms
+      for (unsigned i=0; i<8; ++i) {
+        setup.d_flows.push_back(makeFlow(i*50*ms, (750-50*i)*ms, 0, 30000, i, true));
+      }
+      setup.d_endNs = 750*ms;
+      setup.d_sampleNs = 10*ms;
+      break;
+    }
+    case e_MIXED_RTT: {
+      for (unsigned i=0; i<16; ++i) {
+        setup.d_flows.push_back(makeFlow(0, ~0ull, 0, i%2 ? 300000 : 30000, 15, true));
+      }
+      setup.d_endNs = 500*ms;
+      setup.d_sampleNs = 10*ms;
+      break;
+    }
+    default: {
+      for (unsigned i=0; i<4; ++i) {
+        setup.d_flows.push_back(makeFlow(0, ~0ull, 0, 30000, 3, true));
+      }
+      // Exponential gaps between short flow arrivals at 'kMouseLoad' of the link, stopping 100ms before the end
+      uint64_t state = 1;
+      const double meanGapNs = kMouseBytes/(kMouseLoad*kLinkBps)*1e9;
+      double startNs = 0;
+      for (;;) {
+        const double uniform = Experiment::nextUniform(&state);
+        startNs += -std::log(1.0-uniform)*meanGapNs;
+        if (startNs>=400*ms) {
+          break;
+        }
+        setup.d_flows.push_back(makeFlow(static_cast<uint64_t>(startNs), ~0ull, kMouseBytes, 30000, 4, false));
+      }
+      setup.d_endNs = 500*ms;
+      setup.d_sampleNs = 10*ms;
+      break;
+    }
+  }
+  return setup;
+}
+
+template <class CONTROLLER>
+Result simulate(Scenario scenario, bool ecn) {
+  const auto start = std::chrono::steady_clock::now();
+  const Setup setup = makeSetup(scenario);
+
+  Experiment::SimLinkConfig link;
+  link.d_rateBps = kLinkBps;
+  link.d_bufferBytes = kBufferBytes;
+  link.d_packetBytes = kPacketBytes;
+  if (ecn) {
+    link.d_ecnMinBytes = kEcnMinBytes;
+    link.d_ecnMaxBytes = kEcnMaxBytes;
+    link.d_ecnMaxProbability = kEcnMaxProbability;
+  }
+  Experiment::BottleneckSim<CONTROLLER> sim(link);
+  for (const FlowSpec& spec: setup.d_flows) {
+    sim.addFlow(spec.d_config, spec.d_sessionCount);
+  }
+  const unsigned flows = static_cast<unsigned>(setup.d_flows.size());
+
+  std::vector<uint64_t> lastAcked(flows, 0);
+  std::vector<double> goodput(flows, 0);
+  std::vector<char> active(flows, 0);
+  std::vector<char> epochActive(flows, 0);
+  std::vector<double> converge;
+  double jainSum = 0;
+  unsigned jainCount = 0;
+  double jainMin = 1;
+  unsigned epochs = 0;
+  unsigned unconverged = 0;
+  uint64_t epochStartNs = 0;
+  uint64_t lastUnfairNs = 0;
+  bool inEpoch = false;
+  bool epochFair = false;
+  double shortBytes = 0;
+  double longBytes = 0;
+
+  auto closeEpoch = [&]() {
+    if (!inEpoch) {
+      return;
+    }
+    ++epochs;
+    if (epochFair) {
+      converge.push_back((lastUnfairNs-epochStartNs)*1e-6);
+    } else {
+      ++unconverged;
+    }
+  };
+
+  uint64_t nowNs = 0;
+  while (nowNs<setup.d_endNs) {
+    const uint64_t fromNs = nowNs;
+    nowNs = std::min(setup.d_endNs, nowNs+setup.d_sampleNs);
+    sim.run(nowNs);
+    const double seconds = (nowNs-fromNs)*1e-9;
+
+    // A tracked flow is active if it was sending or had data in flight for the whole interval. An interval in which
+    // one only did so for part of the time straddles an arrival or departure and is left out
+    bool partial = false;
+    bool allFinished = true;
+    unsigned count = 0;
+    double sum = 0;
+    double sumSquares = 0;
+    for (unsigned i=0; i<flows; ++i) {
+      const Experiment::SimFlow& flow = sim.flow(i);
+      goodput[i] = (flow.d_ackedBytes-lastAcked[i])/seconds;
+      lastAcked[i] = flow.d_ackedBytes;
+      const uint64_t endNs = flow.d_config.d_bytes ?
+        (flow.d_finishNs ? flow.d_finishNs : ~0ull) : flow.d_config.d_stopNs;
+      allFinished &= flow.d_config.d_bytes && flow.d_finishNs;
+      if (!setup.d_flows[i].d_tracked) {
+        continue;
+      }
+      const bool before = flow.d_config.d_startNs<=fromNs;
+      const bool after = endNs>=nowNs;
+      active[i] = before && after;
+      partial |= !active[i] && flow.d_config.d_startNs<nowNs && endNs>fromNs;
+      if (active[i]) {
+        ++count;
+        sum += goodput[i];
+        sumSquares += goodput[i]*goodput[i];
+        if (scenario==e_MIXED_RTT) {
+          (setup.d_flows[i].d_config.d_forwardNs<100000 ? shortBytes : longBytes) += goodput[i]*seconds;
+        }
+      }
+    }
+
+    if (!partial) {
+      if (active!=epochActive) {
+        closeEpoch();
+        epochActive = active;
+        epochStartNs = fromNs;
+        lastUnfairNs = fromNs;
+        inEpoch = count>0;
+      }
+      if (count>1 && sum>0) {
+        const double jain = sum*sum/(count*sumSquares);
+        jainSum += jain;
+        ++jainCount;
+        jainMin = std::min(jainMin, jain);
+      }
+      if (count) {
+        // The fair share is an even split of what the tracked flows got together. Utilization is reported on its own,
+        // so a link that is fairly shared but not full still converges
+        const double fairShare = sum/count;
+        bool fair = true;
+        for (unsigned i=0; i<flows; ++i) {
+          fair &= !active[i] || std::fabs(goodput[i]-fairShare)<=kFairBand*fairShare;
+        }
+        if (!fair) {
+          lastUnfairNs = nowNs;
+        }
+        epochFair = fair;
+      }
+    }
+    if (allFinished) {
+      break;
+    }
+  }
+  closeEpoch();
+
+  Result result;
+  result.d_flows = flows;
+  result.d_seconds = nowNs*1e-9;
+  result.d_jainMean = jainCount ? jainSum/jainCount : NAN;
+  result.d_jainMin = jainCount ? jainMin : NAN;
+  result.d_epochs = epochs;
+  result.d_unconverged = unconverged;
+  result.d_convergeMeanMs = NAN;
+  result.d_convergeMaxMs = NAN;
+  if (!converge.empty()) {
+    double total = 0;
+    for (double ms: converge) {
+      total += ms;
+    }
+    result.d_convergeMeanMs = total/converge.size();
+    result.d_convergeMaxMs = *std::max_element(converge.begin(), converge.end());
+  }
+  result.d_queueMeanKB = sim.queueArea()/nowNs/1024;
+  result.d_queuePeakKB = sim.peakQueueBytes()/1024;
+  result.d_utilization = sim.departedBytes()/(kLinkBps*nowNs*1e-9);
+  result.d_drops = sim.drops();
+  result.d_marks = sim.marks();
+
+  result.d_completionMs = NAN;
+  result.d_shortLongRatio = NAN;
+  result.d_miceFctP50Us = NAN;
+  result.d_miceFctP99Us = NAN;
+  if (scenario==e_INCAST) {
+    uint64_t last = 0;
+    bool finished = true;
+    for (unsigned i=0; i<flows; ++i) {
+      finished &= sim.flow(i).d_finishNs!=0;
+      last = std::max(last, sim.flow(i).d_finishNs);
+    }
+    result.d_completionMs = finished ? last*1e-6 : NAN;
+  } else if (scenario==e_MIXED_RTT) {
+    result.d_shortLongRatio = longBytes>0 ? shortBytes/longBytes : NAN;
+  } else if (scenario==e_ELEPHANT_MICE) {
+    std::vector<double> fct;
+    for (unsigned i=0; i<flows; ++i) {
+      const Experiment::SimFlow& flow = sim.flow(i);
+      if (!setup.d_flows[i].d_tracked && flow.d_finishNs) {
+        fct.push_back((flow.d_finishNs-flow.d_config.d_startNs)*1e-3);
+      }
+    }
+    if (!fct.empty()) {
+      std::sort(fct.begin(), fct.end());
+      result.d_miceFctP50Us = fct[fct.size()/2];
+      result.d_miceFctP99Us = fct[std::min(fct.size()-1, fct.size()*99/100)];
+    }
+  }
+  result.d_wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  return result;
+}
+
+Result simulate(Scenario scenario, Variant variant) {
+  switch (variant) {
+    case e_ERPC:
+      return simulate<Experiment::Timely<Experiment::TimelyErpcParams>>(scenario, true);
+    case e_BASIC:
+      return simulate<Experiment::Timely<Experiment::TimelyBasicParams>>(scenario, true);
+    case e_DCQCN:
+      return simulate<Experiment::Dcqcn<Experiment::DcqcnParams>>(scenario, true);
+    case e_HYBRID:
+      return simulate<Experiment::Dcqcn<Experiment::DcqcnHybridParams>>(scenario, true);
+    default:
+      return simulate<Experiment::Dcqcn<Experiment::DcqcnHybridParams>>(scenario, false);
+  }
+}
+
+bool sameMetrics(const Result& lhs, const Result& rhs) {
+  // Return true if every metric but the wall time is equal. NaN equals NaN here
+  auto same = [](double a, double b) {
+    return a==b || (std::isnan(a) && std::isnan(b));
+  };
+  return lhs.d_flows==rhs.d_flows && same(lhs.d_seconds, rhs.d_seconds) && same(lhs.d_jainMean, rhs.d_jainMean) &&
+    same(lhs.d_jainMin, rhs.d_jainMin) && lhs.d_epochs==rhs.d_epochs && lhs.d_unconverged==rhs.d_unconverged &&
+    same(lhs.d_convergeMeanMs, rhs.d_convergeMeanMs) && same(lhs.d_convergeMaxMs, rhs.d_convergeMaxMs) &&
+    same(lhs.d_queueMeanKB, rhs.d_queueMeanKB) && same(lhs.d_queuePeakKB, rhs.d_queuePeakKB) &&
+    same(lhs.d_utilization, rhs.d_utilization) && lhs.d_drops==rhs.d_drops &&
+    same(lhs.d_completionMs, rhs.d_completionMs) && same(lhs.d_shortLongRatio, rhs.d_shortLongRatio) &&
+    same(lhs.d_miceFctP50Us, rhs.d_miceFctP50Us) && same(lhs.d_miceFctP99Us, rhs.d_miceFctP99Us);
+}
+
+void usage() {
+  fprintf(stderr, "usage: timely_fairness.tsk [-t threads] [-o results-file]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  unsigned threads = std::thread::hardware_concurrency();
+  std::string output = "./fairness.dat";
+
+  for (int i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (i+1>=argc) {
+      usage();
+    }
+    if (arg=="-t") {
+      threads = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg=="-o") {
+      output = argv[++i];
+    } else {
+      usage();
+    }
+  }
+
+  const unsigned jobs = e_SCENARIO_COUNT*e_VARIANT_COUNT;
+  std::vector<Result> results(jobs);
+  const auto start = std::chrono::steady_clock::now();
+  {
+    Experiment::WorkStealingPool pool(threads);
+    for (unsigned j=0; j<jobs; ++j) {
+      pool.submit([&results, j]() {
+        results[j] = simulate(static_cast<Scenario>(j/e_VARIANT_COUNT), static_cast<Variant>(j%e_VARIANT_COUNT));
+      });
+    }
+    pool.wait();
+  }
+  const double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+  FILE *fid = fopen(output.c_str(), "wt");
+  if (fid==0) {
+    fprintf(stderr, "cannot open '%s'\n", output.c_str());
+    return 1;
+  }
+  fprintf(fid, "# Timely fairness: %.0f Gbps bottleneck, %lu KB buffer, %u byte packets, fair band +/-%.0f%%\n",
+    kLinkBps*8e-9, kBufferBytes/1024, kPacketBytes, kFairBand*100);
+  fprintf(fid, "Scenario,Variant,Flows,Seconds,JainMean,JainMin,Epochs,Unconverged,ConvergeMeanMs,ConvergeMaxMs,"
+    "QueueMeanKB,QueuePeakKB,Utilization,Drops,Marks,CompletionMs,ShortLongRatio,MiceFctP50Us,MiceFctP99Us\n");
+  printf("%-12s %-10s %5s %6s %6s %6s %7s %8s %8s %8s %8s %6s %6s %7s  %s\n", "scenario", "control", "flows",
+    "jain", "jain", "epochs", "unconv", "converge", "converge", "queue", "queue", "util", "drops", "marks",
+    "scenario metric");
+  printf("%-12s %-10s %5s %6s %6s %6s %7s %8s %8s %8s %8s %6s %6s %7s\n", "", "", "", "mean", "min", "", "",
+    "mean ms", "max ms", "mean KB", "peak KB", "%", "", "");
+
+  bool ok = true;
+  for (unsigned j=0; j<jobs; ++j) {
+    const char *scenario = scenarioName[j/e_VARIANT_COUNT];
+    const char *variant = variantName[j%e_VARIANT_COUNT];
+    const Result& r = results[j];
+    fprintf(fid, "%s,%s,%u,%.3f,%.4f,%.4f,%u,%u,%.1f,%.1f,%.1f,%.1f,%.4f,%lu,%lu,%.2f,%.3f,%.1f,%.1f\n", scenario,
+      variant, r.d_flows, r.d_seconds, r.d_jainMean, r.d_jainMin, r.d_epochs, r.d_unconverged, r.d_convergeMeanMs,
+      r.d_convergeMaxMs, r.d_queueMeanKB, r.d_queuePeakKB, r.d_utilization, r.d_drops, r.d_marks, r.d_completionMs,
+      r.d_shortLongRatio, r.d_miceFctP50Us, r.d_miceFctP99Us);
+
+    char extra[64] = "";
+    if (!std::isnan(r.d_completionMs)) {
+      snprintf(extra, sizeof(extra), "last done %.1f ms", r.d_completionMs);
+    } else if (!std::isnan(r.d_shortLongRatio)) {
+      snprintf(extra, sizeof(extra), "short/long RTT %.2f", r.d_shortLongRatio);
+    } else if (!std::isnan(r.d_miceFctP50Us)) {
+      snprintf(extra, sizeof(extra), "mice FCT p50 %.0f p99 %.0f us", r.d_miceFctP50Us, r.d_miceFctP99Us);
+    }
+    printf("%-12s %-10s %5u %6.3f %6.3f %6u %7u %8.1f %8.1f %8.1f %8.1f %6.1f %6lu %7lu  %s\n", scenario,
+      variant, r.d_flows, r.d_jainMean, r.d_jainMin, r.d_epochs, r.d_unconverged, r.d_convergeMeanMs,
+      r.d_convergeMaxMs, r.d_queueMeanKB, r.d_queuePeakKB, 100*r.d_utilization, r.d_drops, r.d_marks, extra);
+
+    if (!(r.d_utilization>0) || r.d_utilization>1.001 || !(r.d_jainMean>0 && r.d_jainMean<=1)) {
+      printf("FAIL: %s %s: utilization %.4f, Jain's index %.4f\n", scenario, variant, r.d_utilization,
+        r.d_jainMean);
+      ok = false;
+    }
+    if (j%e_VARIANT_COUNT==e_HYBRID_RTT && !sameMetrics(r, results[j-e_HYBRID_RTT+e_ERPC])) {
+      printf("FAIL: %s %s: hybrid without ECN marks does not match %s\n", scenario, variant, variantName[e_ERPC]);
+      ok = false;
+    }
+  }
+  fclose(fid);
+
+  printf("%u jobs in %.2f s; results written to %s\n", jobs, elapsedSec, output.c_str());
+  return ok ? 0 : 1;
+}
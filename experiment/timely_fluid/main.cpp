@@ -0,0 +1,314 @@
+#include <bottlenecksim.h>
+#include <timely.h>
+#include <timelyconfig.h>
+#include <timelyfluid.h>
+#include <workstealingpool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Screen a grid of Timely parameter sets for stability with the fluid model in 'timelyfluid.h'. One job integrates
+// 'kPointsPerJob' parameter sets. The program first checks that the vector kernel gives the same bits as the scalar
+// one, then sweeps the grid and writes one row per parameter set. Last, it runs eRPC's and the basic Timely through
+// both the fluid model and the packet-level 'BottleneckSim' with the same link and flows, to show how far the two
+// agree. It exits non-zero if the kernels disagree.
+
+const unsigned kPointsPerJob = 64;                  // parameter sets integrated by one job
+const unsigned kRanked = 5;                         // flag-free parameter sets listed, least queue swing first
+
+// Return the parameter grid: every combination of the values below with the eRPC variant switches
+std::vector<Experiment::TimelyConfig> makeGrid() {
+  const double alphas[] = { 0.02, 0.05, 0.1, 0.2, 0.3, 0.46, 0.6, 0.75, 0.875, 1.0 };
+  const double betas[] = { 0.05, 0.1, 0.2, 0.26, 0.4, 0.6, 0.8, 1.0 };
+  const double deltas[] = { 1e6, 2e6, 5e6, 10e6, 20e6, 50e6 };
+  const double minModelRtts[] = { 20, 30, 50, 80, 100 };
+  const double maxModelRtts[] = { 200, 500, 1000, 2000 };
+
+  std::vector<Experiment::TimelyConfig> grid;
+  Experiment::TimelyConfig config = Experiment::TimelyConfig::fromParams<Experiment::TimelyErpcParams>();
+  for (double alpha: alphas) {
+    for (double beta: betas) {
+      for (double delta: deltas) {
+        for (double minModelRtt: minModelRtts) {
+          for (double maxModelRtt: maxModelRtts) {
+            config.d_alpha = alpha;
+            config.d_beta = beta;
+            config.d_delta = delta;
+            config.d_minModelRttUs = minModelRtt;
+            config.d_maxModelRttUs = maxModelRtt;
+            assert(config.isValid());
+            grid.push_back(config);
+          }
+        }
+      }
+    }
+  }
+  return grid;
+}
+
+// Return the '+' separated names of the flags in 'flags', or "stable"
+std::string flagNames(unsigned flags) {
+  const char *names[] = { "oscillating", "overflow", "unfair", "idle" };
+  std::string text;
+  for (unsigned i=0; i<4; ++i) {
+    if (flags & (1u<<i)) {
+      text += text.empty() ? "" : "+";
+      text += names[i];
+    }
+  }
+  return text.empty() ? "stable" : text;
+}
+
+// Return true if 'lhs' and 'rhs' hold the same bits. Unlike '==', NaNs with the same bits compare equal and 0 does not
+// equal -0
+bool sameBits(double lhs, double rhs) {
+  return memcmp(&lhs, &rhs, sizeof(double))==0;
+}
+
+// Return true if every field of 'lhs' and 'rhs' holds the same bits
+bool sameBits(const Experiment::TimelyFluidResult& lhs, const Experiment::TimelyFluidResult& rhs) {
+  return sameBits(lhs.d_queueMeanBytes, rhs.d_queueMeanBytes) &&
+    sameBits(lhs.d_queueSwingBytes, rhs.d_queueSwingBytes) &&
+    sameBits(lhs.d_queueDecay, rhs.d_queueDecay) &&
+    sameBits(lhs.d_rateMeanBps, rhs.d_rateMeanBps) &&
+    sameBits(lhs.d_rateSwingBps, rhs.d_rateSwingBps) &&
+    sameBits(lhs.d_utilization, rhs.d_utilization) &&
+    sameBits(lhs.d_fairness, rhs.d_fairness) &&
+    sameBits(lhs.d_overflowUs, rhs.d_overflowUs) &&
+    sameBits(lhs.d_dropBytes, rhs.d_dropBytes) &&
+    lhs.d_flags==rhs.d_flags;
+}
+
+// Run 'PARAMS' Timely through 'BottleneckSim' with the link and flows of 'config' and return its tail metrics the
+// way 'TimelyFluidModel' computes them. The queue's extremes are sampled every step of 'config'. Flags, offered rate
+// swing and time at the buffer are not computed
+template <class PARAMS>
+Experiment::TimelyFluidResult packetLevel(const Experiment::TimelyFluidConfig& config) {
+  Experiment::SimLinkConfig link;
+  link.d_rateBps = config.d_linkBps;
+  link.d_bufferBytes = static_cast<uint64_t>(config.d_bufferBytes);
+  link.d_packetBytes = static_cast<uint32_t>(config.d_segmentBytes);
+  Experiment::BottleneckSim<Experiment::Timely<PARAMS>> sim(link);
+
+  Experiment::SimFlowConfig flow;
+  const uint64_t baseRttNs = static_cast<uint64_t>(config.d_baseRttUs*1000);
+  flow.d_forwardNs = baseRttNs/2;
+  flow.d_returnNs = baseRttNs-baseRttNs/2;
+  const unsigned flowsA = config.d_flows/2;
+  const unsigned startRatio = static_cast<unsigned>(config.d_startRatio);
+  for (unsigned i=0; i<config.d_flows; ++i) {
+    // 'Timely(sessionCount)' starts at maxNic/(sessionCount+1)
+    sim.addFlow(flow, i<flowsA ? config.d_flows-1 : startRatio*config.d_flows-1);
+  }
+
+  const uint64_t endNs = static_cast<uint64_t>(config.d_durationUs*1000);
+  const uint64_t tailNs = static_cast<uint64_t>(config.d_durationUs*config.d_tailFraction*1000);
+  const uint64_t stepNs = std::max<uint64_t>(1, static_cast<uint64_t>(config.d_stepUs*1000));
+  sim.run(endNs-tailNs);
+  const double area = sim.queueArea();
+  const uint64_t departed = sim.departedBytes();
+  const uint64_t drops = sim.drops();
+  std::vector<uint64_t> acked(config.d_flows);
+  for (unsigned i=0; i<config.d_flows; ++i) {
+    acked[i] = sim.flow(i).d_ackedBytes;
+  }
+
+  // Extremes over the first and second half of the tail
+  double queueMin[2] = { config.d_bufferBytes, config.d_bufferBytes };
+  double queueMax[2] = { 0, 0 };
+  for (uint64_t nowNs=endNs-tailNs+stepNs; nowNs<=endNs; nowNs+=stepNs) {
+    sim.run(nowNs);
+    const unsigned half = nowNs>endNs-tailNs/2;
+    queueMin[half] = std::min(queueMin[half], sim.queueBytes());
+    queueMax[half] = std::max(queueMax[half], sim.queueBytes());
+  }
+  const double firstSwing = queueMax[0]-queueMin[0];
+  const double secondSwing = queueMax[1]-queueMin[1];
+
+  double bytesA = 0;
+  double bytesB = 0;
+  for (unsigned i=0; i<config.d_flows; ++i) {
+    (i<flowsA ? bytesA : bytesB) += (sim.flow(i).d_ackedBytes-acked[i])/(i<flowsA ? flowsA : config.d_flows-flowsA);
+  }
+  const double seconds = tailNs*1e-9;
+  Experiment::TimelyFluidResult result = Experiment::TimelyFluidResult();
+  result.d_queueMeanBytes = (sim.queueArea()-area)/tailNs;
+  result.d_queueSwingBytes = std::max(queueMax[0], queueMax[1])-std::min(queueMin[0], queueMin[1]);
+  result.d_queueDecay = firstSwing>0 ? secondSwing/firstSwing :
+    (secondSwing>0 ? std::numeric_limits<double>::infinity() : 0.0);
+  result.d_rateMeanBps = (bytesA*flowsA+bytesB*(config.d_flows-flowsA))/seconds;
+  result.d_utilization = (sim.departedBytes()-departed)/(config.d_linkBps*seconds);
+  result.d_fairness = std::min(bytesA, bytesB)/std::max(bytesA, bytesB);
+  result.d_dropBytes = static_cast<double>(sim.drops()-drops)*link.d_packetBytes;
+  return result;
+}
+
+void usage() {
+  fprintf(stderr, "usage: timely_fluid.tsk [-t threads] [-f flows] [-r baseRttUs] [-d durationMs] "
+    "[-o results-file]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  unsigned threads = std::thread::hardware_concurrency();
+  Experiment::TimelyFluidConfig config;
+  std::string output = "./fluid.dat";
+
+  for (int i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (i+1>=argc) {
+      usage();
+    }
+    if (arg=="-t") {
+      threads = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg=="-f") {
+      config.d_flows = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg=="-r") {
+      config.d_baseRttUs = atof(argv[++i]);
+    } else if (arg=="-d") {
+      config.d_durationUs = atof(argv[++i])*1000;
+    } else if (arg=="-o") {
+      output = argv[++i];
+    } else {
+      usage();
+    }
+  }
+  if (config.d_flows<2 || config.d_baseRttUs<config.d_stepUs || config.d_durationUs<100*config.d_stepUs) {
+    usage();
+  }
+
+  const std::vector<Experiment::TimelyConfig> grid = makeGrid();
+  bool ok = true;
+
+  // The vector kernel must reproduce the scalar reference bit for bit
+  {
+    const std::size_t count = std::min<std::size_t>(grid.size(), 4*kPointsPerJob+3);
+    std::vector<Experiment::TimelyFluidResult> scalar(count);
+    std::vector<Experiment::TimelyFluidResult> vector(count);
+    Experiment::TimelyFluidModel model(config);
+    model.evaluate<Experiment::TimelySimdScalar>(grid.data(), count, scalar.data());
+    model.evaluate(grid.data(), count, vector.data());
+    unsigned mismatches = 0;
+    for (std::size_t i=0; i<count; ++i) {
+      mismatches += !sameBits(scalar[i], vector[i]);
+    }
+    printf("vector kernel (%u lanes) against scalar: %zu parameter sets, %u differ\n",
+#if defined(EXPERIMENT_TIMELY_SIMD_AVX512)
+      static_cast<unsigned>(Experiment::TimelySimdAvx512::k_width),
+#elif defined(EXPERIMENT_TIMELY_SIMD_AVX2)
+      static_cast<unsigned>(Experiment::TimelySimdAvx2::k_width),
+#else
+      1u,
+#endif
+      count, mismatches);
+    ok = mismatches==0;
+  }
+
+  std::vector<Experiment::TimelyFluidResult> results(grid.size());
+  const auto start = std::chrono::steady_clock::now();
+  unsigned poolThreads(0);
+  {
+    Experiment::WorkStealingPool pool(threads);
+    poolThreads = pool.threadCount();
+    for (std::size_t first=0; first<grid.size(); first+=kPointsPerJob) {
+      pool.submit([&grid, &results, &config, first]() {
+        Experiment::TimelyFluidModel model(config);
+        model.evaluate(grid.data()+first, std::min<std::size_t>(kPointsPerJob, grid.size()-first),
+          results.data()+first);
+      });
+    }
+    pool.wait();
+  }
+  const double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+  FILE *fid = fopen(output.c_str(), "wt");
+  if (fid==0) {
+    fprintf(stderr, "cannot open '%s'\n", output.c_str());
+    return 1;
+  }
+  fprintf(fid, "# Timely fluid model: %u flows, %.0f Gbps, %.0f KB buffer, base RTT %g us, %g ms integrated in %g us "
+    "steps, metrics over the last %.0f%%\n", config.d_flows, config.d_linkBps*8e-9, config.d_bufferBytes/1024,
+    config.d_baseRttUs, config.d_durationUs*1e-3, config.d_stepUs, config.d_tailFraction*100);
+  fprintf(fid, "Alpha,Beta,Delta,MinModelRtt,MaxModelRtt,QueueMeanKB,QueueSwingKB,QueueDecay,RateMeanGbps,"
+    "RateSwingGbps,Utilization,Fairness,OverflowUs,DropKB,Flags,Status\n");
+  unsigned flagCount[5] = { 0, 0, 0, 0, 0 };
+  for (std::size_t i=0; i<grid.size(); ++i) {
+    const Experiment::TimelyConfig& c = grid[i];
+    const Experiment::TimelyFluidResult& r = results[i];
+    fprintf(fid, "%g,%g,%g,%g,%g,%.2f,%.2f,%.4f,%.4f,%.4f,%.4f,%.4f,%.0f,%.2f,%u,%s\n", c.d_alpha, c.d_beta,
+      c.d_delta, c.d_minModelRttUs, c.d_maxModelRttUs, r.d_queueMeanBytes/1024, r.d_queueSwingBytes/1024,
+      r.d_queueDecay, r.d_rateMeanBps*8e-9, r.d_rateSwingBps*8e-9, r.d_utilization, r.d_fairness, r.d_overflowUs,
+      r.d_dropBytes/1024, r.d_flags, flagNames(r.d_flags).c_str());
+    for (unsigned f=0; f<4; ++f) {
+      flagCount[f] += (r.d_flags>>f) & 1;
+    }
+    flagCount[4] += r.d_flags==0;
+  }
+  fclose(fid);
+
+  printf("%zu parameter sets on %u threads in %.3f s: %.0f parameter sets/s, %.1f M lane steps/s\n", grid.size(),
+    poolThreads, elapsedSec, grid.size()/elapsedSec,
+    grid.size()*(config.d_durationUs/config.d_stepUs)/elapsedSec*1e-6);
+  printf("stable %u, oscillating %u, overflow %u, unfair %u, idle %u\n", flagCount[4], flagCount[0], flagCount[1],
+    flagCount[2], flagCount[3]);
+  printf("results written to %s\n\n", output.c_str());
+
+  // Rank the flag-free parameter sets by queue swing, then mean queue
+  std::vector<std::size_t> ranked;
+  for (std::size_t i=0; i<grid.size(); ++i) {
+    if (results[i].d_flags==0) {
+      ranked.push_back(i);
+    }
+  }
+  std::sort(ranked.begin(), ranked.end(), [&results](std::size_t lhs, std::size_t rhs) {
+    const Experiment::TimelyFluidResult& l = results[lhs];
+    const Experiment::TimelyFluidResult& r = results[rhs];
+    return l.d_queueSwingBytes<r.d_queueSwingBytes ||
+      (l.d_queueSwingBytes==r.d_queueSwingBytes && l.d_queueMeanBytes<r.d_queueMeanBytes);
+  });
+  printf("%-4s %6s %6s %8s %8s %8s %10s %11s %8s %8s\n", "rank", "alpha", "beta", "delta", "minModel", "maxModel",
+    "queue mean", "queue swing", "decay", "util %");
+  for (std::size_t n=0; n<std::min<std::size_t>(kRanked, ranked.size()); ++n) {
+    const Experiment::TimelyConfig& c = grid[ranked[n]];
+    const Experiment::TimelyFluidResult& r = results[ranked[n]];
+    printf("%-4zu %6g %6g %8g %8g %8g %10.1f %11.1f %8.3f %8.1f\n", n+1, c.d_alpha, c.d_beta, c.d_delta,
+      c.d_minModelRttUs, c.d_maxModelRttUs, r.d_queueMeanBytes/1024, r.d_queueSwingBytes/1024, r.d_queueDecay,
+      100*r.d_utilization);
+  }
+  printf("\n");
+
+  // The shipped parameter sets through both models
+  const Experiment::TimelyConfig shipped[2] = {
+    Experiment::TimelyConfig::fromParams<Experiment::TimelyErpcParams>(),
+    Experiment::TimelyConfig::fromParams<Experiment::TimelyBasicParams>()
+  };
+  Experiment::TimelyFluidResult fluid[2];
+  {
+    Experiment::TimelyFluidModel model(config);
+    model.evaluate(shipped, 2, fluid);
+  }
+  const Experiment::TimelyFluidResult packet[2] = {
+    packetLevel<Experiment::TimelyErpcParams>(config),
+    packetLevel<Experiment::TimelyBasicParams>(config)
+  };
+  const char *names[2] = { "erpc", "basic" };
+  printf("%-6s %-7s %10s %11s %8s %10s %8s %8s %8s  %s\n", "timely", "model", "queue mean", "queue swing", "decay",
+    "rate Gbps", "util %", "fairness", "drop KB", "flags");
+  for (unsigned i=0; i<2; ++i) {
+    const Experiment::TimelyFluidResult *rows[2] = { &fluid[i], &packet[i] };
+    for (unsigned model=0; model<2; ++model) {
+      const Experiment::TimelyFluidResult& r = *rows[model];
+      printf("%-6s %-7s %10.1f %11.1f %8.3f %10.3f %8.1f %8.3f %8.1f", names[i], model ? "packet" : "fluid",
+        r.d_queueMeanBytes/1024, r.d_queueSwingBytes/1024, r.d_queueDecay, r.d_rateMeanBps*8e-9,
+        100*r.d_utilization, r.d_fairness, r.d_dropBytes/1024);
+      printf(model ? "\n" : "  %s\n", flagNames(r.d_flags).c_str());
+    }
+  }
+  return ok ? 0 : 1;
+}
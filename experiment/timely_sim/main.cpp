@@ -0,0 +1,151 @@
+#include <bottlenecksim.h>
+#include <timely.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Closed-loop Timely. 'flows' long-lived flows, each paced by its own Timely, share one bottleneck switch queue for
+// 'seconds' of virtual time. Unlike 'timely_erpc' the RTT each flow sees is the queue its own and everyone else's
+// rate built. Runs eRPC's and the basic Timely once each and prints a line per 'seconds/20' of virtual time, then
+// totals and the wall time the simulation took. Exits non-zero if nothing was delivered, or if a short run repeated
+// with the same flows gives a different result
+
+const unsigned kRows = 20;                          // report lines per run
+
+struct Config {
+  unsigned                      d_flows;            // flows sharing the bottleneck
+  double                        d_seconds;          // virtual time simulated
+  Experiment::SimLinkConfig     d_link;             // the bottleneck
+  uint64_t                      d_baseRttNs;        // propagation RTT, half each way
+};
+
+template <class CONTROLLER>
+void addFlows(const Config& config, Experiment::BottleneckSim<CONTROLLER> *sim) {
+  Experiment::SimFlowConfig flow;
+  flow.d_forwardNs = config.d_baseRttNs/2;
+  flow.d_returnNs = config.d_baseRttNs-flow.d_forwardNs;
+  for (unsigned i=0; i<config.d_flows; ++i) {
+    // Every flow starts knowing the others exist, so the initial rates sum to the NIC rate
+    sim->addFlow(flow, config.d_flows-1);
+  }
+}
+
+template <class CONTROLLER>
+bool run(const char *name, const Config& config) {
+  Experiment::BottleneckSim<CONTROLLER> sim(config.d_link);
+  addFlows(config, &sim);
+
+  const double linkBps = config.d_link.d_rateBps;
+  const uint64_t endNs = static_cast<uint64_t>(config.d_seconds*1e9);
+  const uint64_t stepNs = endNs/kRows;
+
+  printf("\n%s: %u flows, %.1f Gbps link, %lu KB buffer, %lu byte packets, base RTT %.1f us\n", name,
+    config.d_flows, linkBps*8e-9, config.d_link.d_bufferBytes/1024, static_cast<unsigned long>(
+    config.d_link.d_packetBytes), config.d_baseRttNs*1e-3);
+  printf("%9s %8s %6s %10s %10s %9s %9s %9s %9s\n", "ms", "goodput", "util", "queue mean", "queue peak", "drops",
+    "rate min", "rate p50", "rate max");
+  printf("%9s %8s %6s %10s %10s %9s %9s %9s %9s\n", "", "Gbps", "%", "KB", "KB", "", "MB/s", "MB/s", "MB/s");
+
+  std::vector<double> rates(config.d_flows);
+  uint64_t lastAcked = 0;
+  uint64_t lastDeparted = 0;
+  uint64_t lastDrops = 0;
+  double lastArea = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (unsigned row=1; row<=kRows; ++row) {
+    const uint64_t untilNs = row==kRows ? endNs : row*stepNs;
+    const uint64_t fromNs = sim.nowNs();
+    sim.run(untilNs);
+
+    uint64_t acked = 0;
+    for (unsigned i=0; i<sim.flowCount(); ++i) {
+      acked += sim.flow(i).d_ackedBytes;
+      rates[i] = sim.controller(i).rate();
+    }
+    std::sort(rates.begin(), rates.end());
+    const double intervalNs = static_cast<double>(untilNs-fromNs);
+    printf("%9.1f %8.3f %6.1f %10.1f %10.1f %9lu %9.2f %9.2f %9.2f\n", untilNs*1e-6,
+      (acked-lastAcked)*8.0/intervalNs, 100.0*(sim.departedBytes()-lastDeparted)/(linkBps*intervalNs*1e-9),
+      (sim.queueArea()-lastArea)/intervalNs/1024, sim.peakQueueBytes()/1024, sim.drops()-lastDrops,
+      rates.front()*1e-6, rates[rates.size()/2]*1e-6, rates.back()*1e-6);
+    lastAcked = acked;
+    lastDeparted = sim.departedBytes();
+    lastDrops = sim.drops();
+    lastArea = sim.queueArea();
+    sim.resetPeakQueue();
+  }
+  const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+  uint64_t minAcked = ~0ull;
+  uint64_t maxAcked = 0;
+  for (unsigned i=0; i<sim.flowCount(); ++i) {
+    minAcked = std::min(minAcked, sim.flow(i).d_ackedBytes);
+    maxAcked = std::max(maxAcked, sim.flow(i).d_ackedBytes);
+  }
+  const Experiment::HdrHistogram& rtt = sim.rttNs();
+  printf("utilization %.1f%%, %lu drops, per-flow goodput min %.2f max %.2f MB/s\n",
+    100.0*sim.departedBytes()/(linkBps*config.d_seconds), sim.drops(), minAcked/config.d_seconds*1e-6,
+    maxAcked/config.d_seconds*1e-6);
+  printf("RTT us: min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", rtt.min()*1e-3,
+    rtt.percentile(50)*1e-3, rtt.percentile(90)*1e-3, rtt.percentile(99)*1e-3, rtt.percentile(99.9)*1e-3,
+    rtt.max()*1e-3);
+  printf("%.1f s virtual in %.2f s wall: %lu events, %.2f M events/s, %.1f virtual/wall\n", config.d_seconds,
+    wallSeconds, sim.processed(), sim.processed()/wallSeconds*1e-6, config.d_seconds/wallSeconds);
+
+  if (lastAcked==0) {
+    printf("FAIL: %s: nothing acknowledged\n", name);
+    return false;
+  }
+  return true;
+}
+
+template <class CONTROLLER>
+bool repeatable(const char *name, Config config) {
+  // Two independent short runs of the same flows must end in the same state
+  config.d_flows = std::min(config.d_flows, 100u);
+  const uint64_t endNs = 200*1000*1000;
+  Experiment::BottleneckSim<CONTROLLER> first(config.d_link);
+  Experiment::BottleneckSim<CONTROLLER> second(config.d_link);
+  addFlows(config, &first);
+  addFlows(config, &second);
+  first.run(endNs);
+  for (uint64_t ns=endNs/7; ns<endNs; ns+=endNs/7) {
+    // Stopping and resuming must not change anything either
+    second.run(ns);
+  }
+  second.run(endNs);
+  if (first.digest()!=second.digest() || first.processed()==0) {
+    printf("FAIL: %s: repeated run digest %016lx differs from %016lx\n", name, second.digest(), first.digest());
+    return false;
+  }
+  printf("%s: repeated %u flow run matches, digest %016lx\n", name, config.d_flows, first.digest());
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Config config;
+  config.d_flows = argc>1 ? static_cast<unsigned>(atoi(argv[1])) : 1000;
+  config.d_seconds = argc>2 ? atof(argv[2]) : 10.0;
+  const double linkGbps = argc>3 ? atof(argv[3]) : 10.0;
+  const long bufferKB = argc>4 ? atol(argv[4]) : 1024;
+  const double baseRttUs = argc>5 ? atof(argv[5]) : 10.0;
+  const long packetBytes = argc>6 ? atol(argv[6]) : 4096;
+  if (config.d_flows==0 || config.d_seconds<=0 || linkGbps<=0 || bufferKB<=0 || baseRttUs<=0 || packetBytes<=0) {
+    fprintf(stderr, "usage: timely_sim.tsk [flows] [seconds] [linkGbps] [bufferKB] [baseRttUs] [packetBytes]\n");
+    return 2;
+  }
+  config.d_link.d_rateBps = linkGbps*1e9/8;
+  config.d_link.d_bufferBytes = static_cast<uint64_t>(bufferKB)*1024;
+  config.d_link.d_packetBytes = static_cast<uint32_t>(packetBytes);
+  config.d_baseRttNs = static_cast<uint64_t>(baseRttUs*1000);
+
+  bool ok = true;
+  ok &= repeatable<Experiment::Timely<Experiment::TimelyErpcParams>>("erpc", config);
+  ok &= run<Experiment::Timely<Experiment::TimelyErpcParams>>("erpc", config);
+  ok &= run<Experiment::Timely<Experiment::TimelyBasicParams>>("basic", config);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,288 @@
+#include <timelydynamic.h>
+#include <timelyconfig.h>
+#include <timely.h>
+#include <workstealingpool.h>
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// One job is one (parameter set, scenario, seed) triple. Each job simulates 'durationUs' of RTT samples through a
+// 'TimelyDynamic' configured with its parameter set, then reduces the rate trace to the metrics in 'Result'.
+
+enum Scenario {
+  e_BELOW_MODEL,                                    // RTT ~ N(minModelRtt-2, 4): mostly additive increase
+  e_ABOVE_MODEL,                                    // RTT ~ N(minModelRtt+10, 4): gradient regime
+  e_CONGESTED,                                      // RTT ~ N(1.2*maxModelRtt, 0.1*maxModelRtt): sustained decrease
+  e_BOTTLENECK,                                     // RTT from a queue fed by Timely's own rate: closed loop
+  e_SCENARIO_COUNT
+};
+
+const char *scenarioName[e_SCENARIO_COUNT] = { "below", "above", "congested", "bottleneck" };
+
+const double kBottleneckShare = 0.25;               // bottleneck capacity as a fraction of NIC bandwidth
+const double kBaseRttRatio = 0.8;                   // bottleneck propagation RTT as a fraction of min model RTT
+const double kSettleBand = 0.1;                     // a rate within +/- this fraction of the final rate is settled
+const double kFinalWindow = 0.2;                    // fraction of the run at the end whose mean is the final rate
+
+struct Job {
+  unsigned                      d_paramSet;         // index into the parameter grid
+  Scenario                      d_scenario;         // RTT source
+  unsigned                      d_seed;             // RNG seed
+};
+
+struct Result {
+  double                        d_convergenceUs;    // time of last sample outside the settle band of the final rate
+  double                        d_finalRateBps;     // mean rate over the final window
+  double                        d_rateVarGbps2;     // rate variance over the second half of the run (Gbps^2)
+  double                        d_belowMinUs;       // total time spent at or below the minimum rate
+  unsigned                      d_samples;          // updates run
+};
+
+struct TracePoint {
+  double                        d_nowUs;            // time of update
+  double                        d_rateBps;          // rate after update
+};
+
+// Simulate 'job' for 'durationUs' using 'trace' as scratch space and return its metrics
+Result simulate(const Experiment::TimelyConfig& config, const Job& job, double durationUs,
+  std::vector<TracePoint>& trace) {
+  Experiment::TimelyConfigDomain domain(config);
+  Experiment::TimelyDynamic timely(&domain);
+
+  std::mt19937 rng(job.d_seed);
+  std::normal_distribution<double> unit(0.0, 1.0);
+
+  const double capacityBps = config.d_maxNicBps*kBottleneckShare;
+  const double baseRttUs = config.d_minModelRttUs*kBaseRttRatio;
+  double queueBytes = 0;
+
+  Result result = Result();
+  trace.clear();
+
+  double nowUs = 0;
+  while (nowUs<durationUs) {
+    double rttUs(0);
+    switch (job.d_scenario) {
+      case e_BELOW_MODEL:
+        rttUs = config.d_minModelRttUs-2.0+4.0*unit(rng);
+        break;
+      case e_ABOVE_MODEL:
+        rttUs = config.d_minModelRttUs+10.0+4.0*unit(rng);
+        break;
+      case e_CONGESTED:
+        rttUs = config.d_maxModelRttUs*(1.2+0.1*unit(rng));
+        break;
+      case e_BOTTLENECK:
+        rttUs = baseRttUs+queueBytes/capacityBps*1000000.0+unit(rng);
+        break;
+      default:
+        assert(0);
+    }
+    rttUs = std::max(0.1, rttUs);
+
+    // Time at the minimum rate is charged before the update that may lift the rate off it
+    if (timely.rate()<=config.d_minRateBps) {
+      result.d_belowMinUs += rttUs;
+    }
+    nowUs += rttUs;
+    timely.update(rttUs, nowUs);
+    trace.push_back(TracePoint{nowUs, timely.rate()});
+
+    if (job.d_scenario==e_BOTTLENECK) {
+      // The queue drains at the bottleneck capacity and fills at Timely's rate for one RTT
+      queueBytes = std::max(0.0, queueBytes+(timely.rate()-capacityBps)*rttUs/1000000.0);
+    }
+  }
+
+  // Final rate: mean over the last 'kFinalWindow' of the run. Variance: Welford over the second half
+  const double finalStartUs = nowUs*(1.0-kFinalWindow);
+  const double halfUs = nowUs*0.5;
+  double finalSum(0);
+  unsigned finalCount(0);
+  double mean(0), m2(0);
+  unsigned count(0);
+  for (const TracePoint& p: trace) {
+    if (p.d_nowUs>=finalStartUs) {
+      finalSum += p.d_rateBps;
+      ++finalCount;
+    }
+    if (p.d_nowUs>=halfUs) {
+      const double gbps = p.d_rateBps*Experiment::TimelyDynamic::k_byteToGbits;
+      ++count;
+      const double delta = gbps-mean;
+      mean += delta/count;
+      m2 += delta*(gbps-mean);
+    }
+  }
+  result.d_finalRateBps = finalCount ? finalSum/finalCount : timely.rate();
+  result.d_rateVarGbps2 = count>1 ? m2/(count-1) : 0;
+
+  const double band = kSettleBand*result.d_finalRateBps;
+  for (const TracePoint& p: trace) {
+    if (std::fabs(p.d_rateBps-result.d_finalRateBps)>band) {
+      result.d_convergenceUs = p.d_nowUs;
+    }
+  }
+  result.d_samples = static_cast<unsigned>(trace.size());
+  return result;
+}
+
+// Return the parameter grid: every combination of the values below with the eRPC variant switches
+std::vector<Experiment::TimelyConfig> makeGrid() {
+  const double alphas[] = { 0.02, 0.05, 0.1, 0.2, 0.3, 0.46, 0.6, 0.875 };
+  const double betas[] = { 0.1, 0.26, 0.4, 0.6, 0.8 };
+  const double deltas[] = { 1e6, 5e6, 10e6, 20e6 };
+  const double minModelRtts[] = { 20, 50, 80 };
+  const double maxModelRtts[] = { 500, 1000 };
+
+  std::vector<Experiment::TimelyConfig> grid;
+  Experiment::TimelyConfig config = Experiment::TimelyConfig::fromParams<Experiment::TimelyErpcParams>();
+  for (double alpha: alphas) {
+    for (double beta: betas) {
+      for (double delta: deltas) {
+        for (double minModelRtt: minModelRtts) {
+          for (double maxModelRtt: maxModelRtts) {
+            config.d_alpha = alpha;
+            config.d_beta = beta;
+            config.d_delta = delta;
+            config.d_minModelRttUs = minModelRtt;
+            config.d_maxModelRttUs = maxModelRtt;
+            assert(config.isValid());
+            grid.push_back(config);
+          }
+        }
+      }
+    }
+  }
+  return grid;
+}
+
+void usage() {
+  fprintf(stderr, "usage: timely_sweep.tsk [-t threads] [-d seconds-per-job] [-s seeds] [-o results-file]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  unsigned threads = std::thread::hardware_concurrency();
+  double durationSec = 1.0;
+  unsigned seeds = 2;
+  std::string output = "./sweep.dat";
+
+  for (int i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (i+1>=argc) {
+      usage();
+    }
+    if (arg=="-t") {
+      threads = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg=="-d") {
+      durationSec = atof(argv[++i]);
+    } else if (arg=="-s") {
+      seeds = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg=="-o") {
+      output = argv[++i];
+    } else {
+      usage();
+    }
+  }
+  if (durationSec<=0 || seeds==0) {
+    usage();
+  }
+
+  const std::vector<Experiment::TimelyConfig> grid = makeGrid();
+  std::vector<Job> jobs;
+  for (unsigned p=0; p<grid.size(); ++p) {
+    for (unsigned s=0; s<e_SCENARIO_COUNT; ++s) {
+      for (unsigned seed=0; seed<seeds; ++seed) {
+        jobs.push_back(Job{p, static_cast<Scenario>(s), 1+seed});
+      }
+    }
+  }
+
+  std::vector<Result> results(jobs.size());
+  const double durationUs = durationSec*1000000.0;
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t steals(0);
+  unsigned poolThreads(0);
+  {
+    Experiment::WorkStealingPool pool(threads);
+    poolThreads = pool.threadCount();
+    for (unsigned j=0; j<jobs.size(); ++j) {
+      pool.submit([&grid, &jobs, &results, durationUs, j]() {
+        thread_local std::vector<TracePoint> trace;
+        results[j] = simulate(grid[jobs[j].d_paramSet], jobs[j], durationUs, trace);
+      });
+    }
+    pool.wait();
+    steals = pool.steals();
+  }
+  const double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+  FILE *fid = fopen(output.c_str(), "wt");
+  if (fid==0) {
+    fprintf(stderr, "cannot open '%s'\n", output.c_str());
+    return 1;
+  }
+  fprintf(fid, "# Timely parameter sweep: %zu parameter sets, %u scenarios, %u seeds, %g s simulated per job\n",
+    grid.size(), static_cast<unsigned>(e_SCENARIO_COUNT), seeds, durationSec);
+  fprintf(fid, "Alpha,Beta,Delta,MinModelRtt,MaxModelRtt,Scenario,Seed,Samples,ConvergenceUs,FinalRateGbps,"
+    "RateVarGbps2,BelowMinUs\n");
+  uint64_t samples = 0;
+  for (unsigned j=0; j<jobs.size(); ++j) {
+    const Experiment::TimelyConfig& c = grid[jobs[j].d_paramSet];
+    const Result& r = results[j];
+    samples += r.d_samples;
+    fprintf(fid, "%g,%g,%g,%g,%g,%s,%u,%u,%.1f,%.4f,%.6g,%.1f\n", c.d_alpha, c.d_beta, c.d_delta,
+      c.d_minModelRttUs, c.d_maxModelRttUs, scenarioName[jobs[j].d_scenario], jobs[j].d_seed, r.d_samples,
+      r.d_convergenceUs, r.d_finalRateBps*Experiment::TimelyDynamic::k_byteToGbits, r.d_rateVarGbps2,
+      r.d_belowMinUs);
+  }
+  fclose(fid);
+
+  printf("%zu jobs (%zu parameter sets x %u scenarios x %u seeds) on %u threads in %.2f s: %.1f jobs/s, "
+    "%.1f M updates/s, %lu steals\n", jobs.size(), grid.size(), static_cast<unsigned>(e_SCENARIO_COUNT), seeds,
+    poolThreads, elapsedSec, jobs.size()/elapsedSec, samples/elapsedSec/1e6, steals);
+
+  // Per scenario, the parameter set that settled soonest on average over seeds without time at the minimum rate. A
+  // run whose last sample outside the band falls in the final window never settled, and neither did its set
+  const double settledByUs = durationUs*(1.0-kFinalWindow);
+  for (unsigned s=0; s<e_SCENARIO_COUNT; ++s) {
+    double best = durationUs+1;
+    unsigned bestSet = 0;
+    unsigned settledSets = 0;
+    for (unsigned p=0; p<grid.size(); ++p) {
+      double convergence(0), belowMin(0);
+      bool settled = true;
+      for (unsigned j=0; j<jobs.size(); ++j) {
+        if (jobs[j].d_paramSet==p && jobs[j].d_scenario==s) {
+          convergence += results[j].d_convergenceUs/seeds;
+          belowMin += results[j].d_belowMinUs;
+          settled = settled && results[j].d_convergenceUs<settledByUs;
+        }
+      }
+      if (!settled || belowMin>0) {
+        continue;
+      }
+      ++settledSets;
+      if (convergence<best) {
+        best = convergence;
+        bestSet = p;
+      }
+    }
+    if (settledSets) {
+      const Experiment::TimelyConfig& c = grid[bestSet];
+      printf("%-10s fastest settling of %u sets: alpha %g beta %g delta %g minModelRtt %g maxModelRtt %g: %.1f us\n",
+        scenarioName[s], settledSets, c.d_alpha, c.d_beta, c.d_delta, c.d_minModelRttUs, c.d_maxModelRttUs, best);
+    } else {
+      printf("%-10s none settled without time at the minimum rate\n", scenarioName[s]);
+    }
+  }
+
+  printf("results written to %s\n", output.c_str());
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <timelyticks.h>
+#include <timely.h>
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+
+typedef Experiment::Timely<Experiment::TimelyErpcParams> Timely;
+typedef Experiment::TimelyTicks<Experiment::TimelyErpcParams> TimelyTicks;
+
+const double nicRate = Timely::k_maxNicBps; // NIC line rate 10GBps (giga bytes/sec) as bytes/sec
+const double kMaxRelError = 1e-6;           // largest relative rate error tolerated against the double implementation
+
+// Drive 'Experiment::Timely' and 'Experiment::TimelyTicks' with the same RTTs and record how far the fixed point rate
+// strays from the double rate. RTTs are quantized to whole ticks first, then the double implementation is given
+// exactly what eRPC would compute: 'ticks/(freq_ghz*1000)'.
+class Comparison {
+  const char                 *d_name;
+  const double                d_ticksPerUs;
+  Timely                      d_timely;
+  TimelyTicks                 d_ticks;
+  int64_t                     d_nowTicks;
+  unsigned                    d_samples;
+  double                      d_maxRelError;
+  double                      d_sumRelError;
+
+public:
+  Comparison(const char *name, double tscGhz)
+  : d_name(name)
+  , d_ticksPerUs(tscGhz*1000.0)
+  , d_timely()
+  , d_ticks(tscGhz)
+  , d_nowTicks(0)
+  , d_samples(0)
+  , d_maxRelError(0)
+  , d_sumRelError(0)
+  {
+  }
+
+  double step(double rttUs, bool measure = true) {
+    // Run one RTT sample of 'rttUs' through both implementations returning the double implementation's rate. The
+    // relative error is recorded only if 'measure'
+    const int64_t rttTicks = std::llround(rttUs*d_ticksPerUs);
+    d_nowTicks += rttTicks;
+    d_timely.update(rttTicks/d_ticksPerUs, d_nowTicks/d_ticksPerUs);
+    d_ticks.update(rttTicks, d_nowTicks);
+    if (!measure) {
+      return d_timely.rate();
+    }
+
+    const double relError = std::fabs(d_ticks.rate()-d_timely.rate())/d_timely.rate();
+    d_maxRelError = std::max(d_maxRelError, relError);
+    d_sumRelError += relError;
+    ++d_samples;
+
+    return d_timely.rate();
+  }
+
+  bool report() const {
+    // Print a one line summary and return true if the maximum relative error is within bound
+    const bool ok = d_maxRelError<=kMaxRelError;
+    printf("%-34s samples %8u  max rel err %10.3e  mean rel err %10.3e  final Bps %14.1f vs %14.1f  %s\n",
+      d_name, d_samples, d_maxRelError, d_sumRelError/d_samples, d_timely.rate(), d_ticks.rate(), ok ? "ok" : "FAIL");
+    return ok;
+  }
+};
+
+// The four scenarios of 'timely_erpc/main.cpp' with a fixed seed
+bool test1(double tscGhz) {
+  Comparison cmp("test1: N(minModelRtt-2, 4) 10s", tscGhz);
+  std::mt19937 rng(1);
+  std::normal_distribution<double> rttDist(Timely::k_minModelRttUs-2.0, 4.0);
+  for (double nowUs=0; nowUs<10000000.0;) {
+    const double rttUs = rttDist(rng);
+    nowUs += rttUs;
+    cmp.step(rttUs);
+  }
+  return cmp.report();
+}
+
+bool test2(double tscGhz) {
+  Comparison cmp("test2: ramp up then down", tscGhz);
+  const double inc  = 5;
+  const double smallInc  = 0.5;
+  const double stopRatio = 0.8;
+  double rttUs = (Timely::k_maxModelRttUs-Timely::k_minModelRttUs)/2.0;
+  do {
+    cmp.step(rttUs);
+    rttUs += inc;
+  } while (rttUs<=Timely::k_maxModelRttUs);
+
+  double rate(0);
+  do {
+    rttUs -= smallInc;
+    rate = cmp.step(rttUs);
+  } while (rttUs>Timely::k_minRttUs && rate<=(nicRate*stopRatio));
+  return cmp.report();
+}
+
+bool test3(double tscGhz) {
+  Comparison cmp("test3: N(minModelRtt+10, 4) 10s", tscGhz);
+  std::mt19937 rng(3);
+  std::normal_distribution<double> rttDist(Timely::k_minModelRttUs+10.0, 4.0);
+  for (double nowUs=0; nowUs<10000000.0;) {
+    const double rttUs = rttDist(rng);
+    nowUs += rttUs;
+    cmp.step(rttUs);
+  }
+  return cmp.report();
+}
+
+bool test4(double tscGhz) {
+  Comparison cmp("test4: N(minModelRtt-5, 2) 30s", tscGhz);
+  std::mt19937 rng(4);
+  std::normal_distribution<double> rttDist(Timely::k_minModelRttUs-5.0, 2.0);
+  for (double nowUs=0; nowUs<30000000.0;) {
+    const double rttUs = rttDist(rng);
+    nowUs += rttUs;
+    cmp.step(rttUs);
+  }
+  return cmp.report();
+}
+
+bool test5(double tscGhz) {
+  // RTTs around the model range with a 2s stall every 100000 samples. The 2s RTT difference is past the largest one
+  // 'TimelyTicks' converts to fixed point, so the two implementations part while the clamped difference decays out of
+  // the weighted RTT difference. Errors are measured from 'kSettle' samples after each stall: the clamp must not leave
+  // a lasting error
+  const unsigned kStallEvery = 100000;
+  const unsigned kSettle = 1000;
+  Comparison cmp("test5: N(minModelRtt+10, 4) stalls", tscGhz);
+  std::mt19937 rng(6);
+  std::normal_distribution<double> rttDist(Timely::k_minModelRttUs+10.0, 4.0);
+  for (unsigned i=1; i<=10*kStallEvery; ++i) {
+    cmp.step(i%kStallEvery==0 ? 2000000.0 : rttDist(rng), i%kStallEvery>kSettle);
+  }
+  return cmp.report();
+}
+
+// Time 'kSamples' updates of each implementation on the same jittery RTT stream
+void benchmark(double tscGhz) {
+  const unsigned kSamples = 10000000;
+  const double ticksPerUs = tscGhz*1000.0;
+
+  std::mt19937 rng(5);
+  std::normal_distribution<double> rttDist(60.0, 20.0);
+  std::vector<int64_t> rttTicks(kSamples);
+  for (unsigned i=0; i<kSamples; ++i) {
+    rttTicks[i] = std::max<int64_t>(1, std::llround(rttDist(rng)*ticksPerUs));
+  }
+
+  Timely timely;
+  auto start = std::chrono::steady_clock::now();
+  int64_t nowTicks = 0;
+  for (unsigned i=0; i<kSamples; ++i) {
+    nowTicks += rttTicks[i];
+    timely.update(rttTicks[i]/ticksPerUs, nowTicks/ticksPerUs);
+  }
+  auto end = std::chrono::steady_clock::now();
+  const double timelySec = std::chrono::duration<double>(end-start).count();
+
+  TimelyTicks ticks(tscGhz);
+  start = std::chrono::steady_clock::now();
+  nowTicks = 0;
+  for (unsigned i=0; i<kSamples; ++i) {
+    nowTicks += rttTicks[i];
+    ticks.update(rttTicks[i], nowTicks);
+  }
+  end = std::chrono::steady_clock::now();
+  const double ticksSec = std::chrono::duration<double>(end-start).count();
+
+  printf("\nTimely::update (ticks converted to us): %8.2f M updates/sec, final Bps %.1f\n",
+    kSamples/timelySec/1e6, timely.rate());
+  printf("TimelyTicks::update (raw ticks)       : %8.2f M updates/sec, final Bps %.1f\n",
+    kSamples/ticksSec/1e6, ticks.rate());
+}
+
+int main() {
+  bool ok = true;
+
+  // An integral and a non-integral number of ticks per microsecond
+  const double tscGhz[] = { 2.5, 2.8934 };
+  for (double ghz: tscGhz) {
+    printf("TSC %.4f GHz, relative error bound %g\n", ghz, kMaxRelError);
+    ok = test1(ghz) && ok;
+    ok = test2(ghz) && ok;
+    ok = test3(ghz) && ok;
+    ok = test4(ghz) && ok;
+    ok = test5(ghz) && ok;
+  }
+
+  benchmark(tscGhz[1]);
+
+  return ok ? 0 : 1;
+}
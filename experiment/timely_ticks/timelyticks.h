@@ -0,0 +1,335 @@
+#pragma once
+
+// Purpose: Estimate TX rate for next transmission with the eRPC Timely algorithm using raw TSC ticks and fixed point
+//
+// Classes:
+//   Experiment::TimelyTicks<PARAMS>: Implements Timely in integer arithmetic driven by 'rdtsc()' differences
+//
+// Thread Safety: not-thread-safe.
+//
+// Exception Policy: No exceptions
+//
+// eRPC measures RTTs as the difference of two 'rdtsc()' values, converts that to microseconds by dividing by the TSC
+// frequency, and only then runs Timely in double precision (see 'common/timely.h' and 'timestamp_rdtsc/README').
+// This class skips the conversion. Its inputs are raw tick counts and its rate is held in Q32.32 fixed point bytes per
+// tick. All unit conversions and every division by a constant ('/k_minRttUs', '/k_minModelRttUs') are folded at
+// construction into integer thresholds and Q48 reciprocals, so 'update' executes no floating point instruction. The
+// one variable divide, 'k_maxModelRttUs/rttUs', is only needed above the max model RTT. There it becomes a single
+// integer divide computing '1-k_maxModelRttUs/rttUs' as '(rtt-maxModelRtt)/rtt'.
+//
+// A model RTT limit is rarely a whole number of ticks. Comparisons against a limit use the integer threshold that
+// gives the same answer as comparing against the exact limit. Arithmetic with a limit (gradient, error, 'deltaFactor')
+// uses reciprocals of the exact, unrounded limit so no systematic rounding bias enters the rate.
+//
+// Fixed point formats used below:
+//   Q32   : fraction scaled by 2^32 held in 64 bits (alpha, beta, weight, factors, error, gradient)
+//   Q32.32: bytes/tick scaled by 2^32 (rates), ticks scaled by 2^32 (weighted RTT diff)
+//   Q48   : reciprocal of a tick count scaled by 2^48
+// Products are formed in 128 bits then shifted back so intermediate results cannot overflow. The one conversion into
+// Q32.32 without a product, the RTT difference, is clamped to 'k_maxRttDiffTicks' first. A larger difference (about
+// 0.7s at 3GHz, e.g. after a stall) already saturates the gradient weight, so the clamp does not change the regime.
+// It does shorten the time the weighted difference takes to decay, so the rate parts from 'Timely' for a few hundred
+// samples after such a stall and then agrees again.
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+namespace Experiment {
+
+template <class PARAMS>
+class TimelyTicks {
+public:
+  // TYPES
+  typedef __int128 Wide;                            // intermediate product type
+
+  // CONSTANTS
+  static constexpr double k_alpha = PARAMS::k_alpha;
+  static constexpr double k_beta = PARAMS::k_beta;
+  static constexpr double k_delta = PARAMS::k_delta;
+  static constexpr double k_minRttUs = PARAMS::k_minRttUs;
+  static constexpr double k_minModelRttUs = PARAMS::k_minModelRttUs;
+  static constexpr double k_maxModelRttUs = PARAMS::k_maxModelRttUs;
+  static constexpr double k_maxNicBps = PARAMS::k_maxNicBps;
+  static constexpr double k_minRateBps = PARAMS::k_minRateBps;
+  static constexpr double k_maxRateBps = PARAMS::k_maxRateBps;
+
+  static_assert(PARAMS::k_erpcBypass && PARAMS::k_deltaFactor && PARAMS::k_halfRateFloor && PARAMS::k_patchedError,
+    "TimelyTicks implements the eRPC variant only");
+
+  const double d_tscGhz;                            // TSC frequency in ticks per nanosecond
+
+  static constexpr int64_t k_one = int64_t(1)<<32;  // 1.0 in Q32
+  static constexpr int64_t k_maxRttDiffTicks = (int64_t(1)<<31)-1;
+    // largest RTT difference magnitude converted to Q32.32; times 'k_one' it still fits in 'int64_t'
+
+private:
+  // Constants above converted to ticks and fixed point; fixed at construction
+  int64_t  d_alphaQ;                                // 'k_alpha' Q32
+  int64_t  d_oneMinusAlphaQ;                        // '1-k_alpha' Q32
+  int64_t  d_betaQ;                                 // 'k_beta' Q32
+  int64_t  d_deltaQ;                                // 'k_delta' as bytes/tick Q32.32
+  int64_t  d_minRttTicks;                           // largest tick count 'rtt' with 'rtt<=k_minRttUs'
+  int64_t  d_minModelRttTicks;                      // largest tick count 'rtt' with 'rtt<=k_minModelRttUs'
+  int64_t  d_belowMinModelRttTicks;                 // largest tick count 'rtt' with 'rtt<k_minModelRttUs'
+  int64_t  d_maxModelRttTicks;                      // largest tick count 'rtt' with 'rtt<=k_maxModelRttUs'
+  int64_t  d_maxModelRttQ;                          // 'k_maxModelRttUs' in ticks Q32.32
+  int64_t  d_recipMinRttQ;                          // '1/k_minRttUs' with 'k_minRttUs' in ticks Q48
+  int64_t  d_recipMinModelRttQ;                     // '1/k_minModelRttUs' with 'k_minModelRttUs' in ticks Q48
+  int64_t  d_maxNicQ;                               // 'k_maxNicBps' as bytes/tick Q32.32
+  int64_t  d_maxRateQ;                              // 'k_maxRateBps' as bytes/tick Q32.32
+  int64_t  d_minRateQ;                              // 'k_minRateBps' as bytes/tick Q32.32
+  double   d_qToBps;                                // multiply a Q32.32 bytes/tick rate by this to get bytes/sec
+
+  // State
+  int64_t  d_lineRateQ;                             // calculated TX rate (bytes-per-tick Q32.32)
+  int64_t  d_rawLineRateQ;                          // calculated TX rate (bytes-per-tick Q32.32) before bounding
+  int64_t  d_prevTicks;                             // absolute time in ticks 'update' was last called
+  int64_t  d_prevRttTicks;                          // last RTT provided in 'update'
+  int64_t  d_weightedRttDiffQ;                      // weighted RTT difference (ticks Q32.32)
+
+  // PRIVATE CLASS METHODS
+  static int64_t toQ(double value, int shift);
+    // Return 'value*2^shift' rounded to nearest
+
+  static int64_t mulQ(int64_t lhs, int64_t rhs, int shift);
+    // Return '(lhs*rhs)>>shift' computed without overflow
+
+public:
+  // CREATORS
+  explicit TimelyTicks(double tscGhz);
+    // Create a TimelyTicks object to estimate TX rate on a NIC with 'PARAMS::k_maxNicBps' bandwidth where 'tscGhz'
+    // is the TSC frequency in ticks per nanosecond (eRPC's 'freq_ghz'). Behavior is defined '0.5<=tscGhz<=5.0'. Upon
+    // creation the rate is initialized to 'k_maxNicBps'.
+
+  TimelyTicks() = delete;
+    // Default constructor not provided
+
+  TimelyTicks(const TimelyTicks& other) = delete;
+    // Copy constructor not provided
+
+  ~TimelyTicks() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  int64_t rateQ() const;
+    // Return the last estimated TX rate in bytes/tick Q32.32. This is the value to hand to a TSC driven pacer
+
+  double rate() const;
+    // Return the last estimated TX rate converted to bytes/sec
+
+  double rawRate() const;
+    // Return the last estimated TX rate before it was bounded converted to bytes/sec
+
+  int64_t minRttTicks() const;
+    // Return 'k_minRttUs' converted to ticks rounded down
+
+  int64_t minModelRttTicks() const;
+    // Return 'k_minModelRttUs' converted to ticks rounded down
+
+  int64_t maxModelRttTicks() const;
+    // Return 'k_maxModelRttUs' converted to ticks rounded down
+
+  // MANIPULATORS
+  int64_t update(int64_t rttTicks, int64_t nowTicks);
+    // Return the new, estimated transmission rate in bytes/tick Q32.32 based on the specified 'rttTicks' (the
+    // difference of two 'rdtsc()' values) and the absolute 'rdtsc()' value 'nowTicks'. Behavior is defined provided
+    // 'rttTicks>0' and 'nowTicks>d_prevTicks'. This is 'Timely::update' evaluated in fixed point: the same by-pass,
+    // the same skip of 'rttTicks<=minRttTicks()', and the same three regimes and bounds.
+
+  TimelyTicks& operator=(const TimelyTicks& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Print to specified 'stream' a human readable dump of this object's state returning 'stream'
+};
+
+// FREE OPERATORS
+template <class PARAMS>
+std::ostream& operator<<(std::ostream& stream, const TimelyTicks<PARAMS>& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// PRIVATE CLASS METHODS
+template <class PARAMS>
+inline
+int64_t TimelyTicks<PARAMS>::toQ(double value, int shift) {
+  return static_cast<int64_t>(std::llround(std::ldexp(value, shift)));
+}
+
+template <class PARAMS>
+inline
+int64_t TimelyTicks<PARAMS>::mulQ(int64_t lhs, int64_t rhs, int shift) {
+  return static_cast<int64_t>((static_cast<Wide>(lhs)*rhs) >> shift);
+}
+
+// CREATORS
+template <class PARAMS>
+inline
+TimelyTicks<PARAMS>::TimelyTicks(double tscGhz)
+: d_tscGhz(tscGhz)
+{
+  assert(d_tscGhz>=0.5 && d_tscGhz<=5.0);
+
+  const double ticksPerUs = d_tscGhz*1000.0;
+  const double ticksPerSec = d_tscGhz*1e9;
+
+  d_alphaQ = toQ(k_alpha, 32);
+  d_oneMinusAlphaQ = k_one - d_alphaQ;
+  d_betaQ = toQ(k_beta, 32);
+  d_deltaQ = toQ(k_delta/ticksPerSec, 32);
+
+  d_minRttTicks = static_cast<int64_t>(std::floor(k_minRttUs*ticksPerUs));
+  d_minModelRttTicks = static_cast<int64_t>(std::floor(k_minModelRttUs*ticksPerUs));
+  d_belowMinModelRttTicks = static_cast<int64_t>(std::ceil(k_minModelRttUs*ticksPerUs))-1;
+  d_maxModelRttTicks = static_cast<int64_t>(std::floor(k_maxModelRttUs*ticksPerUs));
+  d_maxModelRttQ = toQ(k_maxModelRttUs*ticksPerUs, 32);
+  d_recipMinRttQ = toQ(1.0/(k_minRttUs*ticksPerUs), 48);
+  d_recipMinModelRttQ = toQ(1.0/(k_minModelRttUs*ticksPerUs), 48);
+
+  d_maxNicQ = toQ(k_maxNicBps/ticksPerSec, 32);
+  d_maxRateQ = toQ(k_maxRateBps/ticksPerSec, 32);
+  d_minRateQ = toQ(k_minRateBps/ticksPerSec, 32);
+  d_qToBps = std::ldexp(ticksPerSec, -32);
+
+  d_lineRateQ = d_maxNicQ;
+  d_rawLineRateQ = d_lineRateQ;
+  d_prevTicks = 0;
+  d_prevRttTicks = std::llround(k_minRttUs*ticksPerUs);
+  d_weightedRttDiffQ = 0;
+}
+
+// ACCESSORS
+template <class PARAMS>
+inline
+int64_t TimelyTicks<PARAMS>::rateQ() const {
+  return d_lineRateQ;
+}
+
+template <class PARAMS>
+inline
+double TimelyTicks<PARAMS>::rate() const {
+  return d_lineRateQ * d_qToBps;
+}
+
+template <class PARAMS>
+inline
+double TimelyTicks<PARAMS>::rawRate() const {
+  return d_rawLineRateQ * d_qToBps;
+}
+
+template <class PARAMS>
+inline
+int64_t TimelyTicks<PARAMS>::minRttTicks() const {
+  return d_minRttTicks;
+}
+
+template <class PARAMS>
+inline
+int64_t TimelyTicks<PARAMS>::minModelRttTicks() const {
+  return d_minModelRttTicks;
+}
+
+template <class PARAMS>
+inline
+int64_t TimelyTicks<PARAMS>::maxModelRttTicks() const {
+  return d_maxModelRttTicks;
+}
+
+// MANIPULATORS
+template <class PARAMS>
+inline
+int64_t TimelyTicks<PARAMS>::update(int64_t rttTicks, int64_t nowTicks) {
+  assert(rttTicks>0);
+  assert(nowTicks>d_prevTicks);
+
+  // eRPC Timely "by-pass"
+  if (d_lineRateQ==d_maxNicQ && rttTicks<=d_minModelRttTicks) {
+    return d_lineRateQ;
+  }
+
+  // When 'rttTicks' is too small, skip Timely update
+  if (rttTicks<=d_minRttTicks) {
+    return d_lineRateQ;
+  }
+
+  // Calculate difference in current and previous RTT then update weighted diff
+  const int64_t rttDiffTicks = std::clamp(rttTicks - d_prevRttTicks, -k_maxRttDiffTicks, k_maxRttDiffTicks);
+  const int64_t newRttDiffQ = rttDiffTicks * k_one;
+  d_weightedRttDiffQ = mulQ(d_oneMinusAlphaQ, d_weightedRttDiffQ, 32) + mulQ(d_alphaQ, newRttDiffQ, 32);
+
+  // eRPC "factor" helpers. Like 'Timely::update' this is measured from the previous RTT not the previous time
+  const int64_t sinceTicks = nowTicks - d_prevRttTicks;
+  const int64_t deltaFactorQ = sinceTicks>d_minRttTicks ? k_one : mulQ(sinceTicks, d_recipMinRttQ, 16);
+  const int64_t addIncreaseQ = mulQ(d_deltaQ, deltaFactorQ, 32);
+  const int64_t multDecreaseQ = mulQ(d_betaQ, deltaFactorQ, 32);
+
+  d_prevRttTicks = rttTicks;
+  d_prevTicks = nowTicks;
+
+  int64_t calculatedRateQ(0);
+
+  if (rttTicks <= d_belowMinModelRttTicks) {
+    calculatedRateQ = d_lineRateQ + addIncreaseQ;
+  } else if (rttTicks > d_maxModelRttTicks) {
+    // 1-maxModelRtt/rtt == (rtt-maxModelRtt)/rtt
+    const int64_t overQ = static_cast<int64_t>(((static_cast<Wide>(rttTicks)<<32) - d_maxModelRttQ) / rttTicks);
+    calculatedRateQ = mulQ(d_lineRateQ, k_one - mulQ(multDecreaseQ, overQ, 32), 32);
+  } else {
+    // Gradient and error in Q32; reciprocals are Q48 so drop 48 bits (gradient from Q32.32) or 16 bits (ticks)
+    const int64_t rttGradientQ = mulQ(d_weightedRttDiffQ, d_recipMinRttQ, 48);
+    int64_t weightQ(-1);
+    if (rttGradientQ <= -(k_one/4)) {
+      weightQ = 0;
+    } else if (rttGradientQ >= k_one/4) {
+      weightQ = k_one;
+    } else {
+      weightQ = 2*rttGradientQ + k_one/2;
+    }
+    // (rtt-minModelRtt)/minModelRtt == rtt/minModelRtt - 1
+    const int64_t errorQ = mulQ(rttTicks, d_recipMinModelRttQ, 16) - k_one;
+    const int64_t decreaseQ = mulQ(mulQ(multDecreaseQ, weightQ, 32), errorQ, 32);
+    calculatedRateQ = mulQ(d_lineRateQ, k_one-decreaseQ, 32) + mulQ(addIncreaseQ, k_one-weightQ, 32);
+  }
+
+  // Store Timely value as calculated
+  d_rawLineRateQ = calculatedRateQ;
+
+  // Bound calculated rate with post-calc checks/balances
+  d_lineRateQ = std::max(calculatedRateQ, d_lineRateQ/2);
+  d_lineRateQ = std::min(d_maxRateQ, d_lineRateQ);
+  d_lineRateQ = std::max(d_minRateQ, d_lineRateQ);
+
+  return d_lineRateQ;
+}
+
+// ASPECTS
+template <class PARAMS>
+inline
+std::ostream& TimelyTicks<PARAMS>::print(std::ostream& stream) const {
+  stream << "[" << std::endl;
+  stream << "    rateBps (last estimated rate)        : " << rate()                  << std::endl;
+  stream << "    rawRateBps (last estimated raw rate) : " << rawRate()               << std::endl;
+  stream << "    rateQ (bytes/tick Q32.32)            : " << d_lineRateQ             << std::endl;
+  stream << "    prevTicks (last reported abs time)   : " << d_prevTicks             << std::endl;
+  stream << "    prevRttTicks (last reported RTT)     : " << d_prevRttTicks          << std::endl;
+  stream << "    tscGhz (ticks per nanosecond)        : " << d_tscGhz                << std::endl;
+  stream << "    minRttTicks (RTTs <= ignored)        : " << d_minRttTicks           << std::endl;
+  stream << "    minModelRttTicks                     : " << d_minModelRttTicks      << std::endl;
+  stream << "    maxModelRttTicks                     : " << d_maxModelRttTicks      << std::endl;
+  stream << "    NIC bandwidth (bytes/sec)            : " << k_maxNicBps             << std::endl;
+  stream << "    minimum computed rate (bytes/sec)    : " << k_minRateBps            << std::endl;
+  stream << "]" << std::endl;
+  return stream;
+}
+
+template <class PARAMS>
+inline
+std::ostream& operator<<(std::ostream& stream, const TimelyTicks<PARAMS>& object) {
+  return object.print(stream);
+}
+
+} // namespace Experiment
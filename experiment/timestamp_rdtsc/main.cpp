@@ -6,14 +6,25 @@
 #include <stdio.h>
 #include <x86intrin.h>
 
+#include <string>
+#include <algorithm>
+#include <random>
 #include <vector>
 
 #include <CommFunc.h>
+#include <streamstats.h>
+#include <hdrhistogram.h>
+#include <tscclock.h>
+#include <timestamp.h>
 
 const int kMAX = 100;
 
-std::vector<double> frequency1;
-std::vector<double> frequency2;
+Experiment::StreamStats frequency1;
+Experiment::StreamStats frequency2;
+// GHz up to 10 at 10KHz resolution. The spread of measurements is well under 1% so 16 significant bits (relative
+// error 2^-15, i.e. about 64KHz at 2GHz) are needed to see it
+Experiment::HdrHistogram frequencyHdr1(10.0, 0.00001, 16);
+Experiment::HdrHistogram frequencyHdr2(10.0, 0.00001, 16);
 
 int pinToCore(int coreId) {
   cpu_set_t mask;
@@ -94,27 +105,272 @@ double rdtsc2() {
   return freq_ghz;;
 }
 
-int main() {
+// Compare 'calibrateFast' with the regression it falls back to and with the 22ms windowed 'calibrate'. Each is run
+// 'kRuns' times; the spread of each column is its real accuracy and should sit inside the regression's reported CI
+void fastCalibration() {
+  const unsigned kRuns = 20;
+  Experiment::StreamStats fastGhz, regressGhz, windowGhz, regressCi, fastNs, regressNs, windowNs;
+  Experiment::TscCalibration fast = Experiment::TscClock::calibrateFast();
+  for (unsigned i=0; i<kRuns; ++i) {
+    fast = Experiment::TscClock::calibrateFast();
+    fastGhz.add(fast.d_ghz);
+    fastNs.add(static_cast<double>(fast.d_elapsedNs));
+    const Experiment::TscCalibration regress = Experiment::TscClock::regress();
+    regressGhz.add(regress.d_ghz);
+    regressCi.add(regress.d_ciGhz);
+    regressNs.add(static_cast<double>(regress.d_elapsedNs));
+    const Experiment::TscCalibration window = Experiment::TscClock::calibrate();
+    windowGhz.add(window.d_ghz);
+    windowNs.add(static_cast<double>(window.d_elapsedNs));
+  }
+
+  std::cout << "\n\nTscClock::calibrateFast: " << fast;
+  printf("%u runs each        mean GHz      stddev GHz    mean CI GHz   mean time us\n", kRuns);
+  printf("calibrateFast  %14.9f %14.3g %14s %12.1f\n", fastGhz.mean(), fastGhz.stddev(), "-", fastNs.mean()/1000);
+  printf("regress        %14.9f %14.3g %14.3g %12.1f\n", regressGhz.mean(), regressGhz.stddev(), regressCi.mean(),
+    regressNs.mean()/1000);
+  printf("calibrate      %14.9f %14.3g %14s %12.1f\n", windowGhz.mean(), windowGhz.stddev(), "-",
+    windowNs.mean()/1000);
+}
+
+// Calibrate a 'TscClock', time its conversions against a division, then watch its drift from CLOCK_MONOTONIC_RAW
+// across re-anchors
+void tscClock() {
+  Experiment::TscClock clock;
+  std::cout << "\n\nTscClock calibration: " << clock.calibration();
+
+  // Each conversion feeds the next so the loops measure latency as on a hot path, not vectorized throughput
+  const unsigned kConversions = 10000000;
+  const double ghz = clock.ghz();
+  uint64_t value = 1;
+  uint64_t start = __rdtsc();
+  for (uint64_t i=0; i<kConversions; ++i) {
+    value = static_cast<uint64_t>(static_cast<double>(value^(i*977))/ghz);
+  }
+  const uint64_t divideTicks = __rdtsc()-start;
+  start = __rdtsc();
+  for (uint64_t i=0; i<kConversions; ++i) {
+    value = clock.toNs(value^(i*977));
+  }
+  const uint64_t multiplyTicks = __rdtsc()-start;
+  printf("ticks to ns: division %.2f ticks/call, multiply-shift %.2f ticks/call (checksum %lu)\n",
+    static_cast<double>(divideTicks)/kConversions, static_cast<double>(multiplyTicks)/kConversions, value);
+
+  // Report drift at each re-anchor. Calibration has ppm scale error so some drift per 100ms at first is expected;
+  // it shrinks as the re-anchor baseline grows. 'nowNs-CLOCK_MONOTONIC_RAW' includes the cost of clock_gettime
+  const uint64_t kPeriodNs = 100000000;
+  clock.setReanchorPeriod(kPeriodNs);
+  const uint64_t endNs = Experiment::TscClock::monotonicRawNs()+10*kPeriodNs;
+  while (Experiment::TscClock::monotonicRawNs()<endNs) {
+    if (clock.maybeReanchor(Experiment::TscClock::nowTicks())) {
+      printf("re-anchor: drift %5ld ns, ghz %.9f, nowNs-CLOCK_MONOTONIC_RAW %ld ns\n", clock.lastDriftNs(),
+        clock.ghz(), static_cast<int64_t>(clock.nowNs()-Experiment::TscClock::monotonicRawNs()));
+    }
+  }
+}
+
+// Timestamp variants. Each region is 'start; work; end' with compiler barriers so only the CPU can reorder. The
+// reference region is Intel's recommended bracket: 'lfence;rdtsc' to start and 'rdtscp;lfence' to end. A variant's
+// reordering error is its net work time (region minus empty region, medians) minus the reference's: negative means
+// the stamps let work escape the region, positive means the fences add to it. The memory workload slows down over
+// the run (on the test VM the same reference region goes from about 180 to 350ns), so a reference measured once
+// would bias every later variant. Reference and variant regions alternate instead and each variant is compared with
+// the reference taken alongside it
+const unsigned kVariantCalls = 1000000;             // calls timed for per-call cost
+const unsigned kVariantPairs = 100000;              // back-to-back pairs for resolution
+const unsigned kVariantRegions = 20000;             // regions timed per workload
+const unsigned kAluChain = 64;                      // dependent multiplies in the ALU workload
+const unsigned kMissChain = 4;                      // dependent cache misses in the memory workload
+const unsigned kChaseEntries = 16*1024*1024;        // 64MB random cycle for the memory workload
+
+std::vector<uint32_t> chase;                        // 'chase[i]' is the next index of a single random cycle
+uint32_t chaseIndex = 0;                            // where the memory workload continues
+uint64_t aluValue = 1;                              // carried through the ALU workload
+uint64_t timestampSink = 0;                         // keeps the per-call cost loop from being removed
+
+struct VariantResult {
+  double                        d_callNs;           // mean cost of one call
+  double                        d_minNs;            // smallest non-zero back-to-back difference
+  double                        d_medianNs;         // median back-to-back difference
+  double                        d_zeroFraction;     // fraction of back-to-back pairs with equal stamps
+  double                        d_aluNs;            // median net time of the ALU workload
+  double                        d_missNs;           // median net time of the memory workload
+  double                        d_referenceAluNs;   // median net time of the ALU workload in reference regions
+  double                        d_referenceMissNs;  // median net time of the memory workload in reference regions
+};
+
+inline
+void aluWork() {
+  uint64_t x = aluValue;
+  for (unsigned i=0; i<kAluChain; ++i) {
+    x = x*6364136223846793005ull+1;
+    asm volatile("" : "+r"(x));
+  }
+  aluValue = x;
+}
+
+inline
+void missWork() {
+  uint32_t i = chaseIndex;
+  for (unsigned k=0; k<kMissChain; ++k) {
+    i = chase[i];
+  }
+  chaseIndex = i;
+}
+
+inline
+void noWork() {
+}
+
+double medianOf(std::vector<double>& values) {
+  std::nth_element(values.begin(), values.begin()+values.size()/2, values.end());
+  return values[values.size()/2];
+}
+
+// Return duration in ns of one region around 'work' stamped with 'START' and 'END'
+template <class START, class END, class WORK>
+double regionNs(WORK work, double ghz) {
+  asm volatile("" ::: "memory");
+  const uint64_t start = START::now();
+  asm volatile("" ::: "memory");
+  work();
+  asm volatile("" ::: "memory");
+  const uint64_t end = END::now();
+  asm volatile("" ::: "memory");
+  return START::k_isTsc ? static_cast<double>(end-start)/ghz : static_cast<double>(end-start);
+}
+
+// Time 'kVariantRegions' regions around 'work' stamped with 'POLICY', each after one reference region, and set the
+// specified 'referenceNs' and 'variantNs' to the median durations in ns
+template <class POLICY, class WORK>
+void medianRegionsNs(WORK work, double ghz, double *referenceNs, double *variantNs) {
+  std::vector<double> reference(kVariantRegions), variant(kVariantRegions);
+  for (unsigned i=0; i<kVariantRegions; ++i) {
+    reference[i] = regionNs<Experiment::TimestampLfenceRdtsc, Experiment::TimestampRdtscpLfence>(work, ghz);
+    variant[i] = regionNs<POLICY, POLICY>(work, ghz);
+  }
+  *referenceNs = medianOf(reference);
+  *variantNs = medianOf(variant);
+}
+
+template <class POLICY>
+VariantResult measureVariant(double ghz) {
+  VariantResult result;
+  const double scale = POLICY::k_isTsc ? 1.0/ghz : 1.0;
+
+  uint64_t checksum = 0;
+  const uint64_t start = Experiment::TimestampLfenceRdtsc::now();
+  for (unsigned i=0; i<kVariantCalls; ++i) {
+    checksum += POLICY::now();
+  }
+  const uint64_t end = Experiment::TimestampRdtscpLfence::now();
+  result.d_callNs = static_cast<double>(end-start)/ghz/kVariantCalls;
+  timestampSink += checksum;
+
+  std::vector<double> deltas(kVariantPairs);
+  unsigned zeros = 0;
+  result.d_minNs = 1e300;
+  for (unsigned i=0; i<kVariantPairs; ++i) {
+    const uint64_t a = POLICY::now();
+    const uint64_t b = POLICY::now();
+    deltas[i] = static_cast<double>(b-a)*scale;
+    if (b==a) {
+      ++zeros;
+    } else {
+      result.d_minNs = std::min(result.d_minNs, deltas[i]);
+    }
+  }
+  result.d_medianNs = medianOf(deltas);
+  result.d_zeroFraction = static_cast<double>(zeros)/kVariantPairs;
+
+  double referenceEmpty(0), empty(0), referenceNs(0), ns(0);
+  medianRegionsNs<POLICY>(noWork, ghz, &referenceEmpty, &empty);
+  medianRegionsNs<POLICY>(aluWork, ghz, &referenceNs, &ns);
+  result.d_aluNs = ns-empty;
+  result.d_referenceAluNs = referenceNs-referenceEmpty;
+  medianRegionsNs<POLICY>(missWork, ghz, &referenceNs, &ns);
+  result.d_missNs = ns-empty;
+  result.d_referenceMissNs = referenceNs-referenceEmpty;
+  return result;
+}
+
+template <class POLICY>
+void printVariant(double ghz) {
+  const VariantResult r = measureVariant<POLICY>(ghz);
+  printf("%-15s %8.1f %8.1f %8.1f %6.1f%% %9.1f %+8.1f %9.1f %9.1f %+8.1f\n", POLICY::name(), r.d_callNs,
+    r.d_minNs, r.d_medianNs, 100*r.d_zeroFraction, r.d_aluNs, r.d_aluNs-r.d_referenceAluNs, r.d_referenceMissNs,
+    r.d_missNs, r.d_missNs-r.d_referenceMissNs);
+}
+
+// Print cost, back-to-back resolution and reordering error of every 'timestamp.h' policy
+void timestampVariants() {
+  const double ghz = Experiment::TscClock::calibrateFast().d_ghz;
+
+  chase.resize(kChaseEntries);
+  std::vector<uint32_t> order(kChaseEntries);
+  for (uint32_t i=0; i<kChaseEntries; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin()+1, order.end(), std::mt19937(1));
+  for (uint32_t i=0; i<kChaseEntries; ++i) {
+    chase[order[i]] = order[(i+1)%kChaseEntries];
+  }
+
+  printf("\n\nTimestamp variants: %u dependent multiplies (alu), %u dependent cache misses (miss)\n", kAluChain,
+    kMissChain);
+  printf("errors against 'lfence;rdtsc' ... 'rdtscp;lfence' regions interleaved with each variant's\n");
+  printf("%-15s %8s %8s %8s %7s %9s %8s %9s %9s %8s\n", "variant", "call ns", "b2b min", "b2b med", "equal",
+    "alu ns", "alu err", "ref miss", "miss ns", "miss err");
+  printVariant<Experiment::TimestampRdtsc>(ghz);
+  printVariant<Experiment::TimestampLfenceRdtsc>(ghz);
+  printVariant<Experiment::TimestampRdtscp>(ghz);
+  printVariant<Experiment::TimestampRdtscpLfence>(ghz);
+  printVariant<Experiment::TimestampMfenceRdtsc>(ghz);
+  printVariant<Experiment::TimestampClockGettime>(ghz);
+  printf("(checksums %lu %lu %u)\n", timestampSink, aluValue, chaseIndex);
+}
+
+int main(int argc, char **argv) {
   // rdtsc is pointless unless pinned to a core
   // for our purposes any valid core works
   pinToCore(10);
 
-  frequency1.resize(kMAX);
-  frequency2.resize(kMAX);
+  // 'fast' skips the eRPC style 1M iteration loops, which take most of the run time. 'variants' runs only the
+  // timestamp variant matrix
+  if (argc>1 && std::string(argv[1])=="variants") {
+    timestampVariants();
+    return 0;
+  }
+  if (argc>1 && std::string(argv[1])=="fast") {
+    fastCalibration();
+    tscClock();
+    timestampVariants();
+    return 0;
+  }
 
   for (unsigned i=0; i<kMAX; ++i) {
-    frequency1[i] = rdtsc1();
+    const double freq = rdtsc1();
+    frequency1.add(freq);
+    frequencyHdr1.record(freq);
   }
 
   for (unsigned i=0; i<kMAX; ++i) {
-    frequency2[i] = rdtsc2();
+    const double freq = rdtsc2();
+    frequency2.add(freq);
+    frequencyHdr2.record(freq);
   }
 
   printf("Histogram of rdtsc clock frequency per std::chrono\n");
   CommFunc::summarize(frequency1);
+  std::cout << "# percentiles (GHz)" << std::endl << frequencyHdr1;
   
   printf("\n\nHistogram of rdtsc clock frequency per clock_gettime\n");
   CommFunc::summarize(frequency2);
+  std::cout << "# percentiles (GHz)" << std::endl << frequencyHdr2;
+
+  fastCalibration();
+  tscClock();
+  timestampVariants();
 
   return 0;
 }
@@ -0,0 +1,51 @@
+#include <tracefile.h>
+
+#include <stdio.h>
+#include <vector>
+
+// Convert a trace written by 'Experiment::TraceWriter' to CSV: the stored comment verbatim, a header line of column
+// names, then one line per row with each value printed '%lf'. This is exactly what the simulations used to 'fprintf'
+int main(int argc, char **argv) {
+  if (argc!=2 && argc!=3) {
+    fprintf(stderr, "usage: trace2csv.tsk <trace-file> [csv-file]\n");
+    return 2;
+  }
+
+  Experiment::TraceReader reader(argv[1]);
+  if (!reader.isOpen()) {
+    fprintf(stderr, "'%s' is not a readable trace file\n", argv[1]);
+    return 1;
+  }
+
+  FILE *fid = (argc==3) ? fopen(argv[2], "wt") : stdout;
+  if (fid==0) {
+    fprintf(stderr, "cannot open '%s'\n", argv[2]);
+    return 1;
+  }
+  static std::vector<char> buffer(1<<20);
+  setvbuf(fid, buffer.data(), _IOFBF, buffer.size());
+
+  const std::string comment = reader.comment();
+  fwrite(comment.data(), 1, comment.size(), fid);
+
+  const unsigned columns = reader.columns();
+  for (unsigned c=0; c<columns; ++c) {
+    fprintf(fid, "%s%c", reader.name(c), c+1<columns ? ',' : '\n');
+  }
+
+  std::vector<const double*> values(columns);
+  for (std::size_t b=0; b<reader.blocks(); ++b) {
+    for (unsigned c=0; c<columns; ++c) {
+      values[c] = reader.column(b, c);
+    }
+    const std::size_t rows = reader.blockRows(b);
+    for (std::size_t r=0; r<rows; ++r) {
+      for (unsigned c=0; c<columns; ++c) {
+        fprintf(fid, "%lf%c", values[c][r], c+1<columns ? ',' : '\n');
+      }
+    }
+  }
+
+  const bool ok = fflush(fid)==0 && (fid==stdout || fclose(fid)==0);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+#include <tscskew.h>
+#include <tscclock.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Ping-pong a cache line between every pair of cores, print the offset and one-way latency matrices, check that
+// pairwise offsets agree with offsets through the reference core, then save the per-core table and apply it with
+// 'TscClock'
+
+void usage() {
+  fprintf(stderr, "usage: tsc_skew.tsk [-r rounds-per-pair] [-c reference-core] [-o table-file]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  unsigned rounds = Experiment::TscSkewTable::k_defaultRounds;
+  std::string output = "./tscskew.dat";
+  const std::vector<unsigned> cores = Experiment::TscSkewTable::availableCores();
+  if (cores.empty()) {
+    fprintf(stderr, "cannot read CPU affinity\n");
+    return 1;
+  }
+  unsigned reference = cores[0];
+
+  for (int i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (i+1>=argc) {
+      usage();
+    }
+    if (arg=="-r") {
+      rounds = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg=="-c") {
+      reference = static_cast<unsigned>(atoi(argv[++i]));
+    } else if (arg=="-o") {
+      output = argv[++i];
+    } else {
+      usage();
+    }
+  }
+  if (rounds==0) {
+    usage();
+  }
+
+  const Experiment::TscCalibration calibration = Experiment::TscClock::calibrateFast();
+  const double ghz = calibration.d_ghz;
+  printf("%zu cores, %u round trips per pair, TSC %.6f GHz\n", cores.size(), rounds, ghz);
+
+  int failures = 0;
+
+  // With one core there are no pairs. Measure the core against itself instead: the threads then alternate by
+  // yielding, so latency is a context switch, but the offset interval must still hold 0
+  if (cores.size()==1) {
+    const Experiment::TscSkewSample self = Experiment::TscSkewTable::measure(cores[0], cores[0], rounds);
+    std::cout << "single core: self check" << std::endl << self;
+    if (!self.isValid() || std::fabs(self.d_offsetTicks)>self.d_uncertaintyTicks) {
+      printf("FAIL: offset interval of a core with itself does not hold 0\n");
+      ++failures;
+    }
+  }
+
+  // offset[i][j] is the offset of core j from core i in ticks
+  const unsigned n = static_cast<unsigned>(cores.size());
+  std::vector<std::vector<Experiment::TscSkewSample>> pairs(n, std::vector<Experiment::TscSkewSample>(n));
+  for (unsigned i=0; i<n; ++i) {
+    for (unsigned j=i+1; j<n; ++j) {
+      pairs[i][j] = Experiment::TscSkewTable::measure(cores[i], cores[j], rounds);
+      if (!pairs[i][j].isValid()) {
+        printf("FAIL: cores %u and %u: empty offset interval\n", cores[i], cores[j]);
+        ++failures;
+      }
+    }
+  }
+
+  if (n>1) {
+    printf("\noffset of column core from row core in ns (+/- uncertainty), upper triangle\n%6s", "");
+    for (unsigned j=0; j<n; ++j) {
+      printf(" %16u", cores[j]);
+    }
+    printf("\n");
+    for (unsigned i=0; i<n; ++i) {
+      printf("%6u", cores[i]);
+      for (unsigned j=0; j<n; ++j) {
+        if (j>i) {
+          printf(" %8.1f +/-%5.1f", pairs[i][j].d_offsetTicks/ghz, pairs[i][j].d_uncertaintyTicks/ghz);
+        } else {
+          printf(" %16s", "-");
+        }
+      }
+      printf("\n");
+    }
+
+    printf("\none-way cache line latency in ns (median round trip / 2 in brackets), upper triangle\n%6s", "");
+    for (unsigned j=0; j<n; ++j) {
+      printf(" %16u", cores[j]);
+    }
+    printf("\n");
+    for (unsigned i=0; i<n; ++i) {
+      printf("%6u", cores[i]);
+      for (unsigned j=0; j<n; ++j) {
+        if (j>i) {
+          printf(" %7.1f (%6.1f)", pairs[i][j].d_oneWayTicks/ghz, pairs[i][j].d_medianRoundTripTicks/ghz/2);
+        } else {
+          printf(" %16s", "-");
+        }
+      }
+      printf("\n");
+    }
+  }
+
+  // Per-core table relative to 'reference' from the measured pairs
+  unsigned r = n;
+  for (unsigned i=0; i<n; ++i) {
+    if (cores[i]==reference) {
+      r = i;
+    }
+  }
+  if (r==n) {
+    fprintf(stderr, "reference core %u is not available\n", reference);
+    return 1;
+  }
+  Experiment::TscSkewTable table(reference);
+  for (unsigned j=0; j<n; ++j) {
+    if (j==r) {
+      table.set(cores[j], 0.0, 0.0);
+    } else if (j>r) {
+      table.set(cores[j], pairs[r][j].d_offsetTicks, pairs[r][j].d_uncertaintyTicks);
+    } else {
+      table.set(cores[j], -pairs[j][r].d_offsetTicks, pairs[j][r].d_uncertaintyTicks);
+    }
+  }
+  std::cout << "\nper-core offsets (ticks) from core " << reference << std::endl << table;
+
+  // The offset between two cores measured directly should match the one through the reference core within the
+  // sum of their uncertainties
+  double worst = 0;
+  for (unsigned i=0; i<n; ++i) {
+    for (unsigned j=i+1; j<n; ++j) {
+      const double direct = pairs[i][j].d_offsetTicks;
+      const double indirect = table.offsetTicks(cores[j])-table.offsetTicks(cores[i]);
+      const double slack = pairs[i][j].d_uncertaintyTicks+table.uncertaintyTicks(cores[i])+
+        table.uncertaintyTicks(cores[j]);
+      worst = std::max(worst, std::fabs(direct-indirect)-slack);
+    }
+  }
+  if (n>2) {
+    printf("largest pairwise disagreement beyond uncertainty: %.1f ticks\n", std::max(0.0, worst));
+    if (worst>0) {
+      printf("FAIL: pairwise offsets are inconsistent with the per-core table\n");
+      ++failures;
+    }
+  }
+
+  if (!table.save(output.c_str())) {
+    fprintf(stderr, "cannot write '%s'\n", output.c_str());
+    return 1;
+  }
+  Experiment::TscSkewTable loaded;
+  if (!loaded.load(output.c_str()) || loaded.referenceCore()!=reference || loaded.size()!=table.size()) {
+    printf("FAIL: table read back from %s differs\n", output.c_str());
+    ++failures;
+  }
+  printf("per-core table written to %s\n", output.c_str());
+
+  // Apply the table: 'referenceTicks' costs one 'rdtscp' and a table lookup more than 'rdtsc'
+  Experiment::TscClock clock(calibration);
+  clock.setSkewTable(&loaded);
+  const unsigned kReads = 1000000;
+  uint64_t checksum = 0;
+  uint64_t start = Experiment::TscClock::nowTicks();
+  for (unsigned i=0; i<kReads; ++i) {
+    checksum += Experiment::TscClock::nowTicks();
+  }
+  const uint64_t plainTicks = Experiment::TscClock::nowTicks()-start;
+  start = Experiment::TscClock::nowTicks();
+  for (unsigned i=0; i<kReads; ++i) {
+    checksum += clock.referenceTicks();
+  }
+  const uint64_t skewTicks = Experiment::TscClock::nowTicks()-start;
+  printf("nowTicks %.1f ticks/call, referenceTicks %.1f ticks/call (checksum %lu)\n",
+    static_cast<double>(plainTicks)/kReads, static_cast<double>(skewTicks)/kReads, checksum);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+#include <hdrhistogram.h>
+#include <streamstats.h>
+#include <tscclock.h>
+#include <tscskew.h>
+#include <udpsocket.h>
+#include <udpwire.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A pinger and an echo thread on 127.0.0.1, each pinned to a core. Every configuration pairs a socket path (one
+// 'sendto'/'recvfrom' per datagram, or 'sendmmsg'/'recvmmsg' batches) with a wait mode (blocking, blocking with
+// 'SO_BUSY_POLL', or nonblocking spin). Each runs twice: with 'kWindow' datagrams outstanding for packets/sec, then
+// with one batch outstanding for RTT noise. The pinger stamps every datagram as it fills it
+
+const uint32_t kDatagramBytes = 64;                 // datagram size
+const unsigned kWindow = 256;                       // datagrams outstanding in the throughput run
+const unsigned kBusyPollUs = 50;                    // 'SO_BUSY_POLL' setting
+const uint64_t kTimeoutUs = 100000;                 // blocking receive timeout; outstanding datagrams count lost
+const int kBufferBytes = 4*1024*1024;               // socket buffers
+
+enum Wait {
+  e_BLOCK,                                          // blocking receive
+  e_BUSY_POLL,                                      // blocking receive with 'SO_BUSY_POLL'
+  e_SPIN                                            // nonblocking receive in a loop
+};
+
+const char *waitName(Wait wait) {
+  return wait==e_BLOCK ? "block" : wait==e_BUSY_POLL ? "busypoll" : "spin";
+}
+
+struct Config {
+  unsigned                      d_batch;            // datagrams per system call; 0 for 'sendto'/'recvfrom'
+  Wait                          d_wait;             // how a receive waits
+};
+
+struct Result {
+  uint64_t                      d_echoed;           // datagrams echoed back to the pinger
+  uint64_t                      d_lost;             // datagrams given up on after 'kTimeoutUs'
+  double                        d_seconds;          // run time
+  Experiment::StreamStats       d_rttStatsNs;       // RTT mean and standard deviation (Welford)
+  Experiment::HdrHistogram      d_rttNs;            // RTTs
+
+  Result() : d_echoed(0), d_lost(0), d_seconds(0), d_rttNs(1e9) {}
+};
+
+// Set buffers, timeout and blocking for 'wait'. Return false on failure. A failure to set 'SO_BUSY_POLL' only sets
+// 'busyPollError' to its 'errno'
+bool configure(Experiment::UdpSocket& socket, Wait wait, int *busyPollError) {
+  if (!socket.setBufferBytes(kBufferBytes, kBufferBytes) || !socket.setReceiveTimeoutUs(kTimeoutUs) ||
+      !socket.setNonBlocking(wait==e_SPIN)) {
+    return false;
+  }
+  if (wait==e_BUSY_POLL && !socket.setBusyPollUs(kBusyPollUs)) {
+    *busyPollError = socket.lastError();
+  }
+  return true;
+}
+
+// Echo every datagram to its source until 'stop'
+void echo(Experiment::UdpSocket& socket, Config config, unsigned core, const std::atomic<bool>& stop) {
+  Experiment::TscSkewTable::pin(core);
+  const bool wait = config.d_wait!=e_SPIN;
+  if (config.d_batch==0) {
+    char buffer[kDatagramBytes];
+    while (!stop.load(std::memory_order_relaxed)) {
+      sockaddr_in from;
+      const int size = socket.receive(buffer, sizeof(buffer), wait, &from);
+      if (size>0) {
+        socket.sendTo(buffer, static_cast<std::size_t>(size), from);
+      }
+    }
+    return;
+  }
+  Experiment::UdpBatch batch(config.d_batch, kDatagramBytes);
+  while (!stop.load(std::memory_order_relaxed)) {
+    const int count = socket.receiveBatch(batch, wait);
+    for (unsigned i=0; static_cast<int>(i)<count; ++i) {
+      batch.setSendTo(i, batch.length(i), batch.from(i));
+    }
+    if (count>0) {
+      socket.sendBatch(batch, static_cast<unsigned>(count));
+    }
+  }
+}
+
+// Keep 'window' datagrams outstanding for 'seconds' and record the RTT of each echoed
+Result ping(Experiment::UdpSocket& socket, Config config, unsigned window, double seconds,
+  const Experiment::TscClock& clock) {
+  Result result;
+  const bool wait = config.d_wait!=e_SPIN;
+  const unsigned perCall = std::max(1u, config.d_batch);
+  Experiment::UdpBatch sendBatch(perCall, kDatagramBytes), receiveBatch(perCall, kDatagramBytes);
+  char buffer[kDatagramBytes];
+  memset(buffer, 0, sizeof(buffer));
+  uint64_t sequence = 0;
+  unsigned outstanding = 0;
+
+  // Fill 'datagram' and stamp it last, so the stamp is as close to its send as the path allows
+  auto fill = [&sequence](char *datagram) {
+    Experiment::UdpData *data = reinterpret_cast<Experiment::UdpData*>(datagram);
+    data->d_header.d_magic = Experiment::UdpMessageHeader::k_magic;
+    data->d_header.d_type = Experiment::UdpMessageHeader::e_DATA;
+    data->d_bytes = kDatagramBytes;
+    data->d_sequence = sequence++;
+    data->d_sendTicks = Experiment::TscClock::nowTicks();
+  };
+  auto record = [&result, &clock](const char *datagram, uint64_t nowTicks) {
+    const uint64_t sendTicks = reinterpret_cast<const Experiment::UdpData*>(datagram)->d_sendTicks;
+    const double rttNs = static_cast<double>(clock.toNs(nowTicks-sendTicks));
+    result.d_rttNs.record(rttNs);
+    result.d_rttStatsNs.add(rttNs);
+    ++result.d_echoed;
+  };
+
+  const uint64_t start = Experiment::TscClock::nowTicks();
+  const uint64_t end = start+static_cast<uint64_t>(seconds*1e9*clock.ghz());
+  uint64_t now = start;
+  while (now<end) {
+    while (outstanding<window) {
+      const unsigned count = std::min(perCall, window-outstanding);
+      int sent = 0;
+      if (config.d_batch==0) {
+        fill(buffer);
+        sent = socket.send(buffer, kDatagramBytes)==static_cast<int>(kDatagramBytes) ? 1 : 0;
+      } else {
+        for (unsigned i=0; i<count; ++i) {
+          fill(sendBatch.data(i));
+          sendBatch.setSend(i, kDatagramBytes);
+        }
+        sent = std::max(0, socket.sendBatch(sendBatch, count));
+      }
+      if (sent==0) {
+        break;
+      }
+      outstanding += static_cast<unsigned>(sent);
+    }
+
+    int received = 0;
+    if (config.d_batch==0) {
+      received = socket.receive(buffer, sizeof(buffer), wait)>0 ? 1 : -1;
+      if (received>0) {
+        record(buffer, Experiment::TscClock::nowTicks());
+      }
+    } else {
+      received = socket.receiveBatch(receiveBatch, wait);
+      const uint64_t receivedTicks = Experiment::TscClock::nowTicks();
+      for (int i=0; i<received; ++i) {
+        record(receiveBatch.data(static_cast<unsigned>(i)), receivedTicks);
+      }
+    }
+    if (received>0) {
+      outstanding -= static_cast<unsigned>(received);
+    } else if (wait && (socket.lastError()==EAGAIN || socket.lastError()==EWOULDBLOCK)) {
+      // Blocking receive timed out: what is outstanding was dropped
+      result.d_lost += outstanding;
+      outstanding = 0;
+    }
+    now = Experiment::TscClock::nowTicks();
+  }
+  result.d_seconds = static_cast<double>(now-start)/clock.ghz()/1e9;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  const double seconds = argc>1 ? atof(argv[1]) : 0.5;
+  const std::vector<unsigned> cores = Experiment::TscSkewTable::availableCores();
+  const unsigned pingCore = argc>2 ? static_cast<unsigned>(atoi(argv[2])) : cores.front();
+  const unsigned echoCore = argc>3 ? static_cast<unsigned>(atoi(argv[3])) : cores[cores.size()>1 ? 1 : 0];
+  const Experiment::TscClock clock;
+  int failures = 0;
+
+  printf("pinger on core %u, echo on core %u of %lu available, %u byte datagrams, %.1f s per run\n", pingCore,
+    echoCore, cores.size(), kDatagramBytes, seconds);
+  if (pingCore==echoCore) {
+    printf("pinger and echo share a core: 'spin' runs measure the scheduler time slice\n");
+  }
+  printf("%-8s %-9s %12s %10s %10s %10s %10s %10s %8s\n", "path", "wait", "Mpps", "RTT p50", "RTT p99", "RTT p99.9",
+    "RTT sd", "RTT min", "lost");
+  printf("%-8s %-9s %12s %10s %10s %10s %10s %10s %8s\n", "", "", "(window 256)", "us", "us", "us", "us", "us", "");
+
+  const unsigned batches[] = {0, 8, 32};
+  const Wait waits[] = {e_BLOCK, e_BUSY_POLL, e_SPIN};
+  bool busyPollWarned = false;
+  for (const unsigned batch: batches) {
+    for (const Wait wait: waits) {
+      const Config config = {batch, wait};
+      Result results[2];
+      const unsigned windows[2] = {kWindow, std::max(1u, batch)};
+      for (unsigned run=0; run<2; ++run) {
+        Experiment::UdpSocket echoSocket, pingSocket;
+        int busyPollError = 0;
+        if (!echoSocket.open("127.0.0.1", 0) || !configure(echoSocket, wait, &busyPollError) ||
+            !pingSocket.open("127.0.0.1", 0) || !pingSocket.connect("127.0.0.1", echoSocket.localPort()) ||
+            !configure(pingSocket, wait, &busyPollError)) {
+          fprintf(stderr, "udp_batch: socket setup: %s\n", strerror(echoSocket.lastError() ? echoSocket.lastError() :
+            pingSocket.lastError()));
+          return 1;
+        }
+        if (busyPollError && !busyPollWarned) {
+          printf("SO_BUSY_POLL not set (%s); 'busypoll' runs are blocking runs\n", strerror(busyPollError));
+          busyPollWarned = true;
+        }
+        std::atomic<bool> stop(false);
+        std::thread echoThread(echo, std::ref(echoSocket), config, echoCore, std::cref(stop));
+        Experiment::TscSkewTable::pin(pingCore);
+        results[run] = ping(pingSocket, config, windows[run], seconds, clock);
+        stop = true;
+        echoThread.join();
+      }
+      const Result& throughput = results[0];
+      const Result& latency = results[1];
+      const double sd = latency.d_rttStatsNs.stddev();
+      char path[16];
+      snprintf(path, sizeof(path), batch ? "mmsg%u" : "single", batch);
+      printf("%-8s %-9s %12.3f %10.1f %10.1f %10.1f %10.1f %10.1f %8lu\n", path, waitName(wait),
+        throughput.d_echoed/throughput.d_seconds/1e6, latency.d_rttNs.percentile(50)/1000.0,
+        latency.d_rttNs.percentile(99)/1000.0, latency.d_rttNs.percentile(99.9)/1000.0, sd/1000.0,
+        latency.d_rttNs.min()/1000.0, throughput.d_lost+latency.d_lost);
+      if (throughput.d_echoed==0 || latency.d_echoed==0) {
+        printf("FAIL: nothing echoed\n");
+        ++failures;
+      }
+    }
+  }
+
+  return failures ? 1 : 0;
+}
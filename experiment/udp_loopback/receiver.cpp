@@ -0,0 +1,119 @@
+#include <tscclock.h>
+#include <tscskew.h>
+#include <udpsocket.h>
+#include <udpwire.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Receiver half of the UDP pair. Datagrams are taken 'batch' at a time with 'recvmmsg' and every data datagram is
+// answered by an ACK echoing its sequence and send stamp; the batch's ACKs go out in one 'sendmmsg'. Exits on the
+// sender's FIN or after 'idleSeconds' without a datagram. 'mode' is 'block', 'busypoll' (block with 'SO_BUSY_POLL')
+// or 'spin' (nonblocking, never sleeps). A 'core' of -1 leaves the thread unpinned
+
+const uint32_t kMaxDatagram = 65536;                // largest datagram received
+const int kBufferBytes = 4*1024*1024;               // socket buffers
+const unsigned kBusyPollUs = 50;                    // 'SO_BUSY_POLL' setting in 'busypoll' mode
+
+int main(int argc, char **argv) {
+  const char *address = argc>1 ? argv[1] : "127.0.0.1";
+  const uint16_t port = static_cast<uint16_t>(argc>2 ? atoi(argv[2]) : 9000);
+  const double idleSeconds = argc>3 ? atof(argv[3]) : 5.0;
+  const unsigned batch = argc>4 ? static_cast<unsigned>(atoi(argv[4])) : 32;
+  const char *mode = argc>5 ? argv[5] : "block";
+  const int core = argc>6 ? atoi(argv[6]) : -1;
+  const bool spin = strcmp(mode, "spin")==0;
+  const bool busyPoll = strcmp(mode, "busypoll")==0;
+  if (batch==0 || batch>1024 || (!spin && !busyPoll && strcmp(mode, "block")!=0)) {
+    fprintf(stderr, "usage: udp_receiver.tsk [address] [port] [idleSeconds] [batch 1-1024] [block|busypoll|spin] "
+      "[core]\n");
+    return 2;
+  }
+  if (core>=0 && !Experiment::TscSkewTable::pin(static_cast<unsigned>(core))) {
+    fprintf(stderr, "udp_receiver: cannot pin to core %d\n", core);
+    return 1;
+  }
+
+  Experiment::UdpSocket socket;
+  if (!socket.open(address, port) || !socket.setBufferBytes(kBufferBytes, kBufferBytes) ||
+      !socket.setReceiveTimeoutUs(static_cast<uint64_t>(idleSeconds*1e6)) || !socket.setNonBlocking(spin)) {
+    fprintf(stderr, "udp_receiver: %s:%u: %s\n", address, port, strerror(socket.lastError()));
+    return 1;
+  }
+  if (busyPoll && !socket.setBusyPollUs(kBusyPollUs)) {
+    printf("udp_receiver: SO_BUSY_POLL not set: %s\n", strerror(socket.lastError()));
+  }
+  printf("udp_receiver: listening on %s:%u, batch %u, %s\n", address, socket.localPort(), batch, mode);
+  fflush(stdout);
+
+  const Experiment::TscClock clock;
+  const uint64_t idleTicks = static_cast<uint64_t>(idleSeconds*1e9*clock.ghz());
+  Experiment::UdpBatch datagrams(batch, kMaxDatagram), acks(batch, sizeof(Experiment::UdpAck));
+  uint64_t received = 0, bytes = 0, calls = 0, ackFailures = 0, malformed = 0, turnaroundTicks = 0;
+  uint64_t lastTicks = Experiment::TscClock::nowTicks();
+  bool finished = false;
+  while (!finished) {
+    const int count = socket.receiveBatch(datagrams, !spin);
+    const uint64_t receivedTicks = Experiment::TscClock::nowTicks();
+    if (count<0) {
+      if (socket.lastError()==EAGAIN || socket.lastError()==EWOULDBLOCK) {
+        if (!spin || receivedTicks-lastTicks>idleTicks) {
+          printf("udp_receiver: idle for %.1f seconds\n", idleSeconds);
+          break;
+        }
+        continue;
+      }
+      if (socket.lastError()==EINTR) {
+        continue;
+      }
+      fprintf(stderr, "udp_receiver: receive: %s\n", strerror(socket.lastError()));
+      return 1;
+    }
+    lastTicks = receivedTicks;
+    ++calls;
+
+    unsigned ackCount = 0;
+    for (unsigned i=0; i<static_cast<unsigned>(count); ++i) {
+      const uint32_t size = datagrams.length(i);
+      const Experiment::UdpMessageHeader *header =
+        reinterpret_cast<const Experiment::UdpMessageHeader*>(datagrams.data(i));
+      if (size<sizeof(*header) || header->d_magic!=Experiment::UdpMessageHeader::k_magic) {
+        ++malformed;
+        continue;
+      }
+      if (header->d_type==Experiment::UdpMessageHeader::e_FIN) {
+        finished = true;
+        continue;
+      }
+      if (header->d_type!=Experiment::UdpMessageHeader::e_DATA || size<sizeof(Experiment::UdpData)) {
+        ++malformed;
+        continue;
+      }
+      const Experiment::UdpData *data = reinterpret_cast<const Experiment::UdpData*>(datagrams.data(i));
+      ++received;
+      bytes += size;
+      Experiment::UdpAck *ack = reinterpret_cast<Experiment::UdpAck*>(acks.data(ackCount));
+      memset(ack, 0, sizeof(*ack));
+      ack->d_header.d_magic = Experiment::UdpMessageHeader::k_magic;
+      ack->d_header.d_type = Experiment::UdpMessageHeader::e_ACK;
+      ack->d_header.d_session = data->d_header.d_session;
+      ack->d_bytes = size;
+      ack->d_sendIndex = data->d_sendIndex;
+      ack->d_sequence = data->d_sequence;
+      ack->d_sendTicks = data->d_sendTicks;
+      ack->d_turnaroundTicks = Experiment::TscClock::nowTicks()-receivedTicks;
+      turnaroundTicks += ack->d_turnaroundTicks;
+      acks.setSendTo(ackCount++, sizeof(Experiment::UdpAck), datagrams.from(i));
+    }
+    if (ackCount) {
+      const int sent = socket.sendBatch(acks, ackCount);
+      ackFailures += ackCount-static_cast<unsigned>(sent<0 ? 0 : sent);
+    }
+  }
+
+  printf("udp_receiver: %lu datagrams in %lu calls, %lu bytes, %lu ACK send failures, %lu malformed, "
+    "mean turnaround %.0f ticks\n", received, calls, bytes, ackFailures, malformed,
+    received ? static_cast<double>(turnaroundTicks)/received : 0.0);
+  return 0;
+}
@@ -0,0 +1,364 @@
+#include <carousel.h>
+#include <hdrhistogram.h>
+#include <timely.h>
+#include <tracefile.h>
+#include <tscclock.h>
+#include <tscskew.h>
+#include <udpsocket.h>
+#include <udpwire.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+// Sender half of the UDP pair. 'sessions' always-backlogged sessions are paced by one 'Carousel'. Datagrams the
+// wheel releases are stamped with the TSC one by one as they are written into a batch, which goes out with
+// 'sendmmsg' when full or when the wheel has nothing more due. ACKs are taken 'batch' at a time with 'recvmmsg';
+// each ACK's echoed stamp gives an RTT which updates the session's 'Timely', whose rate re-paces the session.
+// Prints the rate trajectory, then goodput and RTT percentiles. 'mode' is 'block' (yield the core when idle),
+// 'busypoll' (also set 'SO_BUSY_POLL') or 'spin' (never yield). A 'core' of -1 leaves the thread unpinned.
+//
+// 'stamps' other than 'off' turns on 'SO_TIMESTAMPING': 'sw' for kernel software stamps, or an interface name for
+// software and that NIC's hardware stamps. Each ACK then also gives the RTT from the kernel's send stamp of the data
+// datagram to its receive stamp of the ACK, and from the two hardware stamps if present. The rdtsc RTT less the
+// kernel RTT is the host-side time Timely sees but the network did not cause; it splits into the send side (stamp to
+// kernel send) and the receive side (kernel receive to the ACK being read). Per-ACK values go to 'kTraceFile'
+
+typedef Experiment::Timely<Experiment::TimelyErpcParams> TimelyErpc;
+
+const unsigned kMaxDatagram = 65536;                // largest datagram sent or received
+const int kBufferBytes = 4*1024*1024;               // socket buffers
+const uint32_t kBudget = 16;                        // datagrams per session in the wheel
+const double kReportMs = 50;                        // trajectory interval
+const double kLingerMs = 100;                       // time ACKs are collected after the last send
+const unsigned kBusyPollUs = 50;                    // 'SO_BUSY_POLL' setting in 'busypoll' mode
+const char *kTraceFile = "./udp_stamps.trc";        // per-ACK RTTs when stamping
+const uint32_t kSendRecords = 1<<16;                // send stamp ring; power of 2 above the datagrams the socket
+                                                    // buffers hold, which the wheel's budget does not bound
+
+// Send side of one datagram while stamping, kept in a ring indexed by 'd_sendIndex'
+struct SendRecord {
+  uint32_t                      d_index;            // 'd_sendIndex' of the datagram in this slot
+  uint64_t                      d_sendNs;           // 'CLOCK_REALTIME' read with its TSC stamp
+  uint64_t                      d_softwareNs;       // kernel send stamp or 0
+  uint64_t                      d_hardwareNs;       // NIC send stamp or 0
+};
+
+uint64_t realtimeNs() {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return Experiment::UdpSocket::toNs(now);
+}
+
+void printRow(const char *name, const Experiment::HdrHistogram& histogram) {
+  printf("%-34s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, histogram.min()/1000.0, histogram.percentile(50)/1000.0,
+    histogram.percentile(90)/1000.0, histogram.percentile(99)/1000.0, histogram.percentile(99.9)/1000.0);
+}
+
+int main(int argc, char **argv) {
+  const char *address = argc>1 ? argv[1] : "127.0.0.1";
+  const uint16_t port = static_cast<uint16_t>(argc>2 ? atoi(argv[2]) : 9000);
+  const double seconds = argc>3 ? atof(argv[3]) : 2.0;
+  const unsigned sessions = argc>4 ? static_cast<unsigned>(atoi(argv[4])) : 4;
+  const uint32_t bytes = static_cast<uint32_t>(argc>5 ? atoi(argv[5]) : 1024);
+  const unsigned batch = argc>6 ? static_cast<unsigned>(atoi(argv[6])) : 32;
+  const char *mode = argc>7 ? argv[7] : "block";
+  const int core = argc>8 ? atoi(argv[8]) : -1;
+  const char *stamps = argc>9 ? argv[9] : "off";
+  const bool stamping = strcmp(stamps, "off")!=0;
+  const char *interface = stamping && strcmp(stamps, "sw")!=0 ? stamps : 0;
+  const bool spin = strcmp(mode, "spin")==0;
+  const bool busyPoll = strcmp(mode, "busypoll")==0;
+  if (sessions==0 || sessions>65535 || bytes<sizeof(Experiment::UdpData) || bytes>kMaxDatagram || batch==0 ||
+      batch>1024 || (!spin && !busyPoll && strcmp(mode, "block")!=0)) {
+    fprintf(stderr, "usage: udp_sender.tsk [address] [port] [seconds] [sessions] [bytes >= %lu] [batch 1-1024] "
+      "[block|busypoll|spin] [core] [off|sw|<interface>]\n", sizeof(Experiment::UdpData));
+    return 2;
+  }
+  if (core>=0 && !Experiment::TscSkewTable::pin(static_cast<unsigned>(core))) {
+    fprintf(stderr, "udp_sender: cannot pin to core %d\n", core);
+    return 1;
+  }
+
+  Experiment::UdpSocket socket;
+  if (!socket.open("0.0.0.0", 0) || !socket.setBufferBytes(kBufferBytes, kBufferBytes) ||
+      !socket.connect(address, port)) {
+    fprintf(stderr, "udp_sender: %s:%u: %s\n", address, port, strerror(socket.lastError()));
+    return 1;
+  }
+  if (busyPoll && !socket.setBusyPollUs(kBusyPollUs)) {
+    printf("udp_sender: SO_BUSY_POLL not set: %s\n", strerror(socket.lastError()));
+  }
+  if (interface && !socket.setTimestamping(interface)) {
+    printf("udp_sender: no hardware stamps on %s (%s); software stamps only\n", interface,
+      strerror(socket.lastError()));
+    interface = 0;
+  }
+  if (stamping && !interface && !socket.setTimestamping()) {
+    fprintf(stderr, "udp_sender: SO_TIMESTAMPING: %s\n", strerror(socket.lastError()));
+    return 1;
+  }
+
+  const Experiment::TscClock clock;
+  std::vector<TimelyErpc> timely(sessions);
+  Experiment::Carousel wheel(sessions, sessions*kBudget, clock.ghz());
+  for (unsigned s=0; s<sessions; ++s) {
+    wheel.setRate(s, timely[s].rate());
+  }
+  std::vector<uint64_t> sequence(sessions, 0);
+  Experiment::HdrHistogram rttNs(1e9), intervalRttNs(1e9);
+
+  std::vector<SendRecord> sendRecords(stamping ? kSendRecords : 0);
+  const uint32_t ringMask = kSendRecords-1;
+  Experiment::HdrHistogram stampedUserNs(1e9), kernelNs(1e9), hardwareNs(1e9), hostNs(1e9), sendSideNs(1e9),
+    receiveSideNs(1e9);
+  uint64_t stampedAcks = 0, hardwareAcks = 0, unmatchedStamps = 0, noSendStamp = 0, noReceiveStamp = 0;
+  const std::vector<std::string> traceColumns = {"session", "sequence", "userNs", "kernelNs", "hardwareNs",
+    "sendSideNs", "receiveSideNs"};
+  char comment[256];
+  snprintf(comment, sizeof(comment), "# udp_sender per-ACK RTTs, stamps %s; nan where a stamp is missing\n", stamps);
+  std::unique_ptr<Experiment::TraceWriter> trace;
+  if (stamping) {
+    trace.reset(new Experiment::TraceWriter(kTraceFile, traceColumns, comment));
+    if (!trace->isOpen()) {
+      fprintf(stderr, "udp_sender: cannot create %s\n", kTraceFile);
+      return 1;
+    }
+  }
+
+  printf("udp_sender: %u sessions, %u byte datagrams to %s:%u for %.1f s, batch %u, %s, TSC %.3f GHz\n", sessions,
+    bytes, address, port, seconds, batch, mode, clock.ghz());
+  printf("%8s %12s %12s %12s %10s %10s %10s\n", "ms", "goodput MB/s", "mean rate", "min rate", "RTT p50", "RTT p99",
+    "ACKs");
+  printf("%8s %12s %12s %12s %10s %10s %10s\n", "", "", "MB/s", "MB/s", "us", "us", "");
+
+  Experiment::UdpBatch datagrams(batch, bytes), acks(batch, sizeof(Experiment::UdpAck), stamping);
+  Experiment::UdpBatch sendStamps(stamping ? batch : 1, 1, stamping);
+  uint32_t sendIndex = 0;
+  unsigned batched = 0;
+  uint64_t sent = 0, sendFailures = 0, sendCalls = 0, acked = 0, ackedBytes = 0, intervalBytes = 0, intervalAcks = 0;
+  double intervalRateSum = 0, intervalRateMin = 1e300;
+
+  auto flush = [&]() {
+    if (batched) {
+      const int rc = socket.sendBatch(datagrams, batched);
+      const unsigned count = rc<0 ? 0 : static_cast<unsigned>(rc);
+      sent += count;
+      sendFailures += batched-count;
+      ++sendCalls;
+      // The kernel keys send stamps by datagrams actually sent; unsent ones are the tail of the batch
+      sendIndex -= batched-count;
+      batched = 0;
+    }
+  };
+
+  auto transmit = [&](const Experiment::CarouselPacket& packet) {
+    Experiment::UdpData *data = reinterpret_cast<Experiment::UdpData*>(datagrams.data(batched));
+    data->d_header.d_magic = Experiment::UdpMessageHeader::k_magic;
+    data->d_header.d_type = Experiment::UdpMessageHeader::e_DATA;
+    data->d_header.d_session = static_cast<uint16_t>(packet.d_flow);
+    data->d_bytes = packet.d_bytes;
+    data->d_sequence = sequence[packet.d_flow]++;
+    data->d_sendIndex = sendIndex;
+    if (stamping) {
+      SendRecord& record = sendRecords[sendIndex&ringMask];
+      record.d_index = sendIndex;
+      record.d_softwareNs = record.d_hardwareNs = 0;
+      record.d_sendNs = realtimeNs();
+    }
+    ++sendIndex;
+    data->d_sendTicks = Experiment::TscClock::nowTicks();
+    datagrams.setSend(batched, packet.d_bytes);
+    if (++batched==batch) {
+      flush();
+    }
+  };
+
+  // Move queued kernel send stamps into their datagrams' records. A datagram's software and hardware stamps arrive
+  // as separate messages
+  auto receiveSendStamps = [&]() {
+    int received;
+    while ((received = socket.receiveErrorQueue(sendStamps))>0) {
+      for (unsigned i=0; i<static_cast<unsigned>(received); ++i) {
+        Experiment::UdpTimestamps stamp;
+        if (!sendStamps.timestamps(i, &stamp) || !stamp.d_hasId) {
+          continue;
+        }
+        SendRecord& record = sendRecords[stamp.d_id&ringMask];
+        if (record.d_index!=stamp.d_id) {
+          ++unmatchedStamps;
+          continue;
+        }
+        if (stamp.d_softwareNs) {
+          record.d_softwareNs = stamp.d_softwareNs;
+        }
+        if (stamp.d_hardwareNs) {
+          record.d_hardwareNs = stamp.d_hardwareNs;
+        }
+      }
+    }
+  };
+
+  // Record the kernel and hardware RTTs of one ACK next to its rdtsc RTT
+  auto recordStamps = [&](const Experiment::UdpAck *ack, unsigned index, uint64_t rttTicks, uint64_t readNs) {
+    Experiment::UdpTimestamps stamp;
+    acks.timestamps(index, &stamp);
+    const SendRecord& record = sendRecords[ack->d_sendIndex&ringMask];
+    const bool matched = record.d_index==ack->d_sendIndex;
+    const double userNs = static_cast<double>(clock.toNs(rttTicks));
+    double row[7] = {static_cast<double>(ack->d_header.d_session), static_cast<double>(ack->d_sequence), userNs,
+      NAN, NAN, NAN, NAN};
+    noSendStamp += !matched || record.d_softwareNs==0;
+    noReceiveStamp += stamp.d_softwareNs==0;
+    if (matched && record.d_softwareNs && stamp.d_softwareNs) {
+      row[3] = static_cast<double>(stamp.d_softwareNs-record.d_softwareNs);
+      row[5] = static_cast<double>(record.d_softwareNs-record.d_sendNs);
+      row[6] = static_cast<double>(readNs-stamp.d_softwareNs);
+      stampedUserNs.record(userNs);
+      kernelNs.record(row[3]);
+      hostNs.record(std::max(0.0, userNs-row[3]));
+      sendSideNs.record(row[5]);
+      receiveSideNs.record(row[6]);
+      ++stampedAcks;
+    }
+    if (matched && record.d_hardwareNs && stamp.d_hardwareNs) {
+      row[4] = static_cast<double>(stamp.d_hardwareNs-record.d_hardwareNs);
+      hardwareNs.record(row[4]);
+      ++hardwareAcks;
+    }
+    trace->append(row);
+  };
+
+  // Drain every ACK waiting; return how many. Each ACK is stamped as it is handled, so two ACKs of one session in a
+  // batch give 'Timely::update' increasing times. The realtime read for the kernel comparison is one per 'recvmmsg'
+  auto receiveAcks = [&]() {
+    unsigned count = 0;
+    int received;
+    if (stamping) {
+      // Send stamps are queued before the datagram reaches the receiver, so those an ACK needs are already here
+      receiveSendStamps();
+    }
+    while ((received = socket.receiveBatch(acks, false))>0) {
+      const uint64_t readNs = stamping ? realtimeNs() : 0;
+      for (unsigned i=0; i<static_cast<unsigned>(received); ++i) {
+        const Experiment::UdpAck *ack = reinterpret_cast<const Experiment::UdpAck*>(acks.data(i));
+        if (acks.length(i)!=sizeof(Experiment::UdpAck) ||
+            ack->d_header.d_magic!=Experiment::UdpMessageHeader::k_magic ||
+            ack->d_header.d_type!=Experiment::UdpMessageHeader::e_ACK || ack->d_header.d_session>=sessions) {
+          continue;
+        }
+        const uint64_t nowTicks = Experiment::TscClock::nowTicks();
+        const uint64_t rttTicks = nowTicks-ack->d_sendTicks;
+        if (stamping) {
+          recordStamps(ack, i, rttTicks, readNs);
+        }
+        const unsigned s = ack->d_header.d_session;
+        const double rate = timely[s].update(clock.toUs(rttTicks), clock.toUs(nowTicks));
+        wheel.setRate(s, rate);
+        intervalRateSum += rate;
+        intervalRateMin = std::min(intervalRateMin, rate);
+        rttNs.record(static_cast<double>(clock.toNs(rttTicks)));
+        intervalRttNs.record(static_cast<double>(clock.toNs(rttTicks)));
+        ++acked;
+        ++intervalAcks;
+        ackedBytes += ack->d_bytes;
+        intervalBytes += ack->d_bytes;
+        ++count;
+      }
+    }
+    return count;
+  };
+
+  const uint64_t startTicks = Experiment::TscClock::nowTicks();
+  const uint64_t endTicks = startTicks+static_cast<uint64_t>(seconds*1e9*clock.ghz());
+  const uint64_t reportTicks = static_cast<uint64_t>(kReportMs*1e6*clock.ghz());
+  uint64_t nextReport = startTicks+reportTicks;
+  uint64_t now = startTicks;
+  while (now<endTicks) {
+    for (unsigned s=0; s<sessions; ++s) {
+      while (wheel.canEnqueue(s)) {
+        wheel.enqueue(s, bytes, now);
+      }
+    }
+    const unsigned released = wheel.dequeue(now, transmit);
+    flush();
+    const unsigned ackCount = receiveAcks();
+    if (released==0 && ackCount==0 && !spin) {
+      // Nothing due and nothing received: give the receiver the core if it shares this one
+      sched_yield();
+    }
+    now = Experiment::TscClock::nowTicks();
+
+    // Rates are averaged over the updates in the interval: one ACK can move a rate from the floor to line rate
+    if (now>=nextReport) {
+      printf("%8.0f %12.2f %12.2f %12.2f %10.1f %10.1f %10lu\n", clock.toUs(now-startTicks)/1000.0,
+        intervalBytes/(kReportMs/1000.0)/1e6, intervalAcks ? intervalRateSum/intervalAcks/1e6 : 0.0,
+        intervalAcks ? intervalRateMin/1e6 : 0.0, intervalRttNs.percentile(50)/1000.0,
+        intervalRttNs.percentile(99)/1000.0, intervalAcks);
+      intervalRttNs.reset();
+      intervalBytes = intervalAcks = 0;
+      intervalRateSum = 0;
+      intervalRateMin = 1e300;
+      nextReport += reportTicks;
+    }
+  }
+
+  // Collect the ACKs still in flight, then tell the receiver to finish
+  const double elapsedSeconds = clock.toUs(now-startTicks)/1e6;
+  Experiment::UdpMessageHeader fin = {Experiment::UdpMessageHeader::k_magic, Experiment::UdpMessageHeader::e_FIN, 0};
+  const uint64_t lingerEnd = now+static_cast<uint64_t>(kLingerMs*1e6*clock.ghz());
+  while (Experiment::TscClock::nowTicks()<lingerEnd) {
+    if (receiveAcks()==0 && !spin) {
+      sched_yield();
+    }
+  }
+  socket.send(&fin, sizeof(fin));
+
+  printf("\nsent %lu datagrams in %lu calls (%lu send failures), acked %lu, unacknowledged %lu\n", sent, sendCalls,
+    sendFailures, acked, sent-acked);
+  printf("goodput %.2f MB/s (%.0f datagrams/s) over %.2f s\n", ackedBytes/elapsedSeconds/1e6, acked/elapsedSeconds,
+    elapsedSeconds);
+  printf("RTT us: min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", rttNs.min()/1000.0,
+    rttNs.percentile(50)/1000.0, rttNs.percentile(90)/1000.0, rttNs.percentile(99)/1000.0,
+    rttNs.percentile(99.9)/1000.0, rttNs.max()/1000.0);
+  for (unsigned s=0; s<sessions; ++s) {
+    printf("session %u: %lu sent, final rate %.2f MB/s\n", s, sequence[s], timely[s].rate()/1e6);
+  }
+  if (stamping) {
+    printf("\nSO_TIMESTAMPING %s: %lu of %lu ACKs have kernel stamps, %lu hardware; %lu without a send stamp, %lu "
+      "without a receive stamp, %lu send stamps unmatched\n", stamps, stampedAcks, acked, hardwareAcks, noSendStamp,
+      noReceiveStamp, unmatchedStamps);
+    printf("%-34s %10s %10s %10s %10s %10s\n", "us over ACKs with kernel stamps", "min", "p50", "p90", "p99",
+      "p99.9");
+    printRow("RTT user rdtsc", stampedUserNs);
+    printRow("RTT kernel software", kernelNs);
+    if (hardwareAcks) {
+      printRow("RTT hardware", hardwareNs);
+    }
+    printRow("host: rdtsc less kernel RTT", hostNs);
+    printRow("  send: TSC stamp to kernel send", sendSideNs);
+    printRow("  receive: kernel receive to read", receiveSideNs);
+    if (trace->close()!=0) {
+      fprintf(stderr, "udp_sender: cannot write %s\n", kTraceFile);
+    } else {
+      printf("per-ACK RTTs in %s\n", kTraceFile);
+    }
+  }
+
+  if (acked==0) {
+    printf("FAIL: no ACKs received; is udp_receiver.tsk running on %s:%u?\n", address, port);
+    return 1;
+  }
+  if (stamping && stampedAcks==0) {
+    printf("FAIL: SO_TIMESTAMPING on but no ACK had both kernel stamps\n");
+    return 1;
+  }
+  return 0;
+}
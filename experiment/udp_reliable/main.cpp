@@ -0,0 +1,457 @@
+#include <hdrhistogram.h>
+#include <lossinjector.h>
+#include <reliable.h>
+#include <tscclock.h>
+#include <udpsocket.h>
+#include <udpwire.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reliable delivery of 'sessions' sessions through a 'LossInjector' dropping and reordering data and SACKs. First
+// in memory on one thread, which measures what the sequence, reorder window, SACK and timer work costs per core.
+// Then over UDP on 127.0.0.1 with a receiver thread, 'packets' datagrams per session. Both runs check that every
+// session's receiver delivered exactly what its sender sent, in order, and that nothing is left outstanding. A third
+// run repeats the one in memory with sequences starting just below 2^32, so every session wraps under loss and reorder.
+// Before them a scripted exchange checks each outcome of the window and sender across the wrap
+
+const uint32_t kWindow = 1024;                      // sequences per session in flight and in the reorder window
+const uint32_t kUdpWindow = 32;                     // sequences per session in flight over UDP; more only queues in
+                                                    // the socket buffers and inflates the RTT
+const uint32_t kDatagramBytes = 64;                 // data datagram size
+const unsigned kBurst = 16;                         // new datagrams per session per pass
+const unsigned kMaxDelay = 16;                      // most datagrams a reordered one falls behind
+const unsigned kBatch = 32;                         // datagrams per 'sendmmsg'/'recvmmsg'
+const uint64_t kMemoryMinRtoNs = 50000;             // RTO floor in memory (50us)
+const uint64_t kUdpMinRtoNs = 2000000;              // RTO floor over UDP (2ms): one core's scheduling is RTT
+const uint32_t kWrapSequence = 0u-4*kWindow;        // initial sequence of the wrap run: 4 windows below 2^32
+const double kDrainSeconds = 10;                    // longest wait for the last acknowledgements
+const int kBufferBytes = 4*1024*1024;               // socket buffers
+
+struct Result {
+  uint64_t                      d_sent;             // data datagrams built, retransmissions included
+  uint64_t                      d_delivered;        // sequences delivered in order
+  uint64_t                      d_duplicates;       // data datagrams received again
+  uint64_t                      d_beyondWindow;     // data datagrams received too far ahead
+  uint64_t                      d_sacks;            // SACKs applied by the sender
+  uint64_t                      d_timeouts;         // retransmissions after a timer ran out
+  uint64_t                      d_fastRetransmits;  // retransmissions of holes a SACK showed lost
+  uint64_t                      d_dataDropped;      // data datagrams the injector dropped
+  uint64_t                      d_dataReordered;    // data datagrams the injector held back
+  uint64_t                      d_sacksDropped;     // SACKs the injector dropped
+  double                        d_seconds;          // time until everything was acknowledged
+  Experiment::HdrHistogram      d_rttNs;            // RTTs from SACK echoes
+
+  Result()
+  : d_sent(0), d_delivered(0), d_duplicates(0), d_beyondWindow(0), d_sacks(0), d_timeouts(0),
+    d_fastRetransmits(0), d_dataDropped(0), d_dataReordered(0), d_sacksDropped(0), d_seconds(0), d_rttNs(1e9)
+  {
+  }
+};
+
+// Build data datagram 'sequence' of 'session' in 'datagram' stamped last
+void makeData(Experiment::UdpReliableData *datagram, unsigned session, uint32_t sequence) {
+  datagram->d_header.d_magic = Experiment::UdpMessageHeader::k_magic;
+  datagram->d_header.d_type = Experiment::UdpMessageHeader::e_RDATA;
+  datagram->d_header.d_session = static_cast<uint16_t>(session);
+  datagram->d_bytes = kDatagramBytes;
+  datagram->d_sequence = sequence;
+  datagram->d_sendTicks = Experiment::TscClock::nowTicks();
+}
+
+// Apply 'data' to its session's 'window', count the outcome in 'result', and build the SACK answering it in 'sack'
+void receiveData(const Experiment::UdpReliableData& data, Experiment::ReorderWindow& window, Result *result,
+  Experiment::UdpSack *sack) {
+  uint32_t delivered = 0;
+  const Experiment::ReorderWindow::Result outcome = window.receive(data.d_sequence, &delivered);
+  result->d_delivered += delivered;
+  result->d_duplicates += outcome==Experiment::ReorderWindow::e_DUPLICATE;
+  result->d_beyondWindow += outcome==Experiment::ReorderWindow::e_BEYOND_WINDOW;
+  sack->d_header.d_magic = Experiment::UdpMessageHeader::k_magic;
+  sack->d_header.d_type = Experiment::UdpMessageHeader::e_SACK;
+  sack->d_header.d_session = data.d_header.d_session;
+  sack->d_cumulative = window.next();
+  sack->d_sequence = data.d_sequence;
+  sack->d_sendTicks = data.d_sendTicks;
+  sack->d_sackBits = window.sackBits();
+}
+
+// Apply 'sack' to 'sender' at 'nowTicks' recording its RTT in 'result'
+void receiveSack(const Experiment::UdpSack& sack, uint64_t nowTicks, const Experiment::TscClock& clock,
+  Experiment::ReliableSender& sender, Result *result) {
+  sender.acknowledge(sack.d_header.d_session, sack.d_cumulative, sack.d_sackBits, sack.d_sendTicks, nowTicks);
+  result->d_rttNs.record(static_cast<double>(clock.toNs(nowTicks-sack.d_sendTicks)));
+  ++result->d_sacks;
+}
+
+// Fixed capacity FIFO of datagrams standing in for the network in memory
+template <class T>
+class Fifo {
+  std::vector<T>                d_items;            // ring
+  uint64_t                      d_head;             // next to pop
+  uint64_t                      d_tail;             // next to push
+
+public:
+  explicit Fifo(uint32_t capacity) : d_items(capacity), d_head(0), d_tail(0) {}
+  bool empty() const { return d_head==d_tail; }
+  bool push(const char *data) {
+    if (d_tail-d_head==d_items.size()) {
+      return false;
+    }
+    memcpy(&d_items[d_tail++%d_items.size()], data, sizeof(T));
+    return true;
+  }
+  const T& front() const { return d_items[d_head%d_items.size()]; }
+  void pop() { ++d_head; }
+};
+
+// Check every session of 'sender', which started at 'initialSequence', against its receiver's window. Unless 0,
+// 'packets' is what each session had to send. A session starting above 0 must have wrapped
+bool verify(const char *name, const Experiment::ReliableSender& sender,
+  const std::vector<Experiment::ReorderWindow>& windows, const Result& result, uint32_t packets,
+  uint32_t initialSequence) {
+  bool ok = true;
+  uint64_t sent = 0;
+  for (unsigned s=0; s<sender.sessions(); ++s) {
+    const uint32_t count = sender.nextSequence(s)-initialSequence;
+    sent += count;
+    if (windows[s].next()!=sender.nextSequence(s) || sender.inFlight(s) || (packets && count!=packets) ||
+        (initialSequence && count<=0u-initialSequence)) {
+      printf("FAIL: %s session %u: sent %u from %u, delivered in order up to %u, unacknowledged %u\n", name, s,
+        count, initialSequence, windows[s].next(), sender.inFlight(s));
+      ok = false;
+    }
+  }
+  if (result.d_delivered!=sent || sender.timersArmed()) {
+    printf("FAIL: %s: %lu sequences sent, %lu delivered, %u timers armed\n", name, sent, result.d_delivered,
+      sender.timersArmed());
+    ok = false;
+  }
+  if (result.d_beyondWindow) {
+    printf("FAIL: %s: %lu datagrams beyond the reorder window\n", name, result.d_beyondWindow);
+    ok = false;
+  }
+  return ok;
+}
+
+// Script a reordered, partly lost and duplicated exchange across 0xffffffff through a 'ReorderWindow' and a
+// 'ReliableSender' and check every outcome. Return true if all are as expected
+bool testWrap() {
+  typedef Experiment::ReorderWindow Window;
+  unsigned failures = 0;
+  auto expect = [&failures](const char *what, uint64_t got, uint64_t expected) {
+    if (got!=expected) {
+      printf("FAIL: wrap: %s: got %lu, expected %lu\n", what, got, expected);
+      ++failures;
+    }
+  };
+
+  Window window(128, 0xfffffff8u);
+  uint32_t delivered = 0;
+  expect("2 before 0xfffffff8 is held", window.receive(2, &delivered), Window::e_OUT_OF_ORDER);
+  expect("0xfffffff8 is in order", window.receive(0xfffffff8u, &delivered), Window::e_IN_ORDER);
+  expect("0xfffffff8 delivers itself", delivered, 1);
+  for (uint32_t sequence=0xfffffffau; sequence!=2; ++sequence) {
+    expect("0xfffffffa to 1 are held", window.receive(sequence, &delivered), Window::e_OUT_OF_ORDER);
+  }
+  expect("SACK map above 0xfffffff9", window.sackBits(), 0x1ff);
+  expect("0xfffffff9 is in order", window.receive(0xfffffff9u, &delivered), Window::e_IN_ORDER);
+  expect("0xfffffff9 delivers through 2", delivered, 10);
+  expect("next after the wrap", window.next(), 3);
+  expect("0xfffffffe again is a duplicate", window.receive(0xfffffffeu, &delivered), Window::e_DUPLICATE);
+  expect("3+window is beyond it", window.receive(3+128, &delivered), Window::e_BEYOND_WINDOW);
+
+  // Sequences 0xfffffffc to 3 are sent. The first SACK covers through 0xfffffffd and selectively 0, the second
+  // through 3. A stale SACK afterwards changes nothing
+  Experiment::ReliableSender sender(1, 128, 1.0, 1000, 100000, 0xfffffffcu);
+  for (unsigned i=0; i<8; ++i) {
+    sender.send(0, 1000);
+  }
+  expect("next sequence after 8 sends", sender.nextSequence(0), 4);
+  expect("acknowledged by the first SACK", sender.acknowledge(0, 0xfffffffeu, 0x2, 1000, 2000), 3);
+  expect("in flight after the first SACK", sender.inFlight(0), 6);
+  expect("acknowledged by the second SACK", sender.acknowledge(0, 4, 0, 1000, 3000), 5);
+  expect("acknowledged by a stale SACK", sender.acknowledge(0, 0xfffffffdu, 0x1, 1000, 4000), 0);
+  expect("in flight at the end", sender.inFlight(0), 0);
+  expect("timers armed at the end", sender.timersArmed(), 0);
+  return failures==0;
+}
+
+void print(const char *name, const Result& result) {
+  printf("%-8s %9.3f %9.3f %9lu %9lu %9lu %9lu %9lu %9lu %9.1f %9.1f\n", name,
+    result.d_delivered/result.d_seconds/1e6, (result.d_sent+result.d_sacks)/result.d_seconds/1e6,
+    result.d_dataDropped, result.d_dataReordered, result.d_sacksDropped, result.d_fastRetransmits,
+    result.d_timeouts, result.d_duplicates, result.d_rttNs.percentile(50)/1000.0,
+    result.d_rttNs.percentile(99)/1000.0);
+}
+
+// Sender, network and receiver in one thread with sequences from 'initialSequence'. New data is sent for 'seconds',
+// then the loop runs until every sequence is acknowledged
+bool runInMemory(const char *name, unsigned sessions, double drop, double reorder, double seconds,
+  uint32_t initialSequence, const Experiment::TscClock& clock, Result *result) {
+  Experiment::ReliableSender sender(sessions, kWindow, clock.ghz(), kMemoryMinRtoNs,
+    Experiment::ReliableSender::k_defaultMaxRtoNs, initialSequence);
+  std::vector<Experiment::ReorderWindow> windows(sessions, Experiment::ReorderWindow(kWindow, initialSequence));
+  Experiment::LossInjector dataLoss(drop, reorder, kMaxDelay, sizeof(Experiment::UdpReliableData), 64, 1);
+  Experiment::LossInjector sackLoss(drop, reorder, kMaxDelay, sizeof(Experiment::UdpSack), 64, 2);
+  Fifo<Experiment::UdpReliableData> network(2*sessions*kWindow);
+  Fifo<Experiment::UdpSack> sacks(2*sessions*kWindow);
+  auto toNetwork = [&network](const char *data, uint32_t) { network.push(data); };
+  auto toSacks = [&sacks](const char *data, uint32_t) { sacks.push(data); };
+  auto resend = [&](unsigned session, uint32_t sequence) {
+    Experiment::UdpReliableData data;
+    makeData(&data, session, sequence);
+    dataLoss.submit(&data, sizeof(data), toNetwork);
+    ++result->d_sent;
+  };
+
+  const uint64_t start = Experiment::TscClock::nowTicks();
+  const uint64_t sendEnd = start+static_cast<uint64_t>(seconds*1e9*clock.ghz());
+  const uint64_t drainEnd = sendEnd+static_cast<uint64_t>(kDrainSeconds*1e9*clock.ghz());
+  uint64_t now = start;
+  bool outstanding = true;
+  while ((now<sendEnd || outstanding) && now<drainEnd) {
+    if (now<sendEnd) {
+      for (unsigned s=0; s<sessions; ++s) {
+        for (unsigned i=0; i<kBurst && sender.canSend(s); ++i) {
+          Experiment::UdpReliableData data;
+          makeData(&data, s, sender.nextSequence(s));
+          sender.send(s, data.d_sendTicks);
+          dataLoss.submit(&data, sizeof(data), toNetwork);
+          ++result->d_sent;
+        }
+      }
+    }
+    sender.expire(now, resend);
+    if (now>=sendEnd && network.empty()) {
+      // No new data will push held datagrams out
+      dataLoss.flush(toNetwork);
+    }
+    while (!network.empty()) {
+      const Experiment::UdpReliableData& data = network.front();
+      Experiment::UdpSack sack;
+      receiveData(data, windows[data.d_header.d_session], result, &sack);
+      network.pop();
+      sackLoss.submit(&sack, sizeof(sack), toSacks);
+    }
+    if (now>=sendEnd) {
+      sackLoss.flush(toSacks);
+    }
+    now = Experiment::TscClock::nowTicks();
+    while (!sacks.empty()) {
+      receiveSack(sacks.front(), now, clock, sender, result);
+      sacks.pop();
+    }
+    outstanding = false;
+    for (unsigned s=0; s<sessions && !outstanding; ++s) {
+      outstanding = sender.inFlight(s)>0;
+    }
+    now = Experiment::TscClock::nowTicks();
+  }
+  result->d_seconds = static_cast<double>(now-start)/clock.ghz()/1e9;
+  result->d_timeouts = sender.timeouts();
+  result->d_fastRetransmits = sender.fastRetransmits();
+  result->d_dataDropped = dataLoss.dropped();
+  result->d_dataReordered = dataLoss.reordered();
+  result->d_sacksDropped = sackLoss.dropped();
+  return verify(name, sender, windows, *result, 0, initialSequence);
+}
+
+// Receive data on 'socket' until a FIN, answering each datagram with a SACK through 'sackLoss'
+void receiver(Experiment::UdpSocket& socket, unsigned sessions, Experiment::LossInjector& sackLoss,
+  std::vector<Experiment::ReorderWindow>& windows, Result *result) {
+  Experiment::UdpBatch datagrams(kBatch, kDatagramBytes), sacks(kBatch, sizeof(Experiment::UdpSack));
+  unsigned batched = 0;
+  sockaddr_in peer;
+  memset(&peer, 0, sizeof(peer));
+  auto flush = [&]() {
+    if (batched) {
+      socket.sendBatch(sacks, batched);
+      batched = 0;
+    }
+  };
+  auto emit = [&](const char *data, uint32_t bytes) {
+    memcpy(sacks.data(batched), data, bytes);
+    sacks.setSendTo(batched, bytes, peer);
+    if (++batched==kBatch) {
+      flush();
+    }
+  };
+
+  for (;;) {
+    const int count = socket.receiveBatch(datagrams, true);
+    if (count<0) {
+      if (socket.lastError()==EINTR) {
+        continue;
+      }
+      // Idle past the receive timeout: the sender is gone
+      return;
+    }
+    for (unsigned i=0; i<static_cast<unsigned>(count); ++i) {
+      const Experiment::UdpReliableData *data = reinterpret_cast<const Experiment::UdpReliableData*>(
+        datagrams.data(i));
+      if (datagrams.length(i)<sizeof(Experiment::UdpMessageHeader) ||
+          data->d_header.d_magic!=Experiment::UdpMessageHeader::k_magic) {
+        continue;
+      }
+      if (data->d_header.d_type==Experiment::UdpMessageHeader::e_FIN) {
+        return;
+      }
+      if (data->d_header.d_type!=Experiment::UdpMessageHeader::e_RDATA ||
+          datagrams.length(i)<sizeof(Experiment::UdpReliableData) || data->d_header.d_session>=sessions) {
+        continue;
+      }
+      peer = datagrams.from(i);
+      Experiment::UdpSack sack;
+      receiveData(*data, windows[data->d_header.d_session], result, &sack);
+      sackLoss.submit(&sack, sizeof(sack), emit);
+    }
+    flush();
+  }
+}
+
+// Send 'packets' datagrams per session over UDP to a receiver thread, retransmitting until all are acknowledged
+bool runUdp(unsigned sessions, uint32_t packets, double drop, double reorder, const Experiment::TscClock& clock,
+  Result *result) {
+  Experiment::UdpSocket receiveSocket, sendSocket;
+  if (!receiveSocket.open("127.0.0.1", 0) || !receiveSocket.setBufferBytes(kBufferBytes, kBufferBytes) ||
+      !receiveSocket.setReceiveTimeoutUs(static_cast<uint64_t>(kDrainSeconds*1e6)) ||
+      !sendSocket.open("127.0.0.1", 0) || !sendSocket.setBufferBytes(kBufferBytes, kBufferBytes) ||
+      !sendSocket.connect("127.0.0.1", receiveSocket.localPort())) {
+    printf("FAIL: udp socket setup: %s\n", strerror(receiveSocket.lastError() ? receiveSocket.lastError() :
+      sendSocket.lastError()));
+    return false;
+  }
+  Experiment::ReliableSender sender(sessions, kUdpWindow, clock.ghz(), kUdpMinRtoNs);
+  std::vector<Experiment::ReorderWindow> windows(sessions, Experiment::ReorderWindow(kWindow));
+  Experiment::LossInjector dataLoss(drop, reorder, kMaxDelay, sizeof(Experiment::UdpReliableData), 64, 3);
+  Experiment::LossInjector sackLoss(drop, reorder, kMaxDelay, sizeof(Experiment::UdpSack), 64, 4);
+  Result received;
+  std::thread receiveThread(receiver, std::ref(receiveSocket), sessions, std::ref(sackLoss), std::ref(windows),
+    &received);
+
+  Experiment::UdpBatch datagrams(kBatch, kDatagramBytes), sacks(kBatch, sizeof(Experiment::UdpSack));
+  unsigned batched = 0;
+  auto flush = [&]() {
+    if (batched) {
+      sendSocket.sendBatch(datagrams, batched);
+      batched = 0;
+    }
+  };
+  auto emit = [&](const char *data, uint32_t bytes) {
+    memcpy(datagrams.data(batched), data, bytes);
+    datagrams.setSend(batched, kDatagramBytes);
+    if (++batched==kBatch) {
+      flush();
+    }
+  };
+  auto resend = [&](unsigned session, uint32_t sequence) {
+    Experiment::UdpReliableData data;
+    makeData(&data, session, sequence);
+    dataLoss.submit(&data, sizeof(data), emit);
+    ++result->d_sent;
+  };
+
+  const uint64_t start = Experiment::TscClock::nowTicks();
+  const uint64_t drainTicks = static_cast<uint64_t>(kDrainSeconds*1e9*clock.ghz());
+  uint64_t lastProgress = start;
+  uint64_t now = start;
+  for (;;) {
+    bool done = true, allSent = true;
+    for (unsigned s=0; s<sessions; ++s) {
+      for (unsigned i=0; i<kBurst && sender.nextSequence(s)<packets && sender.canSend(s); ++i) {
+        Experiment::UdpReliableData data;
+        makeData(&data, s, sender.nextSequence(s));
+        sender.send(s, data.d_sendTicks);
+        dataLoss.submit(&data, sizeof(data), emit);
+        ++result->d_sent;
+      }
+      allSent = allSent && sender.nextSequence(s)==packets;
+      done = done && sender.nextSequence(s)==packets && sender.inFlight(s)==0;
+    }
+    if (done || now-lastProgress>drainTicks) {
+      break;
+    }
+    const unsigned resent = sender.expire(now, resend);
+    if (allSent) {
+      dataLoss.flush(emit);
+    }
+    flush();
+
+    int count;
+    unsigned acknowledged = 0;
+    while ((count = sendSocket.receiveBatch(sacks, false))>0) {
+      now = Experiment::TscClock::nowTicks();
+      for (unsigned i=0; i<static_cast<unsigned>(count); ++i) {
+        const Experiment::UdpSack *sack = reinterpret_cast<const Experiment::UdpSack*>(sacks.data(i));
+        if (sacks.length(i)==sizeof(Experiment::UdpSack) &&
+            sack->d_header.d_magic==Experiment::UdpMessageHeader::k_magic &&
+            sack->d_header.d_type==Experiment::UdpMessageHeader::e_SACK && sack->d_header.d_session<sessions) {
+          receiveSack(*sack, now, clock, sender, result);
+          ++acknowledged;
+        }
+      }
+    }
+    now = Experiment::TscClock::nowTicks();
+    if (acknowledged) {
+      lastProgress = now;
+    } else if (resent==0) {
+      // Give the receiver thread the core if it shares this one
+      sched_yield();
+    }
+  }
+  result->d_seconds = static_cast<double>(now-start)/clock.ghz()/1e9;
+
+  // The FIN bypasses the injector
+  Experiment::UdpMessageHeader fin = {Experiment::UdpMessageHeader::k_magic, Experiment::UdpMessageHeader::e_FIN, 0};
+  sendSocket.send(&fin, sizeof(fin));
+  receiveThread.join();
+  result->d_delivered = received.d_delivered;
+  result->d_duplicates = received.d_duplicates;
+  result->d_beyondWindow = received.d_beyondWindow;
+  result->d_timeouts = sender.timeouts();
+  result->d_fastRetransmits = sender.fastRetransmits();
+  result->d_dataDropped = dataLoss.dropped();
+  result->d_dataReordered = dataLoss.reordered();
+  result->d_sacksDropped = sackLoss.dropped();
+  return verify("udp", sender, windows, *result, packets, 0);
+}
+
+int main(int argc, char **argv) {
+  const double drop = argc>1 ? atof(argv[1]) : 0.01;
+  const double reorder = argc>2 ? atof(argv[2]) : 0.01;
+  const unsigned sessions = argc>3 ? static_cast<unsigned>(atoi(argv[3])) : 16;
+  const uint32_t packets = static_cast<uint32_t>(argc>4 ? atol(argv[4]) : 100000);
+  const double seconds = argc>5 ? atof(argv[5]) : 1.0;
+  if (drop<0 || drop>=1 || reorder<0 || reorder>1 || sessions==0 || sessions>65535 || packets==0 || seconds<=0) {
+    fprintf(stderr, "usage: udp_reliable.tsk [drop 0-1) [reorder 0-1] [sessions] [packetsPerSession] [seconds]\n");
+    return 2;
+  }
+  const Experiment::TscClock clock;
+
+  printf("%u sessions, window %u, %u byte datagrams, drop %.3f and reorder %.3f of data and SACKs\n", sessions,
+    kWindow, kDatagramBytes, drop, reorder);
+  printf("%-8s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "run", "delivered", "dgrams", "data", "data", "SACKs",
+    "fast", "timeout", "dup", "RTT p50", "RTT p99");
+  printf("%-8s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "", "Mpps", "Mpps", "dropped", "reordered", "dropped",
+    "resends", "resends", "received", "us", "us");
+
+  const bool scriptOk = testWrap();
+  Result memory;
+  const bool memoryOk = runInMemory("memory", sessions, drop, reorder, seconds, 0, clock, &memory);
+  print("memory", memory);
+  Result wrap;
+  const bool wrapOk = runInMemory("wrap", sessions, drop, reorder, seconds, kWrapSequence, clock, &wrap);
+  print("wrap", wrap);
+  Result udp;
+  const bool udpOk = runUdp(sessions, packets, drop, reorder, clock, &udp);
+  print("udp", udp);
+
+  return scriptOk && memoryOk && wrapOk && udpOk ? 0 : 1;
+}